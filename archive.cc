@@ -0,0 +1,356 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "archive.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+
+namespace {
+
+constexpr size_t kTarBlockSize = 512;
+constexpr size_t kTarSizeOffset = 124;
+constexpr size_t kTarSizeLength = 12;
+constexpr size_t kTarChecksumOffset = 148;
+constexpr size_t kTarChecksumLength = 8;
+constexpr size_t kTarTypeOffset = 156;
+constexpr size_t kTarMagicOffset = 257;
+constexpr size_t kTarPrefixOffset = 345;
+constexpr size_t kTarPrefixLength = 155;
+constexpr size_t kTarNameLength = 100;
+
+constexpr uint32_t kZipLocalHeaderSignature = 0x04034b50;
+constexpr uint32_t kZipCentralHeaderSignature = 0x02014b50;
+constexpr uint32_t kZipEndSignature = 0x06054b50;
+constexpr uint32_t kZip64EndSignature = 0x06064b50;
+constexpr uint32_t kZip64LocatorSignature = 0x07064b50;
+constexpr size_t kZipLocalHeaderSize = 30;
+constexpr size_t kZipCentralHeaderSize = 46;
+constexpr size_t kZipEndSize = 22;
+constexpr size_t kZip64EndSize = 56;
+constexpr size_t kZip64LocatorSize = 20;
+constexpr size_t kZipMaxCommentSize = 65535;
+constexpr uint16_t kZip64ExtraId = 0x0001;
+constexpr uint16_t kZipEncryptedFlag = 0x0001;
+
+uint64_t DecodeLittleEndian(const uint8_t* data, int size) {
+  uint64_t value = 0;
+  for (int i = 0; i < size; ++i) {
+    value |= static_cast<uint64_t>(data[i]) << (8 * i);
+  }
+  return value;
+}
+
+// Drops empty, "." and ".." components, so a member can't be written outside
+// the output directory.
+std::string CleanMemberPath(const std::string& path) {
+  std::string result;
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find_first_of("/\\", start);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    const std::string part = path.substr(start, end - start);
+    if (!part.empty() && (part != ".") && (part != "..")) {
+      if (!result.empty()) {
+        result += '/';
+      }
+      result += part;
+    }
+    start = end + 1;
+  }
+  return result;
+}
+
+// Tar numbers are octal text, or big-endian binary with the top bit of the
+// first byte set for values too large for that.
+uint64_t ParseTarNumber(const uint8_t* field, size_t length) {
+  uint64_t value = 0;
+  if (field[0] & 0x80) {
+    for (size_t i = 1; i < length; ++i) {
+      value = (value << 8) | field[i];
+    }
+    return value;
+  }
+  size_t i = 0;
+  while ((i < length) && (field[i] == ' ')) {
+    ++i;
+  }
+  for (; (i < length) && (field[i] >= '0') && (field[i] <= '7'); ++i) {
+    value = (value << 3) | (field[i] - '0');
+  }
+  return value;
+}
+
+std::string TarString(const uint8_t* field, size_t length) {
+  const char* text = reinterpret_cast<const char*>(field);
+  return std::string(text, strnlen(text, length));
+}
+
+// Pax records are "<length> <key>=<value>\n", with the length covering the
+// whole record.
+void ParsePaxRecords(const uint8_t* data, size_t size, std::string* path,
+                     uint64_t* member_size, bool* has_size) {
+  size_t position = 0;
+  while (position < size) {
+    size_t length = 0;
+    size_t i = position;
+    while ((i < size) && (data[i] >= '0') && (data[i] <= '9')) {
+      length = (length * 10) + (data[i] - '0');
+      ++i;
+    }
+    if ((length == 0) || (length > (size - position)) || (i >= size) ||
+        (data[i] != ' ')) {
+      return;
+    }
+    const std::string record(reinterpret_cast<const char*>(data + i + 1),
+                             (position + length) - (i + 1));
+    const size_t equals = record.find('=');
+    if (equals != std::string::npos) {
+      const std::string key = record.substr(0, equals);
+      // The record ends with a newline that isn't part of the value.
+      std::string value = record.substr(equals + 1);
+      if (!value.empty() && (value.back() == '\n')) {
+        value.pop_back();
+      }
+      if (key == "path") {
+        *path = value;
+      } else if (key == "size") {
+        *member_size = strtoull(value.c_str(), nullptr, 10);
+        *has_size = true;
+      }
+    }
+    position += length;
+  }
+}
+
+bool IsZeroBlock(const uint8_t* block) {
+  for (size_t i = 0; i < kTarBlockSize; ++i) {
+    if (block[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+ArchiveType ArchiveTypeFromFilename(const std::string& filename) {
+  auto has_extension = [&filename](const char* extension) {
+    const size_t length = strlen(extension);
+    return (filename.size() >= length) &&
+           (strcasecmp(filename.c_str() + filename.size() - length,
+                       extension) == 0);
+  };
+  if (has_extension(".tar")) {
+    return ArchiveType::kTar;
+  }
+  if (has_extension(".zip")) {
+    return ArchiveType::kZip;
+  }
+  return ArchiveType::kNone;
+}
+
+Status ListTarMembers(const uint8_t* data, size_t size,
+                      std::vector<ArchiveMember>* members) {
+  // Set by GNU long name and pax headers for the member that follows them.
+  std::string next_path;
+  uint64_t next_size = 0;
+  bool has_next_size = false;
+  size_t offset = 0;
+  while ((offset + kTarBlockSize) <= size) {
+    const uint8_t* header = data + offset;
+    // The archive ends with two blocks of zeros, though some writers stop
+    // after one.
+    if (IsZeroBlock(header)) {
+      break;
+    }
+    uint32_t checksum = 0;
+    for (size_t i = 0; i < kTarBlockSize; ++i) {
+      const bool in_field = (i >= kTarChecksumOffset) &&
+                            (i < (kTarChecksumOffset + kTarChecksumLength));
+      checksum += in_field ? ' ' : header[i];
+    }
+    if (checksum != ParseTarNumber(header + kTarChecksumOffset,
+                                   kTarChecksumLength)) {
+      return errors::DataLoss("Bad tar header checksum at byte ", offset);
+    }
+    uint64_t member_size =
+        ParseTarNumber(header + kTarSizeOffset, kTarSizeLength);
+    if (has_next_size) {
+      member_size = next_size;
+    }
+    const size_t data_offset = offset + kTarBlockSize;
+    if ((member_size > size) || ((data_offset + member_size) > size)) {
+      return errors::DataLoss("Tar member at byte ", offset,
+                              " runs past the end of the archive");
+    }
+    const char type = header[kTarTypeOffset];
+    if (type == 'L') {
+      next_path = TarString(data + data_offset, member_size);
+    } else if (type == 'x') {
+      ParsePaxRecords(data + data_offset, member_size, &next_path, &next_size,
+                      &has_next_size);
+    } else if (type != 'g') {
+      if ((type == '0') || (type == '\0') || (type == '7')) {
+        std::string path = next_path;
+        if (path.empty()) {
+          path = TarString(header, kTarNameLength);
+          const bool is_ustar =
+              (memcmp(header + kTarMagicOffset, "ustar", 5) == 0);
+          const std::string prefix =
+              is_ustar ? TarString(header + kTarPrefixOffset, kTarPrefixLength)
+                       : "";
+          if (!prefix.empty()) {
+            path = prefix + "/" + path;
+          }
+        }
+        path = CleanMemberPath(path);
+        if (!path.empty()) {
+          members->push_back(ArchiveMember{path, data_offset, member_size, 0});
+        }
+      }
+      // Whatever the entry was, the pending long name was for it.
+      next_path.clear();
+      has_next_size = false;
+    }
+    offset = data_offset + (((member_size + kTarBlockSize - 1) /
+                             kTarBlockSize) * kTarBlockSize);
+  }
+  return Status::OK();
+}
+
+Status ListZipMembers(const uint8_t* data, size_t size,
+                      std::vector<ArchiveMember>* members) {
+  // The end of central directory record is at the very end, unless the
+  // archive has a comment, which can be up to 64KB long.
+  if (size < kZipEndSize) {
+    return errors::InvalidArgument("Too short to be a zip archive");
+  }
+  const size_t search_end =
+      (size > (kZipEndSize + kZipMaxCommentSize))
+          ? (size - kZipEndSize - kZipMaxCommentSize)
+          : 0;
+  size_t end_offset = size - kZipEndSize;
+  while (DecodeLittleEndian(data + end_offset, 4) != kZipEndSignature) {
+    if (end_offset == search_end) {
+      return errors::InvalidArgument("No zip end of central directory record");
+    }
+    --end_offset;
+  }
+  const uint8_t* end = data + end_offset;
+  uint64_t entry_count = DecodeLittleEndian(end + 10, 2);
+  uint64_t directory_size = DecodeLittleEndian(end + 12, 4);
+  uint64_t directory_offset = DecodeLittleEndian(end + 16, 4);
+  if ((entry_count == 0xffff) || (directory_size == 0xffffffff) ||
+      (directory_offset == 0xffffffff)) {
+    // Zip64 keeps the real values in a record found through a locator that
+    // sits just before the regular one.
+    if ((end_offset < kZip64LocatorSize) ||
+        (DecodeLittleEndian(end - kZip64LocatorSize, 4) !=
+         kZip64LocatorSignature)) {
+      return errors::DataLoss("Missing Zip64 end of central directory locator");
+    }
+    const uint64_t record_offset =
+        DecodeLittleEndian(end - kZip64LocatorSize + 8, 8);
+    // The offset is read from the file, so compare against the space left
+    // rather than adding to it, which could wrap around.
+    if ((record_offset > size) || (kZip64EndSize > (size - record_offset)) ||
+        (DecodeLittleEndian(data + record_offset, 4) != kZip64EndSignature)) {
+      return errors::DataLoss("Bad Zip64 end of central directory record");
+    }
+    const uint8_t* record = data + record_offset;
+    entry_count = DecodeLittleEndian(record + 32, 8);
+    directory_size = DecodeLittleEndian(record + 40, 8);
+    directory_offset = DecodeLittleEndian(record + 48, 8);
+  }
+  if ((directory_offset > size) || (directory_size > size) ||
+      ((directory_offset + directory_size) > size)) {
+    return errors::DataLoss("Zip central directory runs past the end");
+  }
+
+  const uint8_t* entry = data + directory_offset;
+  const uint8_t* directory_end = entry + directory_size;
+  for (uint64_t i = 0; i < entry_count; ++i) {
+    if (((entry + kZipCentralHeaderSize) > directory_end) ||
+        (DecodeLittleEndian(entry, 4) != kZipCentralHeaderSignature)) {
+      return errors::DataLoss("Bad zip central directory entry ", i);
+    }
+    const uint16_t flags = DecodeLittleEndian(entry + 8, 2);
+    const uint16_t method = DecodeLittleEndian(entry + 10, 2);
+    uint64_t compressed_size = DecodeLittleEndian(entry + 20, 4);
+    uint64_t uncompressed_size = DecodeLittleEndian(entry + 24, 4);
+    const size_t name_length = DecodeLittleEndian(entry + 28, 2);
+    const size_t extra_length = DecodeLittleEndian(entry + 30, 2);
+    const size_t comment_length = DecodeLittleEndian(entry + 32, 2);
+    uint64_t local_offset = DecodeLittleEndian(entry + 42, 4);
+    const uint8_t* name = entry + kZipCentralHeaderSize;
+    const uint8_t* extra = name + name_length;
+    const uint8_t* next = extra + extra_length + comment_length;
+    if (next > directory_end) {
+      return errors::DataLoss("Bad zip central directory entry ", i);
+    }
+    // Fields too big for 32 bits are in the Zip64 extra field, in this order,
+    // but only the ones that overflowed.
+    for (const uint8_t* field = extra; (field + 4) <= (extra + extra_length);) {
+      const uint16_t id = DecodeLittleEndian(field, 2);
+      const uint16_t length = DecodeLittleEndian(field + 2, 2);
+      const uint8_t* value = field + 4;
+      const uint8_t* value_end = std::min(value + length, extra + extra_length);
+      if (id == kZip64ExtraId) {
+        for (uint64_t* target :
+             {&uncompressed_size, &compressed_size, &local_offset}) {
+          if ((*target == 0xffffffff) && ((value + 8) <= value_end)) {
+            *target = DecodeLittleEndian(value, 8);
+            value += 8;
+          }
+        }
+      }
+      field += 4 + length;
+    }
+    const std::string path = CleanMemberPath(
+        std::string(reinterpret_cast<const char*>(name), name_length));
+    entry = next;
+    const bool is_directory =
+        (name_length > 0) && (name[name_length - 1] == '/');
+    if (is_directory || path.empty()) {
+      continue;
+    }
+    if (flags & kZipEncryptedFlag) {
+      return errors::Unimplemented("Zip member '", path, "' is encrypted");
+    }
+    if ((local_offset > size) ||
+        (kZipLocalHeaderSize > (size - local_offset)) ||
+        (DecodeLittleEndian(data + local_offset, 4) !=
+         kZipLocalHeaderSignature)) {
+      return errors::DataLoss("Bad zip local header for '", path, "'");
+    }
+    const uint8_t* local = data + local_offset;
+    const uint64_t data_offset = local_offset + kZipLocalHeaderSize +
+                                 DecodeLittleEndian(local + 26, 2) +
+                                 DecodeLittleEndian(local + 28, 2);
+    if ((compressed_size > size) || ((data_offset + compressed_size) > size)) {
+      return errors::DataLoss("Zip member '", path,
+                              "' runs past the end of the archive");
+    }
+    members->push_back(
+        ArchiveMember{path, data_offset, compressed_size, method});
+  }
+  return Status::OK();
+}
@@ -0,0 +1,62 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Lists the members of tar and zip archives held in memory, so the WAVs inside
+// them can be processed where they are, without being extracted first.
+
+#ifndef ARCHIVE_H_
+#define ARCHIVE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "status.h"
+
+enum class ArchiveType { kNone, kTar, kZip };
+
+struct ArchiveMember {
+  // The path inside the archive, with any leading "/", "." or ".."
+  // components removed so it's safe to use as part of an output path.
+  std::string path;
+  // Where the member's bytes start in the archive, and how many there are.
+  uint64_t offset;
+  uint64_t size;
+  // Zip's compression method code. Only zero, for stored members, can be read
+  // in place, and tar members always have it.
+  uint16_t compression_method;
+};
+
+// Picks the archive type from a filename's extension, so that a glob can be
+// expanded without opening every file it matches.
+ArchiveType ArchiveTypeFromFilename(const std::string& filename);
+
+// Walks a tar archive's headers from the start, collecting its regular files
+// in order. POSIX ustar and GNU tars are understood, including long names
+// from GNU 'L' records and paths and sizes from pax extended headers. If the
+// archive is damaged part way through, the members before the damage are still
+// returned along with the error.
+Status ListTarMembers(const uint8_t* data, size_t size,
+                      std::vector<ArchiveMember>* members);
+
+// Reads a zip archive's central directory, which lists every member with
+// where its local header is, and follows each local header to find the data.
+// Zip64 archives are handled, and directories are left out.
+Status ListZipMembers(const uint8_t* data, size_t size,
+                      std::vector<ArchiveMember>* members);
+
+#endif  // ARCHIVE_H_
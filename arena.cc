@@ -0,0 +1,155 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "arena.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include "numa.h"
+
+namespace {
+
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+constexpr size_t kMinBlockSize = 64 * 1024;
+
+size_t RoundUp(size_t value, size_t multiple) {
+  return ((value + multiple - 1) / multiple) * multiple;
+}
+
+// Returns nullptr if the mapping failed.
+uint8_t* MapBlock(size_t size, bool use_huge_pages) {
+  void* data = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (use_huge_pages) {
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  }
+#endif
+  if (data == MAP_FAILED) {
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+    if (use_huge_pages && (data != MAP_FAILED)) {
+      madvise(data, size, MADV_HUGEPAGE);
+    }
+#endif
+  }
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  return static_cast<uint8_t*>(data);
+}
+
+}  // namespace
+
+Arena::Arena(size_t initial_size, bool use_huge_pages, int numa_node)
+    : use_huge_pages_(use_huge_pages),
+      numa_node_(numa_node),
+      block_used_(0),
+      bytes_requested_(0),
+      block_allocations_(0) {
+  // Growth is geometric, so this is plenty to keep the list itself from
+  // reallocating while a file is being processed.
+  blocks_.reserve(32);
+  // If this fails, the first allocation tries again and reports it.
+  if (initial_size > 0) {
+    AddBlock(initial_size);
+  }
+}
+
+Arena::~Arena() { FreeBlocks(); }
+
+void* Arena::Allocate(size_t bytes) {
+  const size_t aligned_bytes = RoundUp(std::max<size_t>(bytes, 1), kAlignment);
+  if (aligned_bytes < bytes) {
+    status_ = errors::ResourceExhausted("Arena allocation of ", bytes,
+                                        " bytes is too large");
+    return nullptr;
+  }
+  if ((blocks_.empty() ||
+       ((block_used_ + aligned_bytes) > blocks_.back().size)) &&
+      !AddBlock(aligned_bytes)) {
+    status_ = errors::ResourceExhausted("Couldn't map ", aligned_bytes,
+                                        " bytes for the arena");
+    return nullptr;
+  }
+  bytes_requested_ += aligned_bytes;
+  void* result = blocks_.back().data + block_used_;
+  block_used_ += aligned_bytes;
+  return result;
+}
+
+void Arena::Reset() {
+  // If the merged block can't be mapped, the next allocation maps what it
+  // needs itself.
+  if (blocks_.size() > 1) {
+    FreeBlocks();
+    AddBlock(bytes_requested_);
+  }
+  block_used_ = 0;
+  bytes_requested_ = 0;
+  status_ = Status::OK();
+}
+
+size_t Arena::bytes_reserved() const {
+  size_t total = 0;
+  for (const Block& block : blocks_) {
+    total += block.size;
+  }
+  return total;
+}
+
+bool Arena::AddBlock(size_t min_size) {
+  // Grow geometrically so that a run of small allocations doesn't create a
+  // long list of blocks.
+  const size_t page_size = use_huge_pages_ ? kHugePageSize : kAlignment;
+  if (min_size > (SIZE_MAX - page_size)) {
+    return false;
+  }
+  size_t size = std::max(min_size, kMinBlockSize);
+  if (!blocks_.empty()) {
+    size = std::max(size, blocks_.back().size * 2);
+  }
+  size = RoundUp(size, page_size);
+  Block block;
+  block.data = MapBlock(size, use_huge_pages_);
+  // Doubling can ask for far more than is needed, so fall back to just enough
+  // before giving up.
+  const size_t exact_size = RoundUp(min_size, page_size);
+  if ((block.data == nullptr) && (exact_size < size)) {
+    size = exact_size;
+    block.data = MapBlock(size, use_huge_pages_);
+  }
+  if (block.data == nullptr) {
+    return false;
+  }
+  if (numa_node_ != -1) {
+    BindMemoryToNode(block.data, size, numa_node_);
+  }
+  block.size = size;
+  blocks_.push_back(block);
+  block_used_ = 0;
+  ++block_allocations_;
+  return true;
+}
+
+void Arena::FreeBlocks() {
+  for (const Block& block : blocks_) {
+    munmap(block.data, block.size);
+  }
+  blocks_.clear();
+}
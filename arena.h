@@ -0,0 +1,96 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// A simple bump allocator for buffers that only live as long as one file.
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "status.h"
+
+// Hands out 64-byte aligned buffers from large blocks of memory, which are all
+// released together by Reset(). After each reset the blocks are merged into
+// one big enough for everything that was asked for since the previous reset,
+// so once a worker has seen its largest file it stops touching the system
+// allocator entirely.
+//
+// If the system can't supply a block, Allocate() returns nullptr and status()
+// reports the failure until the next Reset(), so callers can check once after
+// a group of allocations rather than after every one.
+//
+// Example usage:
+//
+// Arena arena(1 << 20, false);
+// for (...) {
+//   float* samples = arena.AllocateArray<float>(sample_count);
+//   TF_RETURN_IF_ERROR(arena.status());
+//   ...
+//   arena.Reset();
+// }
+class Arena {
+ public:
+  static constexpr size_t kAlignment = 64;
+
+  // If use_huge_pages is true, blocks are rounded up to 2MB and backed by huge
+  // pages if the system has any reserved, or transparent huge pages otherwise.
+  // If numa_node isn't -1, blocks are placed on that node's memory.
+  Arena(size_t initial_size, bool use_huge_pages, int numa_node = -1);
+  ~Arena();
+
+  // Returns nullptr if no memory could be mapped for the request.
+  void* Allocate(size_t bytes);
+
+  template <class T>
+  T* AllocateArray(size_t count) {
+    return static_cast<T*>(Allocate(count * sizeof(T)));
+  }
+
+  // Makes all the memory available again, and clears any failure. Pointers
+  // returned before this call must no longer be used.
+  void Reset();
+
+  // An error if any allocation since the last reset failed.
+  const Status& status() const { return status_; }
+
+  // How many times a block has been requested from the system.
+  int64_t block_allocations() const { return block_allocations_; }
+  size_t bytes_reserved() const;
+
+ private:
+  struct Block {
+    uint8_t* data;
+    size_t size;
+  };
+
+  // Returns false if the system couldn't supply a block of min_size bytes.
+  bool AddBlock(size_t min_size);
+  void FreeBlocks();
+
+  const bool use_huge_pages_;
+  const int numa_node_;
+  std::vector<Block> blocks_;
+  size_t block_used_;
+  // Total size of all the allocations since the last reset.
+  size_t bytes_requested_;
+  int64_t block_allocations_;
+  Status status_;
+};
+
+#endif  // ARENA_H_
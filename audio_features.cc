@@ -0,0 +1,392 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "audio_features.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "kernels.h"
+
+namespace {
+
+constexpr char kShardMagic[] = "ELSFEAT1";
+constexpr int64_t kShardHeaderSize = 64;
+// How many frames are transformed together, one per vector lane. This is a
+// multiple of every kernel's vector width.
+constexpr int kFrameBatch = 16;
+// Keeps the smallest log-mel energies finite.
+constexpr float kLogOffset = 1e-6f;
+
+double HzToMel(double frequency) {
+  return 1127.0 * log(1.0 + (frequency / 700.0));
+}
+
+// Rounds to the nearest float16, with ties to even, the same as F16C's
+// default mode. Values too large become infinities, and NaNs stay NaNs.
+uint16_t FloatToHalf(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = (bits >> 16) & 0x8000;
+  const uint32_t magnitude = bits & 0x7fffffff;
+  if (magnitude >= 0x7f800000) {
+    return sign | 0x7c00 | ((magnitude > 0x7f800000) ? 0x200 : 0);
+  }
+  const int exponent = magnitude >> 23;
+  uint32_t result;
+  uint32_t remainder;
+  uint32_t halfway;
+  if (exponent >= 113) {
+    // Normal in float16, unless rounding carries it up into infinity.
+    if (exponent > 142) {
+      return sign | 0x7c00;
+    }
+    result = (magnitude - (112u << 23)) >> 13;
+    remainder = magnitude & 0x1fff;
+    halfway = 0x1000;
+  } else {
+    // Subnormal in float16, in units of 2^-24.
+    if (exponent < 102) {
+      return sign;
+    }
+    const uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+    const int shift = 126 - exponent;
+    result = mantissa >> shift;
+    remainder = mantissa & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  }
+  if ((remainder > halfway) || ((remainder == halfway) && (result & 1))) {
+    ++result;
+  }
+  return sign | std::min<uint32_t>(result, 0x7c00);
+}
+
+Status PwriteAll(int fd, const std::string& filename, const void* data,
+                 size_t size, int64_t offset) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t written = pwrite(fd, bytes, size, offset);
+    if ((written == -1) && (errno == EINTR)) {
+      continue;
+    }
+    if (written <= 0) {
+      return errors::Unavailable("Writing to '", filename,
+                                 "' failed: ", strerror(errno));
+    }
+    bytes += written;
+    size -= written;
+    offset += written;
+  }
+  return Status::OK();
+}
+
+}  // namespace
+
+int FeatureFrameCount(const FeatureOptions& options, int64_t clip_length_ms) {
+  return 1 + (std::max<int64_t>(0, clip_length_ms - options.window_ms) /
+              options.stride_ms);
+}
+
+FeatureExtractor::FeatureExtractor(const FeatureOptions& options,
+                                   uint32_t sample_rate)
+    : options_(options), sample_rate_(sample_rate) {
+  window_size_ = std::max<int64_t>(
+      1, (static_cast<int64_t>(options.window_ms) * sample_rate) / 1000);
+  stride_ = std::max<int64_t>(
+      1, (static_cast<int64_t>(options.stride_ms) * sample_rate) / 1000);
+  fft_size_ = 4;
+  while (fft_size_ < window_size_) {
+    fft_size_ *= 2;
+  }
+  half_size_ = fft_size_ / 2;
+
+  // A periodic Hann window, padded with zeros out to the FFT size.
+  window_.assign(fft_size_, 0.0f);
+  for (int64_t i = 0; i < window_size_; ++i) {
+    window_[i] = 0.5 - (0.5 * cos((2.0 * M_PI * i) / window_size_));
+  }
+
+  int bits = 0;
+  while ((1 << bits) < half_size_) {
+    ++bits;
+  }
+  bit_reverse_.resize(half_size_);
+  for (int64_t i = 0; i < half_size_; ++i) {
+    int32_t reversed = 0;
+    for (int b = 0; b < bits; ++b) {
+      reversed |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    bit_reverse_[i] = reversed;
+  }
+
+  twiddle_real_.assign(half_size_, 0.0f);
+  twiddle_imag_.assign(half_size_, 0.0f);
+  for (int64_t half = 1; half < half_size_; half *= 2) {
+    for (int64_t k = 0; k < half; ++k) {
+      const double angle = (-M_PI * k) / half;
+      twiddle_real_[half + k] = cos(angle);
+      twiddle_imag_[half + k] = sin(angle);
+    }
+  }
+  split_real_.resize(half_size_ + 1);
+  split_imag_.resize(half_size_ + 1);
+  for (int64_t k = 0; k <= half_size_; ++k) {
+    const double angle = (-2.0 * M_PI * k) / fft_size_;
+    split_real_[k] = cos(angle);
+    split_imag_[k] = sin(angle);
+  }
+
+  // Triangular filters evenly spaced on the mel scale, each rising from the
+  // previous one's center to its own, then falling to the next one's.
+  const int mel_bins = options.mel_bins;
+  const double lower_mel = HzToMel(options.lower_frequency);
+  const double upper_mel = HzToMel(sample_rate / 2.0);
+  const double mel_spacing = (upper_mel - lower_mel) / (mel_bins + 1);
+  mel_start_.resize(mel_bins);
+  mel_end_.resize(mel_bins);
+  mel_offset_.resize(mel_bins);
+  mel_weights_.clear();
+  for (int m = 0; m < mel_bins; ++m) {
+    const double left = lower_mel + (m * mel_spacing);
+    const double center = left + mel_spacing;
+    const double right = center + mel_spacing;
+    mel_start_[m] = half_size_ + 1;
+    mel_end_[m] = half_size_ + 1;
+    mel_offset_[m] = mel_weights_.size();
+    for (int64_t k = 0; k <= half_size_; ++k) {
+      const double mel =
+          HzToMel((static_cast<double>(k) * sample_rate) / fft_size_);
+      if ((mel <= left) || (mel >= right)) {
+        if (mel >= right) {
+          break;
+        }
+        continue;
+      }
+      if (mel_start_[m] > half_size_) {
+        mel_start_[m] = k;
+      }
+      mel_end_[m] = k + 1;
+      const double weight = (mel <= center) ? ((mel - left) / mel_spacing)
+                                            : ((right - mel) / mel_spacing);
+      mel_weights_.push_back(weight);
+    }
+    if (mel_start_[m] > half_size_) {
+      mel_start_[m] = 0;
+      mel_end_[m] = 0;
+    }
+  }
+
+  const int mfcc_count = options.mfcc_count;
+  dct_.resize(mfcc_count * mel_bins);
+  for (int i = 0; i < mfcc_count; ++i) {
+    const double scale = sqrt(((i == 0) ? 1.0 : 2.0) / mel_bins);
+    for (int m = 0; m < mel_bins; ++m) {
+      dct_[(i * mel_bins) + m] = scale * cos((M_PI * i * (m + 0.5)) / mel_bins);
+    }
+  }
+}
+
+Status FeatureExtractor::Compute(const float* samples, int64_t sample_count,
+                                 int frame_count, Arena* arena,
+                                 float* features) const {
+  // Copying the clip into a zero-padded buffer keeps the frame loops free of
+  // bounds checks, including for the unused frames that fill out the last
+  // batch.
+  const int64_t batch_count = (frame_count + kFrameBatch - 1) / kFrameBatch;
+  const int64_t padded_count =
+      (((batch_count * kFrameBatch) - 1) * stride_) + fft_size_;
+  float* padded = arena->AllocateArray<float>(padded_count);
+
+  // Everything below holds one value per frame of the batch for each element,
+  // so the inner loops all run across the batch.
+  float* real = arena->AllocateArray<float>(half_size_ * kFrameBatch);
+  float* imag = arena->AllocateArray<float>(half_size_ * kFrameBatch);
+  float* power = arena->AllocateArray<float>((half_size_ + 1) * kFrameBatch);
+  const int mel_bins = options_.mel_bins;
+  const int mfcc_count = options_.mfcc_count;
+  const int features_per_frame = mel_bins + mfcc_count;
+  float* log_mel = arena->AllocateArray<float>(mel_bins * kFrameBatch);
+  float* mfcc = arena->AllocateArray<float>(
+      std::max(1, mfcc_count) * kFrameBatch);
+  TF_RETURN_IF_ERROR(arena->status());
+  const int64_t copy_count = std::min(sample_count, padded_count);
+  memcpy(padded, samples, copy_count * sizeof(float));
+  memset(padded + copy_count, 0, (padded_count - copy_count) * sizeof(float));
+  const AudioKernels& kernels = GetAudioKernels();
+  for (int64_t first = 0; first < frame_count; first += kFrameBatch) {
+    // The even samples become the real parts and the odd ones the imaginary
+    // parts, stored in bit-reversed order for the in-place FFT.
+    const float* frames = padded + (first * stride_);
+    for (int64_t k = 0; k < half_size_; ++k) {
+      const float even_window = window_[2 * k];
+      const float odd_window = window_[(2 * k) + 1];
+      float* even = real + (bit_reverse_[k] * kFrameBatch);
+      float* odd = imag + (bit_reverse_[k] * kFrameBatch);
+      for (int b = 0; b < kFrameBatch; ++b) {
+        even[b] = frames[(b * stride_) + (2 * k)] * even_window;
+        odd[b] = frames[(b * stride_) + (2 * k) + 1] * odd_window;
+      }
+    }
+    for (int64_t half = 1; half < half_size_; half *= 2) {
+      kernels.fft_stage(real, imag, half_size_, half, kFrameBatch,
+                        twiddle_real_.data() + half,
+                        twiddle_imag_.data() + half);
+    }
+
+    // Bin k of the real spectrum combines bins k and half_size - k of the
+    // complex one, which hold the even and odd samples' spectra mixed.
+    for (int64_t k = 0; k <= half_size_; ++k) {
+      const int64_t j = ((k == half_size_) ? 0 : k) * kFrameBatch;
+      const int64_t mirror = ((k == 0) ? 0 : (half_size_ - k)) * kFrameBatch;
+      const float split_real = split_real_[k];
+      const float split_imag = split_imag_[k];
+      float* output = power + (k * kFrameBatch);
+      for (int b = 0; b < kFrameBatch; ++b) {
+        const float even_real = 0.5f * (real[j + b] + real[mirror + b]);
+        const float even_imag = 0.5f * (imag[j + b] - imag[mirror + b]);
+        const float odd_real = 0.5f * (imag[j + b] + imag[mirror + b]);
+        const float odd_imag = -0.5f * (real[j + b] - real[mirror + b]);
+        const float spectrum_real =
+            even_real + ((odd_real * split_real) - (odd_imag * split_imag));
+        const float spectrum_imag =
+            even_imag + ((odd_real * split_imag) + (odd_imag * split_real));
+        output[b] = (spectrum_real * spectrum_real) +
+                    (spectrum_imag * spectrum_imag);
+      }
+    }
+
+    for (int m = 0; m < mel_bins; ++m) {
+      const float* weights = mel_weights_.data() + mel_offset_[m];
+      float* energy = log_mel + (m * kFrameBatch);
+      for (int b = 0; b < kFrameBatch; ++b) {
+        energy[b] = 0.0f;
+      }
+      for (int32_t k = mel_start_[m]; k < mel_end_[m]; ++k) {
+        const float weight = weights[k - mel_start_[m]];
+        const float* bin = power + (k * kFrameBatch);
+        for (int b = 0; b < kFrameBatch; ++b) {
+          energy[b] += weight * bin[b];
+        }
+      }
+      for (int b = 0; b < kFrameBatch; ++b) {
+        energy[b] = logf(energy[b] + kLogOffset);
+      }
+    }
+    for (int i = 0; i < mfcc_count; ++i) {
+      const float* row = dct_.data() + (i * mel_bins);
+      float* total = mfcc + (i * kFrameBatch);
+      for (int b = 0; b < kFrameBatch; ++b) {
+        total[b] = 0.0f;
+      }
+      for (int m = 0; m < mel_bins; ++m) {
+        const float* energy = log_mel + (m * kFrameBatch);
+        for (int b = 0; b < kFrameBatch; ++b) {
+          total[b] += row[m] * energy[b];
+        }
+      }
+    }
+
+    const int valid = std::min<int64_t>(kFrameBatch, frame_count - first);
+    for (int b = 0; b < valid; ++b) {
+      float* output = features + ((first + b) * features_per_frame);
+      for (int m = 0; m < mel_bins; ++m) {
+        output[m] = log_mel[(m * kFrameBatch) + b];
+      }
+      for (int i = 0; i < mfcc_count; ++i) {
+        output[mel_bins + i] = mfcc[(i * kFrameBatch) + b];
+      }
+    }
+  }
+  return Status::OK();
+}
+
+FeatureShardWriter::FeatureShardWriter(const std::string& filename,
+                                       const FeatureOptions& options,
+                                       int64_t clip_count, int frame_count)
+    : filename_(filename),
+      options_(options),
+      clip_count_(clip_count),
+      frame_count_(frame_count),
+      fd_(-1) {
+  records_offset_ =
+      kShardHeaderSize + (((clip_count + 63) / 64) * 64);
+  const size_t value_size =
+      (options.type == FeatureType::kFloat16) ? sizeof(uint16_t)
+                                              : sizeof(float);
+  const int64_t record_size =
+      static_cast<int64_t>(frame_count) * FeaturesPerFrame(options) *
+      value_size;
+  fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd_ == -1) {
+    status_ = errors::Unavailable("Couldn't open '", filename,
+                                  "' for writing: ", strerror(errno));
+    return;
+  }
+  // Everything not written later reads back as zeros.
+  if (ftruncate(fd_, records_offset_ + (clip_count * record_size)) != 0) {
+    status_ = errors::Unavailable("Couldn't resize '", filename,
+                                  "': ", strerror(errno));
+    return;
+  }
+  char header[kShardHeaderSize] = {};
+  memcpy(header, kShardMagic, 8);
+  const uint32_t fields[] = {
+      (options.type == FeatureType::kFloat16) ? 1u : 0u,
+      static_cast<uint32_t>(frame_count),
+      static_cast<uint32_t>(options.mel_bins),
+      static_cast<uint32_t>(options.mfcc_count),
+      static_cast<uint32_t>(options.window_ms),
+      static_cast<uint32_t>(options.stride_ms)};
+  memcpy(header + 8, fields, sizeof(fields));
+  const uint64_t count = clip_count;
+  memcpy(header + 8 + sizeof(fields), &count, sizeof(count));
+  status_ = PwriteAll(fd_, filename, header, sizeof(header), 0);
+}
+
+FeatureShardWriter::~FeatureShardWriter() {
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+Status FeatureShardWriter::Write(int64_t clip_index, const float* features,
+                                 Arena* arena) {
+  TF_RETURN_IF_ERROR(status_);
+  const int64_t value_count =
+      static_cast<int64_t>(frame_count_) * FeaturesPerFrame(options_);
+  if (options_.type == FeatureType::kFloat16) {
+    uint16_t* halves = arena->AllocateArray<uint16_t>(value_count);
+    TF_RETURN_IF_ERROR(arena->status());
+    for (int64_t i = 0; i < value_count; ++i) {
+      halves[i] = FloatToHalf(features[i]);
+    }
+    TF_RETURN_IF_ERROR(PwriteAll(
+        fd_, filename_, halves, value_count * sizeof(uint16_t),
+        records_offset_ + (clip_index * value_count * sizeof(uint16_t))));
+  } else {
+    TF_RETURN_IF_ERROR(PwriteAll(
+        fd_, filename_, features, value_count * sizeof(float),
+        records_offset_ + (clip_index * value_count * sizeof(float))));
+  }
+  // The flag goes in last, so a record is never marked present before all of
+  // it has been written.
+  const char present = 1;
+  return PwriteAll(fd_, filename_, &present, 1, kShardHeaderSize + clip_index);
+}
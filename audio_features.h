@@ -0,0 +1,144 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Log-mel filterbank energies and MFCCs for the trimmed clips, computed while
+// the samples are still in cache, and a writer that stores them in one dense
+// shard so training jobs don't have to rebuild spectrograms every epoch.
+
+#ifndef AUDIO_FEATURES_H_
+#define AUDIO_FEATURES_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "status.h"
+
+enum class FeatureType { kFloat32, kFloat16 };
+
+struct FeatureOptions {
+  int window_ms = 25;
+  int stride_ms = 10;
+  int mel_bins = 40;
+  int mfcc_count = 13;
+  // The filterbank covers from here up to the Nyquist frequency.
+  float lower_frequency = 20.0f;
+  FeatureType type = FeatureType::kFloat32;
+};
+
+// How many frames of features a clip of the given length produces. Every clip
+// is treated as exactly this long, with zeros after the end of shorter ones,
+// so all the records in a shard are the same size.
+int FeatureFrameCount(const FeatureOptions& options, int64_t clip_length_ms);
+
+inline int FeaturesPerFrame(const FeatureOptions& options) {
+  return options.mel_bins + options.mfcc_count;
+}
+
+// Holds the window, FFT twiddles, mel filterbank and DCT for one sample rate.
+// Each frame is Hann windowed and zero padded to a power of two, and its power
+// spectrum comes from a half-length complex FFT over the even and odd samples.
+// Sixteen frames are transformed at once, one per vector lane, so that the
+// fft_stage kernel's early stages are as wide as its later ones, rather than
+// being limited by how many butterflies share a twiddle. The log-mel energies
+// are the natural log of the triangular HTK-style filter outputs plus a small
+// offset, and the MFCCs are their orthonormal DCT-II.
+//
+// Example usage:
+//
+// FeatureExtractor extractor(options, 16000);
+// float* features = arena.AllocateArray<float>(
+//     frame_count * FeaturesPerFrame(options));
+// TF_RETURN_IF_ERROR(
+//     extractor.Compute(samples, sample_count, frame_count, &arena, features));
+class FeatureExtractor {
+ public:
+  FeatureExtractor(const FeatureOptions& options, uint32_t sample_rate);
+
+  // Writes frame_count rows of mel_bins log-mel energies followed by
+  // mfcc_count coefficients. Scratch space comes from the arena, and an error
+  // is returned if it runs out.
+  Status Compute(const float* samples, int64_t sample_count, int frame_count,
+               Arena* arena, float* features) const;
+
+  uint32_t sample_rate() const { return sample_rate_; }
+
+ private:
+  const FeatureOptions options_;
+  const uint32_t sample_rate_;
+  int64_t window_size_;
+  int64_t stride_;
+  // The real FFT size, and the size of the complex FFT that computes it.
+  int64_t fft_size_;
+  int64_t half_size_;
+  std::vector<float> window_;
+  std::vector<int32_t> bit_reverse_;
+  // Twiddles for the stage with groups of 2 * half start at index half.
+  std::vector<float> twiddle_real_;
+  std::vector<float> twiddle_imag_;
+  // Splits the complex FFT's output back into the real input's spectrum.
+  std::vector<float> split_real_;
+  std::vector<float> split_imag_;
+  // Each mel bin's filter covers FFT bins [mel_start_[m], mel_end_[m]), with
+  // weights at mel_weights_[mel_offset_[m]] onwards.
+  std::vector<int32_t> mel_start_;
+  std::vector<int32_t> mel_end_;
+  std::vector<int32_t> mel_offset_;
+  std::vector<float> mel_weights_;
+  // mfcc_count rows of mel_bins.
+  std::vector<float> dct_;
+};
+
+// Writes features into a single file, with one fixed-size record per input
+// file, in input order. The file starts with a 64-byte header of
+// little-endian fields:
+//
+//   char magic[8] = "ELSFEAT1"
+//   uint32 value_type: 0 for float32, 1 for float16
+//   uint32 frame_count, mel_bins, mfcc_count, window_ms, stride_ms
+//   uint64 clip_count
+//
+// which is followed by clip_count bytes, padded to a multiple of 64, that are
+// 1 for clips that have features and 0 for ones that were skipped or failed.
+// Then come the records, each frame_count * (mel_bins + mfcc_count) values,
+// which are left as zeros for missing clips. Records are written in place with
+// pwrite(), so workers can finish them in any order.
+class FeatureShardWriter {
+ public:
+  FeatureShardWriter(const std::string& filename,
+                     const FeatureOptions& options, int64_t clip_count,
+                     int frame_count);
+  ~FeatureShardWriter();
+
+  const Status& status() const { return status_; }
+
+  // Stores the features for one clip. Safe to call from several threads at
+  // once, as long as they're writing different clips. The arena holds the
+  // float16 version, if that's the chosen type.
+  Status Write(int64_t clip_index, const float* features, Arena* arena);
+
+ private:
+  const std::string filename_;
+  const FeatureOptions options_;
+  const int64_t clip_count_;
+  const int frame_count_;
+  int fd_;
+  int64_t records_offset_;
+  Status status_;
+};
+
+#endif  // AUDIO_FEATURES_H_
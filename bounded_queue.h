@@ -0,0 +1,165 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// A fixed-size queue that any number of threads can push to and pop from
+// without taking locks, for passing work between the stages of the pipeline.
+
+#ifndef BOUNDED_QUEUE_H_
+#define BOUNDED_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+// Waits a little longer each time it's called, first spinning, then yielding
+// the CPU, and finally sleeping, so a thread that's waiting on another stage
+// reacts quickly to short gaps without burning a core through long ones.
+class Backoff {
+ public:
+  Backoff() : attempts_(0) {}
+
+  void Wait() {
+    if (attempts_ < 64) {
+      ++attempts_;
+    } else if (attempts_ < 128) {
+      ++attempts_;
+      std::this_thread::yield();
+    } else {
+      const struct timespec delay = {0, 50 * 1000};
+      nanosleep(&delay, nullptr);
+    }
+  }
+
+ private:
+  int attempts_;
+};
+
+// Dmitry Vyukov's bounded multi-producer, multi-consumer queue. Each cell has
+// a sequence number that says whether it's waiting to be written or read on
+// the current lap around the ring, so producers and consumers only contend on
+// their own position counter, with a single compare-and-swap each. Push()
+// waits while the queue is full, which is what stops a fast stage from
+// running arbitrarily far ahead of a slow one.
+//
+// Example usage:
+//
+// BoundedQueue<Job*> queue(64);
+// queue.Push(job);  // On one thread.
+// Job* job = queue.Pop();  // On another.
+template <class T>
+class BoundedQueue {
+ public:
+  // The capacity is rounded up to a power of two.
+  explicit BoundedQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size *= 2;
+    }
+    mask_ = size - 1;
+    cells_.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    enqueue_position_.store(0, std::memory_order_relaxed);
+    dequeue_position_.store(0, std::memory_order_relaxed);
+  }
+
+  // Returns false without waiting if the queue is full.
+  bool TryPush(const T& value) {
+    size_t position = enqueue_position_.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells_[position & mask_];
+      const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      const intptr_t difference =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+      if (difference == 0) {
+        if (enqueue_position_.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed)) {
+          cell.value = value;
+          cell.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = enqueue_position_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Returns false without waiting if the queue is empty.
+  bool TryPop(T* value) {
+    size_t position = dequeue_position_.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells_[position & mask_];
+      const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      const intptr_t difference = static_cast<intptr_t>(sequence) -
+                                  static_cast<intptr_t>(position + 1);
+      if (difference == 0) {
+        if (dequeue_position_.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed)) {
+          *value = cell.value;
+          cell.sequence.store(position + mask_ + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = dequeue_position_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void Push(const T& value) {
+    Backoff backoff;
+    while (!TryPush(value)) {
+      backoff.Wait();
+    }
+  }
+
+  T Pop() {
+    Backoff backoff;
+    T value;
+    while (!TryPop(&value)) {
+      backoff.Wait();
+    }
+    return value;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_;
+  // Keeps the two ends on their own cache lines, so producers and consumers
+  // don't slow each other down.
+  char padding0_[64];
+  std::atomic<size_t> enqueue_position_;
+  char padding1_[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> dequeue_position_;
+  char padding2_[64 - sizeof(std::atomic<size_t>)];
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  void operator=(const BoundedQueue&) = delete;
+};
+
+#endif  // BOUNDED_QUEUE_H_
@@ -0,0 +1,55 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "byte_reader.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+Status FdByteReader::Read(uint8_t* data, int64_t length, int64_t* bytes_read) {
+  *bytes_read = 0;
+  while (*bytes_read < length) {
+    const ssize_t result = read(fd_, data + *bytes_read, length - *bytes_read);
+    if (result == 0) {
+      break;
+    }
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errors::Unavailable("Reading stream failed: ", strerror(errno));
+    }
+    *bytes_read += result;
+  }
+  return Status::OK();
+}
+
+Status PrefixedByteReader::Read(uint8_t* data, int64_t length,
+                                int64_t* bytes_read) {
+  const int64_t from_prefix = std::min(length, prefix_size_);
+  memcpy(data, prefix_, from_prefix);
+  prefix_ += from_prefix;
+  prefix_size_ -= from_prefix;
+  int64_t from_rest = 0;
+  if (from_prefix < length) {
+    TF_RETURN_IF_ERROR(
+        rest_->Read(data + from_prefix, length - from_prefix, &from_rest));
+  }
+  *bytes_read = from_prefix + from_rest;
+  return Status::OK();
+}
@@ -0,0 +1,64 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// A minimal interface for pulling bytes out of a stream, so the incremental
+// WAV reader can sit on top of a pipe or a decompressor alike.
+
+#ifndef BYTE_READER_H_
+#define BYTE_READER_H_
+
+#include <stdint.h>
+
+#include "status.h"
+
+class ByteReader {
+ public:
+  virtual ~ByteReader() {}
+
+  // Reads up to length bytes, returning fewer only if the stream ends first.
+  // bytes_read is set to zero once there's nothing left.
+  virtual Status Read(uint8_t* data, int64_t length, int64_t* bytes_read) = 0;
+};
+
+// Reads from a file descriptor, such as stdin, retrying short reads.
+class FdByteReader : public ByteReader {
+ public:
+  FdByteReader(int fd) : fd_(fd) {}
+
+  Status Read(uint8_t* data, int64_t length, int64_t* bytes_read) override;
+
+ private:
+  const int fd_;
+};
+
+// Hands back bytes that have already been taken from a stream, such as the
+// few that were looked at to tell what kind of data it holds, and then carries
+// on with the rest of the stream. The prefix isn't copied, so it has to stay
+// alive as long as the reader does.
+class PrefixedByteReader : public ByteReader {
+ public:
+  PrefixedByteReader(const uint8_t* prefix, int64_t prefix_size,
+                     ByteReader* rest)
+      : prefix_(prefix), prefix_size_(prefix_size), rest_(rest) {}
+
+  Status Read(uint8_t* data, int64_t length, int64_t* bytes_read) override;
+
+ private:
+  const uint8_t* prefix_;
+  int64_t prefix_size_;
+  ByteReader* rest_;
+};
+
+#endif  // BYTE_READER_H_
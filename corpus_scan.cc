@@ -0,0 +1,409 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "corpus_scan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#include "archive.h"
+#include "flac_format.h"
+#include "gzip_reader.h"
+#include "wav_io.h"
+#include "zstd_reader.h"
+
+namespace {
+
+uint16_t ReadLittleEndian16(const uint8_t* data) {
+  return data[0] | (data[1] << 8);
+}
+
+uint32_t ReadLittleEndian32(const uint8_t* data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) |
+         (static_cast<uint32_t>(data[3]) << 24);
+}
+
+// Reads up to size bytes from offset, stopping early only at the end of the
+// file. Returns how many were read, or -1 on an error.
+int64_t ReadAt(int fd, uint8_t* data, int64_t size, int64_t offset) {
+  int64_t total = 0;
+  while (total < size) {
+    const ssize_t result = pread(fd, data + total, size - total, offset + total);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (result == 0) {
+      break;
+    }
+    total += result;
+  }
+  return total;
+}
+
+// Does the same checks as FindLin16WaveSamples(), but with only the start of
+// the file in memory, following the chunks after it with eight-byte reads.
+Status ScanWav(int fd, const uint8_t* header, int64_t header_size,
+               ScanRecord* record) {
+  // The format fields are recorded before they're checked, so that files the
+  // decoder rejects still show what they hold.
+  constexpr int kFormatEnd = 36;
+  if ((header_size >= kFormatEnd) && (memcmp(header, "RIFF", 4) == 0) &&
+      (memcmp(header + 8, "WAVEfmt ", 8) == 0)) {
+    record->channel_count = ReadLittleEndian16(header + 22);
+    record->sample_rate = ReadLittleEndian32(header + 24);
+    record->bits_per_sample = ReadLittleEndian16(header + 34);
+  }
+  uint16_t channel_count;
+  uint32_t sample_rate;
+  uint16_t bytes_per_sample;
+  int data_offset;
+  TF_RETURN_IF_ERROR(DecodeLin16WaveHeader(header, header_size, &channel_count,
+                                           &sample_rate, &bytes_per_sample,
+                                           &data_offset));
+
+  const int64_t file_size = record->file_size;
+  int64_t offset = data_offset;
+  bool was_data_found = false;
+  while (offset < file_size) {
+    constexpr int kChunkHeaderSize = 8;
+    if ((file_size - offset) < kChunkHeaderSize) {
+      return errors::InvalidArgument(
+          "Data too short when trying to read value");
+    }
+    uint8_t chunk_header[kChunkHeaderSize];
+    if ((offset + kChunkHeaderSize) <= header_size) {
+      memcpy(chunk_header, header + offset, kChunkHeaderSize);
+    } else if (ReadAt(fd, chunk_header, kChunkHeaderSize, offset) !=
+               kChunkHeaderSize) {
+      return errors::DataLoss("Couldn't read the WAV chunk at byte ", offset);
+    }
+    const std::string chunk_id(reinterpret_cast<char*>(chunk_header), 4);
+    const uint32_t chunk_size = ReadLittleEndian32(chunk_header + 4);
+    offset += kChunkHeaderSize;
+    if (chunk_size > (file_size - offset)) {
+      return errors::DataLoss("WAV chunk '", chunk_id, "' claims ", chunk_size,
+                              " bytes, but only ", (file_size - offset),
+                              " are left in the file");
+    }
+    if (chunk_id == "data") {
+      if (was_data_found) {
+        return errors::InvalidArgument("More than one data chunk found in WAV");
+      }
+      was_data_found = true;
+      record->frame_count = chunk_size / bytes_per_sample;
+      // Like the decoder, this skips whole frames, not the chunk's size.
+      offset += record->frame_count * bytes_per_sample;
+    } else {
+      offset += chunk_size;
+    }
+  }
+  if (!was_data_found) {
+    return errors::InvalidArgument("No data chunk found in WAV");
+  }
+  return Status::OK();
+}
+
+// Reads the STREAMINFO block, which the format requires to come first, and
+// applies the same checks as FlacDecoder::ReadHeader().
+Status ScanFlac(const uint8_t* header, int64_t header_size,
+                ScanRecord* record) {
+  constexpr int kBlockStart = kFlacMarkerSize + kFlacMetadataHeaderSize;
+  if (header_size < (kBlockStart + kFlacStreamInfoSize)) {
+    return errors::DataLoss("FLAC metadata block runs past the end");
+  }
+  if ((header[kFlacMarkerSize] & 0x7f) != kFlacStreamInfoType) {
+    return errors::InvalidArgument("No STREAMINFO block in FLAC");
+  }
+  const uint8_t* info = header + kBlockStart;
+  const int max_block_size = (info[2] << 8) | info[3];
+  record->sample_rate = (info[10] << 12) | (info[11] << 4) | (info[12] >> 4);
+  record->channel_count = ((info[12] >> 1) & 0x7) + 1;
+  record->bits_per_sample = (((info[12] & 0x1) << 4) | (info[13] >> 4)) + 1;
+  // Unlike WAV, the fields are big-endian, and a total of zero means the
+  // encoder didn't know the length.
+  const int64_t total_frames =
+      (static_cast<int64_t>(info[13] & 0xf) << 32) |
+      (static_cast<uint32_t>(info[14]) << 24) | (info[15] << 16) |
+      (info[16] << 8) | info[17];
+  if (total_frames > 0) {
+    record->frame_count = total_frames;
+  }
+  if ((record->bits_per_sample < 4) || (record->bits_per_sample > 24)) {
+    return errors::Unimplemented("Can't decode ", record->bits_per_sample,
+                                 "-bit FLAC");
+  }
+  if ((max_block_size < 16) || (record->sample_rate == 0)) {
+    return errors::DataLoss("Bad FLAC STREAMINFO");
+  }
+  return Status::OK();
+}
+
+double RecordSeconds(const ScanRecord& record) {
+  return static_cast<double>(record.frame_count) / record.sample_rate;
+}
+
+bool HasDuration(const ScanRecord& record) {
+  return (record.frame_count >= 0) && (record.sample_rate > 0);
+}
+
+// Prints one histogram, with bars scaled to the largest count.
+template <class Key>
+void WriteHistogram(const std::string& title,
+                    const std::map<Key, int64_t>& counts,
+                    const std::map<Key, std::string>& labels,
+                    std::ostream* output) {
+  if (counts.empty()) {
+    return;
+  }
+  constexpr int kBarWidth = 40;
+  int64_t largest = 0;
+  size_t label_width = 0;
+  for (const auto& entry : counts) {
+    largest = std::max(largest, entry.second);
+    label_width = std::max(label_width, labels.at(entry.first).size());
+  }
+  *output << title << ":" << std::endl;
+  for (const auto& entry : counts) {
+    const int bar = static_cast<int>((entry.second * kBarWidth) / largest);
+    *output << "  " << std::left << std::setw(label_width)
+            << labels.at(entry.first) << std::right << " " << std::setw(8)
+            << entry.second << " " << std::string(bar, '#') << std::endl;
+  }
+}
+
+std::string FormatSeconds(double seconds) {
+  std::ostringstream stream;
+  stream << seconds << "s";
+  return stream.str();
+}
+
+}  // namespace
+
+const char* ScanFormatName(ScanFormat format) {
+  switch (format) {
+    case ScanFormat::kWav:
+      return "wav";
+    case ScanFormat::kFlac:
+      return "flac";
+    case ScanFormat::kGzip:
+      return "gzip";
+    case ScanFormat::kZstd:
+      return "zstd";
+    case ScanFormat::kTar:
+      return "tar";
+    case ScanFormat::kZip:
+      return "zip";
+    case ScanFormat::kUnknown:
+      break;
+  }
+  return "unknown";
+}
+
+void ScanInputHeader(const std::string& filename, ScanRecord* record) {
+  *record = ScanRecord();
+  const int fd = open(filename.c_str(), O_RDONLY, 0);
+  if (fd == -1) {
+    record->status = errors::NotFound("Couldn't open: ", strerror(errno));
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    record->status = errors::Internal("Couldn't stat: ", strerror(errno));
+    close(fd);
+    return;
+  }
+  record->file_size = st.st_size;
+  const ArchiveType archive_type = ArchiveTypeFromFilename(filename);
+  if (archive_type != ArchiveType::kNone) {
+    // Listing the members would mean reading the whole archive.
+    record->format = (archive_type == ArchiveType::kTar) ? ScanFormat::kTar
+                                                         : ScanFormat::kZip;
+    close(fd);
+    return;
+  }
+  if (record->file_size == 0) {
+    record->status = errors::InvalidArgument("File is empty");
+    close(fd);
+    return;
+  }
+
+  uint8_t header[kScanHeaderBytes];
+  const int64_t header_size = ReadAt(fd, header, kScanHeaderBytes, 0);
+  if (header_size < 0) {
+    record->status = errors::DataLoss("Couldn't read: ", strerror(errno));
+    close(fd);
+    return;
+  }
+  auto starts_with = [&header, header_size](const char* marker,
+                                            int marker_size) {
+    return (header_size >= marker_size) &&
+           (memcmp(header, marker, marker_size) == 0);
+  };
+  // These are recognized the same way as when processing, so anything that
+  // isn't one of the other formats is treated as a WAV.
+  if (starts_with(kFlacMarker, kFlacMarkerSize)) {
+    record->format = ScanFormat::kFlac;
+    record->status = ScanFlac(header, header_size, record);
+  } else if (starts_with(kGzipMarker, kGzipMarkerSize)) {
+    record->format = ScanFormat::kGzip;
+  } else if (starts_with(kZstdMarker, kZstdMarkerSize)) {
+    record->format = ScanFormat::kZstd;
+  } else {
+    record->format = ScanFormat::kWav;
+    record->status = ScanWav(fd, header, header_size, record);
+  }
+  close(fd);
+}
+
+void ScanInputs(const std::vector<std::string>& filenames, int thread_count,
+                std::vector<ScanRecord>* records) {
+  records->resize(filenames.size());
+  std::atomic<int64_t> next_index(0);
+  auto scan = [&]() {
+    for (int64_t i = next_index++; i < static_cast<int64_t>(filenames.size());
+         i = next_index++) {
+      ScanInputHeader(filenames[i], &(*records)[i]);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int t = 1; t < thread_count; ++t) {
+    threads.emplace_back(scan);
+  }
+  scan();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+void WriteScanInventory(const std::vector<std::string>& filenames,
+                        const std::vector<ScanRecord>& records,
+                        std::ostream* output) {
+  *output << "file\tformat\tbytes\tsample_rate\tchannels\tbits\tframes\t"
+             "seconds\tproblem"
+          << std::endl;
+  for (size_t i = 0; i < records.size(); ++i) {
+    const ScanRecord& record = records[i];
+    *output << filenames[i] << "\t" << ScanFormatName(record.format) << "\t"
+            << record.file_size << "\t";
+    if (record.sample_rate > 0) {
+      *output << record.sample_rate << "\t" << record.channel_count << "\t"
+              << record.bits_per_sample << "\t";
+    } else {
+      *output << "-\t-\t-\t";
+    }
+    if (HasDuration(record)) {
+      *output << record.frame_count << "\t" << std::fixed
+              << std::setprecision(3) << RecordSeconds(record)
+              << std::defaultfloat << "\t";
+    } else {
+      *output << "-\t-\t";
+    }
+    *output << (record.status.ok() ? "" : record.status.ToString())
+            << std::endl;
+  }
+}
+
+void WriteScanSummary(const std::vector<ScanRecord>& records,
+                      std::ostream* output) {
+  int64_t accepted_count = 0;
+  double accepted_seconds = 0.0;
+  std::map<std::string, int64_t> format_counts;
+  std::map<uint32_t, int64_t> rate_counts;
+  std::map<uint16_t, int64_t> channel_counts;
+  std::map<uint16_t, int64_t> bit_counts;
+  // Durations go in power of two buckets, from 1/8th of a second up.
+  std::map<int, int64_t> duration_counts;
+  std::map<std::string, int64_t> problem_counts;
+  for (const ScanRecord& record : records) {
+    ++format_counts[ScanFormatName(record.format)];
+    if (record.status.ok()) {
+      ++accepted_count;
+      if (HasDuration(record)) {
+        accepted_seconds += RecordSeconds(record);
+      }
+    } else {
+      ++problem_counts[record.status.ToString()];
+    }
+    if (record.sample_rate > 0) {
+      ++rate_counts[record.sample_rate];
+      ++channel_counts[record.channel_count];
+      ++bit_counts[record.bits_per_sample];
+    }
+    if (HasDuration(record)) {
+      const double seconds = RecordSeconds(record);
+      const int bucket =
+          (seconds > 0.0) ? std::max(-3, static_cast<int>(floor(log2(seconds))))
+                          : -3;
+      ++duration_counts[bucket];
+    }
+  }
+
+  *output << "Scanned " << records.size() << " files, "
+          << accepted_count << " accepted and "
+          << (records.size() - accepted_count) << " rejected, holding "
+          << std::fixed << std::setprecision(1) << accepted_seconds
+          << std::defaultfloat << " seconds of audio that could be read"
+          << std::endl;
+  auto identity_labels = [](const std::map<std::string, int64_t>& counts) {
+    std::map<std::string, std::string> labels;
+    for (const auto& entry : counts) {
+      labels[entry.first] = entry.first;
+    }
+    return labels;
+  };
+  auto number_labels = [](const std::map<uint16_t, int64_t>& counts) {
+    std::map<uint16_t, std::string> labels;
+    for (const auto& entry : counts) {
+      labels[entry.first] = std::to_string(entry.first);
+    }
+    return labels;
+  };
+  WriteHistogram("Formats", format_counts, identity_labels(format_counts),
+                 output);
+  std::map<uint32_t, std::string> rate_labels;
+  for (const auto& entry : rate_counts) {
+    rate_labels[entry.first] = std::to_string(entry.first) + "Hz";
+  }
+  WriteHistogram("Sample rates", rate_counts, rate_labels, output);
+  WriteHistogram("Channels", channel_counts, number_labels(channel_counts),
+                 output);
+  WriteHistogram("Bits per sample", bit_counts, number_labels(bit_counts),
+                 output);
+  std::map<int, std::string> duration_labels;
+  for (const auto& entry : duration_counts) {
+    duration_labels[entry.first] =
+        ((entry.first == -3) ? std::string("under ")
+                             : (FormatSeconds(ldexp(1.0, entry.first)) +
+                                " to under ")) +
+        FormatSeconds(ldexp(1.0, entry.first + 1));
+  }
+  WriteHistogram("Durations", duration_counts, duration_labels, output);
+  WriteHistogram("Problems", problem_counts, identity_labels(problem_counts),
+                 output);
+}
@@ -0,0 +1,77 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Takes an inventory of a corpus from the first few kilobytes of each file,
+// without mapping or decoding any audio, so the formats and lengths of a batch
+// can be checked far faster than processing it.
+
+#ifndef CORPUS_SCAN_H_
+#define CORPUS_SCAN_H_
+
+#include <stdint.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "status.h"
+
+// How many bytes are read from the start of each file. Headers that are
+// longer than this, like WAVs with big metadata chunks before their data, are
+// followed with small extra reads.
+constexpr int kScanHeaderBytes = 4096;
+
+enum class ScanFormat { kUnknown, kWav, kFlac, kGzip, kZstd, kTar, kZip };
+
+// A short lowercase name for the format, like "wav".
+const char* ScanFormatName(ScanFormat format);
+
+// What a file's header says about it. The audio fields are filled in as far
+// as the header could be parsed, even for files that would be rejected, and
+// are zero otherwise.
+struct ScanRecord {
+  ScanFormat format = ScanFormat::kUnknown;
+  int64_t file_size = 0;
+  uint32_t sample_rate = 0;
+  uint16_t channel_count = 0;
+  uint16_t bits_per_sample = 0;
+  // Minus one when the header doesn't say, as for compressed WAVs.
+  int64_t frame_count = -1;
+  // Why processing the file would fail, or OK if it would be accepted.
+  Status status;
+};
+
+// Reads the start of a file with pread() and fills in its record, applying
+// the same checks as the decoders to their headers. Compressed files and
+// archives only have their format recorded.
+void ScanInputHeader(const std::string& filename, ScanRecord* record);
+
+// Scans every file on thread_count threads, with records[i] for filenames[i].
+void ScanInputs(const std::vector<std::string>& filenames, int thread_count,
+                std::vector<ScanRecord>* records);
+
+// Writes a tab-separated line for each file in order, after a line naming the
+// columns. Unknown values are written as "-", and the last column holds the
+// reason a file would be rejected, if any.
+void WriteScanInventory(const std::vector<std::string>& filenames,
+                        const std::vector<ScanRecord>& records,
+                        std::ostream* output);
+
+// Writes the totals, and histograms of the formats, sample rates, channel
+// counts, bit depths, durations, and reasons for rejection.
+void WriteScanSummary(const std::vector<ScanRecord>& records,
+                      std::ostream* output);
+
+#endif  // CORPUS_SCAN_H_
@@ -0,0 +1,437 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "flac_decoder.h"
+
+#include <string.h>
+
+#include "flac_format.h"
+
+namespace {
+
+// Reads values most significant bit first, through a 64-bit cache. Reading
+// past the end gives zeros and sets a flag, so the callers only need to check
+// once per frame.
+class BitReader {
+ public:
+  BitReader(const uint8_t* data, size_t size, size_t offset)
+      : data_(data), size_(size), offset_(offset), cache_(0), bit_count_(0),
+        overrun_(false) {}
+
+  // Reads up to 32 bits.
+  uint32_t Read(int bits) {
+    if (bits == 0) {
+      return 0;
+    }
+    if (bit_count_ < bits) {
+      Refill();
+      if (bit_count_ < bits) {
+        overrun_ = true;
+        bit_count_ = bits;
+      }
+    }
+    const uint32_t value = cache_ >> (64 - bits);
+    cache_ <<= bits;
+    bit_count_ -= bits;
+    return value;
+  }
+
+  int32_t ReadSigned(int bits) {
+    if (bits == 0) {
+      return 0;
+    }
+    const uint32_t value = Read(bits);
+    const uint32_t sign = uint32_t(1) << (bits - 1);
+    return static_cast<int32_t>((value ^ sign) - sign);
+  }
+
+  // Counts the zeros before the next one, and skips past them both.
+  uint32_t ReadUnary() {
+    uint32_t zeros = 0;
+    while (true) {
+      if (cache_ == 0) {
+        zeros += bit_count_;
+        bit_count_ = 0;
+        Refill();
+        if (bit_count_ == 0) {
+          overrun_ = true;
+          return zeros;
+        }
+        continue;
+      }
+      // Bits past bit_count_ are always zero, so the one is a valid bit.
+      const int leading_zeros = __builtin_clzll(cache_);
+      zeros += leading_zeros;
+      cache_ <<= leading_zeros;
+      cache_ <<= 1;
+      bit_count_ -= leading_zeros + 1;
+      return zeros;
+    }
+  }
+
+  int32_t ReadRice(int parameter) {
+    const uint32_t quotient = ReadUnary();
+    const uint32_t folded = (quotient << parameter) | Read(parameter);
+    return static_cast<int32_t>(folded >> 1) ^ -static_cast<int32_t>(folded & 1);
+  }
+
+  void Align() { Read(bit_count_ % 8); }
+
+  // The offset of the next unread byte. Only meaningful when aligned.
+  size_t offset() const { return offset_ - (bit_count_ / 8); }
+  bool overrun() const { return overrun_; }
+
+ private:
+  void Refill() {
+    while ((bit_count_ <= 56) && (offset_ < size_)) {
+      cache_ |= uint64_t(data_[offset_]) << (56 - bit_count_);
+      ++offset_;
+      bit_count_ += 8;
+    }
+  }
+
+  const uint8_t* data_;
+  size_t size_;
+  size_t offset_;
+  uint64_t cache_;
+  int bit_count_;
+  bool overrun_;
+};
+
+// Decodes a Rice-coded residual straight into output, which is then turned
+// into samples in place by the predictor.
+Status ReadResidual(BitReader* reader, int block_size, int order,
+                    int32_t* output) {
+  const int method = reader->Read(2);
+  if (method > 1) {
+    return errors::DataLoss("Unknown FLAC residual coding method ", method);
+  }
+  const int parameter_bits = (method == 0) ? 4 : 5;
+  const uint32_t escape = (1 << parameter_bits) - 1;
+  const int partition_order = reader->Read(4);
+  const int partition_size = block_size >> partition_order;
+  if (((partition_size << partition_order) != block_size) ||
+      (partition_size < order)) {
+    return errors::DataLoss("Bad FLAC residual partition order ",
+                            partition_order, " for a block of ", block_size);
+  }
+  int index = order;
+  for (int partition = 0; partition < (1 << partition_order); ++partition) {
+    const int end = (partition + 1) * partition_size;
+    const uint32_t parameter = reader->Read(parameter_bits);
+    if (parameter == escape) {
+      const int raw_bits = reader->Read(5);
+      for (; index < end; ++index) {
+        output[index] = reader->ReadSigned(raw_bits);
+      }
+    } else {
+      for (; index < end; ++index) {
+        output[index] = reader->ReadRice(parameter);
+      }
+    }
+  }
+  return Status::OK();
+}
+
+Status ReadSubframe(BitReader* reader, int block_size, int bits_per_sample,
+                    int32_t* output) {
+  if (reader->Read(1) != 0) {
+    return errors::DataLoss("Bad FLAC subframe padding");
+  }
+  const int type = reader->Read(6);
+  int wasted_bits = 0;
+  if (reader->Read(1)) {
+    wasted_bits = reader->ReadUnary() + 1;
+    bits_per_sample -= wasted_bits;
+    if (bits_per_sample <= 0) {
+      return errors::DataLoss("Too many wasted bits in FLAC subframe");
+    }
+  }
+
+  if (type == kFlacSubframeConstant) {
+    const int32_t value = reader->ReadSigned(bits_per_sample);
+    for (int i = 0; i < block_size; ++i) {
+      output[i] = value;
+    }
+  } else if (type == kFlacSubframeVerbatim) {
+    for (int i = 0; i < block_size; ++i) {
+      output[i] = reader->ReadSigned(bits_per_sample);
+    }
+  } else if ((type >= kFlacSubframeFixed) &&
+             (type <= (kFlacSubframeFixed + kFlacMaxFixedOrder))) {
+    const int order = type - kFlacSubframeFixed;
+    if (order > block_size) {
+      return errors::DataLoss("FLAC predictor order ", order,
+                              " is longer than its block");
+    }
+    for (int i = 0; i < order; ++i) {
+      output[i] = reader->ReadSigned(bits_per_sample);
+    }
+    TF_RETURN_IF_ERROR(ReadResidual(reader, block_size, order, output));
+    // The fixed predictors are successive differences.
+    for (int i = order; i < block_size; ++i) {
+      int64_t prediction = 0;
+      switch (order) {
+        case 1:
+          prediction = output[i - 1];
+          break;
+        case 2:
+          prediction = (2 * int64_t(output[i - 1])) - output[i - 2];
+          break;
+        case 3:
+          prediction = (3 * (int64_t(output[i - 1]) - output[i - 2])) +
+                       output[i - 3];
+          break;
+        case 4:
+          prediction = (4 * (int64_t(output[i - 1]) + output[i - 3])) -
+                       (6 * int64_t(output[i - 2])) - output[i - 4];
+          break;
+      }
+      output[i] += prediction;
+    }
+  } else if (type >= kFlacSubframeLpc) {
+    const int order = type - kFlacSubframeLpc + 1;
+    if (order > block_size) {
+      return errors::DataLoss("FLAC predictor order ", order,
+                              " is longer than its block");
+    }
+    for (int i = 0; i < order; ++i) {
+      output[i] = reader->ReadSigned(bits_per_sample);
+    }
+    const int precision = reader->Read(4) + 1;
+    if (precision == 16) {
+      return errors::DataLoss("Bad FLAC LPC coefficient precision");
+    }
+    const int shift = reader->ReadSigned(5);
+    if (shift < 0) {
+      return errors::DataLoss("Negative FLAC LPC shift ", shift);
+    }
+    int32_t coefficients[kFlacMaxLpcOrder];
+    for (int j = 0; j < order; ++j) {
+      coefficients[j] = reader->ReadSigned(precision);
+    }
+    TF_RETURN_IF_ERROR(ReadResidual(reader, block_size, order, output));
+    for (int i = order; i < block_size; ++i) {
+      int64_t prediction = 0;
+      for (int j = 0; j < order; ++j) {
+        prediction += int64_t(coefficients[j]) * output[i - 1 - j];
+      }
+      output[i] += static_cast<int32_t>(prediction >> shift);
+    }
+  } else {
+    return errors::DataLoss("Reserved FLAC subframe type ", type);
+  }
+
+  if (wasted_bits > 0) {
+    for (int i = 0; i < block_size; ++i) {
+      output[i] = static_cast<int32_t>(uint32_t(output[i]) << wasted_bits);
+    }
+  }
+  return Status::OK();
+}
+
+// Skips the UTF-8 style frame or sample number.
+Status SkipCodedNumber(BitReader* reader) {
+  const uint32_t first = reader->Read(8);
+  int extra_bytes = 0;
+  while ((extra_bytes < 7) && (first & (0x80 >> extra_bytes))) {
+    ++extra_bytes;
+  }
+  if ((extra_bytes == 1) || (extra_bytes == 7)) {
+    return errors::DataLoss("Bad FLAC frame number");
+  }
+  for (int i = 1; i < extra_bytes; ++i) {
+    if ((reader->Read(8) & 0xc0) != 0x80) {
+      return errors::DataLoss("Bad FLAC frame number");
+    }
+  }
+  return Status::OK();
+}
+
+}  // namespace
+
+FlacDecoder::FlacDecoder(const uint8_t* data, size_t size)
+    : data_(data),
+      size_(size),
+      offset_(0),
+      next_frame_(0),
+      sample_rate_(0),
+      channel_count_(0),
+      bits_per_sample_(0),
+      max_block_size_(0),
+      total_frames_(0) {}
+
+Status FlacDecoder::ReadHeader() {
+  if ((size_ < kFlacMarkerSize) ||
+      (memcmp(data_, kFlacMarker, kFlacMarkerSize) != 0)) {
+    return errors::InvalidArgument("Missing 'fLaC' marker");
+  }
+  BitReader reader(data_, size_, kFlacMarkerSize);
+  bool found_stream_info = false;
+  bool is_last = false;
+  while (!is_last) {
+    is_last = reader.Read(1);
+    const int type = reader.Read(7);
+    const uint32_t length = reader.Read(24);
+    const size_t block_start = reader.offset();
+    if (reader.overrun() || (length > (size_ - block_start))) {
+      return errors::DataLoss("FLAC metadata block runs past the end");
+    }
+    if (type == kFlacStreamInfoType) {
+      if (length < kFlacStreamInfoSize) {
+        return errors::DataLoss("FLAC STREAMINFO block is too short");
+      }
+      reader.Read(16);
+      max_block_size_ = reader.Read(16);
+      reader.Read(24);
+      reader.Read(24);
+      sample_rate_ = reader.Read(20);
+      channel_count_ = reader.Read(3) + 1;
+      bits_per_sample_ = reader.Read(5) + 1;
+      total_frames_ = (int64_t(reader.Read(4)) << 32) | reader.Read(32);
+      found_stream_info = true;
+    }
+    reader = BitReader(data_, size_, block_start + length);
+  }
+  if (!found_stream_info) {
+    return errors::InvalidArgument("No STREAMINFO block in FLAC");
+  }
+  if ((bits_per_sample_ < 4) || (bits_per_sample_ > 24)) {
+    return errors::Unimplemented("Can't decode ", bits_per_sample_,
+                                 "-bit FLAC");
+  }
+  if ((max_block_size_ < 16) || (sample_rate_ == 0)) {
+    return errors::DataLoss("Bad FLAC STREAMINFO");
+  }
+  offset_ = reader.offset();
+  next_frame_ = 0;
+  return Status::OK();
+}
+
+Status FlacDecoder::ReadFrame(int32_t* samples, int* block_size) {
+  *block_size = 0;
+  if (offset_ >= size_) {
+    return Status::OK();
+  }
+  const size_t frame_start = offset_;
+  BitReader reader(data_, size_, offset_);
+  if (reader.Read(14) != kFlacFrameSync) {
+    return errors::DataLoss("Lost FLAC frame sync at byte ", frame_start);
+  }
+  reader.Read(2);
+  const int block_size_code = reader.Read(4);
+  const int sample_rate_code = reader.Read(4);
+  const int channel_code = reader.Read(4);
+  const int sample_size_code = reader.Read(3);
+  reader.Read(1);
+  TF_RETURN_IF_ERROR(SkipCodedNumber(&reader));
+
+  int frame_block_size;
+  if (block_size_code == 1) {
+    frame_block_size = 192;
+  } else if ((block_size_code >= 2) && (block_size_code <= 5)) {
+    frame_block_size = 576 << (block_size_code - 2);
+  } else if (block_size_code == 6) {
+    frame_block_size = reader.Read(8) + 1;
+  } else if (block_size_code == 7) {
+    frame_block_size = reader.Read(16) + 1;
+  } else if (block_size_code >= 8) {
+    frame_block_size = 256 << (block_size_code - 8);
+  } else {
+    return errors::DataLoss("Reserved FLAC block size code");
+  }
+  if (frame_block_size > max_block_size_) {
+    return errors::DataLoss("FLAC block of ", frame_block_size,
+                            " is larger than the stream's maximum of ",
+                            max_block_size_);
+  }
+  // The sample rate always comes from STREAMINFO, but some codes are followed
+  // by an explicit value that has to be skipped.
+  if (sample_rate_code == 12) {
+    reader.Read(8);
+  } else if ((sample_rate_code == 13) || (sample_rate_code == 14)) {
+    reader.Read(16);
+  } else if (sample_rate_code == 15) {
+    return errors::DataLoss("Bad FLAC sample rate code");
+  }
+  static const int kSampleSizes[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+  const int bits_per_sample = (sample_size_code == 0)
+                                  ? bits_per_sample_
+                                  : kSampleSizes[sample_size_code];
+  if (bits_per_sample != bits_per_sample_) {
+    return errors::DataLoss("FLAC frame sample size doesn't match STREAMINFO");
+  }
+  const int frame_channels = (channel_code < 8) ? (channel_code + 1) : 2;
+  if ((channel_code > 10) || (frame_channels != channel_count_)) {
+    return errors::DataLoss("FLAC frame channels don't match STREAMINFO");
+  }
+  reader.Align();
+  const size_t header_end = reader.offset();
+  const uint8_t header_crc = reader.Read(8);
+  if (reader.overrun() ||
+      (FlacCrc8(data_ + frame_start, header_end - frame_start) != header_crc)) {
+    return errors::DataLoss("Bad FLAC frame header at byte ", frame_start);
+  }
+
+  for (int channel = 0; channel < channel_count_; ++channel) {
+    // The side channel of a stereo pair needs an extra bit.
+    const bool is_side = ((channel_code == 8) && (channel == 1)) ||
+                         ((channel_code == 9) && (channel == 0)) ||
+                         ((channel_code == 10) && (channel == 1));
+    TF_RETURN_IF_ERROR(ReadSubframe(&reader, frame_block_size,
+                                    bits_per_sample + (is_side ? 1 : 0),
+                                    samples + (channel * max_block_size_)));
+  }
+  reader.Align();
+  const size_t frame_end = reader.offset();
+  const uint16_t frame_crc = reader.Read(16);
+  if (reader.overrun() ||
+      (FlacCrc16(data_ + frame_start, frame_end - frame_start) != frame_crc)) {
+    return errors::DataLoss("Bad FLAC frame at byte ", frame_start);
+  }
+
+  if (channel_code >= 8) {
+    int32_t* first = samples;
+    int32_t* second = samples + max_block_size_;
+    for (int i = 0; i < frame_block_size; ++i) {
+      if (channel_code == 8) {
+        // Left and side.
+        second[i] = first[i] - second[i];
+      } else if (channel_code == 9) {
+        // Side and right.
+        first[i] = first[i] + second[i];
+      } else {
+        // Mid and side, where the mid channel lost its lowest bit.
+        const int32_t side = second[i];
+        const int32_t mid = (uint32_t(first[i]) << 1) | (side & 1);
+        first[i] = (mid + side) >> 1;
+        second[i] = (mid - side) >> 1;
+      }
+    }
+  }
+  offset_ = reader.offset();
+  next_frame_ += frame_block_size;
+  *block_size = frame_block_size;
+  return Status::OK();
+}
+
+FlacSeekPoint FlacDecoder::position() const {
+  return FlacSeekPoint{offset_, next_frame_};
+}
+
+void FlacDecoder::Seek(const FlacSeekPoint& point) {
+  offset_ = point.offset;
+  next_frame_ = point.first_frame;
+}
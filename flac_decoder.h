@@ -0,0 +1,83 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Decodes FLAC streams held in memory, one frame at a time, so that a file
+// never has to be expanded in full.
+
+#ifndef FLAC_DECODER_H_
+#define FLAC_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "status.h"
+
+// Where a frame starts, so decoding can be resumed from it later.
+struct FlacSeekPoint {
+  size_t offset;
+  int64_t first_frame;
+};
+
+// Reads the frames of a FLAC stream in order. Each FLAC frame holds a block
+// of audio frames for every channel, which come out as separate arrays of
+// integers at the stream's own bit depth.
+//
+// Example usage:
+//
+// FlacDecoder decoder(data, size);
+// TF_RETURN_IF_ERROR(decoder.ReadHeader());
+// std::vector<int32_t> samples(decoder.channel_count() *
+//                              decoder.max_block_size());
+// int block_size;
+// do {
+//   TF_RETURN_IF_ERROR(decoder.ReadFrame(samples.data(), &block_size));
+//   // Channel c is at samples[c * decoder.max_block_size()].
+// } while (block_size > 0);
+class FlacDecoder {
+ public:
+  FlacDecoder(const uint8_t* data, size_t size);
+
+  // Parses the STREAMINFO block and skips any other metadata.
+  Status ReadHeader();
+
+  // Decodes the next frame into channel-planar samples, with each channel's
+  // values max_block_size() apart. Sets block_size to zero at the end of the
+  // stream.
+  Status ReadFrame(int32_t* samples, int* block_size);
+
+  // Where the next frame starts, and restarting from a previous one.
+  FlacSeekPoint position() const;
+  void Seek(const FlacSeekPoint& point);
+
+  uint32_t sample_rate() const { return sample_rate_; }
+  int channel_count() const { return channel_count_; }
+  int bits_per_sample() const { return bits_per_sample_; }
+  int max_block_size() const { return max_block_size_; }
+  // Zero if the stream didn't say.
+  int64_t total_frames() const { return total_frames_; }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t offset_;
+  int64_t next_frame_;
+  uint32_t sample_rate_;
+  int channel_count_;
+  int bits_per_sample_;
+  int max_block_size_;
+  int64_t total_frames_;
+};
+
+#endif  // FLAC_DECODER_H_
@@ -0,0 +1,619 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "flac_encoder.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "flac_format.h"
+#include "kernels.h"
+
+namespace {
+
+// The clips are short, so there's little to gain from larger blocks, and this
+// is what the reference encoder uses by default.
+constexpr int kBlockSize = 4096;
+constexpr int kBitsPerSample = 16;
+// Speech at typical sample rates gains little from higher orders.
+constexpr int kMaxLpcOrder = 8;
+// Bits in each quantized LPC coefficient. Together with the sample size and
+// order this keeps every prediction within 32 bits.
+constexpr int kLpcPrecision = 12;
+constexpr int kMaxLpcShift = 15;
+constexpr int kMaxPartitionOrder = 8;
+constexpr int kMaxRiceParameter = kFlacRiceEscape - 1;
+// The longest possible frame header: sync, codes, a six byte frame number, a
+// two byte block size and the CRC.
+constexpr int kMaxFrameHeaderSize = 4 + 6 + 2 + 1;
+
+// Packs values most significant bit first, as FLAC expects. Bits collect in
+// a 64-bit accumulator and go out four bytes at a time.
+class BitWriter {
+ public:
+  BitWriter(uint8_t* data, size_t capacity)
+      : data_(data),
+        capacity_(capacity),
+        size_(0),
+        accumulator_(0),
+        bit_count_(0) {}
+
+  // Writes the low bits of value, up to 32 of them.
+  void Write(uint32_t value, int bits) {
+    const uint64_t mask = (uint64_t(1) << bits) - 1;
+    accumulator_ = (accumulator_ << bits) | (value & mask);
+    bit_count_ += bits;
+    if (bit_count_ >= 32) {
+      bit_count_ -= 32;
+      const uint32_t word = accumulator_ >> bit_count_;
+      if ((size_ + 4) <= capacity_) {
+        data_[size_] = word >> 24;
+        data_[size_ + 1] = word >> 16;
+        data_[size_ + 2] = word >> 8;
+        data_[size_ + 3] = word;
+      }
+      size_ += 4;
+    }
+  }
+
+  // Writes value as zeros followed by a one.
+  void WriteUnary(uint32_t value) {
+    while (value >= 32) {
+      Write(0, 32);
+      value -= 32;
+    }
+    Write(1, value + 1);
+  }
+
+  void WriteRice(int32_t value, int parameter) {
+    const uint32_t folded = (static_cast<uint32_t>(value) << 1) ^
+                            static_cast<uint32_t>(value >> 31);
+    const uint32_t quotient = folded >> parameter;
+    // Usually the unary part, its terminating one and the low bits fit in a
+    // single write.
+    if ((quotient + 1 + parameter) <= 32) {
+      const uint32_t low_bits = folded & ((uint32_t(1) << parameter) - 1);
+      Write((uint32_t(1) << parameter) | low_bits, quotient + 1 + parameter);
+      return;
+    }
+    WriteUnary(quotient);
+    if (parameter > 0) {
+      Write(folded, parameter);
+    }
+  }
+
+  // Pads with zeros up to the next byte boundary, and stores everything
+  // written so far.
+  void Align() {
+    if ((bit_count_ % 8) != 0) {
+      Write(0, 8 - (bit_count_ % 8));
+    }
+    while (bit_count_ > 0) {
+      bit_count_ -= 8;
+      if (size_ < capacity_) {
+        data_[size_] = accumulator_ >> bit_count_;
+      }
+      ++size_;
+    }
+  }
+
+  // Only meaningful straight after Align().
+  size_t size() const { return size_; }
+  bool overflowed() const { return size_ > capacity_; }
+
+ private:
+  uint8_t* data_;
+  size_t capacity_;
+  size_t size_;
+  uint64_t accumulator_;
+  int bit_count_;
+};
+
+// The Rice parameters chosen for a residual, and how many bits they cost.
+struct RiceCoding {
+  int partition_order;
+  int parameters[1 << kMaxPartitionOrder];
+  uint64_t bits;
+};
+
+// Picks the best parameter for a partition from its size and the sum of its
+// folded values. The cost uses the sum shifted down, which is never less than
+// the sum of each value shifted down, so it's an upper bound on the real size.
+// Each step up in the parameter saves bits until two to its power reaches the
+// mean, so only the parameters around the log of the mean need trying.
+int BestRiceParameter(uint64_t sum, int64_t count, uint64_t* bits) {
+  const uint64_t mean = (count > 0) ? (sum / count) : 0;
+  const int log_mean = (mean > 0) ? (63 - __builtin_clzll(mean)) : 0;
+  const int first = std::max(0, log_mean - 1);
+  const int last = std::min(kMaxRiceParameter, log_mean + 1);
+  int best_parameter = first;
+  uint64_t best_bits = UINT64_MAX;
+  for (int parameter = first; parameter <= last; ++parameter) {
+    const uint64_t parameter_bits =
+        (count * (parameter + 1)) + (sum >> parameter);
+    if (parameter_bits < best_bits) {
+      best_bits = parameter_bits;
+      best_parameter = parameter;
+    }
+  }
+  *bits = best_bits;
+  return best_parameter;
+}
+
+// Chooses how to split the residual of a block into partitions, each with its
+// own Rice parameter. The residual holds block_size - order values, since the
+// warm-up samples are stored verbatim.
+void ChooseRiceCoding(const int32_t* residual, int block_size, int order,
+                      RiceCoding* coding) {
+  int max_order = 0;
+  while ((max_order < kMaxPartitionOrder) &&
+         ((block_size % (2 << max_order)) == 0) &&
+         ((block_size >> (max_order + 1)) > order)) {
+    ++max_order;
+  }
+  // Sums for the finest partitioning, which are then merged pairwise for the
+  // coarser ones.
+  uint64_t sums[1 << kMaxPartitionOrder];
+  const int partition_size = block_size >> max_order;
+  int index = 0;
+  for (int partition = 0; partition < (1 << max_order); ++partition) {
+    const int end = ((partition + 1) * partition_size) - order;
+    uint64_t sum = 0;
+    for (; index < end; ++index) {
+      const int32_t value = residual[index];
+      sum += (static_cast<uint32_t>(value) << 1) ^
+             static_cast<uint32_t>(value >> 31);
+    }
+    sums[partition] = sum;
+  }
+  coding->bits = UINT64_MAX;
+  int parameters[1 << kMaxPartitionOrder];
+  for (int partition_order = max_order; partition_order >= 0;
+       --partition_order) {
+    const int partition_count = 1 << partition_order;
+    const int64_t size = block_size >> partition_order;
+    // Method and partition order.
+    uint64_t bits = 2 + 4;
+    for (int partition = 0; partition < partition_count; ++partition) {
+      const int64_t count = (partition == 0) ? (size - order) : size;
+      uint64_t partition_bits;
+      parameters[partition] =
+          BestRiceParameter(sums[partition], count, &partition_bits);
+      bits += 4 + partition_bits;
+    }
+    if (bits < coding->bits) {
+      coding->bits = bits;
+      coding->partition_order = partition_order;
+      memcpy(coding->parameters, parameters,
+             partition_count * sizeof(parameters[0]));
+    }
+    for (int partition = 0; partition < (partition_count / 2); ++partition) {
+      sums[partition] = sums[partition * 2] + sums[(partition * 2) + 1];
+    }
+  }
+}
+
+void WriteResidual(const int32_t* residual, int block_size, int order,
+                   const RiceCoding& coding, BitWriter* writer) {
+  writer->Write(0, 2);
+  writer->Write(coding.partition_order, 4);
+  const int partition_count = 1 << coding.partition_order;
+  const int partition_size = block_size >> coding.partition_order;
+  int index = 0;
+  for (int partition = 0; partition < partition_count; ++partition) {
+    const int parameter = coding.parameters[partition];
+    writer->Write(parameter, 4);
+    const int end = ((partition + 1) * partition_size) - order;
+    for (; index < end; ++index) {
+      writer->WriteRice(residual[index], parameter);
+    }
+  }
+}
+
+// Fills lpc[order - 1] with the coefficients of the best predictor of each
+// order, found with the Levinson-Durbin recursion over a Welch-windowed copy
+// of the block, and errors[order - 1] with its prediction error. Returns how
+// many orders could be computed.
+int ComputeLpcCoefficients(const int16_t* samples, int count, float* windowed,
+                           double lpc[kMaxLpcOrder][kMaxLpcOrder],
+                           double* errors) {
+  const float center = (count - 1) * 0.5f;
+  const float inverse_half_width = 2.0f / (count + 1);
+  for (int i = 0; i < count; ++i) {
+    const float distance = (i - center) * inverse_half_width;
+    windowed[i] = samples[i] * (1.0f - (distance * distance));
+  }
+  // Eight separate partial sums per lag let the compiler use vector
+  // instructions, where one running total would be a chain of dependent adds.
+  double autocorrelation[kMaxLpcOrder + 1];
+  for (int lag = 0; lag <= kMaxLpcOrder; ++lag) {
+    float partial[8] = {};
+    int i = lag;
+    for (; (i + 8) <= count; i += 8) {
+      for (int k = 0; k < 8; ++k) {
+        partial[k] += windowed[i + k] * windowed[i + k - lag];
+      }
+    }
+    double total = 0.0;
+    for (; i < count; ++i) {
+      total += windowed[i] * windowed[i - lag];
+    }
+    for (int k = 0; k < 8; ++k) {
+      total += partial[k];
+    }
+    autocorrelation[lag] = total;
+  }
+  if (autocorrelation[0] == 0.0) {
+    return 0;
+  }
+  double current[kMaxLpcOrder] = {};
+  double error = autocorrelation[0];
+  const int max_order = std::min(kMaxLpcOrder, count - 1);
+  for (int order = 1; order <= max_order; ++order) {
+    double reflection = autocorrelation[order];
+    for (int j = 1; j < order; ++j) {
+      reflection -= current[j - 1] * autocorrelation[order - j];
+    }
+    reflection /= error;
+    double next[kMaxLpcOrder];
+    for (int j = 1; j < order; ++j) {
+      next[j - 1] = current[j - 1] - (reflection * current[order - j - 1]);
+    }
+    next[order - 1] = reflection;
+    memcpy(current, next, order * sizeof(double));
+    memcpy(lpc[order - 1], current, order * sizeof(double));
+    error *= (1.0 - (reflection * reflection));
+    errors[order - 1] = error;
+    if (error <= 0.0) {
+      return order;
+    }
+  }
+  return max_order;
+}
+
+// Guesses which LPC order will code smallest, from the prediction errors. A
+// Laplacian residual with this variance costs about half the log of it in bits
+// per sample, and each order adds its coefficient and warm-up sample.
+int EstimateBestLpcOrder(const double* errors, int order_count,
+                         int block_size) {
+  const double error_scale = 0.5 / block_size;
+  int best_order = 1;
+  double best_bits = HUGE_VAL;
+  for (int order = 1; order <= order_count; ++order) {
+    const double scaled_error = errors[order - 1] * error_scale;
+    const double bits_per_sample =
+        (scaled_error > 1.0) ? (0.5 * log2(scaled_error)) : 0.0;
+    const double bits = ((block_size - order) * bits_per_sample) +
+                        (order * (kBitsPerSample + kLpcPrecision));
+    if (bits < best_bits) {
+      best_bits = bits;
+      best_order = order;
+    }
+  }
+  return best_order;
+}
+
+// Picks the fixed polynomial order with the smallest total absolute residual,
+// in one pass over the block.
+int EstimateBestFixedOrder(const int16_t* samples, int block_size) {
+  if (block_size <= kFlacMaxFixedOrder) {
+    return 0;
+  }
+  uint64_t totals[kFlacMaxFixedOrder + 1] = {};
+  for (int i = kFlacMaxFixedOrder; i < block_size; ++i) {
+    const int32_t error0 = samples[i];
+    const int32_t error1 = error0 - samples[i - 1];
+    const int32_t error2 = error1 - (samples[i - 1] - samples[i - 2]);
+    const int32_t error3 =
+        error2 - (samples[i - 1] - (2 * samples[i - 2]) + samples[i - 3]);
+    const int32_t error4 =
+        error3 - (samples[i - 1] - (3 * samples[i - 2]) +
+                  (3 * samples[i - 3]) - samples[i - 4]);
+    totals[0] += abs(error0);
+    totals[1] += abs(error1);
+    totals[2] += abs(error2);
+    totals[3] += abs(error3);
+    totals[4] += abs(error4);
+  }
+  return std::min_element(totals, totals + kFlacMaxFixedOrder + 1) - totals;
+}
+
+// Rounds the coefficients to kLpcPrecision-bit integers with a shared shift,
+// carrying each rounding error into the next coefficient. Returns false if the
+// coefficients are too large to represent.
+bool QuantizeLpcCoefficients(const double* lpc, int order,
+                             int32_t* coefficients, int* shift) {
+  double largest = 0.0;
+  for (int j = 0; j < order; ++j) {
+    largest = std::max(largest, fabs(lpc[j]));
+  }
+  if (largest <= 0.0) {
+    return false;
+  }
+  int exponent;
+  frexp(largest, &exponent);
+  *shift = std::min(kMaxLpcShift, kLpcPrecision - exponent - 1);
+  if (*shift < 0) {
+    return false;
+  }
+  const int32_t max_value = (1 << (kLpcPrecision - 1)) - 1;
+  const int32_t min_value = -(1 << (kLpcPrecision - 1));
+  double carried_error = 0.0;
+  for (int j = 0; j < order; ++j) {
+    carried_error += lpc[j] * (1 << *shift);
+    const int32_t rounded = lround(carried_error);
+    coefficients[j] = std::max(min_value, std::min(max_value, rounded));
+    carried_error -= coefficients[j];
+  }
+  return true;
+}
+
+// The fixed predictors are polynomials, which the LPC kernel can run with a
+// shift of zero.
+constexpr int32_t kFixedCoefficients[kFlacMaxFixedOrder + 1]
+                                    [kFlacMaxFixedOrder] = {
+    {0, 0, 0, 0}, {1, 0, 0, 0}, {2, -1, 0, 0}, {3, -3, 1, 0}, {4, -6, 4, -1},
+};
+
+struct Scratch {
+  int16_t* channel;
+  float* windowed;
+  int32_t* residual;
+  int32_t* best_residual;
+};
+
+// Encodes one channel of one block, using whichever subframe type is smallest.
+void WriteSubframe(const int16_t* samples, int block_size, Scratch* scratch,
+                   BitWriter* writer) {
+  bool is_constant = true;
+  for (int i = 1; i < block_size; ++i) {
+    if (samples[i] != samples[0]) {
+      is_constant = false;
+      break;
+    }
+  }
+  if (is_constant) {
+    writer->Write(kFlacSubframeConstant << 1, 8);
+    writer->Write(samples[0], kBitsPerSample);
+    return;
+  }
+
+  // Only the most promising fixed and LPC predictors are tried in full, since
+  // each one means a pass to compute its residual and choose the Rice coding.
+  const AudioKernels& kernels = GetAudioKernels();
+  uint64_t best_bits = 8 + (uint64_t(block_size) * kBitsPerSample);
+  int best_type = kFlacSubframeVerbatim;
+  int best_order = 0;
+  int32_t best_coefficients[kMaxLpcOrder];
+  int best_shift = 0;
+  RiceCoding best_coding;
+  RiceCoding coding;
+  const int fixed_order = EstimateBestFixedOrder(samples, block_size);
+  kernels.lpc_residual(samples, block_size, kFixedCoefficients[fixed_order],
+                       fixed_order, 0, scratch->residual);
+  ChooseRiceCoding(scratch->residual, block_size, fixed_order, &coding);
+  const uint64_t fixed_bits = 8 + (fixed_order * kBitsPerSample) + coding.bits;
+  if (fixed_bits < best_bits) {
+    best_bits = fixed_bits;
+    best_type = kFlacSubframeFixed;
+    best_order = fixed_order;
+    best_coding = coding;
+    std::swap(scratch->residual, scratch->best_residual);
+  }
+
+  double lpc[kMaxLpcOrder][kMaxLpcOrder];
+  double errors[kMaxLpcOrder];
+  const int lpc_orders = ComputeLpcCoefficients(samples, block_size,
+                                                scratch->windowed, lpc, errors);
+  int32_t coefficients[kMaxLpcOrder];
+  int shift;
+  const int lpc_order =
+      (lpc_orders > 0) ? EstimateBestLpcOrder(errors, lpc_orders, block_size)
+                       : 0;
+  if ((lpc_order > 0) && QuantizeLpcCoefficients(lpc[lpc_order - 1], lpc_order,
+                                                 coefficients, &shift)) {
+    kernels.lpc_residual(samples, block_size, coefficients, lpc_order, shift,
+                         scratch->residual);
+    ChooseRiceCoding(scratch->residual, block_size, lpc_order, &coding);
+    const uint64_t lpc_bits = 8 + (lpc_order * kBitsPerSample) + 4 + 5 +
+                              (lpc_order * kLpcPrecision) + coding.bits;
+    if (lpc_bits < best_bits) {
+      best_bits = lpc_bits;
+      best_type = kFlacSubframeLpc;
+      best_order = lpc_order;
+      memcpy(best_coefficients, coefficients, lpc_order * sizeof(int32_t));
+      best_shift = shift;
+      best_coding = coding;
+      std::swap(scratch->residual, scratch->best_residual);
+    }
+  }
+
+  if (best_type == kFlacSubframeVerbatim) {
+    writer->Write(kFlacSubframeVerbatim << 1, 8);
+    for (int i = 0; i < block_size; ++i) {
+      writer->Write(samples[i], kBitsPerSample);
+    }
+    return;
+  }
+  if (best_type == kFlacSubframeFixed) {
+    writer->Write((kFlacSubframeFixed + best_order) << 1, 8);
+  } else {
+    writer->Write((kFlacSubframeLpc + best_order - 1) << 1, 8);
+  }
+  for (int i = 0; i < best_order; ++i) {
+    writer->Write(samples[i], kBitsPerSample);
+  }
+  if (best_type == kFlacSubframeLpc) {
+    writer->Write(kLpcPrecision - 1, 4);
+    writer->Write(best_shift, 5);
+    for (int j = 0; j < best_order; ++j) {
+      writer->Write(best_coefficients[j], kLpcPrecision);
+    }
+  }
+  WriteResidual(scratch->best_residual, block_size, best_order, best_coding,
+                writer);
+}
+
+// Frame numbers use the same variable-length scheme as UTF-8.
+void WriteFrameNumber(uint32_t number, BitWriter* writer) {
+  if (number < 0x80) {
+    writer->Write(number, 8);
+    return;
+  }
+  int extra_bytes = 1;
+  while ((extra_bytes < 5) && (number >= (1u << (6 + (5 * extra_bytes))))) {
+    ++extra_bytes;
+  }
+  const uint32_t lead_mask = (0xff00 >> (extra_bytes + 1)) & 0xff;
+  writer->Write(lead_mask | (number >> (6 * extra_bytes)), 8);
+  for (int i = extra_bytes - 1; i >= 0; --i) {
+    writer->Write(0x80 | ((number >> (6 * i)) & 0x3f), 8);
+  }
+}
+
+void WriteStreamInfo(uint32_t sample_rate, int channel_count,
+                     int64_t frame_count, uint32_t min_frame_size,
+                     uint32_t max_frame_size, BitWriter* writer) {
+  for (int i = 0; i < kFlacMarkerSize; ++i) {
+    writer->Write(kFlacMarker[i], 8);
+  }
+  // The last metadata block, of type STREAMINFO.
+  writer->Write(0x80 | kFlacStreamInfoType, 8);
+  writer->Write(kFlacStreamInfoSize, 24);
+  writer->Write(kBlockSize, 16);
+  writer->Write(kBlockSize, 16);
+  writer->Write(min_frame_size, 24);
+  writer->Write(max_frame_size, 24);
+  writer->Write(sample_rate, 20);
+  writer->Write(channel_count - 1, 3);
+  writer->Write(kBitsPerSample - 1, 5);
+  writer->Write(frame_count >> 32, 4);
+  writer->Write(frame_count, 32);
+  // An all-zero MD5 signature means it wasn't computed.
+  for (int i = 0; i < 4; ++i) {
+    writer->Write(0, 32);
+  }
+}
+
+}  // namespace
+
+size_t FlacMaxSize(int channel_count, int64_t frame_count) {
+  const int64_t block_count = (frame_count + kBlockSize - 1) / kBlockSize;
+  // Each frame has a header, padding, a CRC, and for each channel a subframe
+  // header and the samples verbatim.
+  const int64_t frame_overhead = kMaxFrameHeaderSize + 1 + 2 + channel_count;
+  return kFlacMarkerSize + kFlacMetadataHeaderSize + kFlacStreamInfoSize +
+         (block_count * frame_overhead) +
+         (frame_count * channel_count * (kBitsPerSample / 8));
+}
+
+Status EncodeLin16AsFlac(const int16_t* samples, uint32_t sample_rate,
+                         int channel_count, int64_t frame_count, Arena* arena,
+                         char* output, size_t output_size,
+                         size_t* encoded_size) {
+  if ((sample_rate == 0) || (sample_rate >= (1 << 20))) {
+    return errors::InvalidArgument("FLAC can't store a sample rate of ",
+                                   sample_rate);
+  }
+  if ((channel_count < 1) || (channel_count > 8)) {
+    return errors::InvalidArgument("FLAC can't store ", channel_count,
+                                   " channels");
+  }
+  if (output_size < FlacMaxSize(channel_count, frame_count)) {
+    return errors::InvalidArgument("FLAC output buffer of ", output_size,
+                                   " bytes is too small");
+  }
+  Scratch scratch;
+  scratch.channel = arena->AllocateArray<int16_t>(kBlockSize);
+  scratch.windowed = arena->AllocateArray<float>(kBlockSize);
+  scratch.residual = arena->AllocateArray<int32_t>(kBlockSize);
+  scratch.best_residual = arena->AllocateArray<int32_t>(kBlockSize);
+  TF_RETURN_IF_ERROR(arena->status());
+
+  uint8_t* data = reinterpret_cast<uint8_t*>(output);
+  BitWriter writer(data, output_size);
+  WriteStreamInfo(sample_rate, channel_count, frame_count, 0, 0, &writer);
+  writer.Align();
+  uint32_t min_frame_size = UINT32_MAX;
+  uint32_t max_frame_size = 0;
+  uint32_t frame_number = 0;
+  for (int64_t start = 0; start < frame_count; start += kBlockSize) {
+    const int block_size = std::min<int64_t>(kBlockSize, frame_count - start);
+    const size_t frame_start = writer.size();
+    writer.Write(kFlacFrameSync, 14);
+    // Reserved bit, then fixed block sizes.
+    writer.Write(0, 2);
+    if (block_size == kBlockSize) {
+      writer.Write(12, 4);
+    } else if (block_size <= 256) {
+      writer.Write(6, 4);
+    } else {
+      writer.Write(7, 4);
+    }
+    // The sample rate is taken from STREAMINFO.
+    writer.Write(0, 4);
+    writer.Write(channel_count - 1, 4);
+    // 16 bits per sample, then a reserved bit.
+    writer.Write(4, 3);
+    writer.Write(0, 1);
+    WriteFrameNumber(frame_number, &writer);
+    if (block_size != kBlockSize) {
+      writer.Write(block_size - 1, (block_size <= 256) ? 8 : 16);
+    }
+    writer.Align();
+    if (writer.overflowed()) {
+      break;
+    }
+    writer.Write(FlacCrc8(data + frame_start, writer.size() - frame_start), 8);
+
+    for (int channel = 0; channel < channel_count; ++channel) {
+      const int16_t* channel_samples = samples + (start * channel_count);
+      if (channel_count != 1) {
+        for (int i = 0; i < block_size; ++i) {
+          scratch.channel[i] = samples[((start + i) * channel_count) + channel];
+        }
+        channel_samples = scratch.channel;
+      }
+      WriteSubframe(channel_samples, block_size, &scratch, &writer);
+    }
+    writer.Align();
+    if (writer.overflowed()) {
+      break;
+    }
+    writer.Write(FlacCrc16(data + frame_start, writer.size() - frame_start),
+                 16);
+    writer.Align();
+    const uint32_t frame_size = writer.size() - frame_start;
+    min_frame_size = std::min(min_frame_size, frame_size);
+    max_frame_size = std::max(max_frame_size, frame_size);
+    ++frame_number;
+  }
+  if (writer.overflowed()) {
+    return errors::Internal("FLAC encoding overran its buffer");
+  }
+  if (max_frame_size == 0) {
+    min_frame_size = 0;
+  }
+  // Now the frame sizes are known, go back and fill them in.
+  BitWriter header_writer(data, writer.size());
+  WriteStreamInfo(sample_rate, channel_count, frame_count, min_frame_size,
+                  max_frame_size, &header_writer);
+  header_writer.Align();
+  *encoded_size = writer.size();
+  return Status::OK();
+}
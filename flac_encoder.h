@@ -0,0 +1,42 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// A small FLAC encoder for the trimmed clips, with no outside dependencies.
+
+#ifndef FLAC_ENCODER_H_
+#define FLAC_ENCODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "status.h"
+
+// Returns the most bytes EncodeLin16AsFlac() can produce for audio of this
+// shape. No frame is ever written larger than its uncompressed size.
+size_t FlacMaxSize(int channel_count, int64_t frame_count);
+
+// Compresses interleaved 16-bit samples into a FLAC stream, written to a
+// caller-owned buffer of at least FlacMaxSize() bytes. Each block of samples
+// is predicted with whichever of the fixed polynomials or a quantized LPC
+// filter gives the smallest Rice-coded residual. Channels are coded
+// independently, and the MD5 signature is left empty, which the format allows.
+// Scratch space comes from the arena.
+Status EncodeLin16AsFlac(const int16_t* samples, uint32_t sample_rate,
+                         int channel_count, int64_t frame_count, Arena* arena,
+                         char* output, size_t output_size,
+                         size_t* encoded_size);
+
+#endif  // FLAC_ENCODER_H_
@@ -0,0 +1,79 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "flac_format.h"
+
+namespace {
+
+// The CRC-16 uses slicing-by-8, where crc16[k] gives the effect of a byte
+// followed by k zero bytes, so eight input bytes can be folded in at once.
+struct CrcTables {
+  uint8_t crc8[256];
+  uint16_t crc16[8][256];
+
+  CrcTables() {
+    for (int i = 0; i < 256; ++i) {
+      uint8_t crc8_value = i;
+      uint16_t crc16_value = i << 8;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc8_value = (crc8_value & 0x80) ? ((crc8_value << 1) ^ 0x07)
+                                         : (crc8_value << 1);
+        crc16_value = (crc16_value & 0x8000) ? ((crc16_value << 1) ^ 0x8005)
+                                             : (crc16_value << 1);
+      }
+      crc8[i] = crc8_value;
+      crc16[0][i] = crc16_value;
+    }
+    for (int k = 1; k < 8; ++k) {
+      for (int i = 0; i < 256; ++i) {
+        const uint16_t previous = crc16[k - 1][i];
+        crc16[k][i] = (previous << 8) ^ crc16[0][previous >> 8];
+      }
+    }
+  }
+};
+
+const CrcTables& GetCrcTables() {
+  static const CrcTables tables;
+  return tables;
+}
+
+}  // namespace
+
+uint8_t FlacCrc8(const uint8_t* data, size_t size) {
+  const CrcTables& tables = GetCrcTables();
+  uint8_t crc = 0;
+  for (size_t i = 0; i < size; ++i) {
+    crc = tables.crc8[crc ^ data[i]];
+  }
+  return crc;
+}
+
+uint16_t FlacCrc16(const uint8_t* data, size_t size) {
+  const CrcTables& tables = GetCrcTables();
+  uint16_t crc = 0;
+  size_t i = 0;
+  for (; (i + 8) <= size; i += 8) {
+    const uint16_t first = crc ^ ((data[i] << 8) | data[i + 1]);
+    crc = tables.crc16[7][first >> 8] ^ tables.crc16[6][first & 0xff] ^
+          tables.crc16[5][data[i + 2]] ^ tables.crc16[4][data[i + 3]] ^
+          tables.crc16[3][data[i + 4]] ^ tables.crc16[2][data[i + 5]] ^
+          tables.crc16[1][data[i + 6]] ^ tables.crc16[0][data[i + 7]];
+  }
+  for (; i < size; ++i) {
+    crc = (crc << 8) ^ tables.crc16[0][(crc >> 8) ^ data[i]];
+  }
+  return crc;
+}
@@ -0,0 +1,52 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Pieces of the FLAC format shared by the encoder and decoder.
+
+#ifndef FLAC_FORMAT_H_
+#define FLAC_FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Every stream starts with "fLaC", followed by metadata blocks.
+constexpr char kFlacMarker[] = "fLaC";
+constexpr int kFlacMarkerSize = 4;
+constexpr int kFlacMetadataHeaderSize = 4;
+constexpr int kFlacStreamInfoSize = 34;
+constexpr int kFlacStreamInfoType = 0;
+
+// The first 14 bits of every frame header.
+constexpr uint32_t kFlacFrameSync = 0x3ffe;
+
+// The subframe type codes, before the order is added.
+constexpr int kFlacSubframeConstant = 0;
+constexpr int kFlacSubframeVerbatim = 1;
+constexpr int kFlacSubframeFixed = 8;
+constexpr int kFlacSubframeLpc = 32;
+
+constexpr int kFlacMaxFixedOrder = 4;
+constexpr int kFlacMaxLpcOrder = 32;
+// Rice parameters are four bits, with the all-ones value escaping to raw
+// binary residuals.
+constexpr int kFlacRiceEscape = 15;
+
+// The checksum at the end of each frame header, polynomial 0x07.
+uint8_t FlacCrc8(const uint8_t* data, size_t size);
+
+// The checksum at the end of each frame, polynomial 0x8005.
+uint16_t FlacCrc16(const uint8_t* data, size_t size);
+
+#endif  // FLAC_FORMAT_H_
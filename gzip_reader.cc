@@ -0,0 +1,585 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "gzip_reader.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace {
+
+// Deflate can refer back this far, and no match is longer than kMaxMatch.
+constexpr int64_t kWindowSize = 32768;
+constexpr int64_t kMaxMatch = 258;
+// How much is inflated at a time between copies out to the caller.
+constexpr int64_t kChunkSize = 128 * 1024;
+constexpr int64_t kWindowCapacity = kWindowSize + kChunkSize + kMaxMatch;
+
+// Codes up to this long are decoded with a single table lookup.
+constexpr int kFastBits = 10;
+constexpr int kMaxCodeLength = 15;
+constexpr int kLiteralCodeCount = 288;
+constexpr int kDistanceCodeCount = 30;
+
+constexpr uint8_t kGzipTextFlag = 0x01;
+constexpr uint8_t kGzipHeaderCrcFlag = 0x02;
+constexpr uint8_t kGzipExtraFlag = 0x04;
+constexpr uint8_t kGzipNameFlag = 0x08;
+constexpr uint8_t kGzipCommentFlag = 0x10;
+constexpr uint8_t kGzipDeflateMethod = 8;
+
+const uint16_t kLengthBase[29] = {3,  4,  5,  6,   7,   8,   9,   10,  11, 13,
+                                  15, 17, 19, 23,  27,  31,  35,  43,  51, 59,
+                                  67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                  1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                  4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t kDistanceBase[30] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+const uint8_t kDistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                    4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                    9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+// The order code length code lengths are stored in.
+const uint8_t kCodeLengthOrder[19] = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                      11, 4,  12, 3, 13, 2, 14, 1, 15};
+
+// Tables for slicing-by-8 CRC-32, as used by gzip.
+struct Crc32Tables {
+  uint32_t crc[8][256];
+
+  Crc32Tables() {
+    for (int i = 0; i < 256; ++i) {
+      uint32_t value = i;
+      for (int bit = 0; bit < 8; ++bit) {
+        value = (value & 1) ? ((value >> 1) ^ 0xedb88320) : (value >> 1);
+      }
+      crc[0][i] = value;
+    }
+    for (int k = 1; k < 8; ++k) {
+      for (int i = 0; i < 256; ++i) {
+        const uint32_t previous = crc[k - 1][i];
+        crc[k][i] = (previous >> 8) ^ crc[0][previous & 0xff];
+      }
+    }
+  }
+};
+
+const Crc32Tables& GetCrc32Tables() {
+  static const Crc32Tables tables;
+  return tables;
+}
+
+uint32_t UpdateCrc32(uint32_t crc, const uint8_t* data, size_t size) {
+  const Crc32Tables& tables = GetCrc32Tables();
+  crc = ~crc;
+  size_t i = 0;
+  for (; (i + 8) <= size; i += 8) {
+    uint32_t low;
+    uint32_t high;
+    memcpy(&low, data + i, sizeof(low));
+    memcpy(&high, data + i + 4, sizeof(high));
+    low ^= crc;
+    crc = tables.crc[7][low & 0xff] ^ tables.crc[6][(low >> 8) & 0xff] ^
+          tables.crc[5][(low >> 16) & 0xff] ^ tables.crc[4][low >> 24] ^
+          tables.crc[3][high & 0xff] ^ tables.crc[2][(high >> 8) & 0xff] ^
+          tables.crc[1][(high >> 16) & 0xff] ^ tables.crc[0][high >> 24];
+  }
+  for (; i < size; ++i) {
+    crc = (crc >> 8) ^ tables.crc[0][(crc ^ data[i]) & 0xff];
+  }
+  return ~crc;
+}
+
+uint32_t ReverseBits(uint32_t code, int length) {
+  uint32_t reversed = 0;
+  for (int i = 0; i < length; ++i) {
+    reversed = (reversed << 1) | ((code >> i) & 1);
+  }
+  return reversed;
+}
+
+}  // namespace
+
+// A canonical Huffman code. Codes of up to kFastBits are looked up directly
+// by the next input bits, with entries of symbol << 4 | length, and zero for
+// longer codes, which are walked a bit at a time as in zlib's puff.
+struct GzipReader::HuffmanTable {
+  uint16_t fast[1 << kFastBits];
+  uint16_t counts[kMaxCodeLength + 1];
+  uint16_t symbols[kLiteralCodeCount];
+};
+
+namespace {
+
+// Incomplete codes are allowed, since a block with a single distance code
+// needs one, but over-subscribed ones aren't.
+template <class Table>
+Status BuildHuffmanTable(const uint8_t* lengths, int count, Table* table) {
+  memset(table->counts, 0, sizeof(table->counts));
+  for (int i = 0; i < count; ++i) {
+    ++table->counts[lengths[i]];
+  }
+  table->counts[0] = 0;
+  int left = 1;
+  for (int length = 1; length <= kMaxCodeLength; ++length) {
+    left = (left << 1) - table->counts[length];
+    if (left < 0) {
+      return errors::DataLoss("Over-subscribed Huffman code in gzip data");
+    }
+  }
+  uint16_t offsets[kMaxCodeLength + 1];
+  offsets[1] = 0;
+  for (int length = 1; length < kMaxCodeLength; ++length) {
+    offsets[length + 1] = offsets[length] + table->counts[length];
+  }
+  for (int i = 0; i < count; ++i) {
+    if (lengths[i] != 0) {
+      table->symbols[offsets[lengths[i]]++] = i;
+    }
+  }
+  memset(table->fast, 0, sizeof(table->fast));
+  uint32_t code = 0;
+  int index = 0;
+  for (int length = 1; length <= kFastBits; ++length) {
+    for (int k = 0; k < table->counts[length]; ++k) {
+      const uint16_t entry = (table->symbols[index] << 4) | length;
+      for (uint32_t r = ReverseBits(code, length); r < (1u << kFastBits);
+           r += (1u << length)) {
+        table->fast[r] = entry;
+      }
+      ++index;
+      ++code;
+    }
+    code <<= 1;
+  }
+  return Status::OK();
+}
+
+}  // namespace
+
+GzipReader::GzipReader(const uint8_t* data, size_t size, Arena* arena)
+    : data_(data),
+      size_(size),
+      arena_(arena),
+      position_(0),
+      bits_(0),
+      bit_count_(0),
+      state_(State::kMemberHeader),
+      final_block_(false),
+      stored_left_(0),
+      literal_table_(nullptr),
+      distance_table_(nullptr),
+      window_(nullptr),
+      window_end_(0),
+      read_position_(0),
+      member_start_(0),
+      crc_position_(0),
+      crc_(0),
+      member_size_(0) {}
+
+void GzipReader::Refill() {
+  if ((position_ + sizeof(uint64_t)) <= size_) {
+    uint64_t word;
+    memcpy(&word, data_ + position_, sizeof(word));
+    bits_ |= word << bit_count_;
+    position_ += (63 - bit_count_) >> 3;
+    bit_count_ |= 56;
+    return;
+  }
+  while (bit_count_ <= 56) {
+    const uint64_t byte = (position_ < size_) ? data_[position_] : 0;
+    bits_ |= byte << bit_count_;
+    ++position_;
+    bit_count_ += 8;
+  }
+}
+
+uint32_t GzipReader::TakeBits(int count) {
+  const uint32_t value = bits_ & ((1ull << count) - 1);
+  bits_ >>= count;
+  bit_count_ -= count;
+  return value;
+}
+
+int GzipReader::DecodeSymbol(const HuffmanTable& table) {
+  const uint16_t entry = table.fast[bits_ & ((1 << kFastBits) - 1)];
+  if (entry != 0) {
+    TakeBits(entry & 15);
+    return entry >> 4;
+  }
+  int code = 0;
+  int first = 0;
+  int index = 0;
+  for (int length = 1; length <= kMaxCodeLength; ++length) {
+    code |= (bits_ >> (length - 1)) & 1;
+    const int count = table.counts[length];
+    if ((code - first) < count) {
+      TakeBits(length);
+      return table.symbols[index + (code - first)];
+    }
+    index += count;
+    first = (first + count) << 1;
+    code <<= 1;
+  }
+  return -1;
+}
+
+void GzipReader::AlignToByte() { TakeBits(bit_count_ & 7); }
+
+Status GzipReader::Corrupt(const char* what) const {
+  if (BytesConsumed() > size_) {
+    return errors::DataLoss("gzip data is truncated");
+  }
+  return errors::DataLoss(what, " in gzip data");
+}
+
+Status GzipReader::Read(uint8_t* data, int64_t length, int64_t* bytes_read) {
+  *bytes_read = 0;
+  if (window_ == nullptr) {
+    uint8_t* window = arena_->AllocateArray<uint8_t>(kWindowCapacity);
+    literal_table_ = arena_->AllocateArray<HuffmanTable>(1);
+    distance_table_ = arena_->AllocateArray<HuffmanTable>(1);
+    TF_RETURN_IF_ERROR(arena_->status());
+    // Only set once the tables are, since it marks them as ready.
+    window_ = window;
+  }
+  while (*bytes_read < length) {
+    if (read_position_ == window_end_) {
+      if (state_ == State::kDone) {
+        break;
+      }
+      TF_RETURN_IF_ERROR(Inflate());
+      continue;
+    }
+    const int64_t count =
+        std::min(length - *bytes_read, window_end_ - read_position_);
+    memcpy(data + *bytes_read, window_ + read_position_, count);
+    read_position_ += count;
+    *bytes_read += count;
+  }
+  return Status::OK();
+}
+
+Status GzipReader::Inflate() {
+  // Everything has been read, so only the history has to be kept.
+  if (window_end_ > kWindowSize) {
+    const int64_t shift = window_end_ - kWindowSize;
+    memmove(window_, window_ + shift, kWindowSize);
+    window_end_ = kWindowSize;
+    read_position_ = kWindowSize;
+    crc_position_ = kWindowSize;
+    member_start_ = std::max<int64_t>(0, member_start_ - shift);
+  }
+  const int64_t target = window_end_ + kChunkSize;
+  while ((window_end_ < target) && (state_ != State::kDone)) {
+    switch (state_) {
+      case State::kMemberHeader:
+        TF_RETURN_IF_ERROR(ReadMemberHeader());
+        break;
+      case State::kBlockHeader:
+        TF_RETURN_IF_ERROR(ReadBlockHeader());
+        break;
+      case State::kStored:
+        TF_RETURN_IF_ERROR(CopyStored(target));
+        break;
+      case State::kHuffman:
+        TF_RETURN_IF_ERROR(InflateHuffman(target));
+        break;
+      case State::kMemberTrailer:
+        TF_RETURN_IF_ERROR(ReadMemberTrailer());
+        break;
+      case State::kDone:
+        break;
+    }
+    if (BytesConsumed() > size_) {
+      return errors::DataLoss("gzip data is truncated");
+    }
+  }
+  crc_ = UpdateCrc32(crc_, window_ + crc_position_,
+                     window_end_ - crc_position_);
+  member_size_ += window_end_ - crc_position_;
+  crc_position_ = window_end_;
+  return Status::OK();
+}
+
+Status GzipReader::ReadMemberHeader() {
+  uint8_t header[10];
+  for (int i = 0; i < 10; ++i) {
+    Refill();
+    header[i] = TakeBits(8);
+  }
+  if (memcmp(header, kGzipMarker, kGzipMarkerSize) != 0) {
+    return errors::InvalidArgument("Missing gzip marker");
+  }
+  if (header[2] != kGzipDeflateMethod) {
+    return errors::Unimplemented("Unknown gzip compression method ",
+                                 header[2]);
+  }
+  const uint8_t flags = header[3];
+  if ((flags & ~(kGzipTextFlag | kGzipHeaderCrcFlag | kGzipExtraFlag |
+                 kGzipNameFlag | kGzipCommentFlag)) != 0) {
+    return errors::DataLoss("Reserved gzip header flags are set");
+  }
+  if (flags & kGzipExtraFlag) {
+    Refill();
+    const uint32_t extra_size = TakeBits(16);
+    for (uint32_t i = 0; (i < extra_size) && (BytesConsumed() <= size_); ++i) {
+      Refill();
+      TakeBits(8);
+    }
+  }
+  for (const uint8_t string_flag : {kGzipNameFlag, kGzipCommentFlag}) {
+    if (flags & string_flag) {
+      // Past the end of the data the padding is zero, so this stops.
+      do {
+        Refill();
+      } while (TakeBits(8) != 0);
+    }
+  }
+  if (flags & kGzipHeaderCrcFlag) {
+    Refill();
+    TakeBits(16);
+  }
+  state_ = State::kBlockHeader;
+  member_start_ = window_end_;
+  crc_position_ = window_end_;
+  crc_ = 0;
+  member_size_ = 0;
+  return Status::OK();
+}
+
+Status GzipReader::ReadBlockHeader() {
+  Refill();
+  final_block_ = TakeBits(1);
+  const int type = TakeBits(2);
+  if (type == 0) {
+    AlignToByte();
+    Refill();
+    const uint32_t length = TakeBits(16);
+    const uint32_t inverse = TakeBits(16);
+    if ((length ^ 0xffff) != inverse) {
+      return Corrupt("Bad stored block length");
+    }
+    stored_left_ = length;
+    state_ = State::kStored;
+    return Status::OK();
+  }
+  if (type == 1) {
+    uint8_t lengths[kLiteralCodeCount + kDistanceCodeCount];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 256 - 144);
+    memset(lengths + 256, 7, 280 - 256);
+    memset(lengths + 280, 8, kLiteralCodeCount - 280);
+    memset(lengths + kLiteralCodeCount, 5, kDistanceCodeCount);
+    TF_RETURN_IF_ERROR(
+        BuildHuffmanTable(lengths, kLiteralCodeCount, literal_table_));
+    TF_RETURN_IF_ERROR(BuildHuffmanTable(lengths + kLiteralCodeCount,
+                                         kDistanceCodeCount, distance_table_));
+    state_ = State::kHuffman;
+    return Status::OK();
+  }
+  if (type == 2) {
+    TF_RETURN_IF_ERROR(ReadDynamicTables());
+    state_ = State::kHuffman;
+    return Status::OK();
+  }
+  return Corrupt("Reserved block type");
+}
+
+Status GzipReader::ReadDynamicTables() {
+  Refill();
+  const int literal_count = TakeBits(5) + 257;
+  const int distance_count = TakeBits(5) + 1;
+  const int code_length_count = TakeBits(4) + 4;
+  if ((literal_count > 286) || (distance_count > kDistanceCodeCount)) {
+    return Corrupt("Too many Huffman codes");
+  }
+  uint8_t code_lengths[19] = {};
+  for (int i = 0; i < code_length_count; ++i) {
+    Refill();
+    code_lengths[kCodeLengthOrder[i]] = TakeBits(3);
+  }
+  // The code length code only needs the long-code tables, but building it
+  // into the distance table saves a third one.
+  TF_RETURN_IF_ERROR(BuildHuffmanTable(code_lengths, 19, distance_table_));
+
+  uint8_t lengths[286 + kDistanceCodeCount];
+  const int total = literal_count + distance_count;
+  int index = 0;
+  while (index < total) {
+    Refill();
+    const int symbol = DecodeSymbol(*distance_table_);
+    if (symbol < 0) {
+      return Corrupt("Bad code length code");
+    }
+    if (symbol < 16) {
+      lengths[index++] = symbol;
+      continue;
+    }
+    uint8_t repeated = 0;
+    int repeat_count;
+    if (symbol == 16) {
+      if (index == 0) {
+        return Corrupt("Repeated code length with nothing before it");
+      }
+      repeated = lengths[index - 1];
+      repeat_count = 3 + TakeBits(2);
+    } else if (symbol == 17) {
+      repeat_count = 3 + TakeBits(3);
+    } else {
+      repeat_count = 11 + TakeBits(7);
+    }
+    if ((index + repeat_count) > total) {
+      return Corrupt("Code lengths run past the end");
+    }
+    memset(lengths + index, repeated, repeat_count);
+    index += repeat_count;
+  }
+  if (lengths[256] == 0) {
+    return Corrupt("Missing end of block code");
+  }
+  TF_RETURN_IF_ERROR(
+      BuildHuffmanTable(lengths, literal_count, literal_table_));
+  return BuildHuffmanTable(lengths + literal_count, distance_count,
+                           distance_table_);
+}
+
+Status GzipReader::CopyStored(int64_t target) {
+  // Hand back whole bytes still in the bit buffer, then copy straight from
+  // the input.
+  position_ -= bit_count_ >> 3;
+  bits_ = 0;
+  bit_count_ = 0;
+  const int64_t count = std::min(stored_left_, target - window_end_);
+  if ((position_ + count) > size_) {
+    return errors::DataLoss("gzip data is truncated");
+  }
+  memcpy(window_ + window_end_, data_ + position_, count);
+  position_ += count;
+  window_end_ += count;
+  stored_left_ -= count;
+  if (stored_left_ == 0) {
+    state_ = final_block_ ? State::kMemberTrailer : State::kBlockHeader;
+  }
+  return Status::OK();
+}
+
+Status GzipReader::InflateHuffman(int64_t target) {
+  uint8_t* const window = window_;
+  int64_t end = window_end_;
+  // Past the end of the data the bits are all zeros, which could decode to a
+  // whole chunk of junk before the truncation was noticed. A symbol with its
+  // extra bits and distance takes at most 48 bits, so how much input is left
+  // says how many can be decoded before it's worth looking again.
+  int64_t unchecked_symbols = 0;
+  while (end < target) {
+    if (unchecked_symbols == 0) {
+      const size_t consumed = BytesConsumed();
+      if (consumed > size_) {
+        break;
+      }
+      unchecked_symbols = ((size_ - consumed) / 6) + 1;
+    }
+    --unchecked_symbols;
+    // Enough for a length and distance with their extra bits.
+    Refill();
+    const int symbol = DecodeSymbol(*literal_table_);
+    if (symbol < 256) {
+      if (symbol < 0) {
+        window_end_ = end;
+        return Corrupt("Bad literal/length code");
+      }
+      window[end++] = symbol;
+      continue;
+    }
+    if (symbol == 256) {
+      state_ = final_block_ ? State::kMemberTrailer : State::kBlockHeader;
+      break;
+    }
+    const int length_code = symbol - 257;
+    if (length_code >= 29) {
+      window_end_ = end;
+      return Corrupt("Bad length code");
+    }
+    const int64_t length =
+        kLengthBase[length_code] + TakeBits(kLengthExtra[length_code]);
+    const int distance_code = DecodeSymbol(*distance_table_);
+    if ((distance_code < 0) || (distance_code >= kDistanceCodeCount)) {
+      window_end_ = end;
+      return Corrupt("Bad distance code");
+    }
+    const int64_t distance =
+        kDistanceBase[distance_code] + TakeBits(kDistanceExtra[distance_code]);
+    if (distance > (end - member_start_)) {
+      window_end_ = end;
+      return Corrupt("Distance too far back");
+    }
+    const uint8_t* from = window + end - distance;
+    uint8_t* to = window + end;
+    if (distance >= length) {
+      memcpy(to, from, length);
+    } else {
+      // Overlapping copies repeat the last distance bytes.
+      for (int64_t i = 0; i < length; ++i) {
+        to[i] = from[i];
+      }
+    }
+    end += length;
+  }
+  window_end_ = end;
+  return Status::OK();
+}
+
+Status GzipReader::ReadMemberTrailer() {
+  crc_ = UpdateCrc32(crc_, window_ + crc_position_,
+                     window_end_ - crc_position_);
+  member_size_ += window_end_ - crc_position_;
+  crc_position_ = window_end_;
+  AlignToByte();
+  Refill();
+  const uint32_t expected_crc = TakeBits(32);
+  Refill();
+  const uint32_t expected_size = TakeBits(32);
+  if (BytesConsumed() > size_) {
+    return errors::DataLoss("gzip data is truncated");
+  }
+  if (expected_crc != crc_) {
+    return errors::DataLoss("gzip CRC-32 mismatch");
+  }
+  if (expected_size != member_size_) {
+    return errors::DataLoss("gzip length mismatch");
+  }
+  // Another member may follow, or zeros that pad the file out to a block
+  // size, which gzip itself skips. Anything else is most likely a member
+  // whose header was damaged, so it's an error rather than a silently short
+  // stream.
+  const size_t next = BytesConsumed();
+  if (((next + kGzipMarkerSize) <= size_) &&
+      (memcmp(data_ + next, kGzipMarker, kGzipMarkerSize) == 0)) {
+    state_ = State::kMemberHeader;
+    return Status::OK();
+  }
+  for (size_t i = next; i < size_; ++i) {
+    if (data_[i] != 0) {
+      return errors::DataLoss("Unexpected data after gzip member at byte ",
+                              next);
+    }
+  }
+  state_ = State::kDone;
+  return Status::OK();
+}
@@ -0,0 +1,109 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// A streaming gzip decoder, with no outside dependencies.
+
+#ifndef GZIP_READER_H_
+#define GZIP_READER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "byte_reader.h"
+#include "status.h"
+
+constexpr char kGzipMarker[] = "\x1f\x8b";
+constexpr int kGzipMarkerSize = 2;
+
+// Inflates a gzip file held in memory a piece at a time, so its contents never
+// have to exist all at once. Only the 32KB of history that deflate can refer
+// back to is kept, plus the piece that's waiting to be read. Members that were
+// concatenated, as `cat a.gz b.gz` produces, come out as one stream, and each
+// one's CRC-32 and length are checked against its trailer. Zeros after the
+// last member are skipped, but anything else there is an error.
+//
+// Example usage:
+//
+// GzipReader gzip(data, size, &arena);
+// WavStreamReader reader(&gzip);
+// TF_RETURN_IF_ERROR(reader.ReadHeader());
+class GzipReader : public ByteReader {
+ public:
+  // The data must stay valid for as long as the reader is used. Buffers come
+  // from the arena on the first Read().
+  GzipReader(const uint8_t* data, size_t size, Arena* arena);
+
+  Status Read(uint8_t* data, int64_t length, int64_t* bytes_read) override;
+
+ private:
+  struct HuffmanTable;
+
+  enum class State {
+    kMemberHeader,
+    kBlockHeader,
+    kStored,
+    kHuffman,
+    kMemberTrailer,
+    kDone
+  };
+
+  // Tops the bit buffer up to at least 56 bits, with zeros past the end of
+  // the data.
+  void Refill();
+  uint32_t TakeBits(int count);
+  int DecodeSymbol(const HuffmanTable& table);
+  // Bytes of input used so far, which is more than size_ if the decoder has
+  // run off the end.
+  size_t BytesConsumed() const { return position_ - (bit_count_ >> 3); }
+  void AlignToByte();
+  Status Corrupt(const char* what) const;
+
+  // Decodes until kChunkSize more bytes are ready or the stream ends.
+  Status Inflate();
+  Status ReadMemberHeader();
+  Status ReadBlockHeader();
+  Status ReadDynamicTables();
+  Status CopyStored(int64_t target);
+  Status InflateHuffman(int64_t target);
+  Status ReadMemberTrailer();
+
+  const uint8_t* const data_;
+  const size_t size_;
+  Arena* const arena_;
+  size_t position_;
+  uint64_t bits_;
+  int bit_count_;
+
+  State state_;
+  bool final_block_;
+  int64_t stored_left_;
+  HuffmanTable* literal_table_;
+  HuffmanTable* distance_table_;
+
+  // Decoded bytes, with up to 32KB of history before read_position_ and the
+  // ones still to be read up to window_end_.
+  uint8_t* window_;
+  int64_t window_end_;
+  int64_t read_position_;
+  // Where the current member's output starts, since matches can't reach back
+  // before it, and how far its checksum has got.
+  int64_t member_start_;
+  int64_t crc_position_;
+  uint32_t crc_;
+  uint32_t member_size_;
+};
+
+#endif  // GZIP_READER_H_
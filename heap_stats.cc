@@ -0,0 +1,42 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "heap_stats.h"
+
+#include <stdlib.h>
+
+#include <new>
+
+namespace {
+
+thread_local int64_t heap_allocations = 0;
+
+}  // namespace
+
+int64_t ThreadHeapAllocations() { return heap_allocations; }
+
+// Replacements for the global allocation functions, which only add a
+// thread-local counter on top of malloc() and free(). The array and nothrow
+// versions all route through these by default.
+void* operator new(size_t size) {
+  ++heap_allocations;
+  void* result = malloc(size == 0 ? 1 : size);
+  if (result == nullptr) {
+    throw std::bad_alloc();
+  }
+  return result;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
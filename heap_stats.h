@@ -0,0 +1,27 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Counts heap allocations, so we can check that per-file work stays off the
+// system allocator.
+
+#ifndef HEAP_STATS_H_
+#define HEAP_STATS_H_
+
+#include <stdint.h>
+
+// Returns how many times operator new has been called on the current thread.
+int64_t ThreadHeapAllocations();
+
+#endif  // HEAP_STATS_H_
@@ -0,0 +1,197 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "kernels.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+// Defined in kernels_x86.cc.
+extern const AudioKernels kSse2Kernels;
+extern const AudioKernels kAvx2Kernels;
+extern const AudioKernels kAvx512Kernels;
+#define HAVE_X86_KERNELS 1
+#endif
+
+namespace {
+
+void DecodeLin16Scalar(const uint8_t* input, int64_t count, float* output) {
+  constexpr float kMultiplier = 1.0f / (1 << 15);
+  for (int64_t i = 0; i < count; ++i) {
+    int16_t value;
+    memcpy(&value, input + (i * sizeof(int16_t)), sizeof(value));
+    output[i] = value * kMultiplier;
+  }
+}
+
+void DownmixScalar(const float* input, int64_t frame_count, int channel_count,
+                   float* output) {
+  for (int64_t i = 0; i < frame_count; ++i) {
+    const int64_t frame_index = i * channel_count;
+    float total = 0.0f;
+    for (int c = 0; c < channel_count; ++c) {
+      total += input[frame_index + c];
+    }
+    output[i] = total / channel_count;
+  }
+}
+
+void VolumeFloatScalar(const float* input, int64_t count, float* output) {
+  for (int64_t i = 0; i < count; ++i) {
+    output[i] = fabsf(input[i]);
+  }
+}
+
+void VolumeInt16Scalar(const int16_t* input, int64_t count, float* output) {
+  constexpr float kMultiplier = 1.0f / (1 << 15);
+  for (int64_t i = 0; i < count; ++i) {
+    output[i] = fabsf(input[i] * kMultiplier);
+  }
+}
+
+void EncodeLin16Scalar(const float* input, int64_t count, char* output) {
+  constexpr float kMultiplier = 1.0f * (1 << 15);
+  for (int64_t i = 0; i < count; ++i) {
+    const int16_t value = std::min<float>(
+        std::max<float>(roundf(input[i] * kMultiplier), -32768.0f), 32767.0f);
+    memcpy(output + (i * sizeof(int16_t)), &value, sizeof(value));
+  }
+}
+
+void LpcResidualScalar(const int16_t* input, int64_t count,
+                       const int32_t* coefficients, int order, int shift,
+                       int32_t* residual) {
+  for (int64_t i = order; i < count; ++i) {
+    int32_t prediction = 0;
+    for (int j = 0; j < order; ++j) {
+      prediction += coefficients[j] * input[i - 1 - j];
+    }
+    residual[i - order] = input[i] - (prediction >> shift);
+  }
+}
+
+void FftStageScalar(float* real, float* imag, int64_t size, int64_t half,
+                    int64_t batch, const float* twiddle_real,
+                    const float* twiddle_imag) {
+  for (int64_t group = 0; group < size; group += (half * 2)) {
+    for (int64_t k = 0; k < half; ++k) {
+      float* a_real = real + ((group + k) * batch);
+      float* a_imag = imag + ((group + k) * batch);
+      float* b_real = a_real + (half * batch);
+      float* b_imag = a_imag + (half * batch);
+      const float w_real = twiddle_real[k];
+      const float w_imag = twiddle_imag[k];
+      for (int64_t j = 0; j < batch; ++j) {
+        const float t_real = (b_real[j] * w_real) - (b_imag[j] * w_imag);
+        const float t_imag = (b_real[j] * w_imag) + (b_imag[j] * w_real);
+        b_real[j] = a_real[j] - t_real;
+        b_imag[j] = a_imag[j] - t_imag;
+        a_real[j] = a_real[j] + t_real;
+        a_imag[j] = a_imag[j] + t_imag;
+      }
+    }
+  }
+}
+
+void SlideWindowBatchScalar(const double* deltas, int64_t stride,
+                            int64_t count, double first_index, double* sums,
+                            double* loudest, double* loudest_index) {
+  for (int64_t i = 0; i < count; ++i) {
+    for (int lane = 0; lane < kSearchBatchLanes; ++lane) {
+      sums[lane] += deltas[(lane * stride) + i];
+      if (sums[lane] > loudest[lane]) {
+        loudest[lane] = sums[lane];
+        loudest_index[lane] = first_index + i;
+      }
+    }
+  }
+}
+
+const AudioKernels kScalarKernels = {
+    "scalar",          DecodeLin16Scalar, DownmixScalar,
+    VolumeFloatScalar, VolumeInt16Scalar, EncodeLin16Scalar,
+    LpcResidualScalar, FftStageScalar,    SlideWindowBatchScalar,
+};
+
+// Returns null if the CPU can't run the named variant.
+const AudioKernels* FindKernels(const std::string& name) {
+  if (name == "scalar") {
+    return &kScalarKernels;
+  }
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if ((name == "sse2") && __builtin_cpu_supports("sse2")) {
+    return &kSse2Kernels;
+  }
+  if ((name == "avx2") && __builtin_cpu_supports("avx2")) {
+    return &kAvx2Kernels;
+  }
+  if ((name == "avx512") && __builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512bw")) {
+    return &kAvx512Kernels;
+  }
+#endif
+  return nullptr;
+}
+
+const AudioKernels* BestKernels() {
+  for (const char* name : {"avx512", "avx2", "sse2"}) {
+    const AudioKernels* kernels = FindKernels(name);
+    if (kernels != nullptr) {
+      return kernels;
+    }
+  }
+  return &kScalarKernels;
+}
+
+const AudioKernels*& ActiveKernels() {
+  static const AudioKernels* active = BestKernels();
+  return active;
+}
+
+}  // namespace
+
+const AudioKernels& GetAudioKernels() { return *ActiveKernels(); }
+
+Status SelectAudioKernels(const std::string& name) {
+  if (name == "auto") {
+    ActiveKernels() = BestKernels();
+    return Status::OK();
+  }
+  const bool is_known = (name == "scalar") || (name == "sse2") ||
+                        (name == "avx2") || (name == "avx512");
+  if (!is_known) {
+    return errors::InvalidArgument(
+        "Unknown kernel '", name,
+        "', expected one of auto, scalar, sse2, avx2, or avx512");
+  }
+  const AudioKernels* kernels = FindKernels(name);
+  if (kernels == nullptr) {
+    return errors::FailedPrecondition("This CPU can't run the '", name,
+                                      "' kernels");
+  }
+  ActiveKernels() = kernels;
+  return Status::OK();
+}
+
+void ComputeVolumes(const int32_t* input, int64_t count, float* output) {
+  constexpr float kMultiplier = 1.0f / (1ll << 31);
+  for (int64_t i = 0; i < count; ++i) {
+    output[i] = fabsf(input[i] * kMultiplier);
+  }
+}
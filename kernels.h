@@ -0,0 +1,95 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// The inner loops that touch every sample, with versions for different
+// instruction sets chosen at runtime.
+
+#ifndef KERNELS_H_
+#define KERNELS_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "status.h"
+
+// How many clips the batched window search advances at once, one per lane.
+constexpr int kSearchBatchLanes = 8;
+
+// A set of implementations for the per-sample loops. All variants produce
+// bit-identical results, so switching between them only changes speed.
+struct AudioKernels {
+  // Which instruction set these are written for, e.g. "avx2".
+  const char* name;
+  // Converts little-endian signed 16-bit values to floats within -1 to 1.
+  void (*decode_lin16)(const uint8_t* input, int64_t count, float* output);
+  // Averages each frame of interleaved channels down to a single value. The
+  // output may be the same array as the input.
+  void (*downmix)(const float* input, int64_t frame_count, int channel_count,
+                  float* output);
+  // Computes the volume, the absolute value, of each sample.
+  void (*volume_float)(const float* input, int64_t count, float* output);
+  void (*volume_int16)(const int16_t* input, int64_t count, float* output);
+  // Converts floats to rounded, saturated little-endian signed 16-bit values.
+  void (*encode_lin16)(const float* input, int64_t count, char* output);
+  // Computes the residual of a linear predictor, for the FLAC encoder. For
+  // each i from order up to count, writes input[i] minus the sum of
+  // coefficients[j] * input[i - 1 - j], shifted right by shift, to
+  // residual[i - order]. Coefficients must fit in 16 bits, and the sums in 32.
+  void (*lpc_residual)(const int16_t* input, int64_t count,
+                       const int32_t* coefficients, int order, int shift,
+                       int32_t* residual);
+  // Runs one radix-2 stage of in-place complex FFTs, for the feature
+  // extractor, on a batch of transforms at once. Element i of transform b is at
+  // index (i * batch) + b of the separate real and imaginary arrays, so the
+  // vectors run across the batch and every stage is equally wide. The size
+  // elements are split into groups of 2 * half, and within each group element
+  // k is combined with element k + half, after multiplying that by twiddle k.
+  void (*fft_stage)(float* real, float* imag, int64_t size, int64_t half,
+                    int64_t batch, const float* twiddle_real,
+                    const float* twiddle_imag);
+  // Slides kSearchBatchLanes windows along together, one per clip, for the
+  // batched search. Each lane has its own array of count deltas, starting at
+  // deltas + (lane * stride), with how much the clip's window total changes
+  // on each step, the volume of the frame entering it minus that of the frame
+  // leaving. Each lane's entry in sums is its running total, and whenever that
+  // rises above its entry in loudest, it replaces it, and loudest_index
+  // records first_index plus the step. The values are all whole numbers below
+  // 2^53, held as doubles so every variant can compare them exactly.
+  void (*slide_window_batch)(const double* deltas, int64_t stride,
+                             int64_t count, double first_index, double* sums,
+                             double* loudest, double* loudest_index);
+};
+
+// Returns the kernels in use, which by default are the fastest ones the CPU
+// supports.
+const AudioKernels& GetAudioKernels();
+
+// Forces a particular variant, by name, or "auto" for the default choice.
+// Returns an error if the name is unknown or the CPU can't run it. This must
+// be called before any worker threads start.
+Status SelectAudioKernels(const std::string& name);
+
+// Helpers for the volume kernels that pick the right one for the sample type.
+inline void ComputeVolumes(const float* input, int64_t count, float* output) {
+  GetAudioKernels().volume_float(input, count, output);
+}
+inline void ComputeVolumes(const int16_t* input, int64_t count,
+                           float* output) {
+  GetAudioKernels().volume_int16(input, count, output);
+}
+void ComputeVolumes(const int32_t* input, int64_t count, float* output);
+
+#endif  // KERNELS_H_
@@ -0,0 +1,755 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// SSE2, AVX2 and AVX-512 versions of the kernels. Each function is compiled
+// for its own instruction set with a target attribute, so the rest of the
+// program can still run on any x86 CPU, and kernels.cc only hands these out
+// once it has checked the CPU supports them.
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+#include <string.h>
+
+namespace {
+
+// The scalar loops below are always inlined into the vector functions, to
+// finish off any samples left over after the vector loop.
+
+inline __attribute__((always_inline)) void DecodeLin16Loop(
+    const uint8_t* input, int64_t start, int64_t count, float* output) {
+  constexpr float kMultiplier = 1.0f / (1 << 15);
+  for (int64_t i = start; i < count; ++i) {
+    int16_t value;
+    memcpy(&value, input + (i * sizeof(int16_t)), sizeof(value));
+    output[i] = value * kMultiplier;
+  }
+}
+
+inline __attribute__((always_inline)) void DownmixLoop(const float* input,
+                                                       int64_t start,
+                                                       int64_t frame_count,
+                                                       int channel_count,
+                                                       float* output) {
+  for (int64_t i = start; i < frame_count; ++i) {
+    const int64_t frame_index = i * channel_count;
+    float total = 0.0f;
+    for (int c = 0; c < channel_count; ++c) {
+      total += input[frame_index + c];
+    }
+    output[i] = total / channel_count;
+  }
+}
+
+inline __attribute__((always_inline)) void VolumeFloatLoop(const float* input,
+                                                           int64_t start,
+                                                           int64_t count,
+                                                           float* output) {
+  for (int64_t i = start; i < count; ++i) {
+    output[i] = __builtin_fabsf(input[i]);
+  }
+}
+
+inline __attribute__((always_inline)) void VolumeInt16Loop(
+    const int16_t* input, int64_t start, int64_t count, float* output) {
+  constexpr float kMultiplier = 1.0f / (1 << 15);
+  for (int64_t i = start; i < count; ++i) {
+    output[i] = __builtin_fabsf(input[i] * kMultiplier);
+  }
+}
+
+// Matches roundf() followed by clamping to the int16 range, but without any
+// calls or branches, for the samples left over after the vector loops.
+// Clamping first doesn't change the result, and after that the value fits in
+// an int32, so rounding half away from zero is a truncation plus a correction
+// based on the exact fractional part.
+inline __attribute__((always_inline)) void EncodeLin16Loop(const float* input,
+                                                           int64_t start,
+                                                           int64_t count,
+                                                           char* output) {
+  constexpr float kMultiplier = 1.0f * (1 << 15);
+  for (int64_t i = start; i < count; ++i) {
+    float value = input[i] * kMultiplier;
+    value = (value < -32768.0f) ? -32768.0f : value;
+    value = (value > 32767.0f) ? 32767.0f : value;
+    int32_t truncated = static_cast<int32_t>(value);
+    const float fraction = value - static_cast<float>(truncated);
+    truncated += (fraction >= 0.5f) - (fraction <= -0.5f);
+    const int16_t sample = truncated;
+    memcpy(output + (i * sizeof(int16_t)), &sample, sizeof(sample));
+  }
+}
+
+inline __attribute__((always_inline)) void LpcResidualLoop(
+    const int16_t* input, int64_t start, int64_t count,
+    const int32_t* coefficients, int order, int shift, int32_t* residual) {
+  for (int64_t i = start; i < count; ++i) {
+    int32_t prediction = 0;
+    for (int j = 0; j < order; ++j) {
+      prediction += coefficients[j] * input[i - 1 - j];
+    }
+    residual[i - order] = input[i] - (prediction >> shift);
+  }
+}
+
+// Finishes off the transforms left over after the vector loop, in each
+// butterfly.
+inline __attribute__((always_inline)) void FftStageLoop(
+    float* real, float* imag, int64_t size, int64_t half, int64_t batch,
+    int64_t start, const float* twiddle_real, const float* twiddle_imag) {
+  for (int64_t group = 0; group < size; group += (half * 2)) {
+    for (int64_t k = 0; k < half; ++k) {
+      float* a_real = real + ((group + k) * batch);
+      float* a_imag = imag + ((group + k) * batch);
+      float* b_real = a_real + (half * batch);
+      float* b_imag = a_imag + (half * batch);
+      const float w_real = twiddle_real[k];
+      const float w_imag = twiddle_imag[k];
+      for (int64_t j = start; j < batch; ++j) {
+        const float t_real = (b_real[j] * w_real) - (b_imag[j] * w_imag);
+        const float t_imag = (b_real[j] * w_imag) + (b_imag[j] * w_real);
+        b_real[j] = a_real[j] - t_real;
+        b_imag[j] = a_imag[j] - t_imag;
+        a_real[j] = a_real[j] + t_real;
+        a_imag[j] = a_imag[j] + t_imag;
+      }
+    }
+  }
+}
+
+// FLAC allows predictors up to this order.
+constexpr int kMaxLpcOrder = 32;
+
+// SSE2
+
+__attribute__((target("sse2"))) void DecodeLin16Sse2(const uint8_t* input,
+                                                     int64_t count,
+                                                     float* output) {
+  const __m128 multiplier = _mm_set1_ps(1.0f / (1 << 15));
+  int64_t i = 0;
+  for (; (i + 8) <= count; i += 8) {
+    const __m128i values = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(input + (i * sizeof(int16_t))));
+    // Put each value in the top half of a 32-bit lane, then shift it back
+    // down to sign-extend it.
+    const __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16);
+    const __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16);
+    _mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(low), multiplier));
+    _mm_storeu_ps(output + i + 4,
+                  _mm_mul_ps(_mm_cvtepi32_ps(high), multiplier));
+  }
+  DecodeLin16Loop(input, i, count, output);
+}
+
+__attribute__((target("sse2"))) void DownmixSse2(const float* input,
+                                                 int64_t frame_count,
+                                                 int channel_count,
+                                                 float* output) {
+  int64_t i = 0;
+  if (channel_count == 2) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 divisor = _mm_set1_ps(2.0f);
+    for (; (i + 4) <= frame_count; i += 4) {
+      const __m128 first = _mm_loadu_ps(input + (i * 2));
+      const __m128 second = _mm_loadu_ps(input + (i * 2) + 4);
+      const __m128 left = _mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0));
+      const __m128 right =
+          _mm_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1));
+      // Adding to zero first keeps the sign of zero sums the same as the
+      // scalar loop.
+      const __m128 total = _mm_add_ps(_mm_add_ps(zero, left), right);
+      _mm_storeu_ps(output + i, _mm_div_ps(total, divisor));
+    }
+  }
+  DownmixLoop(input, i, frame_count, channel_count, output);
+}
+
+__attribute__((target("sse2"))) void VolumeFloatSse2(const float* input,
+                                                     int64_t count,
+                                                     float* output) {
+  const __m128 sign_mask = _mm_set1_ps(-0.0f);
+  int64_t i = 0;
+  for (; (i + 4) <= count; i += 4) {
+    _mm_storeu_ps(output + i,
+                  _mm_andnot_ps(sign_mask, _mm_loadu_ps(input + i)));
+  }
+  VolumeFloatLoop(input, i, count, output);
+}
+
+__attribute__((target("sse2"))) void VolumeInt16Sse2(const int16_t* input,
+                                                     int64_t count,
+                                                     float* output) {
+  const __m128 multiplier = _mm_set1_ps(1.0f / (1 << 15));
+  const __m128 sign_mask = _mm_set1_ps(-0.0f);
+  int64_t i = 0;
+  for (; (i + 8) <= count; i += 8) {
+    const __m128i values =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+    const __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16);
+    const __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16);
+    _mm_storeu_ps(output + i,
+                  _mm_andnot_ps(sign_mask, _mm_mul_ps(_mm_cvtepi32_ps(low),
+                                                      multiplier)));
+    _mm_storeu_ps(output + i + 4,
+                  _mm_andnot_ps(sign_mask, _mm_mul_ps(_mm_cvtepi32_ps(high),
+                                                      multiplier)));
+  }
+  VolumeInt16Loop(input, i, count, output);
+}
+
+// Rounds half away from zero like roundf(), without SSE4.1's round
+// instructions. Values are only clamped enough to keep the conversion to int32
+// in range, leaving the final saturation to the pack. NaNs are zeroed, which is
+// what the scalar conversion ends up producing for them on x86.
+__attribute__((target("sse2"))) inline __m128i RoundToInt32Sse2(
+    __m128 value) {
+  value = _mm_and_ps(value, _mm_cmpord_ps(value, value));
+  value = _mm_min_ps(_mm_max_ps(value, _mm_set1_ps(-65536.0f)),
+                     _mm_set1_ps(65536.0f));
+  const __m128i truncated = _mm_cvttps_epi32(value);
+  const __m128 fraction = _mm_sub_ps(value, _mm_cvtepi32_ps(truncated));
+  // The comparison masks are -1 where true.
+  const __m128i round_up =
+      _mm_castps_si128(_mm_cmpge_ps(fraction, _mm_set1_ps(0.5f)));
+  const __m128i round_down =
+      _mm_castps_si128(_mm_cmple_ps(fraction, _mm_set1_ps(-0.5f)));
+  return _mm_add_epi32(_mm_sub_epi32(truncated, round_up), round_down);
+}
+
+__attribute__((target("sse2"))) void EncodeLin16Sse2(const float* input,
+                                                     int64_t count,
+                                                     char* output) {
+  const __m128 multiplier = _mm_set1_ps(1.0f * (1 << 15));
+  int64_t i = 0;
+  for (; (i + 8) <= count; i += 8) {
+    const __m128i low =
+        RoundToInt32Sse2(_mm_mul_ps(_mm_loadu_ps(input + i), multiplier));
+    const __m128i high =
+        RoundToInt32Sse2(_mm_mul_ps(_mm_loadu_ps(input + i + 4), multiplier));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(output + (i * sizeof(int16_t))),
+        _mm_packs_epi32(low, high));
+  }
+  EncodeLin16Loop(input, i, count, output);
+}
+
+// SSE2 has no 32-bit multiply, but madd can do it for 16-bit values. Each
+// sample is widened with a zero above it, and each coefficient likewise, so
+// the second product in every pair is always zero.
+__attribute__((target("sse2"))) void LpcResidualSse2(
+    const int16_t* input, int64_t count, const int32_t* coefficients,
+    int order, int shift, int32_t* residual) {
+  __m128i pairs[kMaxLpcOrder];
+  for (int j = 0; j < order; ++j) {
+    pairs[j] = _mm_set1_epi32(coefficients[j] & 0xffff);
+  }
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i shift_count = _mm_cvtsi32_si128(shift);
+  int64_t i = order;
+  for (; (i + 4) <= count; i += 4) {
+    __m128i prediction = zero;
+    for (int j = 0; j < order; ++j) {
+      const __m128i past = _mm_loadl_epi64(
+          reinterpret_cast<const __m128i*>(input + i - 1 - j));
+      prediction = _mm_add_epi32(
+          prediction, _mm_madd_epi16(_mm_unpacklo_epi16(past, zero), pairs[j]));
+    }
+    const __m128i current =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input + i));
+    const __m128i widened =
+        _mm_srai_epi32(_mm_unpacklo_epi16(current, current), 16);
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(residual + i - order),
+        _mm_sub_epi32(widened, _mm_sra_epi32(prediction, shift_count)));
+  }
+  LpcResidualLoop(input, i, count, coefficients, order, shift, residual);
+}
+
+__attribute__((target("sse2"))) void FftStageSse2(
+    float* real, float* imag, int64_t size, int64_t half, int64_t batch,
+    const float* twiddle_real, const float* twiddle_imag) {
+  const int64_t vector_end = batch - (batch % 4);
+  for (int64_t group = 0; group < size; group += (half * 2)) {
+    for (int64_t k = 0; k < half; ++k) {
+      float* a_real = real + ((group + k) * batch);
+      float* a_imag = imag + ((group + k) * batch);
+      float* b_real = a_real + (half * batch);
+      float* b_imag = a_imag + (half * batch);
+      const __m128 w_real = _mm_set1_ps(twiddle_real[k]);
+      const __m128 w_imag = _mm_set1_ps(twiddle_imag[k]);
+      for (int64_t j = 0; j < vector_end; j += 4) {
+        const __m128 x_real = _mm_loadu_ps(b_real + j);
+        const __m128 x_imag = _mm_loadu_ps(b_imag + j);
+        const __m128 t_real =
+            _mm_sub_ps(_mm_mul_ps(x_real, w_real), _mm_mul_ps(x_imag, w_imag));
+        const __m128 t_imag =
+            _mm_add_ps(_mm_mul_ps(x_real, w_imag), _mm_mul_ps(x_imag, w_real));
+        const __m128 y_real = _mm_loadu_ps(a_real + j);
+        const __m128 y_imag = _mm_loadu_ps(a_imag + j);
+        _mm_storeu_ps(b_real + j, _mm_sub_ps(y_real, t_real));
+        _mm_storeu_ps(b_imag + j, _mm_sub_ps(y_imag, t_imag));
+        _mm_storeu_ps(a_real + j, _mm_add_ps(y_real, t_real));
+        _mm_storeu_ps(a_imag + j, _mm_add_ps(y_imag, t_imag));
+      }
+    }
+  }
+  FftStageLoop(real, imag, size, half, batch, vector_end, twiddle_real,
+               twiddle_imag);
+}
+
+// The lanes are whole numbers, so max() picks the same value as the compare,
+// and only the index needs a blend. Each step's deltas are loaded from the
+// separate lanes' arrays two at a time.
+__attribute__((target("sse2"))) void SlideWindowBatchSse2(
+    const double* deltas, int64_t stride, int64_t count, double first_index,
+    double* sums, double* loudest, double* loudest_index) {
+  constexpr int kVectors = kSearchBatchLanes / 2;
+  __m128d sum[kVectors];
+  __m128d best[kVectors];
+  __m128d best_index[kVectors];
+  for (int v = 0; v < kVectors; ++v) {
+    sum[v] = _mm_loadu_pd(sums + (v * 2));
+    best[v] = _mm_loadu_pd(loudest + (v * 2));
+    best_index[v] = _mm_loadu_pd(loudest_index + (v * 2));
+  }
+  __m128d index = _mm_set1_pd(first_index);
+  const __m128d one = _mm_set1_pd(1.0);
+  for (int64_t i = 0; i < count; ++i) {
+    const double* step = deltas + i;
+    for (int v = 0; v < kVectors; ++v) {
+      const __m128d delta =
+          _mm_loadh_pd(_mm_load_sd(step + ((v * 2) * stride)),
+                       step + (((v * 2) + 1) * stride));
+      sum[v] = _mm_add_pd(sum[v], delta);
+      const __m128d louder = _mm_cmpgt_pd(sum[v], best[v]);
+      best[v] = _mm_max_pd(sum[v], best[v]);
+      best_index[v] = _mm_or_pd(_mm_and_pd(louder, index),
+                                _mm_andnot_pd(louder, best_index[v]));
+    }
+    index = _mm_add_pd(index, one);
+  }
+  for (int v = 0; v < kVectors; ++v) {
+    _mm_storeu_pd(sums + (v * 2), sum[v]);
+    _mm_storeu_pd(loudest + (v * 2), best[v]);
+    _mm_storeu_pd(loudest_index + (v * 2), best_index[v]);
+  }
+}
+
+// AVX2
+
+__attribute__((target("avx2"))) void DecodeLin16Avx2(const uint8_t* input,
+                                                     int64_t count,
+                                                     float* output) {
+  const __m256 multiplier = _mm256_set1_ps(1.0f / (1 << 15));
+  int64_t i = 0;
+  for (; (i + 8) <= count; i += 8) {
+    const __m128i values = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(input + (i * sizeof(int16_t))));
+    const __m256 floats = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(values));
+    _mm256_storeu_ps(output + i, _mm256_mul_ps(floats, multiplier));
+  }
+  DecodeLin16Loop(input, i, count, output);
+}
+
+__attribute__((target("avx2"))) void DownmixAvx2(const float* input,
+                                                 int64_t frame_count,
+                                                 int channel_count,
+                                                 float* output) {
+  int64_t i = 0;
+  if (channel_count == 2) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 divisor = _mm256_set1_ps(2.0f);
+    for (; (i + 8) <= frame_count; i += 8) {
+      const __m256 first = _mm256_loadu_ps(input + (i * 2));
+      const __m256 second = _mm256_loadu_ps(input + (i * 2) + 8);
+      // The shuffles work within 128-bit lanes, so the 64-bit pairs come out
+      // in 0, 2, 1, 3 order and need swapping back.
+      const __m256 left = _mm256_castpd_ps(_mm256_permute4x64_pd(
+          _mm256_castps_pd(
+              _mm256_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0))),
+          _MM_SHUFFLE(3, 1, 2, 0)));
+      const __m256 right = _mm256_castpd_ps(_mm256_permute4x64_pd(
+          _mm256_castps_pd(
+              _mm256_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1))),
+          _MM_SHUFFLE(3, 1, 2, 0)));
+      const __m256 total = _mm256_add_ps(_mm256_add_ps(zero, left), right);
+      _mm256_storeu_ps(output + i, _mm256_div_ps(total, divisor));
+    }
+  }
+  DownmixLoop(input, i, frame_count, channel_count, output);
+}
+
+__attribute__((target("avx2"))) void VolumeFloatAvx2(const float* input,
+                                                     int64_t count,
+                                                     float* output) {
+  const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+  int64_t i = 0;
+  for (; (i + 8) <= count; i += 8) {
+    _mm256_storeu_ps(output + i,
+                     _mm256_andnot_ps(sign_mask, _mm256_loadu_ps(input + i)));
+  }
+  VolumeFloatLoop(input, i, count, output);
+}
+
+__attribute__((target("avx2"))) void VolumeInt16Avx2(const int16_t* input,
+                                                     int64_t count,
+                                                     float* output) {
+  const __m256 multiplier = _mm256_set1_ps(1.0f / (1 << 15));
+  const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+  int64_t i = 0;
+  for (; (i + 8) <= count; i += 8) {
+    const __m128i values =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+    const __m256 floats = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(values));
+    _mm256_storeu_ps(output + i, _mm256_andnot_ps(
+                                     sign_mask,
+                                     _mm256_mul_ps(floats, multiplier)));
+  }
+  VolumeInt16Loop(input, i, count, output);
+}
+
+__attribute__((target("avx2"))) inline __m256i RoundToInt32Avx2(
+    __m256 value) {
+  value = _mm256_and_ps(value, _mm256_cmp_ps(value, value, _CMP_ORD_Q));
+  value = _mm256_min_ps(_mm256_max_ps(value, _mm256_set1_ps(-65536.0f)),
+                        _mm256_set1_ps(65536.0f));
+  const __m256i truncated = _mm256_cvttps_epi32(value);
+  const __m256 fraction = _mm256_sub_ps(value, _mm256_cvtepi32_ps(truncated));
+  const __m256i round_up = _mm256_castps_si256(
+      _mm256_cmp_ps(fraction, _mm256_set1_ps(0.5f), _CMP_GE_OQ));
+  const __m256i round_down = _mm256_castps_si256(
+      _mm256_cmp_ps(fraction, _mm256_set1_ps(-0.5f), _CMP_LE_OQ));
+  return _mm256_add_epi32(_mm256_sub_epi32(truncated, round_up), round_down);
+}
+
+__attribute__((target("avx2"))) void EncodeLin16Avx2(const float* input,
+                                                     int64_t count,
+                                                     char* output) {
+  const __m256 multiplier = _mm256_set1_ps(1.0f * (1 << 15));
+  int64_t i = 0;
+  for (; (i + 16) <= count; i += 16) {
+    const __m256i low = RoundToInt32Avx2(
+        _mm256_mul_ps(_mm256_loadu_ps(input + i), multiplier));
+    const __m256i high = RoundToInt32Avx2(
+        _mm256_mul_ps(_mm256_loadu_ps(input + i + 8), multiplier));
+    // The pack works within 128-bit lanes, so the 64-bit groups come out in
+    // 0, 2, 1, 3 order.
+    const __m256i packed = _mm256_permute4x64_epi64(
+        _mm256_packs_epi32(low, high), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(output + (i * sizeof(int16_t))), packed);
+  }
+  EncodeLin16Loop(input, i, count, output);
+}
+
+__attribute__((target("avx2"))) void LpcResidualAvx2(
+    const int16_t* input, int64_t count, const int32_t* coefficients,
+    int order, int shift, int32_t* residual) {
+  __m256i broadcast[kMaxLpcOrder];
+  for (int j = 0; j < order; ++j) {
+    broadcast[j] = _mm256_set1_epi32(coefficients[j]);
+  }
+  const __m128i shift_count = _mm_cvtsi32_si128(shift);
+  int64_t i = order;
+  for (; (i + 8) <= count; i += 8) {
+    __m256i prediction = _mm256_setzero_si256();
+    for (int j = 0; j < order; ++j) {
+      const __m256i past = _mm256_cvtepi16_epi32(_mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(input + i - 1 - j)));
+      prediction = _mm256_add_epi32(prediction,
+                                    _mm256_mullo_epi32(past, broadcast[j]));
+    }
+    const __m256i current = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i)));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(residual + i - order),
+        _mm256_sub_epi32(current, _mm256_sra_epi32(prediction, shift_count)));
+  }
+  LpcResidualLoop(input, i, count, coefficients, order, shift, residual);
+}
+
+__attribute__((target("avx2"))) void FftStageAvx2(
+    float* real, float* imag, int64_t size, int64_t half, int64_t batch,
+    const float* twiddle_real, const float* twiddle_imag) {
+  const int64_t vector_end = batch - (batch % 8);
+  for (int64_t group = 0; group < size; group += (half * 2)) {
+    for (int64_t k = 0; k < half; ++k) {
+      float* a_real = real + ((group + k) * batch);
+      float* a_imag = imag + ((group + k) * batch);
+      float* b_real = a_real + (half * batch);
+      float* b_imag = a_imag + (half * batch);
+      const __m256 w_real = _mm256_set1_ps(twiddle_real[k]);
+      const __m256 w_imag = _mm256_set1_ps(twiddle_imag[k]);
+      for (int64_t j = 0; j < vector_end; j += 8) {
+        const __m256 x_real = _mm256_loadu_ps(b_real + j);
+        const __m256 x_imag = _mm256_loadu_ps(b_imag + j);
+        const __m256 t_real =
+            _mm256_sub_ps(_mm256_mul_ps(x_real, w_real),
+                          _mm256_mul_ps(x_imag, w_imag));
+        const __m256 t_imag =
+            _mm256_add_ps(_mm256_mul_ps(x_real, w_imag),
+                          _mm256_mul_ps(x_imag, w_real));
+        const __m256 y_real = _mm256_loadu_ps(a_real + j);
+        const __m256 y_imag = _mm256_loadu_ps(a_imag + j);
+        _mm256_storeu_ps(b_real + j, _mm256_sub_ps(y_real, t_real));
+        _mm256_storeu_ps(b_imag + j, _mm256_sub_ps(y_imag, t_imag));
+        _mm256_storeu_ps(a_real + j, _mm256_add_ps(y_real, t_real));
+        _mm256_storeu_ps(a_imag + j, _mm256_add_ps(y_imag, t_imag));
+      }
+    }
+  }
+  FftStageLoop(real, imag, size, half, batch, vector_end, twiddle_real,
+               twiddle_imag);
+}
+
+// Separate loads are quicker than AVX2's gathers for picking up the lanes.
+__attribute__((target("avx2"))) void SlideWindowBatchAvx2(
+    const double* deltas, int64_t stride, int64_t count, double first_index,
+    double* sums, double* loudest, double* loudest_index) {
+  constexpr int kVectors = kSearchBatchLanes / 4;
+  __m256d sum[kVectors];
+  __m256d best[kVectors];
+  __m256d best_index[kVectors];
+  for (int v = 0; v < kVectors; ++v) {
+    sum[v] = _mm256_loadu_pd(sums + (v * 4));
+    best[v] = _mm256_loadu_pd(loudest + (v * 4));
+    best_index[v] = _mm256_loadu_pd(loudest_index + (v * 4));
+  }
+  __m256d index = _mm256_set1_pd(first_index);
+  const __m256d one = _mm256_set1_pd(1.0);
+  for (int64_t i = 0; i < count; ++i) {
+    for (int v = 0; v < kVectors; ++v) {
+      const double* lane = deltas + i + ((v * 4) * stride);
+      const __m128d low = _mm_loadh_pd(_mm_load_sd(lane), lane + stride);
+      const __m128d high = _mm_loadh_pd(_mm_load_sd(lane + (2 * stride)),
+                                        lane + (3 * stride));
+      const __m256d delta =
+          _mm256_insertf128_pd(_mm256_castpd128_pd256(low), high, 1);
+      sum[v] = _mm256_add_pd(sum[v], delta);
+      const __m256d louder = _mm256_cmp_pd(sum[v], best[v], _CMP_GT_OQ);
+      best[v] = _mm256_max_pd(sum[v], best[v]);
+      best_index[v] = _mm256_blendv_pd(best_index[v], index, louder);
+    }
+    index = _mm256_add_pd(index, one);
+  }
+  for (int v = 0; v < kVectors; ++v) {
+    _mm256_storeu_pd(sums + (v * 4), sum[v]);
+    _mm256_storeu_pd(loudest + (v * 4), best[v]);
+    _mm256_storeu_pd(loudest_index + (v * 4), best_index[v]);
+  }
+}
+
+// AVX-512
+
+__attribute__((target("avx512f,avx512bw"))) void DecodeLin16Avx512(
+    const uint8_t* input, int64_t count, float* output) {
+  const __m512 multiplier = _mm512_set1_ps(1.0f / (1 << 15));
+  int64_t i = 0;
+  for (; (i + 16) <= count; i += 16) {
+    const __m256i values = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(input + (i * sizeof(int16_t))));
+    const __m512 floats = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(values));
+    _mm512_storeu_ps(output + i, _mm512_mul_ps(floats, multiplier));
+  }
+  DecodeLin16Loop(input, i, count, output);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void DownmixAvx512(
+    const float* input, int64_t frame_count, int channel_count,
+    float* output) {
+  int64_t i = 0;
+  if (channel_count == 2) {
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 divisor = _mm512_set1_ps(2.0f);
+    const __m512i left_indices = _mm512_set_epi32(
+        30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0);
+    const __m512i right_indices = _mm512_set_epi32(
+        31, 29, 27, 25, 23, 21, 19, 17, 15, 13, 11, 9, 7, 5, 3, 1);
+    for (; (i + 16) <= frame_count; i += 16) {
+      const __m512 first = _mm512_loadu_ps(input + (i * 2));
+      const __m512 second = _mm512_loadu_ps(input + (i * 2) + 16);
+      const __m512 left = _mm512_permutex2var_ps(first, left_indices, second);
+      const __m512 right =
+          _mm512_permutex2var_ps(first, right_indices, second);
+      const __m512 total = _mm512_add_ps(_mm512_add_ps(zero, left), right);
+      _mm512_storeu_ps(output + i, _mm512_div_ps(total, divisor));
+    }
+  }
+  DownmixLoop(input, i, frame_count, channel_count, output);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void VolumeFloatAvx512(
+    const float* input, int64_t count, float* output) {
+  int64_t i = 0;
+  for (; (i + 16) <= count; i += 16) {
+    _mm512_storeu_ps(output + i, _mm512_abs_ps(_mm512_loadu_ps(input + i)));
+  }
+  VolumeFloatLoop(input, i, count, output);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void VolumeInt16Avx512(
+    const int16_t* input, int64_t count, float* output) {
+  const __m512 multiplier = _mm512_set1_ps(1.0f / (1 << 15));
+  int64_t i = 0;
+  for (; (i + 16) <= count; i += 16) {
+    const __m256i values =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+    const __m512 floats = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(values));
+    _mm512_storeu_ps(output + i,
+                     _mm512_abs_ps(_mm512_mul_ps(floats, multiplier)));
+  }
+  VolumeInt16Loop(input, i, count, output);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void EncodeLin16Avx512(
+    const float* input, int64_t count, char* output) {
+  const __m512 multiplier = _mm512_set1_ps(1.0f * (1 << 15));
+  const __m512 lowest = _mm512_set1_ps(-65536.0f);
+  const __m512 highest = _mm512_set1_ps(65536.0f);
+  const __m512 half = _mm512_set1_ps(0.5f);
+  const __m512 minus_half = _mm512_set1_ps(-0.5f);
+  const __m512i one = _mm512_set1_epi32(1);
+  int64_t i = 0;
+  for (; (i + 16) <= count; i += 16) {
+    __m512 value = _mm512_mul_ps(_mm512_loadu_ps(input + i), multiplier);
+    value = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(value, value, _CMP_ORD_Q),
+                                value);
+    value = _mm512_min_ps(_mm512_max_ps(value, lowest), highest);
+    __m512i rounded = _mm512_cvttps_epi32(value);
+    const __m512 fraction = _mm512_sub_ps(value, _mm512_cvtepi32_ps(rounded));
+    rounded = _mm512_mask_add_epi32(
+        rounded, _mm512_cmp_ps_mask(fraction, half, _CMP_GE_OQ), rounded, one);
+    rounded = _mm512_mask_sub_epi32(
+        rounded, _mm512_cmp_ps_mask(fraction, minus_half, _CMP_LE_OQ), rounded,
+        one);
+    // Saturating narrow, the AVX-512 equivalent of packs.
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(output + (i * sizeof(int16_t))),
+        _mm512_cvtsepi32_epi16(rounded));
+  }
+  EncodeLin16Loop(input, i, count, output);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void LpcResidualAvx512(
+    const int16_t* input, int64_t count, const int32_t* coefficients,
+    int order, int shift, int32_t* residual) {
+  __m512i broadcast[kMaxLpcOrder];
+  for (int j = 0; j < order; ++j) {
+    broadcast[j] = _mm512_set1_epi32(coefficients[j]);
+  }
+  const __m128i shift_count = _mm_cvtsi32_si128(shift);
+  int64_t i = order;
+  for (; (i + 16) <= count; i += 16) {
+    __m512i prediction = _mm512_setzero_si512();
+    for (int j = 0; j < order; ++j) {
+      const __m512i past = _mm512_cvtepi16_epi32(_mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(input + i - 1 - j)));
+      prediction = _mm512_add_epi32(prediction,
+                                    _mm512_mullo_epi32(past, broadcast[j]));
+    }
+    const __m512i current = _mm512_cvtepi16_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i)));
+    _mm512_storeu_si512(
+        residual + i - order,
+        _mm512_sub_epi32(current, _mm512_sra_epi32(prediction, shift_count)));
+  }
+  LpcResidualLoop(input, i, count, coefficients, order, shift, residual);
+}
+
+// AVX-512 implies FMA, and gcc would otherwise fuse the butterflies'
+// multiplies and adds, which rounds differently from the other variants.
+__attribute__((target("avx512f,avx512bw"), optimize("fp-contract=off"))) void
+FftStageAvx512(
+    float* real, float* imag, int64_t size, int64_t half, int64_t batch,
+    const float* twiddle_real, const float* twiddle_imag) {
+  const int64_t vector_end = batch - (batch % 16);
+  for (int64_t group = 0; group < size; group += (half * 2)) {
+    for (int64_t k = 0; k < half; ++k) {
+      float* a_real = real + ((group + k) * batch);
+      float* a_imag = imag + ((group + k) * batch);
+      float* b_real = a_real + (half * batch);
+      float* b_imag = a_imag + (half * batch);
+      const __m512 w_real = _mm512_set1_ps(twiddle_real[k]);
+      const __m512 w_imag = _mm512_set1_ps(twiddle_imag[k]);
+      for (int64_t j = 0; j < vector_end; j += 16) {
+        const __m512 x_real = _mm512_loadu_ps(b_real + j);
+        const __m512 x_imag = _mm512_loadu_ps(b_imag + j);
+        const __m512 t_real =
+            _mm512_sub_ps(_mm512_mul_ps(x_real, w_real),
+                          _mm512_mul_ps(x_imag, w_imag));
+        const __m512 t_imag =
+            _mm512_add_ps(_mm512_mul_ps(x_real, w_imag),
+                          _mm512_mul_ps(x_imag, w_real));
+        const __m512 y_real = _mm512_loadu_ps(a_real + j);
+        const __m512 y_imag = _mm512_loadu_ps(a_imag + j);
+        _mm512_storeu_ps(b_real + j, _mm512_sub_ps(y_real, t_real));
+        _mm512_storeu_ps(b_imag + j, _mm512_sub_ps(y_imag, t_imag));
+        _mm512_storeu_ps(a_real + j, _mm512_add_ps(y_real, t_real));
+        _mm512_storeu_ps(a_imag + j, _mm512_add_ps(y_imag, t_imag));
+      }
+    }
+  }
+  FftStageLoop(real, imag, size, half, batch, vector_end, twiddle_real,
+               twiddle_imag);
+}
+
+// All eight lanes fit in one register, and one gather loads a step for each.
+__attribute__((target("avx512f,avx512bw"))) void SlideWindowBatchAvx512(
+    const double* deltas, int64_t stride, int64_t count, double first_index,
+    double* sums, double* loudest, double* loudest_index) {
+  static_assert(kSearchBatchLanes == 8, "One vector holds every lane");
+  __m512d sum = _mm512_loadu_pd(sums);
+  __m512d best = _mm512_loadu_pd(loudest);
+  __m512d best_index = _mm512_loadu_pd(loudest_index);
+  const __m512i offsets =
+      _mm512_setr_epi64(0, stride, 2 * stride, 3 * stride, 4 * stride,
+                        5 * stride, 6 * stride, 7 * stride);
+  __m512d index = _mm512_set1_pd(first_index);
+  const __m512d one = _mm512_set1_pd(1.0);
+  for (int64_t i = 0; i < count; ++i) {
+    sum = _mm512_add_pd(sum, _mm512_i64gather_pd(offsets, deltas + i, 8));
+    const __mmask8 louder = _mm512_cmp_pd_mask(sum, best, _CMP_GT_OQ);
+    best = _mm512_max_pd(sum, best);
+    best_index = _mm512_mask_blend_pd(louder, best_index, index);
+    index = _mm512_add_pd(index, one);
+  }
+  _mm512_storeu_pd(sums, sum);
+  _mm512_storeu_pd(loudest, best);
+  _mm512_storeu_pd(loudest_index, best_index);
+}
+
+}  // namespace
+
+extern const AudioKernels kSse2Kernels = {
+    "sse2",          DecodeLin16Sse2, DownmixSse2,
+    VolumeFloatSse2, VolumeInt16Sse2, EncodeLin16Sse2,
+    LpcResidualSse2, FftStageSse2, SlideWindowBatchSse2,
+};
+
+extern const AudioKernels kAvx2Kernels = {
+    "avx2",          DecodeLin16Avx2, DownmixAvx2,
+    VolumeFloatAvx2, VolumeInt16Avx2, EncodeLin16Avx2,
+    LpcResidualAvx2, FftStageAvx2, SlideWindowBatchAvx2,
+};
+
+extern const AudioKernels kAvx512Kernels = {
+    "avx512",          DecodeLin16Avx512, DownmixAvx512,
+    VolumeFloatAvx512, VolumeInt16Avx512, EncodeLin16Avx512,
+    LpcResidualAvx512, FftStageAvx512, SlideWindowBatchAvx512,
+};
+
+#endif  // defined(__x86_64__) || defined(__i386__)
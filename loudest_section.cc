@@ -0,0 +1,417 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "loudest_section.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <thread>
+
+void TrimToLoudestSegment(const std::vector<float>& input,
+                          int64_t desired_samples, std::vector<float>* output) {
+  const Span<const float> input_span(input);
+  const SegmentRange range = FindLoudestSegment(input_span, desired_samples);
+  output->resize(range.size());
+  ExtractSegment(input_span, range, output->data());
+}
+
+namespace {
+
+// Searches below this size aren't worth starting threads for.
+constexpr int64_t kMinFramesPerThread = 1 << 20;
+
+inline int64_t FrameVolume(const int16_t* frame, int channel_count) {
+  if (channel_count == 1) {
+    return abs(frame[0]);
+  }
+  int64_t total = 0;
+  for (int c = 0; c < channel_count; ++c) {
+    total += frame[c];
+  }
+  return llabs(total);
+}
+
+// The loudest window whose last frame is last_index.
+struct Candidate {
+  int64_t volume;
+  int64_t last_index;
+};
+
+// Looks at every window whose last frame falls within [first, last], and
+// returns the earliest of the loudest ones.
+Candidate FindLoudestCandidate(const int16_t* input, int channel_count,
+                               int64_t desired_frames, int64_t first,
+                               int64_t last) {
+  int64_t volume_sum = 0;
+  for (int64_t i = (first - desired_frames) + 1; i <= first; ++i) {
+    volume_sum += FrameVolume(input + (i * channel_count), channel_count);
+  }
+  Candidate loudest = {volume_sum, first};
+  for (int64_t i = first + 1; i <= last; ++i) {
+    volume_sum -= FrameVolume(input + ((i - desired_frames) * channel_count),
+                              channel_count);
+    volume_sum += FrameVolume(input + (i * channel_count), channel_count);
+    if (volume_sum > loudest.volume) {
+      loudest.volume = volume_sum;
+      loudest.last_index = i;
+    }
+  }
+  return loudest;
+}
+
+// Splits the window end positions into contiguous runs, one per thread, each
+// of which reads a window's worth of frames before its run to get started.
+Candidate FindLoudestCandidateInParallel(Span<const int16_t> input,
+                                         int channel_count,
+                                         int64_t desired_frames,
+                                         int64_t chunk_count) {
+  const int64_t frame_count = input.size() / channel_count;
+  const int64_t first = desired_frames - 1;
+  const int64_t candidate_count = frame_count - first;
+  std::vector<Candidate> candidates(chunk_count);
+  std::vector<std::thread> threads;
+  for (int64_t chunk = 0; chunk < chunk_count; ++chunk) {
+    const int64_t chunk_first = first + (candidate_count * chunk) / chunk_count;
+    const int64_t chunk_last =
+        first + (candidate_count * (chunk + 1)) / chunk_count - 1;
+    Candidate* candidate = &candidates[chunk];
+    auto search_chunk = [=]() {
+      *candidate = FindLoudestCandidate(input.data(), channel_count,
+                                        desired_frames, chunk_first,
+                                        chunk_last);
+    };
+    if (chunk == (chunk_count - 1)) {
+      search_chunk();
+    } else {
+      threads.emplace_back(search_chunk);
+    }
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  // Taking the first of any equal volumes in chunk order gives the same
+  // choice as a single pass would.
+  Candidate loudest = candidates[0];
+  for (const Candidate& candidate : candidates) {
+    if (candidate.volume > loudest.volume) {
+      loudest = candidate;
+    }
+  }
+  return loudest;
+}
+
+// Writes how much a window's total changes as it moves onto each of count
+// frames, for one lane of a batch. The window leaves the frames starting at
+// trailing. Mono is by far the most common case, and this loop vectorizes.
+void FillDeltaLane(const int16_t* leading, const int16_t* trailing,
+                   int channel_count, int64_t count, double* deltas) {
+  if (channel_count == 1) {
+    for (int64_t i = 0; i < count; ++i) {
+      deltas[i] = abs(leading[i]) - abs(trailing[i]);
+    }
+    return;
+  }
+  for (int64_t i = 0; i < count; ++i) {
+    deltas[i] = FrameVolume(leading + (i * channel_count), channel_count) -
+                FrameVolume(trailing + (i * channel_count), channel_count);
+  }
+}
+
+// Searches up to kSearchBatchLanes clips, one per lane.
+void FindLoudestSegmentsInLanes(const Span<const int16_t>* inputs,
+                                const int* channel_counts, int clip_count,
+                                int64_t desired_frames, SegmentRange* ranges) {
+  // Lanes without a clip, or whose clip doesn't need searching, have no
+  // frames, and are fed zeros that never make a window louder.
+  const int16_t* frames[kSearchBatchLanes] = {};
+  int lane_channels[kSearchBatchLanes] = {};
+  int64_t frame_counts[kSearchBatchLanes] = {};
+  double sums[kSearchBatchLanes] = {};
+  double loudest[kSearchBatchLanes] = {};
+  double loudest_index[kSearchBatchLanes] = {};
+  int64_t last_frame = 0;
+  for (int lane = 0; lane < clip_count; ++lane) {
+    const int64_t frame_count = inputs[lane].size() / channel_counts[lane];
+    if (desired_frames >= frame_count) {
+      ranges[lane] = SegmentRange{0, frame_count};
+      continue;
+    }
+    if (desired_frames <= 0) {
+      ranges[lane] = SegmentRange{0, 0};
+      continue;
+    }
+    frames[lane] = inputs[lane].data();
+    lane_channels[lane] = channel_counts[lane];
+    frame_counts[lane] = frame_count;
+    int64_t volume_sum = 0;
+    for (int64_t i = 0; i < desired_frames; ++i) {
+      volume_sum += FrameVolume(frames[lane] + (i * lane_channels[lane]),
+                                lane_channels[lane]);
+    }
+    sums[lane] = volume_sum;
+    loudest[lane] = volume_sum;
+    loudest_index[lane] = desired_frames - 1;
+    last_frame = std::max(last_frame, frame_count);
+  }
+
+  // The changes are worked out a block of steps at a time, into a separate
+  // array for each lane.
+  constexpr int64_t kStepsPerBlock = 512;
+  alignas(64) double deltas[kSearchBatchLanes * kStepsPerBlock];
+  const AudioKernels& kernels = GetAudioKernels();
+  for (int64_t block_start = desired_frames; block_start < last_frame;
+       block_start += kStepsPerBlock) {
+    const int64_t step_count =
+        std::min(kStepsPerBlock, last_frame - block_start);
+    for (int lane = 0; lane < kSearchBatchLanes; ++lane) {
+      double* lane_deltas = deltas + (lane * kStepsPerBlock);
+      const int64_t lane_steps = std::max<int64_t>(
+          0, std::min(step_count, frame_counts[lane] - block_start));
+      if (lane_steps > 0) {
+        const int channel_count = lane_channels[lane];
+        FillDeltaLane(
+            frames[lane] + (block_start * channel_count),
+            frames[lane] + ((block_start - desired_frames) * channel_count),
+            channel_count, lane_steps, lane_deltas);
+      }
+      std::fill(lane_deltas + lane_steps, lane_deltas + step_count, 0.0);
+    }
+    kernels.slide_window_batch(deltas, kStepsPerBlock, step_count, block_start,
+                               sums, loudest, loudest_index);
+  }
+
+  for (int lane = 0; lane < clip_count; ++lane) {
+    if (frame_counts[lane] == 0) {
+      continue;
+    }
+    ranges[lane] = LoudestWindowRange(
+        static_cast<int64_t>(loudest_index[lane]), desired_frames);
+  }
+}
+
+}  // namespace
+
+SegmentRange FindLoudestSegmentLin16(Span<const int16_t> input,
+                                     int channel_count, int64_t desired_frames,
+                                     int thread_count) {
+  const int64_t frame_count = input.size() / channel_count;
+  if (desired_frames >= frame_count) {
+    return SegmentRange{0, frame_count};
+  }
+  if (desired_frames <= 0) {
+    return SegmentRange{0, 0};
+  }
+
+  // The first window ends at frame first, and each later end position is a
+  // candidate, which can be split between threads.
+  const int64_t first = desired_frames - 1;
+  const int64_t candidate_count = frame_count - first;
+  const int64_t max_threads =
+      std::max<int64_t>(1, candidate_count / kMinFramesPerThread);
+  const int64_t chunk_count =
+      std::min<int64_t>(std::max(thread_count, 1), max_threads);
+  // Most files are short enough for one chunk, so skip the bookkeeping, which
+  // would otherwise be a heap allocation per file.
+  Candidate loudest;
+  if (chunk_count == 1) {
+    loudest = FindLoudestCandidate(input.data(), channel_count, desired_frames,
+                                   first, frame_count - 1);
+  } else {
+    loudest = FindLoudestCandidateInParallel(input, channel_count,
+                                             desired_frames, chunk_count);
+  }
+  return LoudestWindowRange(loudest.last_index, desired_frames);
+}
+
+void FindLoudestSegmentsLin16Batch(const Span<const int16_t>* inputs,
+                                   const int* channel_counts, int clip_count,
+                                   int64_t desired_frames,
+                                   SegmentRange* ranges) {
+  for (int first = 0; first < clip_count; first += kSearchBatchLanes) {
+    FindLoudestSegmentsInLanes(
+        inputs + first, channel_counts + first,
+        std::min(kSearchBatchLanes, clip_count - first), desired_frames,
+        ranges + first);
+  }
+}
+
+SegmentRange SearchLin16Frames(Span<const int16_t> input, int channel_count,
+                               WindowSearch* search) {
+  constexpr int64_t kFramesPerBlock = 1024;
+  int64_t volumes[kFramesPerBlock];
+  const int64_t frame_count = input.size() / channel_count;
+  for (int64_t block_start = 0; block_start < frame_count;
+       block_start += kFramesPerBlock) {
+    const int64_t block_size =
+        std::min(kFramesPerBlock, frame_count - block_start);
+    const int16_t* frames = input.data() + (block_start * channel_count);
+    for (int64_t i = 0; i < block_size; ++i) {
+      volumes[i] = FrameVolume(frames + (i * channel_count), channel_count);
+    }
+    search->AddVolumes(volumes, block_size);
+  }
+  search->Finish();
+  return search->loudest();
+}
+
+SlidingLoudestWindow::SlidingLoudestWindow(int64_t desired_frames,
+                                           int64_t* ring)
+    : desired_frames_(desired_frames),
+      ring_(ring),
+      frames_seen_(0),
+      volume_sum_(0),
+      loudest_volume_(0),
+      loudest_last_index_(0) {}
+
+bool SlidingLoudestWindow::AddVolumes(const int64_t* volumes, int64_t count) {
+  if (desired_frames_ <= 0) {
+    frames_seen_ += count;
+    return false;
+  }
+  bool changed = false;
+  for (int64_t j = 0; j < count; ++j) {
+    const int64_t i = frames_seen_ + j;
+    // The slot for this frame holds the one leaving the window.
+    int64_t& slot = ring_[i % desired_frames_];
+    volume_sum_ += volumes[j];
+    if (i >= desired_frames_) {
+      volume_sum_ -= slot;
+    }
+    slot = volumes[j];
+    if (i == (desired_frames_ - 1)) {
+      loudest_volume_ = volume_sum_;
+      loudest_last_index_ = i;
+      changed = true;
+    } else if ((i >= desired_frames_) && (volume_sum_ > loudest_volume_)) {
+      loudest_volume_ = volume_sum_;
+      loudest_last_index_ = i;
+      changed = true;
+    }
+  }
+  frames_seen_ += count;
+  return changed;
+}
+
+SegmentRange SlidingLoudestWindow::loudest() const {
+  if (desired_frames_ >= frames_seen_) {
+    return SegmentRange{0, frames_seen_};
+  }
+  if (desired_frames_ <= 0) {
+    return SegmentRange{0, 0};
+  }
+  return LoudestWindowRange(loudest_last_index_, desired_frames_);
+}
+
+OnlineLoudestDetector::OnlineLoudestDetector(int64_t window_samples,
+                                             int64_t horizon_samples)
+    : window_samples_(std::max<int64_t>(1, window_samples)),
+      horizon_samples_(std::max(window_samples_, horizon_samples)),
+      buffer_((window_samples_ - 1) + horizon_samples_),
+      buffer_start_index_(0),
+      carried_(0),
+      horizon_fill_(0),
+      decided_(false),
+      current_volume_sum_(0.0f),
+      loudest_volume_(0.0f),
+      loudest_last_index_(-1) {
+  decision_.start_index = 0;
+  decision_.volume = 0.0f;
+  decision_.samples = nullptr;
+  decision_.sample_count = 0;
+}
+
+int64_t OnlineLoudestDetector::AddSamples(const float* samples, int64_t count,
+                                          bool* has_decision) {
+  *has_decision = false;
+  // The previous horizon's decision points into the buffer, so we only start
+  // overwriting it once the caller comes back with more samples.
+  if (decided_) {
+    CarryOver();
+  }
+  const int64_t consumed = std::min(count, horizon_samples_ - horizon_fill_);
+  for (int64_t j = 0; j < consumed; ++j) {
+    const int64_t i = carried_ + horizon_fill_;
+    const float leading_value = samples[j];
+    buffer_[i] = leading_value;
+    ++horizon_fill_;
+    current_volume_sum_ += fabsf(leading_value);
+    if (i >= window_samples_) {
+      current_volume_sum_ -= fabsf(buffer_[i - window_samples_]);
+    }
+    // The buffer always starts with every earlier sample that a window ending
+    // here could need, so only the very start of the stream is incomplete.
+    if ((i >= (window_samples_ - 1)) &&
+        ((loudest_last_index_ == -1) ||
+         (current_volume_sum_ > loudest_volume_))) {
+      loudest_volume_ = current_volume_sum_;
+      loudest_last_index_ = i;
+    }
+  }
+  if (horizon_fill_ == horizon_samples_) {
+    Decide();
+    *has_decision = true;
+  }
+  return consumed;
+}
+
+bool OnlineLoudestDetector::Flush() {
+  if (decided_ || (horizon_fill_ == 0)) {
+    return false;
+  }
+  Decide();
+  return true;
+}
+
+void OnlineLoudestDetector::CarryOver() {
+  const int64_t buffered = carried_ + horizon_fill_;
+  const int64_t kept = std::min(window_samples_ - 1, buffered);
+  if (kept < buffered) {
+    std::copy(buffer_.begin() + (buffered - kept),
+              buffer_.begin() + buffered, buffer_.begin());
+  }
+  buffer_start_index_ += buffered - kept;
+  carried_ = kept;
+  horizon_fill_ = 0;
+  decided_ = false;
+  // Summing the carried samples again, rather than sliding the running total
+  // forever, stops float rounding from building up over a long stream.
+  current_volume_sum_ = 0.0f;
+  for (int64_t i = 0; i < kept; ++i) {
+    current_volume_sum_ += fabsf(buffer_[i]);
+  }
+  loudest_volume_ = 0.0f;
+  loudest_last_index_ = -1;
+}
+
+void OnlineLoudestDetector::Decide() {
+  if (loudest_last_index_ == -1) {
+    // The stream so far is shorter than one window, so all of it is returned.
+    decision_.start_index = buffer_start_index_;
+    decision_.volume = current_volume_sum_;
+    decision_.samples = buffer_.data();
+    decision_.sample_count = carried_ + horizon_fill_;
+  } else {
+    const int64_t loudest_start_index =
+        (loudest_last_index_ - window_samples_) + 1;
+    decision_.start_index = buffer_start_index_ + loudest_start_index;
+    decision_.volume = loudest_volume_;
+    decision_.samples = buffer_.data() + loudest_start_index;
+    decision_.sample_count = window_samples_;
+  }
+  decided_ = true;
+}
@@ -0,0 +1,298 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Functions to find the loudest section of a run of audio samples.
+
+#ifndef LOUDEST_SECTION_H_
+#define LOUDEST_SECTION_H_
+
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "kernels.h"
+#include "span.h"
+
+// Converts a raw sample to the float volume scale used by the search, so that
+// int16 data from a file gives exactly the same results as decoding it to
+// floats first.
+inline float SampleToFloat(float value) { return value; }
+inline float SampleToFloat(int16_t value) {
+  constexpr float kMultiplier = 1.0f / (1 << 15);
+  return value * kMultiplier;
+}
+inline float SampleToFloat(int32_t value) {
+  constexpr float kMultiplier = 1.0f / (1ll << 31);
+  return value * kMultiplier;
+}
+
+// The half-open range of sample positions [start, end).
+struct SegmentRange {
+  int64_t start;
+  int64_t end;
+
+  int64_t size() const { return end - start; }
+};
+
+// The flat whole-file and streaming searches score a window by the sum of its
+// volumes, keep the earliest of any equally loud ones, and report it through
+// this, given the position of its last sample. The reported window ends at
+// that sample rather than just after it, apart from the very first window,
+// which is how the original search has always placed it.
+inline SegmentRange LoudestWindowRange(int64_t last_index,
+                                       int64_t desired_samples) {
+  const int64_t end_index =
+      (last_index == (desired_samples - 1)) ? desired_samples : last_index;
+  return SegmentRange{end_index - desired_samples, end_index};
+}
+
+// Finds the window of desired_samples with the highest total volume in the
+// input, and returns where it is. The volume of a sample is its absolute
+// value. If the input is shorter than the window, the
+// whole input is returned. This works on any sample type that SampleToFloat()
+// handles, and never copies the samples, so it can be run directly on
+// memory-mapped or network data.
+template <class T>
+SegmentRange FindLoudestSegment(Span<const T> input, int64_t desired_samples) {
+  const int64_t input_size = input.size();
+  if (desired_samples >= input_size) {
+    return SegmentRange{0, input_size};
+  }
+
+  // The running sum has to be updated in order to give exact results, but the
+  // volumes feeding it are worked out a block at a time by the vector kernels.
+  constexpr int64_t kBlockSize = 256;
+  float leading_volumes[kBlockSize];
+  float trailing_volumes[kBlockSize];
+  float current_volume_sum = 0.0f;
+  for (int64_t block_start = 0; block_start < desired_samples;
+       block_start += kBlockSize) {
+    const int64_t block_size =
+        std::min(kBlockSize, desired_samples - block_start);
+    ComputeVolumes(input.data() + block_start, block_size, leading_volumes);
+    for (int64_t j = 0; j < block_size; ++j) {
+      current_volume_sum += leading_volumes[j];
+    }
+  }
+  int64_t loudest_last_index = desired_samples - 1;
+  float loudest_volume = current_volume_sum;
+  for (int64_t block_start = desired_samples; block_start < input_size;
+       block_start += kBlockSize) {
+    const int64_t block_size = std::min(kBlockSize, input_size - block_start);
+    ComputeVolumes(input.data() + block_start - desired_samples, block_size,
+                   trailing_volumes);
+    ComputeVolumes(input.data() + block_start, block_size, leading_volumes);
+    for (int64_t j = 0; j < block_size; ++j) {
+      current_volume_sum -= trailing_volumes[j];
+      current_volume_sum += leading_volumes[j];
+      if (current_volume_sum > loudest_volume) {
+        loudest_volume = current_volume_sum;
+        loudest_last_index = block_start + j;
+      }
+    }
+  }
+  return LoudestWindowRange(loudest_last_index, desired_samples);
+}
+
+// Copies the samples in range out of the input, converting them to floats.
+// output must have room for range.size() values.
+template <class T>
+void ExtractSegment(Span<const T> input, SegmentRange range, float* output) {
+  for (int64_t i = range.start; i < range.end; ++i) {
+    *output++ = SampleToFloat(input[i]);
+  }
+}
+
+// Convenience wrapper that finds the loudest window and copies it into output.
+void TrimToLoudestSegment(const std::vector<float>& input,
+                          int64_t desired_samples, std::vector<float>* output);
+
+// Searches interleaved 16-bit PCM frames using exact integer sums. The volume
+// of a frame is the absolute value of the sum of its channels, which ranks
+// windows exactly as the float search on the downmixed signal would with
+// infinite precision, but without any rounding error. That means the result
+// can't drift over very long recordings, and the work can be split across
+// thread_count threads while still giving exactly the same answer as a
+// single thread, ties included. The returned range is in frames.
+SegmentRange FindLoudestSegmentLin16(Span<const int16_t> input,
+                                     int channel_count, int64_t desired_frames,
+                                     int thread_count);
+
+// Performs the same search as FindLoudestSegmentLin16() on clip_count clips
+// that share a window size, and writes the range for inputs[i] to ranges[i].
+// The clips are taken kSearchBatchLanes at a time, each with its own lane of
+// the slide_window_batch kernel, so all of their windows advance together in
+// vector registers. For short clips, where a single search is over in a few
+// thousand steps, that spreads the loop overhead across the batch. Clips can
+// have different lengths and channel counts, and the results are exactly
+// those of separate searches, ties included.
+//
+// Example usage:
+//
+// std::vector<Span<const int16_t>> inputs;
+// std::vector<int> channel_counts;
+// // Add each clip's samples and channel count.
+// std::vector<SegmentRange> ranges(inputs.size());
+// FindLoudestSegmentsLin16Batch(inputs.data(), channel_counts.data(),
+//                               inputs.size(), 16000, ranges.data());
+void FindLoudestSegmentsLin16Batch(const Span<const int16_t>* inputs,
+                                   const int* channel_counts, int clip_count,
+                                   int64_t desired_frames,
+                                   SegmentRange* ranges);
+
+// A search over the volumes of frames that arrive a block at a time, where
+// the volume of a frame is the absolute value of the sum of its channels.
+// The decoders drive these without knowing how the windows are scored.
+class WindowSearch {
+ public:
+  virtual ~WindowSearch() {}
+
+  // Returns true if a window ending in these frames, or at most latency()
+  // frames before them, is now the loudest.
+  virtual bool AddVolumes(const int64_t* volumes, int64_t count) = 0;
+  // Scores any windows that are still waiting once all of the frames have
+  // been added, with the same meaning for the result as AddVolumes().
+  virtual bool Finish() = 0;
+
+  virtual SegmentRange loudest() const = 0;
+  virtual int64_t frames_seen() const = 0;
+  // How many frames can go by before a window that ends with them is scored.
+  virtual int64_t latency() const = 0;
+};
+
+// Runs a search over interleaved 16-bit frames that are all in memory, and
+// returns the loudest window.
+SegmentRange SearchLin16Frames(Span<const int16_t> input, int channel_count,
+                               WindowSearch* search);
+
+// Performs the same search as FindLoudestSegmentLin16(), but on the volumes
+// of frames that arrive a block at a time, for sources where the samples
+// themselves can't be kept around, like compressed files. Only a window's
+// worth of volumes is held, in a caller-owned ring of desired_frames values.
+//
+// Example usage:
+//
+// std::vector<int64_t> ring(16000);
+// SlidingLoudestWindow search(16000, ring.data());
+// while (...) {
+//   if (search.AddVolumes(volumes, count)) {
+//     // Note where search.loudest().start can be found again.
+//   }
+// }
+// const SegmentRange range = search.loudest();
+class SlidingLoudestWindow : public WindowSearch {
+ public:
+  SlidingLoudestWindow(int64_t desired_frames, int64_t* ring);
+
+  // Returns true if a window ending in these frames is now the loudest.
+  bool AddVolumes(const int64_t* volumes, int64_t count) override;
+  // Every window is scored as soon as its last frame arrives.
+  bool Finish() override { return false; }
+
+  SegmentRange loudest() const override;
+  int64_t frames_seen() const override { return frames_seen_; }
+  int64_t latency() const override { return 0; }
+
+ private:
+  const int64_t desired_frames_;
+  int64_t* ring_;
+  int64_t frames_seen_;
+  int64_t volume_sum_;
+  int64_t loudest_volume_;
+  int64_t loudest_last_index_;
+};
+
+// Describes the loudest window found within one horizon of a live stream.
+struct LoudestWindowDecision {
+  // Position of the first sample of the window, counted from the start of the
+  // stream. Unlike the whole-file searches, which report through
+  // LoudestWindowRange(), this is exactly the window that was scored.
+  int64_t start_index;
+  // Sum of the absolute sample values in the window, which is what
+  // FindLoudestSegment() compares windows by.
+  float volume;
+  // Points into the detector's own buffer, so it's only valid until the next
+  // call to AddSamples().
+  const float* samples;
+  int64_t sample_count;
+};
+
+// Picks the loudest window from a live stream, such as a microphone, within a
+// bounded delay. The stream is cut into consecutive horizons of
+// horizon_samples, and as soon as each one is complete the loudest window
+// ending inside it is reported. The last window_samples - 1 samples of each
+// horizon are carried over into the next one, so every window position in the
+// stream is scored, and a window that straddles a boundary is decided on by
+// the horizon it ends in. Decisions are never more than horizon_samples late,
+// and neighboring decisions may overlap by up to window_samples - 1 samples.
+// All memory is allocated up front, and each sample costs a constant amount of
+// amortized work regardless of the window or horizon size.
+//
+// Example usage:
+//
+// OnlineLoudestDetector detector(16000, 48000);
+// while (...) {
+//   const float* block = ...;
+//   int64_t left = block_size;
+//   while (left > 0) {
+//     bool has_decision;
+//     const int64_t used = detector.AddSamples(block, left, &has_decision);
+//     if (has_decision) {
+//       // Use detector.decision().
+//     }
+//     block += used;
+//     left -= used;
+//   }
+// }
+class OnlineLoudestDetector {
+ public:
+  OnlineLoudestDetector(int64_t window_samples, int64_t horizon_samples);
+
+  // Consumes samples until either they run out or a horizon closes, in which
+  // case has_decision is set to true and no more are consumed, so the caller
+  // can look at decision() before the buffer is reused. Returns the number of
+  // samples consumed.
+  int64_t AddSamples(const float* samples, int64_t count, bool* has_decision);
+
+  // Closes the current horizon early, for example at the end of a recording.
+  // Returns false if there are no samples waiting to be decided on.
+  bool Flush();
+
+  const LoudestWindowDecision& decision() const { return decision_; }
+
+ private:
+  void CarryOver();
+  void Decide();
+
+  const int64_t window_samples_;
+  const int64_t horizon_samples_;
+  // Holds the samples carried over from the previous horizon, followed by the
+  // ones added since.
+  std::vector<float> buffer_;
+  int64_t buffer_start_index_;
+  int64_t carried_;
+  int64_t horizon_fill_;
+  bool decided_;
+  float current_volume_sum_;
+  float loudest_volume_;
+  // Buffer position of the last sample of the loudest window so far, or -1 if
+  // no complete window has been seen in this horizon.
+  int64_t loudest_last_index_;
+  LoudestWindowDecision decision_;
+};
+
+#endif  // LOUDEST_SECTION_H_
@@ -14,141 +14,1154 @@
  ==============================================================================*/
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <glob.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <set>
+#include <thread>
 #include <vector>
 
+#include "archive.h"
+#include "arena.h"
+#include "audio_features.h"
+#include "bounded_queue.h"
+#include "corpus_scan.h"
+#include "flac_decoder.h"
+#include "flac_encoder.h"
+#include "flac_format.h"
+#include "gzip_reader.h"
+#include "heap_stats.h"
+#include "kernels.h"
+#include "loudest_section.h"
+#include "mapped_region_guard.h"
+#include "numa.h"
+#include "output_layout.h"
+#include "reorder_buffer.h"
 #include "wav_io.h"
+#include "wav_stream.h"
+#include "weighted_window.h"
+#include "work_queue.h"
+#include "zstd_reader.h"
 
 class MemMappedFile {
  public:
-  MemMappedFile(const std::string& filename) {
+  // If drop_cache is true, the file's pages are evicted from the page cache
+  // once it's unmapped, so reading a big corpus once doesn't push out data
+  // that other programs on the machine will read again.
+  MemMappedFile(const std::string& filename, bool drop_cache = false)
+      : filesize_(0), fd_(-1), data_(nullptr), drop_cache_(drop_cache) {
     const char* c_filename = filename.c_str();
+    fd_ = open(c_filename, O_RDONLY, 0);
+    if (fd_ == -1) {
+      status_ = errors::NotFound("Couldn't open '", filename, "': ",
+                                 strerror(errno));
+      return;
+    }
     struct stat st;
-    stat(c_filename, &st);
+    if (fstat(fd_, &st) != 0) {
+      status_ = errors::Internal("Couldn't stat '", filename, "': ",
+                                 strerror(errno));
+      return;
+    }
     filesize_ = st.st_size;
-    fd_ = open(c_filename, O_RDONLY, 0);
-    data_ = reinterpret_cast<uint8_t*>(
-        mmap(NULL, filesize_, PROT_READ, MAP_PRIVATE, fd_, 0));
-    assert(fd_ != -1);
-    // Execute mmap
-    if (data_ == MAP_FAILED) {
-      fprintf(stderr, "mmap() failed with %p for '%s'\n", data_, filename.c_str());
+    if (filesize_ == 0) {
+      status_ = errors::InvalidArgument("'", filename, "' is empty");
+      return;
+    }
+    void* mapped = mmap(NULL, filesize_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (mapped == MAP_FAILED) {
+      status_ = errors::Internal("mmap() failed for '", filename, "': ",
+                                 strerror(errno));
+      return;
     }
-    assert(data_ != MAP_FAILED);
+    data_ = reinterpret_cast<uint8_t*>(mapped);
   }
   ~MemMappedFile() {
-    int rc = munmap(data_, filesize_);
-    assert(rc == 0);
-    close(fd_);
+    if (data_ != nullptr) {
+      int rc = munmap(data_, filesize_);
+      assert(rc == 0);
+    }
+    if (fd_ != -1) {
+      // The kernel skips pages that are still mapped, so this has to come
+      // after munmap().
+      if (drop_cache_) {
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+      }
+      close(fd_);
+    }
+  }
+
+  const Status& status() const { return status_; }
+
+  // Closes the file but keeps it mapped, for files that stay mapped for the
+  // whole run, so that thousands of them don't use up the process's limit on
+  // open descriptors.
+  void CloseDescriptor() {
+    if (fd_ != -1) {
+      close(fd_);
+      fd_ = -1;
+    }
   }
 
   size_t filesize_;
   int fd_;
   uint8_t* data_;
+
+ private:
+  bool drop_cache_;
+  Status status_;
 };
 
-void TrimToLoudestSegment(const std::vector<float>& input,
-                          int64_t desired_samples, std::vector<float>* output) {
-  const int64_t input_size = input.size();
-  if (desired_samples >= input_size) {
-    *output = input;
+// Asks the kernel to start reading a file into the page cache in the
+// background, so it's already there by the time a worker maps it. Failures
+// are ignored, since the file will still be read when it's needed.
+void AdviseWillNeed(const std::string& filename) {
+  const int fd = open(filename.c_str(), O_RDONLY, 0);
+  if (fd == -1) {
+    return;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  close(fd);
+}
+
+// An archive that's mapped for the whole run, so its members can be read in
+// place.
+struct Archive {
+  std::string filename;
+  std::unique_ptr<MemMappedFile> file;
+};
+
+// Where an input's bytes are if it's a member of an archive, rather than a
+// file of its own, in which case archive is null.
+struct ArchiveSlice {
+  const Archive* archive;
+  uint64_t offset;
+  uint64_t size;
+};
+
+// Page-aligned bounds of a slice, either rounded out to cover all of it, or in
+// to cover only the pages no other member shares.
+void SlicePages(const ArchiveSlice& slice, bool inner, uint8_t** start,
+                size_t* length) {
+  const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  const uintptr_t begin =
+      reinterpret_cast<uintptr_t>(slice.archive->file->data_) + slice.offset;
+  const uintptr_t end = begin + slice.size;
+  const uintptr_t page_begin =
+      inner ? ((begin + page_size - 1) & ~(page_size - 1))
+            : (begin & ~(page_size - 1));
+  const uintptr_t page_end = inner ? (end & ~(page_size - 1)) : end;
+  *start = reinterpret_cast<uint8_t*>(page_begin);
+  *length = (page_end > page_begin) ? (page_end - page_begin) : 0;
+}
+
+// The same as above, for a member of a mapped archive.
+void AdviseWillNeed(const ArchiveSlice& slice) {
+  uint8_t* start;
+  size_t length;
+  SlicePages(slice, false, &start, &length);
+  madvise(start, length, MADV_WILLNEED);
+}
+
+// Evicts a member's pages from the page cache once it's been processed, for
+// --drop_cache. The kernel keeps pages that are still mapped, so they're
+// dropped from the mapping first. Pages shared with the neighbouring members
+// are left alone, since another worker may be reading them.
+void DropCachedPages(const ArchiveSlice& slice) {
+  uint8_t* start;
+  size_t length;
+  SlicePages(slice, true, &start, &length);
+  if (length == 0) {
     return;
   }
+  madvise(start, length, MADV_DONTNEED);
+  const int fd = open(slice.archive->filename.c_str(), O_RDONLY, 0);
+  if (fd == -1) {
+    return;
+  }
+  posix_fadvise(fd, start - slice.archive->file->data_, length,
+                POSIX_FADV_DONTNEED);
+  close(fd);
+}
 
-  float current_volume_sum = 0.0f;
-  for (int64_t i = 0; i < desired_samples; ++i) {
-    const float input_value = input[i];
-    current_volume_sum += fabsf(input_value * input_value);
+// Writes the data out to a new file, replacing anything already there.
+Status WriteWholeFile(const std::string& filename, const char* data,
+                      size_t data_size) {
+  const int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd == -1) {
+    return errors::Unavailable("Couldn't open '", filename,
+                               "' for writing: ", strerror(errno));
   }
-  int64_t loudest_end_index = desired_samples;
-  float loudest_volume = current_volume_sum;
-  for (int64_t i = desired_samples; i < input_size; ++i) {
-    const float trailing_value = input[i - desired_samples];
-    current_volume_sum -= fabsf(trailing_value);
-    const float leading_value = input[i];
-    current_volume_sum += fabsf(leading_value);
-    if (current_volume_sum > loudest_volume) {
-      loudest_volume = current_volume_sum;
-      loudest_end_index = i;
+  while (data_size > 0) {
+    const ssize_t written = write(fd, data, data_size);
+    if ((written == -1) && (errno == EINTR)) {
+      continue;
     }
+    if (written <= 0) {
+      const int write_errno = errno;
+      close(fd);
+      return errors::Unavailable("Writing to '", filename,
+                                 "' failed: ", strerror(write_errno));
+    }
+    data += written;
+    data_size -= written;
   }
-  const int64_t loudest_start_index = loudest_end_index - desired_samples;
-  output->resize(desired_samples);
-  std::copy(input.begin() + loudest_start_index,
-            input.begin() + loudest_end_index, output->begin());
+  close(fd);
+  return Status::OK();
 }
 
-Status TrimFile(const std::string& input_filename,
-                const std::string& output_filename,
-                const int64_t desired_length_ms,
-		const float min_volume) {
-  MemMappedFile input_file(input_filename);
+// Creates a file of a fixed size and maps it, so its contents can be written
+// in place rather than built in memory and then copied out with write(). The
+// blocks are allocated up front where the filesystem allows it, so running out
+// of space is reported here instead of faulting partway through.
+//
+// Example usage:
+//
+// MappedOutputFile output(filename, size);
+// TF_RETURN_IF_ERROR(output.status());
+// memcpy(output.data(), contents, size);
+// TF_RETURN_IF_ERROR(output.Close());
+class MappedOutputFile {
+ public:
+  // The filename is used for error messages, and has to outlive this, which
+  // saves copying it for every file.
+  MappedOutputFile(const std::string& filename, size_t size)
+      : filename_(filename), size_(size), fd_(-1), data_(nullptr) {
+    fd_ = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd_ == -1) {
+      status_ = errors::Unavailable("Couldn't open '", filename,
+                                    "' for writing: ", strerror(errno));
+      return;
+    }
+    if (size_ == 0) {
+      return;
+    }
+    if (ftruncate(fd_, size_) != 0) {
+      status_ = errors::Unavailable("Couldn't resize '", filename, "' to ",
+                                    size_, " bytes: ", strerror(errno));
+      return;
+    }
+    // ftruncate() only makes a sparse file, with no blocks behind it yet.
+    const int allocate_error = posix_fallocate(fd_, 0, size_);
+    if ((allocate_error != 0) && (allocate_error != EINVAL) &&
+        (allocate_error != EOPNOTSUPP)) {
+      status_ = errors::Unavailable("Couldn't allocate ", size_,
+                                    " bytes for '", filename,
+                                    "': ", strerror(allocate_error));
+      return;
+    }
+    // Every byte is about to be written, so all the pages are set up at once
+    // rather than faulted in one by one.
+    void* mapped = mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd_, 0);
+    if (mapped == MAP_FAILED) {
+      status_ = errors::Internal("mmap() failed for '", filename, "': ",
+                                 strerror(errno));
+      return;
+    }
+    data_ = reinterpret_cast<char*>(mapped);
+  }
+  // A file that wasn't closed is incomplete, so it's emptied rather than left
+  // looking like a whole file of zeros.
+  ~MappedOutputFile() {
+    if (fd_ != -1) {
+      Unmap();
+      if (ftruncate(fd_, 0) != 0) {
+        std::cerr << "Couldn't empty the incomplete '" << filename_
+                  << "': " << strerror(errno) << std::endl;
+      }
+    }
+    Close();
+  }
 
-  std::vector<float> wav_samples;
-  uint32_t sample_count;
+  const Status& status() const { return status_; }
+  char* data() { return data_; }
+  size_t size() const { return size_; }
+
+  // Unmaps and closes the file. Like write(), this leaves the contents in the
+  // page cache for the kernel to write back later.
+  Status Close() {
+    Unmap();
+    if ((fd_ != -1) && (close(fd_) != 0) && status_.ok()) {
+      status_ = errors::Unavailable("Closing '", filename_, "' failed: ",
+                                    strerror(errno));
+    }
+    fd_ = -1;
+    return status_;
+  }
+
+ private:
+  void Unmap() {
+    if ((data_ != nullptr) && (munmap(data_, size_) != 0) && status_.ok()) {
+      status_ = errors::Internal("munmap() failed for '", filename_, "': ",
+                                 strerror(errno));
+    }
+    data_ = nullptr;
+  }
+
+  const std::string& filename_;
+  const size_t size_;
+  int fd_;
+  char* data_;
+  Status status_;
+
+  MappedOutputFile(const MappedOutputFile&) = delete;
+  void operator=(const MappedOutputFile&) = delete;
+};
+
+// Encodes a mono clip as a WAV straight into a mapping of its output file, so
+// there's no buffer in between.
+Status WriteWavInPlace(const std::string& filename, const float* samples,
+                       int64_t sample_count, uint32_t sample_rate) {
+  const size_t size = S16LEWavSize(1, sample_count);
+  MappedOutputFile output(filename, size);
+  TF_RETURN_IF_ERROR(output.status());
+  MappedRegionGuard guard(output.data(), size);
+  TF_RETURN_IF_ERROR(EncodeAudioAsS16LEWav(samples, sample_rate, 1,
+                                           sample_count, output.data(), size));
+  if (guard.faulted()) {
+    return errors::Unavailable("Ran out of space while writing '", filename,
+                               "'");
+  }
+  return output.Close();
+}
+
+enum class OutputFormat { kWav, kFlac };
+
+// Compresses a mono clip into an arena buffer in the chosen format.
+Status EncodeClip(const float* samples, int64_t sample_count,
+                  uint32_t sample_rate, OutputFormat format, Arena* arena,
+                  char** data, size_t* data_size) {
+  if (format == OutputFormat::kWav) {
+    *data_size = S16LEWavSize(1, sample_count);
+    *data = arena->AllocateArray<char>(*data_size);
+    TF_RETURN_IF_ERROR(arena->status());
+    return EncodeAudioAsS16LEWav(samples, sample_rate, 1, sample_count, *data,
+                                 *data_size);
+  }
+  // The FLAC encoder works on integers, so round the clip to 16 bits first,
+  // the same way the WAV writer does.
+  int16_t* lin16_samples = arena->AllocateArray<int16_t>(sample_count);
+  const size_t max_size = FlacMaxSize(1, sample_count);
+  *data = arena->AllocateArray<char>(max_size);
+  TF_RETURN_IF_ERROR(arena->status());
+  GetAudioKernels().encode_lin16(samples, sample_count,
+                                 reinterpret_cast<char*>(lin16_samples));
+  return EncodeLin16AsFlac(lin16_samples, sample_rate, 1, sample_count, arena,
+                           *data, max_size, data_size);
+}
+
+// A time budget for one file. It's checked between the stages of processing,
+// so a file that takes too long gives up at the next stage boundary instead of
+// holding up the worker for the rest of the batch.
+class Deadline {
+ public:
+  // A timeout of zero or less means there's no limit.
+  explicit Deadline(int64_t timeout_ms)
+      : has_limit_(timeout_ms > 0),
+        timeout_ms_(timeout_ms),
+        end_(std::chrono::steady_clock::now() +
+             std::chrono::milliseconds(std::max<int64_t>(0, timeout_ms))) {}
+
+  Status Check(const std::string& filename) const {
+    if (has_limit_ && (std::chrono::steady_clock::now() > end_)) {
+      return errors::DeadlineExceeded("Gave up on '", filename, "' after ",
+                                      timeout_ms_, "ms");
+    }
+    return Status::OK();
+  }
+
+ private:
+  bool has_limit_;
+  int64_t timeout_ms_;
+  std::chrono::steady_clock::time_point end_;
+};
+
+// Sets up a block-at-a-time search in the arena. The flat search sums
+// integers exactly, and the weighted ones share a plan for each window size.
+// Returns nullptr if the arena ran out of memory.
+WindowSearch* NewWindowSearch(const WindowShape& window_shape,
+                              int64_t desired_frames, Arena* arena) {
+  if ((window_shape.weighting == WindowWeighting::kFlat) ||
+      (desired_frames <= 0)) {
+    int64_t* ring =
+        arena->AllocateArray<int64_t>(std::max<int64_t>(1, desired_frames));
+    void* search = arena->AllocateArray<SlidingLoudestWindow>(1);
+    if (!arena->status().ok()) {
+      return nullptr;
+    }
+    return new (search) SlidingLoudestWindow(desired_frames, ring);
+  }
+  void* search = arena->AllocateArray<WeightedLoudestWindow>(1);
+  if (search == nullptr) {
+    return nullptr;
+  }
+  WeightedLoudestWindow* weighted = new (search) WeightedLoudestWindow(
+      WeightedWindowPlan::Get(window_shape, desired_frames), arena);
+  // The search's own buffers come from the arena too.
+  return arena->status().ok() ? weighted : nullptr;
+}
+
+// The loudest section of a file, decoded and downmixed to mono. If padding was
+// asked for, up to that many samples either side of it are decoded too, for
+// cutting crops, and are readable from samples - samples_before up to
+// samples + sample_count + samples_after.
+struct LoudestClip {
+  float* samples;
+  int64_t sample_count;
+  int64_t desired_samples;
+  uint32_t sample_rate;
+  int64_t samples_before;
+  int64_t samples_after;
+};
+
+Status ExtractLoudestFromWav(const std::string& input_filename,
+                             const uint8_t* data, size_t size,
+                             const int64_t desired_length_ms,
+                             const int64_t padding_ms, int search_threads,
+                             const WindowShape& window_shape,
+                             const Deadline& deadline, std::ostream* log,
+                             Arena* arena, LoudestClip* clip) {
+  int64_t sample_count;
   uint16_t channel_count;
   uint32_t sample_rate;
-  Status load_wav_status = DecodeLin16WaveAsFloatVector(
-      input_file.data_, input_file.filesize_, &wav_samples, &sample_count,
-      &channel_count, &sample_rate);
+  const uint8_t* sample_data;
+  Status load_wav_status =
+      FindLin16WaveSamples(data, size, &sample_count, &channel_count,
+                           &sample_rate, &sample_data);
   if (!load_wav_status.ok()) {
-    std::cerr << "Failed to decode '" << input_filename
+    *log << "Failed to decode '" << input_filename
               << "' as a WAV: " << load_wav_status << std::endl;
     return load_wav_status;
   }
+  const int64_t desired_samples = (desired_length_ms * sample_rate) / 1000;
+  TF_RETURN_IF_ERROR(deadline.Check(input_filename));
 
-  // If we have a stereo or more recording, convert it down to mono.
+  // The search runs straight on the 16-bit data, and then only the winning
+  // window needs decoding and downmixing.
+  const int64_t value_count = static_cast<int64_t>(sample_count) * channel_count;
+  const int16_t* file_samples = reinterpret_cast<const int16_t*>(sample_data);
+  if ((reinterpret_cast<uintptr_t>(sample_data) % alignof(int16_t)) != 0) {
+    int16_t* aligned_samples = arena->AllocateArray<int16_t>(value_count);
+    TF_RETURN_IF_ERROR(arena->status());
+    memcpy(aligned_samples, sample_data, value_count * sizeof(int16_t));
+    file_samples = aligned_samples;
+  }
+  const Span<const int16_t> file_span(file_samples, value_count);
+  SegmentRange range;
+  if (window_shape.weighting == WindowWeighting::kFlat) {
+    range = FindLoudestSegmentLin16(file_span, channel_count, desired_samples,
+                                    search_threads);
+  } else {
+    WindowSearch* search =
+        NewWindowSearch(window_shape, desired_samples, arena);
+    TF_RETURN_IF_ERROR(arena->status());
+    range = SearchLin16Frames(file_span, channel_count, search);
+  }
+  TF_RETURN_IF_ERROR(deadline.Check(input_filename));
+  const int64_t padding = (padding_ms * sample_rate) / 1000;
+  const int64_t decode_start = std::max<int64_t>(0, range.start - padding);
+  const int64_t decode_end =
+      std::min<int64_t>(sample_count, range.end + padding);
+  const int64_t decode_count = decode_end - decode_start;
+  float* trimmed_samples =
+      arena->AllocateArray<float>(decode_count * channel_count);
+  TF_RETURN_IF_ERROR(arena->status());
+  DecodeLin16Samples(
+      reinterpret_cast<const uint8_t*>(file_samples +
+                                       (decode_start * channel_count)),
+      decode_count * channel_count, trimmed_samples);
+  // Each mono value only depends on the frame at or after its own position,
+  // so this can be done in place.
   if (channel_count != 1) {
-    const int mono_sample_count = sample_count / channel_count;
-    std::vector<float> mono_samples(mono_sample_count);
-    for (int i = 0; i < mono_sample_count; ++i) {
-      const int frame_index = i * channel_count;
+    GetAudioKernels().downmix(trimmed_samples, decode_count, channel_count,
+                              trimmed_samples);
+  }
+  clip->samples = trimmed_samples + (range.start - decode_start);
+  clip->sample_count = range.size();
+  clip->desired_samples = desired_samples;
+  clip->sample_rate = sample_rate;
+  clip->samples_before = range.start - decode_start;
+  clip->samples_after = decode_end - range.end;
+  return Status::OK();
+}
+
+// Searches a FLAC file one frame at a time, keeping only the volumes of the
+// last window's worth of frames. Whenever the loudest window moves, the FLAC
+// frame its start falls in is remembered, so afterwards only the frames that
+// overlap the winner have to be decoded again, at their full bit depth.
+Status ExtractLoudestFromFlac(const std::string& input_filename,
+                              const uint8_t* data, size_t size,
+                              const int64_t desired_length_ms,
+                              const int64_t padding_ms,
+                              const WindowShape& window_shape,
+                              const Deadline& deadline, std::ostream* log,
+                              Arena* arena, LoudestClip* clip) {
+  FlacDecoder decoder(data, size);
+  Status header_status = decoder.ReadHeader();
+  if (!header_status.ok()) {
+    *log << "Failed to decode '" << input_filename
+              << "' as a FLAC: " << header_status << std::endl;
+    return header_status;
+  }
+  const int channel_count = decoder.channel_count();
+  const int max_block_size = decoder.max_block_size();
+  const int64_t desired_samples =
+      (desired_length_ms * decoder.sample_rate()) / 1000;
+  const int64_t padding = (padding_ms * decoder.sample_rate()) / 1000;
+  int32_t* block = arena->AllocateArray<int32_t>(channel_count * max_block_size);
+  int64_t* volumes = arena->AllocateArray<int64_t>(max_block_size);
+  WindowSearch* search =
+      NewWindowSearch(window_shape, desired_samples, arena);
+  TF_RETURN_IF_ERROR(arena->status());
+  // Where each of the recent FLAC frames started. Blocks are at least 16
+  // frames long, apart from the last, so this covers more than a window, its
+  // padding, and however late the search finds it.
+  const int64_t recent_count =
+      ((desired_samples + padding + max_block_size + search->latency()) /
+       16) + 2;
+  FlacSeekPoint* recent = arena->AllocateArray<FlacSeekPoint>(recent_count);
+  TF_RETURN_IF_ERROR(arena->status());
+  int64_t recent_total = 0;
+  FlacSeekPoint loudest_start = decoder.position();
+  // Remembers the FLAC frame the new loudest window's padding starts in.
+  auto note_loudest_start = [&]() {
+    const int64_t start =
+        std::max<int64_t>(0, search->loudest().start - padding);
+    for (int64_t k = recent_total - 1;
+         (k >= 0) && (k >= (recent_total - recent_count)); --k) {
+      if (recent[k % recent_count].first_frame <= start) {
+        loudest_start = recent[k % recent_count];
+        break;
+      }
+    }
+  };
+
+  while (true) {
+    const FlacSeekPoint point = decoder.position();
+    int block_size;
+    TF_RETURN_IF_ERROR(decoder.ReadFrame(block, &block_size));
+    if (block_size == 0) {
+      break;
+    }
+    recent[recent_total % recent_count] = point;
+    ++recent_total;
+    for (int i = 0; i < block_size; ++i) {
+      int64_t total = 0;
+      for (int c = 0; c < channel_count; ++c) {
+        total += block[(c * max_block_size) + i];
+      }
+      volumes[i] = llabs(total);
+    }
+    if (search->AddVolumes(volumes, block_size)) {
+      note_loudest_start();
+    }
+    TF_RETURN_IF_ERROR(deadline.Check(input_filename));
+  }
+  if (search->Finish()) {
+    note_loudest_start();
+  }
+
+  const SegmentRange range = search->loudest();
+  const int64_t decode_start = std::max<int64_t>(0, range.start - padding);
+  const int64_t decode_end =
+      std::min<int64_t>(search->frames_seen(), range.end + padding);
+  float* trimmed_samples =
+      arena->AllocateArray<float>(decode_end - decode_start);
+  TF_RETURN_IF_ERROR(arena->status());
+  const float scale = 1.0f / (1 << (decoder.bits_per_sample() - 1));
+  decoder.Seek(loudest_start);
+  while (true) {
+    const int64_t first_frame = decoder.position().first_frame;
+    if (first_frame >= decode_end) {
+      break;
+    }
+    int block_size;
+    TF_RETURN_IF_ERROR(decoder.ReadFrame(block, &block_size));
+    if (block_size == 0) {
+      break;
+    }
+    const int64_t begin = std::max(decode_start, first_frame);
+    const int64_t end = std::min(decode_end, first_frame + block_size);
+    // Matches converting to floats and then downmixing, as for WAVs.
+    for (int64_t i = begin; i < end; ++i) {
       float total = 0.0f;
       for (int c = 0; c < channel_count; ++c) {
-    	total += wav_samples[frame_index + c];
+        total += block[(c * max_block_size) + (i - first_frame)] * scale;
       }
-      mono_samples[i] = total / channel_count;
+      trimmed_samples[i - decode_start] = total / channel_count;
     }
-    wav_samples = mono_samples;
   }
+  clip->samples = trimmed_samples + (range.start - decode_start);
+  clip->sample_count = range.size();
+  clip->desired_samples = desired_samples;
+  clip->sample_rate = decoder.sample_rate();
+  clip->samples_before = range.start - decode_start;
+  clip->samples_after = decode_end - range.end;
+  return Status::OK();
+}
+
+// Copies frames [begin, end) between a ring buffer, where frame i lives in slot
+// i % ring_frames, and a flat array of interleaved samples.
+void CopyFromRing(const int16_t* ring, int64_t ring_frames, int channel_count,
+                  int64_t begin, int64_t end, int16_t* output) {
+  for (int64_t frame = begin; frame < end;) {
+    const int64_t slot = frame % ring_frames;
+    const int64_t run = std::min(end - frame, ring_frames - slot);
+    memcpy(output + ((frame - begin) * channel_count),
+           ring + (slot * channel_count),
+           run * channel_count * sizeof(int16_t));
+    frame += run;
+  }
+}
 
+void CopyToRing(const int16_t* input, int64_t begin, int64_t end,
+                int64_t ring_frames, int channel_count, int16_t* ring) {
+  for (int64_t frame = begin; frame < end;) {
+    const int64_t slot = frame % ring_frames;
+    const int64_t run = std::min(end - frame, ring_frames - slot);
+    memcpy(ring + (slot * channel_count),
+           input + ((frame - begin) * channel_count),
+           run * channel_count * sizeof(int16_t));
+    frame += run;
+  }
+}
+
+// Searches a WAV that can only be read as a stream, such as the output of a
+// decompressor or stdin, without ever holding the whole thing. The last
+// window, its padding and a block of frames are kept in a ring, which is big
+// enough that the loudest window's padding after it has arrived before
+// anything it needs is overwritten, and at that point its frames are copied
+// out. Since the search sees the same volumes as FindLoudestSegmentLin16(),
+// the result is identical to reading the uncompressed file.
+Status ExtractLoudestFromStream(const std::string& input_filename,
+                                ByteReader* input,
+                                const int64_t desired_length_ms,
+                                const int64_t padding_ms,
+                                const WindowShape& window_shape,
+                                const Deadline& deadline, std::ostream* log,
+                                Arena* arena, LoudestClip* clip) {
+  WavStreamReader reader(input);
+  Status header_status = reader.ReadHeader();
+  if (!header_status.ok()) {
+    *log << "Failed to decode '" << input_filename
+              << "' as a WAV: " << header_status << std::endl;
+    return header_status;
+  }
+  const int channel_count = reader.channel_count();
+  const uint32_t sample_rate = reader.sample_rate();
   const int64_t desired_samples = (desired_length_ms * sample_rate) / 1000;
-  std::vector<float> trimmed_samples;
-  TrimToLoudestSegment(wav_samples, desired_samples, &trimmed_samples);
+  const int64_t padding = (padding_ms * sample_rate) / 1000;
+  constexpr int64_t kFramesPerBlock = 4096;
+  WindowSearch* search =
+      NewWindowSearch(window_shape, desired_samples, arena);
+  TF_RETURN_IF_ERROR(arena->status());
+  const int64_t region_capacity =
+      std::max<int64_t>(1, desired_samples + (2 * padding));
+  // A weighted search can find a window a while after it has gone by, so the
+  // ring holds that much more.
+  const int64_t ring_frames =
+      region_capacity + kFramesPerBlock + search->latency();
+  int16_t* ring = arena->AllocateArray<int16_t>(ring_frames * channel_count);
+  int16_t* region =
+      arena->AllocateArray<int16_t>(region_capacity * channel_count);
+  int16_t* block =
+      arena->AllocateArray<int16_t>(kFramesPerBlock * channel_count);
+  int64_t* volumes = arena->AllocateArray<int64_t>(kFramesPerBlock);
+  TF_RETURN_IF_ERROR(arena->status());
+  // The frames the current winner needs, which until the first full window
+  // is everything so far.
+  int64_t region_start = 0;
+  int64_t region_end = desired_samples + padding;
+  bool region_saved = false;
+
+  while (true) {
+    int64_t frames_read;
+    TF_RETURN_IF_ERROR(reader.ReadFrames(block, kFramesPerBlock, &frames_read));
+    if (frames_read == 0) {
+      break;
+    }
+    const int64_t seen = search->frames_seen();
+    if (!region_saved && ((seen + frames_read) > (region_start + ring_frames))) {
+      CopyFromRing(ring, ring_frames, channel_count, region_start,
+                   std::min(region_end, seen), region);
+      region_saved = true;
+    }
+    CopyToRing(block, seen, seen + frames_read, ring_frames, channel_count,
+               ring);
+    for (int64_t i = 0; i < frames_read; ++i) {
+      int64_t total = 0;
+      for (int c = 0; c < channel_count; ++c) {
+        total += block[(i * channel_count) + c];
+      }
+      volumes[i] = llabs(total);
+    }
+    if (search->AddVolumes(volumes, frames_read)) {
+      const SegmentRange range = search->loudest();
+      region_start = std::max<int64_t>(0, range.start - padding);
+      region_end = range.end + padding;
+      region_saved = false;
+    }
+    TF_RETURN_IF_ERROR(deadline.Check(input_filename));
+  }
+  if (search->Finish()) {
+    region_saved = false;
+  }
+
+  const SegmentRange range = search->loudest();
+  const int64_t decode_start = std::max<int64_t>(0, range.start - padding);
+  const int64_t decode_end =
+      std::min<int64_t>(search->frames_seen(), range.end + padding);
+  const int64_t decode_count = decode_end - decode_start;
+  if (!region_saved) {
+    CopyFromRing(ring, ring_frames, channel_count, decode_start, decode_end,
+                 region);
+  }
+  float* trimmed_samples =
+      arena->AllocateArray<float>(decode_count * channel_count);
+  TF_RETURN_IF_ERROR(arena->status());
+  DecodeLin16Samples(reinterpret_cast<const uint8_t*>(region),
+                     decode_count * channel_count, trimmed_samples);
+  if (channel_count != 1) {
+    GetAudioKernels().downmix(trimmed_samples, decode_count, channel_count,
+                              trimmed_samples);
+  }
+  clip->samples = trimmed_samples + (range.start - decode_start);
+  clip->sample_count = range.size();
+  clip->desired_samples = desired_samples;
+  clip->sample_rate = sample_rate;
+  clip->samples_before = range.start - decode_start;
+  clip->samples_after = decode_end - range.end;
+  return Status::OK();
+}
+
+// Computes features for each clip that's saved and stores them in the shard,
+// for --features. Each worker has its own, and keeps an extractor for every
+// sample rate it has seen, since their tables depend on the rate.
+class FeatureSink {
+ public:
+  FeatureSink(const FeatureOptions& options, int frame_count,
+              FeatureShardWriter* writer)
+      : options_(options), frame_count_(frame_count), writer_(writer) {}
+
+  Status Add(int64_t clip_index, const LoudestClip& clip, Arena* arena) {
+    const float* features;
+    TF_RETURN_IF_ERROR(Compute(clip, arena, &features));
+    return writer_->Write(clip_index, features, arena);
+  }
+
+  // Sets *features to the clip's features in an arena buffer, to be written
+  // later.
+  Status Compute(const LoudestClip& clip, Arena* arena,
+                 const float** features) {
+    const FeatureExtractor* extractor = nullptr;
+    for (const std::unique_ptr<FeatureExtractor>& candidate : extractors_) {
+      if (candidate->sample_rate() == clip.sample_rate) {
+        extractor = candidate.get();
+        break;
+      }
+    }
+    if (extractor == nullptr) {
+      extractors_.emplace_back(
+          new FeatureExtractor(options_, clip.sample_rate));
+      extractor = extractors_.back().get();
+    }
+    float* output = arena->AllocateArray<float>(
+        static_cast<int64_t>(frame_count_) * FeaturesPerFrame(options_));
+    TF_RETURN_IF_ERROR(arena->status());
+    TF_RETURN_IF_ERROR(extractor->Compute(clip.samples, clip.sample_count,
+                                          frame_count_, arena, output));
+    *features = output;
+    return Status::OK();
+  }
+
+  FeatureShardWriter* writer() const { return writer_; }
+
+ private:
+  const FeatureOptions options_;
+  const int frame_count_;
+  FeatureShardWriter* writer_;
+  std::vector<std::unique_ptr<FeatureExtractor>> extractors_;
+};
+
+// How to cut several time-shifted crops around the loudest window, for
+// augmentation. Without a seed the offsets are spread evenly from -jitter_ms
+// to +jitter_ms, and with one they're drawn uniformly from that range.
+struct CropOptions {
+  int count = 1;
+  int64_t jitter_ms = 100;
+  bool has_seed = false;
+  uint64_t seed = 0;
+};
+
+// Mixes the bits of a 64-bit value, as in SplitMix64, so that nearby seeds and
+// file indices give unrelated offsets.
+uint64_t MixBits(uint64_t value) {
+  value += 0x9e3779b97f4a7c15ull;
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+  return value ^ (value >> 31);
+}
+
+// Returns where crop crop_index of a file starts relative to its loudest
+// window, in samples. Random offsets depend only on the seed and the file's
+// position in the input list, so they don't change with the thread count.
+int64_t CropOffset(const CropOptions& options, int64_t file_index,
+                   int crop_index, int64_t jitter) {
+  if (options.count == 1) {
+    return 0;
+  }
+  if (!options.has_seed) {
+    return -jitter + ((2 * jitter * crop_index) / (options.count - 1));
+  }
+  const uint64_t bits = MixBits(options.seed ^ MixBits(file_index) ^
+                                MixBits(~static_cast<uint64_t>(crop_index)));
+  return -jitter + static_cast<int64_t>(bits % ((2 * jitter) + 1));
+}
+
+// Everything that's saved for one input, held in the arena until it's written
+// out. A clip that was too quiet to keep has no crops.
+struct EncodedClip {
+  int crop_count;
+  // A null entry is a WAV crop that's encoded straight into its output file
+  // when it's written, from the samples in crop_samples.
+  char** crop_data;
+  size_t* crop_sizes;
+  const float** crop_samples;
+  int64_t sample_count;
+  uint32_t sample_rate;
+  // The loudest window's features, or null if they weren't asked for.
+  const float* features;
+};
+
+// Checks a clip that's been found is loud enough to keep, and encodes its crops
+// and computes its features, whichever kind of input it came from.
+Status EncodeLoudestClip(const std::string& input_filename,
+                         const LoudestClip& clip, const float min_volume,
+                         OutputFormat output_format, bool mapped_output,
+                         const CropOptions& crop_options,
+                         const Deadline& deadline, int64_t clip_index,
+                         FeatureSink* feature_sink, std::ostream* log,
+                         Arena* arena, EncodedClip* encoded) {
+  encoded->crop_count = 0;
+  encoded->features = nullptr;
+  if (clip.desired_samples < 1) {
+    Status window_status = errors::InvalidArgument(
+        "A window at ", clip.sample_rate, "Hz holds no samples");
+    *log << "Failed to decode '" << input_filename << "': " << window_status
+         << std::endl;
+    return window_status;
+  }
   float total_volume = 0.0f;
-  for (float trimmed_sample : trimmed_samples) {
-    total_volume += fabsf(trimmed_sample);
+  for (int64_t i = 0; i < clip.sample_count; ++i) {
+    total_volume += fabsf(clip.samples[i]);
   }
-  const float average_volume = total_volume / desired_samples;
+  const float average_volume = total_volume / clip.desired_samples;
   if (average_volume < min_volume) {
-    std::cerr << "Skipped '" << input_filename << "' as too quiet (" 
+    *log << "Skipped '" << input_filename << "' as too quiet ("
 	      << average_volume << ")" << std::endl;
     return Status::OK();
   }
 
-  std::string output_wav_data;
-  Status save_wav_status =
-      EncodeAudioAsS16LEWav(trimmed_samples.data(), sample_rate, 1,
-                            trimmed_samples.size(), &output_wav_data);
+  // The clip has only just been decoded, so it's still in cache.
+  if (feature_sink != nullptr) {
+    TF_RETURN_IF_ERROR(
+        feature_sink->Compute(clip, arena, &encoded->features));
+  }
 
-  std::ofstream output_file(output_filename);
-  output_file.write(output_wav_data.c_str(), output_wav_data.length());
+  // Crops near the start or end of the file are moved inwards as far as they
+  // need to be to stay within it.
+  const int64_t jitter = (crop_options.jitter_ms * clip.sample_rate) / 1000;
+  encoded->crop_data = arena->AllocateArray<char*>(crop_options.count);
+  encoded->crop_sizes = arena->AllocateArray<size_t>(crop_options.count);
+  encoded->crop_samples =
+      arena->AllocateArray<const float*>(crop_options.count);
+  TF_RETURN_IF_ERROR(arena->status());
+  encoded->sample_count = clip.sample_count;
+  encoded->sample_rate = clip.sample_rate;
+  for (int c = 0; c < crop_options.count; ++c) {
+    const int64_t offset = std::min(
+        std::max(CropOffset(crop_options, clip_index, c, jitter),
+                 -clip.samples_before),
+        clip.samples_after);
+    encoded->crop_samples[c] = clip.samples + offset;
+    if (mapped_output && (output_format == OutputFormat::kWav)) {
+      encoded->crop_data[c] = nullptr;
+      encoded->crop_sizes[c] = S16LEWavSize(1, clip.sample_count);
+      continue;
+    }
+    TF_RETURN_IF_ERROR(EncodeClip(clip.samples + offset, clip.sample_count,
+                                  clip.sample_rate, output_format, arena,
+                                  &encoded->crop_data[c],
+                                  &encoded->crop_sizes[c]));
+  }
+  TF_RETURN_IF_ERROR(deadline.Check(input_filename));
+  encoded->crop_count = crop_options.count;
+  return Status::OK();
+}
 
-  std::cerr << "Saved to '" << output_filename << "'" << std::endl;
+// Finds the loudest section of an input that's already in memory, either a
+// mapped file or a member of a mapped archive, and encodes its crops. If
+// feature_sink isn't null, the window's features are computed too.
+Status EncodeBuffer(const std::string& input_filename, const uint8_t* data,
+                    size_t size, const int64_t desired_length_ms,
+                    const float min_volume, int search_threads,
+                    const WindowShape& window_shape,
+                    OutputFormat output_format, bool mapped_output,
+                    const CropOptions& crop_options, const Deadline& deadline,
+                    int64_t clip_index, FeatureSink* feature_sink,
+                    std::ostream* log, Arena* arena, EncodedClip* encoded) {
+  encoded->crop_count = 0;
+  encoded->features = nullptr;
+  if (size == 0) {
+    return errors::InvalidArgument("'", input_filename, "' is empty");
+  }
+  // If the file shrinks underneath us, reads past its new end come back as
+  // zeros rather than a SIGBUS, and the result is thrown away below.
+  MappedRegionGuard guard(data, size);
+
+  // Everything the crops could need is decoded along with the loudest window.
+  const int64_t padding_ms =
+      (crop_options.count > 1) ? crop_options.jitter_ms : 0;
+  LoudestClip clip;
+  auto starts_with = [data, size](const char* marker, int marker_size) {
+    return (size >= static_cast<size_t>(marker_size)) &&
+           (memcmp(data, marker, marker_size) == 0);
+  };
+  if (starts_with(kFlacMarker, kFlacMarkerSize)) {
+    TF_RETURN_IF_ERROR(ExtractLoudestFromFlac(
+        input_filename, data, size,
+        desired_length_ms, padding_ms, window_shape, deadline, log, arena,
+        &clip));
+  } else if (starts_with(kGzipMarker, kGzipMarkerSize)) {
+    GzipReader gzip(data, size, arena);
+    TF_RETURN_IF_ERROR(ExtractLoudestFromStream(
+        input_filename, &gzip, desired_length_ms, padding_ms, window_shape,
+        deadline, log, arena, &clip));
+  } else if (starts_with(kZstdMarker, kZstdMarkerSize)) {
+    ZstdReader zstd(data, size, arena);
+    TF_RETURN_IF_ERROR(ExtractLoudestFromStream(
+        input_filename, &zstd, desired_length_ms, padding_ms, window_shape,
+        deadline, log, arena, &clip));
+  } else {
+    TF_RETURN_IF_ERROR(ExtractLoudestFromWav(
+        input_filename, data, size,
+        desired_length_ms, padding_ms, search_threads, window_shape, deadline,
+        log, arena, &clip));
+  }
+  if (guard.faulted()) {
+    return errors::DataLoss("'", input_filename,
+                            "' was truncated while it was being read");
+  }
+  return EncodeLoudestClip(input_filename, clip, min_volume, output_format,
+                           mapped_output, crop_options, deadline, clip_index,
+                           feature_sink, log, arena, encoded);
+}
+
+// Saves an encoded clip's crops to output_filenames, which holds one name for
+// each, and stores its features as record clip_index of the shard. WAV crops
+// that weren't encoded yet are written in place.
+Status WriteEncodedClip(const EncodedClip& encoded,
+                        const std::string* output_filenames,
+                        int64_t clip_index, FeatureShardWriter* feature_writer,
+                        std::ostream* log, Arena* arena) {
+  if ((encoded.features != nullptr) && (feature_writer != nullptr)) {
+    TF_RETURN_IF_ERROR(
+        feature_writer->Write(clip_index, encoded.features, arena));
+  }
+  for (int c = 0; c < encoded.crop_count; ++c) {
+    if (encoded.crop_data[c] == nullptr) {
+      TF_RETURN_IF_ERROR(WriteWavInPlace(output_filenames[c],
+                                         encoded.crop_samples[c],
+                                         encoded.sample_count,
+                                         encoded.sample_rate));
+    } else {
+      TF_RETURN_IF_ERROR(WriteWholeFile(
+          output_filenames[c], encoded.crop_data[c], encoded.crop_sizes[c]));
+    }
+    *log << "Saved to '" << output_filenames[c] << "'" << std::endl;
+  }
+  return Status::OK();
+}
+
+// Trims an input that's already in memory and writes out the results.
+// output_filenames holds one name for each crop. If feature_sink isn't null,
+// the loudest window's features are stored as record clip_index of the shard.
+// Progress and problems are logged to log. All of the per-file buffers are
+// carved out of the arena, which the caller resets between files.
+Status TrimBuffer(const std::string& input_filename, const uint8_t* data,
+                  size_t size, const std::string* output_filenames,
+                  const int64_t desired_length_ms, const float min_volume,
+                  int search_threads, const WindowShape& window_shape,
+                  OutputFormat output_format, bool mapped_output,
+                  const CropOptions& crop_options, const Deadline& deadline,
+                  int64_t clip_index, FeatureSink* feature_sink,
+                  std::ostream* log, Arena* arena) {
+  EncodedClip encoded;
+  TF_RETURN_IF_ERROR(EncodeBuffer(
+      input_filename, data, size, desired_length_ms, min_volume,
+      search_threads, window_shape, output_format, mapped_output, crop_options,
+      deadline, clip_index, feature_sink, log, arena, &encoded));
+  return WriteEncodedClip(
+      encoded, output_filenames, clip_index,
+      (feature_sink != nullptr) ? feature_sink->writer() : nullptr, log,
+      arena);
+}
+
+// Maps a file and trims it. With drop_cache, its pages are evicted from the
+// page cache afterwards.
+Status TrimFile(const std::string& input_filename,
+                const std::string* output_filenames,
+                const int64_t desired_length_ms,
+		const float min_volume, int search_threads,
+                const WindowShape& window_shape, OutputFormat output_format,
+                bool mapped_output, const CropOptions& crop_options,
+                const Deadline& deadline, bool drop_cache, int64_t clip_index,
+                FeatureSink* feature_sink, std::ostream* log, Arena* arena) {
+  MemMappedFile input_file(input_filename, drop_cache);
+  TF_RETURN_IF_ERROR(input_file.status());
+  return TrimBuffer(input_filename, input_file.data_, input_file.filesize_,
+                    output_filenames, desired_length_ms, min_volume,
+                    search_threads, window_shape, output_format, mapped_output,
+                    crop_options, deadline, clip_index, feature_sink, log,
+                    arena);
+}
+
+// Does the same job as TrimFile(), but reading from stdin, so the tool can sit
+// at the end of a shell pipeline. A plain WAV is searched as it streams in, so
+// only a few windows of samples are held in memory at any time. FLAC and
+// compressed WAVs are recognized by their first bytes, as files are, and are
+// read into memory first, since their decoders work on a whole buffer.
+// output_filenames holds one name for each crop, and a single name of "-"
+// writes the clip to stdout.
+Status TrimStream(const std::string* output_filenames,
+                  const int64_t desired_length_ms, const float min_volume,
+                  int search_threads, const WindowShape& window_shape,
+                  OutputFormat output_format, bool mapped_output,
+                  const CropOptions& crop_options, const Deadline& deadline,
+                  FeatureSink* feature_sink) {
+  const std::string input_name = "stdin";
+  const bool to_stdout = (output_filenames[0] == "-");
+  // Clips for stdout have to be encoded into memory.
+  const bool encode_in_place = mapped_output && !to_stdout;
+  FdByteReader input(STDIN_FILENO);
+  uint8_t marker[4];
+  int64_t marker_size;
+  TF_RETURN_IF_ERROR(input.Read(marker, sizeof(marker), &marker_size));
+  auto starts_with = [&](const char* expected, int expected_size) {
+    return (marker_size >= expected_size) &&
+           (memcmp(marker, expected, expected_size) == 0);
+  };
+
+  Arena arena(0, false);
+  EncodedClip encoded;
+  std::vector<uint8_t> data;
+  if (starts_with(kFlacMarker, kFlacMarkerSize) ||
+      starts_with(kGzipMarker, kGzipMarkerSize) ||
+      starts_with(kZstdMarker, kZstdMarkerSize)) {
+    constexpr int64_t kReadSize = 1 << 20;
+    data.assign(marker, marker + marker_size);
+    while (true) {
+      const size_t used = data.size();
+      data.resize(used + kReadSize);
+      int64_t bytes_read;
+      TF_RETURN_IF_ERROR(
+          input.Read(data.data() + used, kReadSize, &bytes_read));
+      data.resize(used + bytes_read);
+      if (bytes_read < kReadSize) {
+        break;
+      }
+    }
+    TF_RETURN_IF_ERROR(EncodeBuffer(
+        input_name, data.data(), data.size(), desired_length_ms, min_volume,
+        search_threads, window_shape, output_format, encode_in_place,
+        crop_options, deadline, 0, feature_sink, &std::cerr, &arena,
+        &encoded));
+  } else {
+    PrefixedByteReader stream(marker, marker_size, &input);
+    const int64_t padding_ms =
+        (crop_options.count > 1) ? crop_options.jitter_ms : 0;
+    LoudestClip clip;
+    TF_RETURN_IF_ERROR(ExtractLoudestFromStream(
+        input_name, &stream, desired_length_ms, padding_ms, window_shape,
+        deadline, &std::cerr, &arena, &clip));
+    TF_RETURN_IF_ERROR(EncodeLoudestClip(
+        input_name, clip, min_volume, output_format, encode_in_place,
+        crop_options, deadline, 0, feature_sink, &std::cerr, &arena,
+        &encoded));
+  }
 
+  FeatureShardWriter* feature_writer =
+      (feature_sink != nullptr) ? feature_sink->writer() : nullptr;
+  if (!to_stdout) {
+    return WriteEncodedClip(encoded, output_filenames, 0, feature_writer,
+                            &std::cerr, &arena);
+  }
+  if ((encoded.features != nullptr) && (feature_writer != nullptr)) {
+    TF_RETURN_IF_ERROR(feature_writer->Write(0, encoded.features, &arena));
+  }
+  if (encoded.crop_count == 0) {
+    return Status::OK();
+  }
+  std::cout.write(encoded.crop_data[0], encoded.crop_sizes[0]);
+  std::cout.flush();
+  if (!std::cout) {
+    return errors::Unavailable("Writing to stdout failed");
+  }
   return Status::OK();
 }
 
+// Swaps whatever follows the last '.' in a file name, if anything, for the new
+// extension. Dots in directory names are left alone.
+std::string ReplaceExtension(const std::string& filename,
+                             const std::string& extension) {
+  const std::size_t dot_index = filename.find_last_of('.');
+  const std::size_t separator_index = filename.find_last_of("/\\");
+  if ((dot_index == std::string::npos) ||
+      ((separator_index != std::string::npos) &&
+       (dot_index < separator_index))) {
+    return filename + extension;
+  }
+  return filename.substr(0, dot_index) + extension;
+}
+
+// Adds "_crop" and the index before the extension, so "a/b.wav" becomes
+// "a/b_crop2.wav".
+std::string CropFilename(const std::string& filename, int crop_index) {
+  const std::size_t dot_index = filename.find_last_of('.');
+  const std::size_t separator_index = filename.find_last_of("/\\");
+  const std::string suffix = "_crop" + std::to_string(crop_index);
+  if ((dot_index == std::string::npos) ||
+      ((separator_index != std::string::npos) &&
+       (dot_index < separator_index))) {
+    return filename + suffix;
+  }
+  return filename.substr(0, dot_index) + suffix + filename.substr(dot_index);
+}
+
+bool HasExtension(const std::string& filename, const std::string& extension) {
+  return (filename.size() >= extension.size()) &&
+         (strcasecmp(filename.c_str() + filename.size() - extension.size(),
+                     extension.c_str()) == 0);
+}
+
 void SplitFilename(const std::string& full_path, std::string* dir,
                    std::string* filename) {
   std::size_t separator_index = full_path.find_last_of("/\\");
@@ -156,54 +1169,1036 @@ void SplitFilename(const std::string& full_path, std::string* dir,
   *filename = full_path.substr(separator_index + 1);
 }
 
+// Settings that can be changed with --name=value arguments.
+struct Flags {
+  int threads = 1;
+  // Threads for the reading and writing stages. If either is set, files go
+  // through the staged pipeline, with --threads encoding them.
+  int read_threads = 0;
+  int write_threads = 0;
+  // How many files the pipeline can have in flight at once.
+  int queue_depth = 0;
+  // If set, how far past the oldest unfinished file others can be started,
+  // with the log kept in input order.
+  int reorder_window = 0;
+  int search_threads = 1;
+  // How each frame inside the window counts towards its score.
+  WindowShape window_shape;
+  int64_t file_timeout_ms = 0;
+  bool huge_pages = false;
+  bool numa = false;
+  bool stats = false;
+  std::string kernel = "auto";
+  OutputFormat output_format = OutputFormat::kWav;
+  // Whether WAVs are encoded straight into mappings of their output files.
+  bool mapped_output = false;
+  // Where to write the feature shard, if anywhere.
+  std::string features;
+  FeatureOptions feature_options;
+  CropOptions crops;
+  OutputLayout output_layout = OutputLayout::kFlat;
+  int hash_levels = 2;
+  // How many of the upcoming files to ask the kernel to read ahead.
+  int readahead = 0;
+  bool drop_cache = false;
+  // Which members of tar and zip archives to process.
+  std::string member_pattern = "*.wav";
+  // Only list what the inputs' headers say, rather than processing them.
+  bool scan = false;
+  // A directory shared with other processes, which they all take batches of
+  // files from, if set.
+  std::string work_queue;
+  int work_batch = 64;
+  int lease_seconds = 60;
+};
+
+Status ParseFlags(int argc, const char* argv[], Flags* flags,
+                  std::vector<std::string>* positional) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if ((arg.size() < 3) || (arg.compare(0, 2, "--") != 0)) {
+      positional->push_back(arg);
+      continue;
+    }
+    const std::size_t equals_index = arg.find('=');
+    const std::string name = arg.substr(2, equals_index - 2);
+    const bool has_value = (equals_index != std::string::npos);
+    const std::string value = has_value ? arg.substr(equals_index + 1) : "";
+    if (name == "threads") {
+      flags->threads = atoi(value.c_str());
+      if (flags->threads < 1) {
+        return errors::InvalidArgument("--threads must be at least 1, got '",
+                                       value, "'");
+      }
+    } else if ((name == "read_threads") || (name == "write_threads") ||
+               (name == "queue_depth")) {
+      const int count = atoi(value.c_str());
+      if (count < 1) {
+        return errors::InvalidArgument("--", name, " must be at least 1, got '",
+                                       value, "'");
+      }
+      if (name == "read_threads") {
+        flags->read_threads = count;
+      } else if (name == "write_threads") {
+        flags->write_threads = count;
+      } else {
+        flags->queue_depth = count;
+      }
+    } else if (name == "reorder_window") {
+      flags->reorder_window = atoi(value.c_str());
+      if (flags->reorder_window < 0) {
+        return errors::InvalidArgument(
+            "--reorder_window can't be negative, got '", value, "'");
+      }
+    } else if (name == "output_format") {
+      if (value == "wav") {
+        flags->output_format = OutputFormat::kWav;
+      } else if (value == "flac") {
+        flags->output_format = OutputFormat::kFlac;
+      } else {
+        return errors::InvalidArgument("Unknown --output_format '", value,
+                                       "', expected wav or flac");
+      }
+    } else if (name == "features") {
+      flags->features = value;
+    } else if (name == "feature_type") {
+      if (value == "float32") {
+        flags->feature_options.type = FeatureType::kFloat32;
+      } else if (value == "float16") {
+        flags->feature_options.type = FeatureType::kFloat16;
+      } else {
+        return errors::InvalidArgument("Unknown --feature_type '", value,
+                                       "', expected float32 or float16");
+      }
+    } else if (name == "feature_window_ms") {
+      flags->feature_options.window_ms = atoi(value.c_str());
+    } else if (name == "feature_stride_ms") {
+      flags->feature_options.stride_ms = atoi(value.c_str());
+    } else if (name == "mel_bins") {
+      flags->feature_options.mel_bins = atoi(value.c_str());
+    } else if (name == "mfcc_count") {
+      flags->feature_options.mfcc_count = atoi(value.c_str());
+    } else if (name == "output_layout") {
+      if (value == "flat") {
+        flags->output_layout = OutputLayout::kFlat;
+      } else if (value == "mirror") {
+        flags->output_layout = OutputLayout::kMirror;
+      } else if (value == "hash") {
+        flags->output_layout = OutputLayout::kHash;
+      } else {
+        return errors::InvalidArgument("Unknown --output_layout '", value,
+                                       "', expected flat, mirror or hash");
+      }
+    } else if (name == "hash_levels") {
+      flags->hash_levels = atoi(value.c_str());
+      if ((flags->hash_levels < 1) || (flags->hash_levels > 8)) {
+        return errors::InvalidArgument(
+            "--hash_levels must be between 1 and 8, got '", value, "'");
+      }
+    } else if (name == "readahead") {
+      flags->readahead = atoi(value.c_str());
+      if (flags->readahead < 0) {
+        return errors::InvalidArgument("--readahead can't be negative, got '",
+                                       value, "'");
+      }
+    } else if (name == "drop_cache") {
+      flags->drop_cache = (!has_value || (value == "true"));
+    } else if (name == "member_pattern") {
+      flags->member_pattern = value;
+    } else if (name == "crops") {
+      flags->crops.count = atoi(value.c_str());
+      if (flags->crops.count < 1) {
+        return errors::InvalidArgument("--crops must be at least 1, got '",
+                                       value, "'");
+      }
+    } else if (name == "crop_jitter_ms") {
+      flags->crops.jitter_ms = std::max<int64_t>(0, atoll(value.c_str()));
+    } else if (name == "crop_seed") {
+      flags->crops.has_seed = true;
+      flags->crops.seed = strtoull(value.c_str(), nullptr, 10);
+    } else if (name == "file_timeout_ms") {
+      flags->file_timeout_ms = atoll(value.c_str());
+    } else if (name == "search_threads") {
+      flags->search_threads = atoi(value.c_str());
+      if (flags->search_threads < 1) {
+        return errors::InvalidArgument(
+            "--search_threads must be at least 1, got '", value, "'");
+      }
+    } else if (name == "window_weighting") {
+      if (value == "flat") {
+        flags->window_shape.weighting = WindowWeighting::kFlat;
+      } else if (value == "hann") {
+        flags->window_shape.weighting = WindowWeighting::kHann;
+      } else if (value == "tukey") {
+        flags->window_shape.weighting = WindowWeighting::kTukey;
+      } else {
+        return errors::InvalidArgument(
+            "--window_weighting must be flat, hann or tukey, got '", value,
+            "'");
+      }
+    } else if (name == "tukey_alpha") {
+      char* end = nullptr;
+      flags->window_shape.tukey_alpha = strtof(value.c_str(), &end);
+      if (value.empty() || (*end != '\0') ||
+          !(flags->window_shape.tukey_alpha >= 0.0f) ||
+          !(flags->window_shape.tukey_alpha <= 1.0f)) {
+        return errors::InvalidArgument(
+            "--tukey_alpha must be between 0 and 1, got '", value, "'");
+      }
+    } else if (name == "huge_pages") {
+      flags->huge_pages = (!has_value || (value == "true"));
+    } else if (name == "kernel") {
+      flags->kernel = value;
+    } else if (name == "numa") {
+      flags->numa = (!has_value || (value == "true"));
+    } else if (name == "stats") {
+      flags->stats = (!has_value || (value == "true"));
+    } else if (name == "mapped_output") {
+      flags->mapped_output = (!has_value || (value == "true"));
+    } else if (name == "scan") {
+      flags->scan = (!has_value || (value == "true"));
+    } else if (name == "work_queue") {
+      flags->work_queue = value;
+    } else if ((name == "work_batch") || (name == "lease_seconds")) {
+      const int count = atoi(value.c_str());
+      if (count < 1) {
+        return errors::InvalidArgument("--", name, " must be at least 1, got '",
+                                       value, "'");
+      }
+      if (name == "work_batch") {
+        flags->work_batch = count;
+      } else {
+        flags->lease_seconds = count;
+      }
+    } else {
+      return errors::InvalidArgument("Unknown flag '", arg, "'");
+    }
+  }
+  if (((flags->read_threads > 0) || (flags->write_threads > 0)) &&
+      flags->numa) {
+    return errors::InvalidArgument(
+        "--numa can't be combined with --read_threads or --write_threads");
+  }
+  // The other processes' files leave gaps in the input order, and in the
+  // file queue that these rely on.
+  if (!flags->work_queue.empty() &&
+      ((flags->read_threads > 0) || (flags->write_threads > 0) ||
+       flags->numa || (flags->reorder_window > 0) || (flags->readahead > 0) ||
+       !flags->features.empty())) {
+    return errors::InvalidArgument(
+        "--work_queue can't be combined with --read_threads, --write_threads, "
+        "--numa, --reorder_window, --readahead or --features");
+  }
+  const FeatureOptions& feature_options = flags->feature_options;
+  if ((feature_options.window_ms < 1) || (feature_options.stride_ms < 1) ||
+      (feature_options.mel_bins < 1) || (feature_options.mfcc_count < 0) ||
+      (feature_options.mfcc_count > feature_options.mel_bins)) {
+    return errors::InvalidArgument(
+        "--feature_window_ms, --feature_stride_ms and --mel_bins must be at "
+        "least 1, and --mfcc_count must be between 0 and --mel_bins");
+  }
+  return Status::OK();
+}
+
+// What each worker thread did, for --stats.
+struct WorkerStats {
+  int64_t files = 0;
+  int64_t heap_allocations = 0;
+  // Allocations made after the worker's first file, once its arena has had a
+  // chance to grow.
+  int64_t steady_state_heap_allocations = 0;
+  int64_t arena_block_allocations = 0;
+  size_t arena_bytes = 0;
+  // Files taken from another NUMA node's queue.
+  int64_t stolen_files = 0;
+  // Files the kernel was asked to read ahead, for --readahead.
+  int64_t readahead_files = 0;
+  // Page faults on the worker's thread that needed I/O, and those that didn't.
+  int64_t major_faults = 0;
+  int64_t minor_faults = 0;
+};
+
+// Hands out file indices to workers. The files are split into one contiguous
+// run per queue, usually one per NUMA node, and workers take from their own
+// queue first, only moving on to the others once it has run dry.
+class FileQueue {
+ public:
+  FileQueue(int64_t file_count, int queue_count) : runs_(queue_count) {
+    for (int i = 0; i < queue_count; ++i) {
+      runs_[i].start = (file_count * i) / queue_count;
+      runs_[i].next = runs_[i].start;
+      runs_[i].advised = runs_[i].start;
+      runs_[i].end = (file_count * (i + 1)) / queue_count;
+    }
+  }
+
+  // Returns false once every file has been handed out. stolen is set if the
+  // file came from another queue.
+  bool Next(int queue, int64_t* index, bool* stolen) {
+    const int queue_count = runs_.size();
+    for (int i = 0; i < queue_count; ++i) {
+      Run& run = runs_[(queue + i) % queue_count];
+      if (run.next.load(std::memory_order_relaxed) >= run.end) {
+        continue;
+      }
+      const int64_t candidate = run.next++;
+      if (candidate < run.end) {
+        *index = candidate;
+        *stolen = (i != 0);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Finds the files from just after index to count files beyond it, within
+  // index's run, that no worker has read ahead yet, and marks them as done.
+  // Returns false if there are none.
+  bool ClaimReadahead(int64_t index, int64_t count, int64_t* begin,
+                      int64_t* end) {
+    for (Run& run : runs_) {
+      if ((index < run.start) || (index >= run.end)) {
+        continue;
+      }
+      const int64_t wanted_end = std::min(index + 1 + count, run.end);
+      int64_t advised = run.advised.load(std::memory_order_relaxed);
+      while (advised < wanted_end) {
+        if (run.advised.compare_exchange_weak(advised, wanted_end)) {
+          *begin = std::max(advised, index + 1);
+          *end = wanted_end;
+          return *begin < *end;
+        }
+      }
+      return false;
+    }
+    return false;
+  }
+
+ private:
+  struct Run {
+    std::atomic<int64_t> next;
+    std::atomic<int64_t> advised;
+    int64_t start;
+    int64_t end;
+    // Keeps each queue's counters on their own cache line.
+    char padding[64 - (2 * sizeof(std::atomic<int64_t>)) -
+                 (2 * sizeof(int64_t))];
+  };
+  std::vector<Run> runs_;
+};
+
+// Adds the members of a tar or zip archive to the inputs, named as if the
+// archive were a directory without its extension, so "shards/a.tar" holding
+// "x/y.wav" gives "shards/a/x/y.wav". Only members whose paths match
+// member_pattern are used. Tars are mapped for sequential access, since their
+// members are processed in the order they're stored.
+Status AddArchiveMembers(const std::string& filename, ArchiveType type,
+                         const std::string& member_pattern,
+                         std::vector<std::unique_ptr<Archive>>* archives,
+                         std::vector<std::string>* input_filenames,
+                         std::vector<ArchiveSlice>* input_slices) {
+  std::unique_ptr<Archive> archive(new Archive);
+  archive->filename = filename;
+  archive->file.reset(new MemMappedFile(filename));
+  TF_RETURN_IF_ERROR(archive->file->status());
+  archive->file->CloseDescriptor();
+  const uint8_t* data = archive->file->data_;
+  const size_t size = archive->file->filesize_;
+  // A damaged archive still gives up the members listed before the damage,
+  // the same as the files before a bad one in a directory.
+  std::vector<ArchiveMember> members;
+  Status list_status;
+  if (type == ArchiveType::kTar) {
+    madvise(archive->file->data_, size, MADV_SEQUENTIAL);
+    list_status = ListTarMembers(data, size, &members);
+  } else {
+    list_status = ListZipMembers(data, size, &members);
+  }
+  const std::string prefix = ReplaceExtension(filename, "") + "/";
+  for (const ArchiveMember& member : members) {
+    if (fnmatch(member_pattern.c_str(), member.path.c_str(), 0) != 0) {
+      continue;
+    }
+    if (member.compression_method != 0) {
+      std::cerr << "Skipped '" << member.path << "' in '" << filename
+                << "', which is compressed with zip method "
+                << member.compression_method
+                << ", as only stored members can be read in place"
+                << std::endl;
+      continue;
+    }
+    input_filenames->push_back(prefix + member.path);
+    input_slices->push_back(
+        ArchiveSlice{archive.get(), member.offset, member.size});
+  }
+  archives->push_back(std::move(archive));
+  return list_status;
+}
+
+// Asks the kernel to read the files after index into the page cache, for
+// --readahead, unless another thread already has.
+void ReadAheadAfter(int64_t index,
+                    const std::vector<std::string>& input_filenames,
+                    const std::vector<ArchiveSlice>& input_slices,
+                    int readahead, FileQueue* file_queue, WorkerStats* stats) {
+  int64_t readahead_begin;
+  int64_t readahead_end;
+  if ((readahead == 0) ||
+      !file_queue->ClaimReadahead(index, readahead, &readahead_begin,
+                                  &readahead_end)) {
+    return;
+  }
+  for (int64_t j = readahead_begin; j < readahead_end; ++j) {
+    if (input_slices[j].archive != nullptr) {
+      AdviseWillNeed(input_slices[j]);
+    } else {
+      AdviseWillNeed(input_filenames[j]);
+    }
+  }
+  stats->readahead_files += readahead_end - readahead_begin;
+}
+
+// Adds the heap allocations made on this thread since allocations_before to
+// its stats, and counts the file.
+void CountFile(int64_t allocations_before, WorkerStats* stats) {
+  const int64_t file_allocations =
+      ThreadHeapAllocations() - allocations_before;
+  stats->heap_allocations += file_allocations;
+  if (stats->files > 0) {
+    stats->steady_state_heap_allocations += file_allocations;
+  }
+  ++stats->files;
+}
+
+// Records how many page faults the calling thread has taken.
+void CountPageFaults(WorkerStats* stats) {
+#ifdef RUSAGE_THREAD
+  struct rusage usage;
+  if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+    stats->major_faults = usage.ru_majflt;
+    stats->minor_faults = usage.ru_minflt;
+  }
+#endif
+}
+
+// If node is non-null, the worker is pinned to that NUMA node's CPUs and its
+// arena is placed in that node's memory. If reorder_buffer is non-null, each
+// file's log goes through it rather than straight to stderr.
+void RunWorker(const std::vector<std::string>& input_filenames,
+               const std::vector<ArchiveSlice>& input_slices,
+               const std::vector<std::string>& output_filenames,
+               const int64_t desired_length_ms, const float min_volume,
+               const Flags& flags, const NumaNode* node, int queue,
+               FileQueue* file_queue, SharedWorkQueue* shared_queue,
+               FeatureShardWriter* feature_writer,
+               ReorderBuffer* reorder_buffer, WorkerStats* stats) {
+  if (node != nullptr) {
+    Status pin_status = PinThreadToCpus(node->cpus);
+    if (!pin_status.ok()) {
+      std::cerr << "Couldn't pin worker to NUMA node " << node->id << ": "
+                << pin_status << std::endl;
+    }
+  }
+  Arena arena(0, flags.huge_pages, (node != nullptr) ? node->id : -1);
+  std::unique_ptr<FeatureSink> feature_sink;
+  if (feature_writer != nullptr) {
+    feature_sink.reset(new FeatureSink(
+        flags.feature_options,
+        FeatureFrameCount(flags.feature_options, desired_length_ms),
+        feature_writer));
+  }
+  LogBuffer file_log;
+  std::ostream* log = (reorder_buffer != nullptr) ? &file_log : &std::cerr;
+  int64_t i;
+  bool stolen = false;
+  while ((shared_queue != nullptr) ? shared_queue->Next(&i)
+                                   : file_queue->Next(queue, &i, &stolen)) {
+    const std::string& input_filename = input_filenames[i];
+    if (reorder_buffer != nullptr) {
+      reorder_buffer->WaitForRoom(i);
+    }
+    ReadAheadAfter(i, input_filenames, input_slices, flags.readahead,
+                   file_queue, stats);
+    // Each input has one output for every crop.
+    const std::string* crop_filenames =
+        &output_filenames[i * flags.crops.count];
+    const int64_t allocations_before = ThreadHeapAllocations();
+    const ArchiveSlice& slice = input_slices[i];
+    Status trim_status;
+    if (slice.archive != nullptr) {
+      trim_status = TrimBuffer(
+          input_filename, slice.archive->file->data_ + slice.offset,
+          slice.size, crop_filenames, desired_length_ms, min_volume,
+          flags.search_threads, flags.window_shape, flags.output_format,
+          flags.mapped_output, flags.crops, Deadline(flags.file_timeout_ms), i,
+          feature_sink.get(), log, &arena);
+      if (flags.drop_cache) {
+        DropCachedPages(slice);
+      }
+    } else {
+      trim_status =
+          TrimFile(input_filename, crop_filenames, desired_length_ms,
+                   min_volume, flags.search_threads, flags.window_shape,
+                   flags.output_format, flags.mapped_output, flags.crops,
+                   Deadline(flags.file_timeout_ms), flags.drop_cache, i,
+                   feature_sink.get(), log, &arena);
+    }
+    if (!trim_status.ok()) {
+      *log << "Failed on '" << input_filename << "' => '"
+           << crop_filenames[0] << "' with error " << trim_status << std::endl;
+    }
+    if (reorder_buffer != nullptr) {
+      reorder_buffer->Commit(i, file_log.mutable_text());
+    }
+    arena.Reset();
+    CountFile(allocations_before, stats);
+    if (stolen) {
+      ++stats->stolen_files;
+    }
+    // Like taking the file, finishing it only touches the heap once per
+    // batch, for the queue's paths, so it isn't counted against the file.
+    if (shared_queue != nullptr) {
+      shared_queue->Finish(i);
+    }
+  }
+  stats->arena_block_allocations = arena.block_allocations();
+  stats->arena_bytes = arena.bytes_reserved();
+  CountPageFaults(stats);
+}
+
+// One file's trip through the staged pipeline. A fixed set of these is
+// recycled, each with its own arena, so the number of files in flight and the
+// memory they hold are both bounded.
+struct PipelineJob {
+  explicit PipelineJob(bool huge_pages) : arena(0, huge_pages) {}
+
+  int64_t index = 0;
+  Status status;
+  // Set if the input is a file of its own, rather than an archive member, in
+  // which case it's mapped by the reader and unmapped once it's encoded.
+  MemMappedFile* file = nullptr;
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  EncodedClip encoded;
+  // Collects the file's log if it's being put back into input order.
+  LogBuffer log;
+  Arena arena;
+};
+
+// What the stages share. Readers take the next file from file_queue and a
+// free job from free_jobs, load the file, and pass the job through
+// loaded_jobs to the encoders, which pass it through encoded_jobs to the
+// writers, which hand it back to free_jobs. Readers wait while every job is in
+// use, which is what stops them running ahead of slower stages. With a
+// reorder buffer, they also wait before starting a file too far past the
+// oldest one that's unfinished, and the writers commit each job's log through
+// it.
+//
+// Every file passes through each stage exactly once, so the encoders and
+// writers know they're done once they've taken a ticket for each one.
+struct Pipeline {
+  Pipeline(const std::vector<std::string>& input_filenames,
+           const std::vector<ArchiveSlice>& input_slices,
+           const std::vector<std::string>& output_filenames,
+           int64_t desired_length_ms, float min_volume, const Flags& flags,
+           FeatureShardWriter* feature_writer, ReorderBuffer* reorder_buffer,
+           int job_count)
+      : input_filenames(input_filenames),
+        input_slices(input_slices),
+        output_filenames(output_filenames),
+        desired_length_ms(desired_length_ms),
+        min_volume(min_volume),
+        flags(flags),
+        feature_writer(feature_writer),
+        reorder_buffer(reorder_buffer),
+        file_queue(input_filenames.size(), 1),
+        free_jobs(job_count),
+        loaded_jobs(job_count),
+        encoded_jobs(job_count),
+        encode_tickets(0),
+        write_tickets(0) {}
+
+  const std::vector<std::string>& input_filenames;
+  const std::vector<ArchiveSlice>& input_slices;
+  const std::vector<std::string>& output_filenames;
+  const int64_t desired_length_ms;
+  const float min_volume;
+  const Flags& flags;
+  FeatureShardWriter* feature_writer;
+  ReorderBuffer* reorder_buffer;
+  FileQueue file_queue;
+  BoundedQueue<PipelineJob*> free_jobs;
+  BoundedQueue<PipelineJob*> loaded_jobs;
+  BoundedQueue<PipelineJob*> encoded_jobs;
+  std::atomic<int64_t> encode_tickets;
+  std::atomic<int64_t> write_tickets;
+};
+
+// Maps an input, or finds it within its archive, and then touches every page
+// so that they're all read in now, on the reader's thread, rather than when an
+// encoder gets to them. Files are mapped into an object in the job's arena.
+Status LoadInput(const Pipeline& pipeline, PipelineJob* job) {
+  const std::string& input_filename = pipeline.input_filenames[job->index];
+  const ArchiveSlice& slice = pipeline.input_slices[job->index];
+  if (slice.archive != nullptr) {
+    job->data = slice.archive->file->data_ + slice.offset;
+    job->size = slice.size;
+    AdviseWillNeed(slice);
+  } else {
+    void* file = job->arena.AllocateArray<MemMappedFile>(1);
+    TF_RETURN_IF_ERROR(job->arena.status());
+    job->file = new (file)
+        MemMappedFile(input_filename, pipeline.flags.drop_cache);
+    TF_RETURN_IF_ERROR(job->file->status());
+    job->data = job->file->data_;
+    job->size = job->file->filesize_;
+    madvise(job->file->data_, job->size, MADV_WILLNEED);
+  }
+  if (job->size == 0) {
+    return Status::OK();
+  }
+  MappedRegionGuard guard(job->data, job->size);
+  const volatile uint8_t* bytes = job->data;
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  for (size_t offset = 0; offset < job->size; offset += page_size) {
+    bytes[offset];
+  }
+  bytes[job->size - 1];
+  if (guard.faulted()) {
+    return errors::DataLoss("'", input_filename,
+                            "' was truncated while it was being read");
+  }
+  return Status::OK();
+}
+
+// Where a job's log lines go.
+std::ostream* JobLog(const Pipeline& pipeline, PipelineJob* job) {
+  return (pipeline.reorder_buffer != nullptr) ? &job->log : &std::cerr;
+}
+
+void RunReader(Pipeline* pipeline, WorkerStats* stats) {
+  int64_t i;
+  bool stolen;
+  while (pipeline->file_queue.Next(0, &i, &stolen)) {
+    if (pipeline->reorder_buffer != nullptr) {
+      pipeline->reorder_buffer->WaitForRoom(i);
+    }
+    ReadAheadAfter(i, pipeline->input_filenames, pipeline->input_slices,
+                   pipeline->flags.readahead, &pipeline->file_queue, stats);
+    PipelineJob* job = pipeline->free_jobs.Pop();
+    const int64_t allocations_before = ThreadHeapAllocations();
+    job->index = i;
+    job->status = LoadInput(*pipeline, job);
+    CountFile(allocations_before, stats);
+    pipeline->loaded_jobs.Push(job);
+  }
+  CountPageFaults(stats);
+}
+
+void RunEncoder(Pipeline* pipeline, WorkerStats* stats) {
+  const Flags& flags = pipeline->flags;
+  std::unique_ptr<FeatureSink> feature_sink;
+  if (pipeline->feature_writer != nullptr) {
+    feature_sink.reset(new FeatureSink(
+        flags.feature_options,
+        FeatureFrameCount(flags.feature_options, pipeline->desired_length_ms),
+        pipeline->feature_writer));
+  }
+  const int64_t file_count = pipeline->input_filenames.size();
+  while (pipeline->encode_tickets++ < file_count) {
+    PipelineJob* job = pipeline->loaded_jobs.Pop();
+    const int64_t allocations_before = ThreadHeapAllocations();
+    if (job->status.ok()) {
+      job->status = EncodeBuffer(
+          pipeline->input_filenames[job->index], job->data, job->size,
+          pipeline->desired_length_ms, pipeline->min_volume,
+          flags.search_threads, flags.window_shape, flags.output_format,
+          flags.mapped_output, flags.crops, Deadline(flags.file_timeout_ms),
+          job->index,
+          feature_sink.get(),
+          JobLog(*pipeline, job), &job->arena, &job->encoded);
+    }
+    // The input isn't needed once it's encoded, so it can be let go before
+    // the job waits for a writer.
+    if (job->file != nullptr) {
+      job->file->~MemMappedFile();
+      job->file = nullptr;
+    } else if (flags.drop_cache) {
+      DropCachedPages(pipeline->input_slices[job->index]);
+    }
+    CountFile(allocations_before, stats);
+    pipeline->encoded_jobs.Push(job);
+  }
+  CountPageFaults(stats);
+}
+
+void RunWriter(Pipeline* pipeline, WorkerStats* stats) {
+  const Flags& flags = pipeline->flags;
+  const int64_t file_count = pipeline->input_filenames.size();
+  while (pipeline->write_tickets++ < file_count) {
+    PipelineJob* job = pipeline->encoded_jobs.Pop();
+    const int64_t allocations_before = ThreadHeapAllocations();
+    const std::string* crop_filenames =
+        &pipeline->output_filenames[job->index * flags.crops.count];
+    if (job->status.ok()) {
+      job->status = WriteEncodedClip(
+          job->encoded, crop_filenames, job->index, pipeline->feature_writer,
+          JobLog(*pipeline, job), &job->arena);
+    }
+    if (!job->status.ok()) {
+      *JobLog(*pipeline, job)
+          << "Failed on '" << pipeline->input_filenames[job->index] << "' => '"
+          << crop_filenames[0] << "' with error " << job->status << std::endl;
+    }
+    if (pipeline->reorder_buffer != nullptr) {
+      pipeline->reorder_buffer->Commit(job->index, job->log.mutable_text());
+    }
+    job->status = Status::OK();
+    job->arena.Reset();
+    CountFile(allocations_before, stats);
+    pipeline->free_jobs.Push(job);
+  }
+  CountPageFaults(stats);
+}
+
+WorkerStats SumStats(const std::vector<WorkerStats>& thread_stats) {
+  WorkerStats total;
+  for (const WorkerStats& stats : thread_stats) {
+    total.files += stats.files;
+    total.heap_allocations += stats.heap_allocations;
+    total.steady_state_heap_allocations += stats.steady_state_heap_allocations;
+    total.arena_block_allocations += stats.arena_block_allocations;
+    total.arena_bytes += stats.arena_bytes;
+    total.stolen_files += stats.stolen_files;
+    total.readahead_files += stats.readahead_files;
+    total.major_faults += stats.major_faults;
+    total.minor_faults += stats.minor_faults;
+  }
+  return total;
+}
+
+// With the staged pipeline, io_stats holds the reader and writer threads, and
+// the arena totals are the jobs' rather than the workers'.
+void PrintStats(const std::vector<WorkerStats>& worker_stats,
+                const std::vector<WorkerStats>& io_stats) {
+  const WorkerStats total = SumStats(worker_stats);
+  const WorkerStats io_total = SumStats(io_stats);
+  std::cerr << "Processed " << total.files << " files on "
+            << worker_stats.size() << " workers" << std::endl;
+  std::cerr << "Heap allocations while processing files: "
+            << (total.heap_allocations + io_total.heap_allocations) << " ("
+            << (total.steady_state_heap_allocations +
+                io_total.steady_state_heap_allocations)
+            << " after each thread's first file)" << std::endl;
+  std::cerr << "Arena blocks allocated: "
+            << (total.arena_block_allocations +
+                io_total.arena_block_allocations)
+            << ", holding " << (total.arena_bytes + io_total.arena_bytes)
+            << " bytes" << std::endl;
+  std::cerr << "Files taken from another node's queue: " << total.stolen_files
+            << std::endl;
+  // Compare runs with and without --readahead to see how many major faults,
+  // which each stall a worker on a disk read, it turns into minor ones.
+  std::cerr << "Page faults on workers: " << total.major_faults
+            << " major, " << total.minor_faults << " minor" << std::endl;
+  if (!io_stats.empty()) {
+    // Faults on the readers are ones the workers didn't have to wait for.
+    std::cerr << "Page faults on " << io_stats.size()
+              << " reader and writer threads: " << io_total.major_faults
+              << " major, " << io_total.minor_faults << " minor"
+              << std::endl;
+  }
+  std::cerr << "Files read ahead: "
+            << (total.readahead_files + io_total.readahead_files)
+            << std::endl;
+}
+
+// Runs the files through separate reader, encoder and writer threads, so
+// that waiting on the disk in one stage overlaps with work in the others.
+void RunPipeline(const std::vector<std::string>& input_filenames,
+                 const std::vector<ArchiveSlice>& input_slices,
+                 const std::vector<std::string>& output_filenames,
+                 const int64_t desired_length_ms, const float min_volume,
+                 const Flags& flags, FeatureShardWriter* feature_writer,
+                 ReorderBuffer* reorder_buffer) {
+  const int read_threads = std::max(1, flags.read_threads);
+  const int write_threads = std::max(1, flags.write_threads);
+  const int job_count =
+      (flags.queue_depth > 0)
+          ? flags.queue_depth
+          : (2 * (read_threads + flags.threads + write_threads));
+  Pipeline pipeline(input_filenames, input_slices, output_filenames,
+                    desired_length_ms, min_volume, flags, feature_writer,
+                    reorder_buffer, job_count);
+  std::vector<std::unique_ptr<PipelineJob>> jobs;
+  for (int i = 0; i < job_count; ++i) {
+    jobs.emplace_back(new PipelineJob(flags.huge_pages));
+    pipeline.free_jobs.Push(jobs.back().get());
+  }
+  std::vector<WorkerStats> worker_stats(flags.threads);
+  std::vector<WorkerStats> io_stats(read_threads + write_threads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < read_threads; ++i) {
+    threads.emplace_back(RunReader, &pipeline, &io_stats[i]);
+  }
+  for (int i = 0; i < flags.threads; ++i) {
+    threads.emplace_back(RunEncoder, &pipeline, &worker_stats[i]);
+  }
+  for (int i = 0; i < write_threads; ++i) {
+    threads.emplace_back(RunWriter, &pipeline, &io_stats[read_threads + i]);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  if (flags.stats) {
+    for (const std::unique_ptr<PipelineJob>& job : jobs) {
+      io_stats[0].arena_block_allocations += job->arena.block_allocations();
+      io_stats[0].arena_bytes += job->arena.bytes_reserved();
+    }
+    PrintStats(worker_stats, io_stats);
+  }
+}
+
 int main(int argc, const char* argv[]) {
-  if (argc < 3) {
+  Flags flags;
+  std::vector<std::string> args;
+  Status flags_status = ParseFlags(argc, argv, &flags, &args);
+  if (!flags_status.ok()) {
+    std::cerr << flags_status << std::endl;
+    return -1;
+  }
+  Status kernel_status = SelectAudioKernels(flags.kernel);
+  if (!kernel_status.ok()) {
+    std::cerr << kernel_status << std::endl;
+    return -1;
+  }
+  // Each set is named by the instruction set it targets. Loops with nothing
+  // to gain from it, like downmixing more than two channels, stay scalar.
+  std::cerr << "Using the " << GetAudioKernels().name << " kernels"
+            << std::endl;
+
+  // A scan only needs the inputs, and writes its inventory to stdout.
+  if (flags.scan && !args.empty()) {
+    glob_t glob_result;
+    glob(args[0].c_str(), GLOB_TILDE, nullptr, &glob_result);
+    const std::vector<std::string> scan_filenames(
+        glob_result.gl_pathv, glob_result.gl_pathv + glob_result.gl_pathc);
+    globfree(&glob_result);
+    std::vector<ScanRecord> records;
+    ScanInputs(scan_filenames, flags.threads, &records);
+    WriteScanInventory(scan_filenames, records, &std::cout);
+    WriteScanSummary(records, &std::cerr);
+    return 0;
+  }
+  if (args.size() < 2) {
     std::cerr
         << "You must supply paths to input and output wav files as arguments"
         << std::endl;
     return -1;
   }
-  const std::string input_glob = argv[1];
+  const int64_t desired_length_ms = 1000;
+  const float min_volume = 0.004f;
+
+  // An input of "-" means a single input streamed on stdin.
+  const int feature_frame_count =
+      FeatureFrameCount(flags.feature_options, desired_length_ms);
+  if (args[0] == "-") {
+    // A pipe can only be read once, so there's nothing to share out.
+    if (!flags.work_queue.empty()) {
+      std::cerr << "--work_queue isn't supported when reading from stdin"
+                << std::endl;
+      return -1;
+    }
+    std::vector<std::string> output_filenames;
+    if (flags.crops.count == 1) {
+      output_filenames.push_back(args[1]);
+    } else if (args[1] == "-") {
+      std::cerr << "--crops needs an output file rather than stdout"
+                << std::endl;
+      return -1;
+    } else {
+      for (int c = 0; c < flags.crops.count; ++c) {
+        output_filenames.push_back(CropFilename(args[1], c));
+      }
+    }
+    std::unique_ptr<FeatureShardWriter> feature_writer;
+    std::unique_ptr<FeatureSink> feature_sink;
+    if (!flags.features.empty()) {
+      feature_writer.reset(new FeatureShardWriter(
+          flags.features, flags.feature_options, 1, feature_frame_count));
+      if (!feature_writer->status().ok()) {
+        std::cerr << feature_writer->status() << std::endl;
+        return -1;
+      }
+      feature_sink.reset(new FeatureSink(
+          flags.feature_options, feature_frame_count, feature_writer.get()));
+    }
+    Status trim_status = TrimStream(
+        output_filenames.data(), desired_length_ms, min_volume,
+        flags.search_threads, flags.window_shape, flags.output_format,
+        flags.mapped_output, flags.crops, Deadline(flags.file_timeout_ms),
+        feature_sink.get());
+    if (!trim_status.ok()) {
+      std::cerr << "Failed on stdin with error " << trim_status << std::endl;
+      return -1;
+    }
+    return 0;
+  }
+
+  const std::string& input_glob = args[0];
   glob_t glob_result;
   glob(input_glob.c_str(), GLOB_TILDE, nullptr, &glob_result);
   std::vector<std::string> input_filenames;
-  for (int64_t i = 0; i < glob_result.gl_pathc; ++i) {
-    input_filenames.push_back(std::string(glob_result.gl_pathv[i]));
+  std::vector<ArchiveSlice> input_slices;
+  std::vector<std::unique_ptr<Archive>> archives;
+  for (size_t i = 0; i < glob_result.gl_pathc; ++i) {
+    const std::string filename(glob_result.gl_pathv[i]);
+    const ArchiveType archive_type = ArchiveTypeFromFilename(filename);
+    if (archive_type == ArchiveType::kNone) {
+      input_filenames.push_back(filename);
+      input_slices.push_back(ArchiveSlice{nullptr, 0, 0});
+      continue;
+    }
+    Status archive_status =
+        AddArchiveMembers(filename, archive_type, flags.member_pattern,
+                          &archives, &input_filenames, &input_slices);
+    if (!archive_status.ok()) {
+      std::cerr << "Failed on archive '" << filename << "' with error "
+                << archive_status << std::endl;
+    }
   }
   globfree(&glob_result);
 
-  const std::string output_root = argv[2];
+  const std::string& output_root = args[1];
+  const std::string base_directory = GlobBaseDirectory(input_glob);
   std::vector<std::string> output_filenames;
   std::set<std::string> output_dirs;
   for (const std::string& input_filename : input_filenames) {
-    std::string input_dir;
-    std::string input_base;
-    SplitFilename(input_filename, &input_dir, &input_base);
-    std::string output_filename = output_root + "/" + input_base;
-    output_filenames.push_back(output_filename);
+    std::string output_filename =
+        output_root + "/" +
+        OutputRelativePath(input_filename, base_directory,
+                           flags.output_layout, flags.hash_levels);
+    // Gzip and zstd inputs lose that suffix, so "a.wav.gz" becomes "a.wav".
+    if (HasExtension(output_filename, ".gz") ||
+        HasExtension(output_filename, ".zst")) {
+      output_filename = ReplaceExtension(output_filename, "");
+    }
+    // FLAC inputs are written out as WAVs unless FLAC was asked for.
+    if (flags.output_format == OutputFormat::kFlac) {
+      output_filename = ReplaceExtension(output_filename, ".flac");
+    } else if (HasExtension(output_filename, ".flac")) {
+      output_filename = ReplaceExtension(output_filename, ".wav");
+    }
+    if (flags.crops.count == 1) {
+      output_filenames.push_back(output_filename);
+    } else {
+      for (int c = 0; c < flags.crops.count; ++c) {
+        output_filenames.push_back(CropFilename(output_filename, c));
+      }
+    }
     std::string output_dir;
     std::string output_base;
     SplitFilename(output_filename, &output_dir, &output_base);
     output_dirs.insert(output_dir);
   }
 
+  // Inputs with the same name in different directories would overwrite each
+  // other's outputs, which the flat layout doesn't prevent.
+  const int64_t collision_count =
+      output_filenames.size() -
+      std::set<std::string>(output_filenames.begin(), output_filenames.end())
+          .size();
+  if (collision_count > 0) {
+    std::cerr << collision_count
+              << " outputs have the same path as another, and will be "
+                 "overwritten; --output_layout=mirror keeps them apart"
+              << std::endl;
+  }
+
+  // Every directory is made here, once, before any files are processed.
+  DirectoryCreator directory_creator;
   for (const std::string& output_dir : output_dirs) {
-    mkdir(output_dir.c_str(), ACCESSPERMS);
+    Status create_status = directory_creator.Create(output_dir);
+    if (!create_status.ok()) {
+      std::cerr << create_status << std::endl;
+    }
   }
 
-  assert(input_filenames.size() == output_filenames.size());
-  for (int64_t i = 0; i < input_filenames.size(); ++i) {
-    const std::string input_filename = input_filenames[i];
-    const std::string output_filename = output_filenames[i];
-    const int64_t desired_length_ms = 1000;
-    const float min_volume = 0.004f;
-    Status trim_status =
-      TrimFile(input_filename, output_filename, desired_length_ms, min_volume);
-    if (!trim_status.ok()) {
-      std::cerr << "Failed on '" << input_filename << "' => '"
-                << output_filename << "' with error " << trim_status;
+  assert((input_filenames.size() * flags.crops.count) ==
+         output_filenames.size());
+  // Every input file gets a record in the shard, in glob order, whichever
+  // worker ends up handling it.
+  std::unique_ptr<FeatureShardWriter> feature_writer;
+  if (!flags.features.empty()) {
+    feature_writer.reset(new FeatureShardWriter(
+        flags.features, flags.feature_options, input_filenames.size(),
+        feature_frame_count));
+    if (!feature_writer->status().ok()) {
+      std::cerr << feature_writer->status() << std::endl;
+      return -1;
     }
   }
+  // With --reorder_window, the per-file log comes out in input order.
+  std::unique_ptr<ReorderBuffer> reorder_buffer;
+  if (flags.reorder_window > 0) {
+    reorder_buffer.reset(new ReorderBuffer(flags.reorder_window, &std::cerr));
+  }
+  if ((flags.read_threads > 0) || (flags.write_threads > 0)) {
+    RunPipeline(input_filenames, input_slices, output_filenames,
+                desired_length_ms, min_volume, flags, feature_writer.get(),
+                reorder_buffer.get());
+    return 0;
+  }
+
+  // With --numa, workers are spread evenly over the nodes, and each node gets
+  // its own queue of files.
+  std::vector<NumaNode> nodes;
+  if (flags.numa) {
+    nodes = GetNumaNodes();
+    std::cerr << "Placing " << flags.threads << " workers on " << nodes.size()
+              << " NUMA nodes" << std::endl;
+  }
+  const int queue_count =
+      std::max<int>(1, std::min<int>(nodes.size(), flags.threads));
+  FileQueue file_queue(input_filenames.size(), queue_count);
+  // With --work_queue, every process sharing the directory runs this same
+  // command, and they take batches of the files from it in turn.
+  std::unique_ptr<SharedWorkQueue> shared_queue;
+  if (!flags.work_queue.empty()) {
+    shared_queue.reset(new SharedWorkQueue(flags.work_queue, input_filenames,
+                                           flags.work_batch,
+                                           flags.lease_seconds));
+    if (!shared_queue->status().ok()) {
+      std::cerr << shared_queue->status() << std::endl;
+      return -1;
+    }
+  }
+  std::vector<WorkerStats> worker_stats(flags.threads);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < flags.threads; ++i) {
+    const int queue = i % queue_count;
+    const NumaNode* node = nodes.empty() ? nullptr : &nodes[queue];
+    workers.emplace_back(RunWorker, std::cref(input_filenames),
+                         std::cref(input_slices),
+                         std::cref(output_filenames), desired_length_ms,
+                         min_volume, std::cref(flags), node, queue,
+                         &file_queue, shared_queue.get(), feature_writer.get(),
+                         reorder_buffer.get(), &worker_stats[i]);
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  if (shared_queue) {
+    std::cerr << "Took " << shared_queue->batches_claimed()
+              << " pending batches from the work queue and "
+              << shared_queue->batches_reclaimed()
+              << " whose leases had run out, and lost "
+              << shared_queue->leases_lost() << " to other processes"
+              << std::endl;
+  }
+  if (flags.stats) {
+    PrintStats(worker_stats, std::vector<WorkerStats>());
+  }
 
   return 0;
 }
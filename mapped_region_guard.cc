@@ -0,0 +1,115 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "mapped_region_guard.h"
+
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+
+namespace {
+
+// The handler can't take locks, so guarded regions live in a fixed table of
+// atomics. There's one region per file being worked on, so this only needs to
+// be bigger than the number of workers.
+constexpr int kMaxGuardedRegions = 256;
+
+struct GuardedRegion {
+  std::atomic<uintptr_t> start;
+  std::atomic<uintptr_t> end;
+  std::atomic<bool> faulted;
+};
+
+GuardedRegion g_regions[kMaxGuardedRegions];
+
+struct sigaction g_previous_action;
+
+void HandleSigbus(int signal_number, siginfo_t* info, void* context) {
+  const uintptr_t address = reinterpret_cast<uintptr_t>(info->si_addr);
+  for (int i = 0; i < kMaxGuardedRegions; ++i) {
+    GuardedRegion& region = g_regions[i];
+    const uintptr_t start = region.start.load(std::memory_order_acquire);
+    if ((start == 0) || (address < start) ||
+        (address >= region.end.load(std::memory_order_acquire))) {
+      continue;
+    }
+    const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    void* page = reinterpret_cast<void*>(address & ~(page_size - 1));
+    // Writable, so a store into an output mapping that couldn't get a block
+    // on disk lands somewhere harmless instead of faulting again.
+    if (mmap(page, page_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+      break;
+    }
+    region.faulted.store(true, std::memory_order_release);
+    return;
+  }
+  // Not one of ours, so put back whatever was there before. Returning retries
+  // the faulting access, which then gets the original behavior.
+  sigaction(SIGBUS, &g_previous_action, nullptr);
+}
+
+void InstallHandler() {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = HandleSigbus;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGBUS, &action, &g_previous_action);
+}
+
+}  // namespace
+
+MappedRegionGuard::MappedRegionGuard(const void* data, size_t size)
+    : slot_(-1) {
+  static std::once_flag install_once;
+  std::call_once(install_once, InstallHandler);
+  const uintptr_t start = reinterpret_cast<uintptr_t>(data);
+  if ((start == 0) || (size == 0)) {
+    return;
+  }
+  for (int i = 0; i < kMaxGuardedRegions; ++i) {
+    GuardedRegion& region = g_regions[i];
+    uintptr_t expected = 0;
+    // Claiming a slot with a placeholder start keeps the handler from seeing
+    // a half-written region.
+    if (region.start.compare_exchange_strong(expected, UINTPTR_MAX)) {
+      region.faulted.store(false, std::memory_order_relaxed);
+      region.end.store(start + size, std::memory_order_relaxed);
+      region.start.store(start, std::memory_order_release);
+      slot_ = i;
+      return;
+    }
+  }
+  std::cerr << "Too many mapped files to guard against truncation"
+            << std::endl;
+}
+
+MappedRegionGuard::~MappedRegionGuard() {
+  if (slot_ != -1) {
+    g_regions[slot_].start.store(0, std::memory_order_release);
+  }
+}
+
+bool MappedRegionGuard::faulted() const {
+  return (slot_ != -1) &&
+         g_regions[slot_].faulted.load(std::memory_order_acquire);
+}
@@ -0,0 +1,46 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Keeps a file that's truncated while it's mapped from killing the process.
+// Touching a page past the new end of a mapped file raises SIGBUS, so while a
+// MappedRegionGuard is alive, any SIGBUS inside its range is handled by
+// mapping a page of zeros over the missing one, and recording the fault so the
+// caller can throw away whatever it computed from that data. Writes to a
+// mapped output that the filesystem has no room for raise SIGBUS too, and are
+// caught the same way.
+
+#ifndef MAPPED_REGION_GUARD_H_
+#define MAPPED_REGION_GUARD_H_
+
+#include <stddef.h>
+
+class MappedRegionGuard {
+ public:
+  MappedRegionGuard(const void* data, size_t size);
+  ~MappedRegionGuard();
+
+  // True if any access inside the region has hit a missing page.
+  bool faulted() const;
+
+ private:
+  // Index into the table the signal handler searches, or -1 if the table was
+  // full and the region isn't guarded.
+  int slot_;
+
+  MappedRegionGuard(const MappedRegionGuard&) = delete;
+  void operator=(const MappedRegionGuard&) = delete;
+};
+
+#endif  // MAPPED_REGION_GUARD_H_
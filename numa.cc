@@ -0,0 +1,135 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "numa.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+// Parses a sysfs list like "0-3,8-11".
+std::vector<int> ParseCpuList(const std::string& text) {
+  std::vector<int> cpus;
+  std::stringstream stream(text);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    const std::size_t dash_index = range.find('-');
+    const int first = atoi(range.c_str());
+    const int last = (dash_index == std::string::npos)
+                         ? first
+                         : atoi(range.c_str() + dash_index + 1);
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::vector<int> AllCpus() {
+  const int cpu_count = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<int> cpus;
+  for (int cpu = 0; cpu < cpu_count; ++cpu) {
+    cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+}  // namespace
+
+// Reads the first line of a sysfs file, returning false if it doesn't exist.
+bool ReadSysfsLine(const std::string& filename, std::string* line) {
+  std::ifstream file(filename);
+  if (!file) {
+    return false;
+  }
+  std::getline(file, *line);
+  return true;
+}
+
+std::vector<NumaNode> GetNumaNodes() {
+  std::vector<NumaNode> nodes;
+#ifdef __linux__
+  const std::string node_root = "/sys/devices/system/node/";
+  std::string online;
+  if (ReadSysfsLine(node_root + "online", &online)) {
+    for (int id : ParseCpuList(online)) {
+      std::string cpulist;
+      if (!ReadSysfsLine(node_root + "node" + std::to_string(id) + "/cpulist",
+                         &cpulist)) {
+        continue;
+      }
+      NumaNode node;
+      node.id = id;
+      node.cpus = ParseCpuList(cpulist);
+      // Memory-only nodes have no CPUs to run workers on.
+      if (!node.cpus.empty()) {
+        nodes.push_back(node);
+      }
+    }
+  }
+#endif
+  if (nodes.empty()) {
+    NumaNode node;
+    node.id = 0;
+    node.cpus = AllCpus();
+    nodes.push_back(node);
+  }
+  return nodes;
+}
+
+Status PinThreadToCpus(const std::vector<int>& cpus) {
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : cpus) {
+    CPU_SET(cpu, &cpu_set);
+  }
+  if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+    return errors::Unavailable("sched_setaffinity() failed: ",
+                               strerror(errno));
+  }
+  return Status::OK();
+#else
+  return errors::Unimplemented("Thread pinning is only supported on Linux");
+#endif
+}
+
+void BindMemoryToNode(void* data, size_t size, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  constexpr int kMpolPreferred = 1;
+  constexpr int kMaxNodes = 1024;
+  if ((node < 0) || (node >= kMaxNodes)) {
+    return;
+  }
+  unsigned long node_mask[kMaxNodes / (8 * sizeof(unsigned long))] = {};
+  node_mask[node / (8 * sizeof(unsigned long))] |=
+      1ul << (node % (8 * sizeof(unsigned long)));
+  syscall(SYS_mbind, data, size, kMpolPreferred, node_mask, kMaxNodes, 0);
+#endif
+}
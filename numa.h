@@ -0,0 +1,45 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Helpers for keeping threads and their memory on one NUMA node, without
+// depending on libnuma.
+
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "status.h"
+
+struct NumaNode {
+  int id;
+  std::vector<int> cpus;
+};
+
+// Returns the NUMA nodes that have CPUs, read from sysfs. Systems without NUMA
+// information, including anything that isn't Linux, are reported as a single
+// node holding every CPU.
+std::vector<NumaNode> GetNumaNodes();
+
+// Restricts the calling thread to the given CPUs.
+Status PinThreadToCpus(const std::vector<int>& cpus);
+
+// Asks the kernel to place the pages of a mapping on the given node. Any
+// failure is ignored, since the memory still works, just more slowly.
+void BindMemoryToNode(void* data, size_t size, int node);
+
+#endif  // NUMA_H_
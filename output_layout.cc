@@ -0,0 +1,149 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "output_layout.h"
+
+#include <errno.h>
+#include <pwd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace {
+
+bool IsSeparator(char c) { return (c == '/') || (c == '\\'); }
+
+// FNV-1a, which is simple and spreads similar paths well enough for picking
+// directories.
+uint64_t HashPath(const std::string& path) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (const char c : path) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// The input's path below the base directory, without any leading "./" or
+// separators, so it can be appended to the output root.
+std::string RelativePath(const std::string& input_filename,
+                         const std::string& base_directory) {
+  std::size_t start = 0;
+  if (input_filename.compare(0, base_directory.size(), base_directory) == 0) {
+    start = base_directory.size();
+  }
+  while (start < input_filename.size()) {
+    if (IsSeparator(input_filename[start])) {
+      ++start;
+    } else if ((input_filename.compare(start, 2, "./") == 0)) {
+      start += 2;
+    } else {
+      break;
+    }
+  }
+  return input_filename.substr(start);
+}
+
+// Replaces a leading "~" or "~user" with the home directory, the same way
+// glob() does with GLOB_TILDE, so the base directory matches the paths glob()
+// returns. Anything that can't be looked up is left alone, as glob() does.
+std::string ExpandTilde(const std::string& pattern) {
+  if (pattern.empty() || (pattern[0] != '~')) {
+    return pattern;
+  }
+  const std::size_t name_end = std::min(pattern.find('/'), pattern.size());
+  const std::string user_name = pattern.substr(1, name_end - 1);
+  const char* home = nullptr;
+  if (user_name.empty()) {
+    home = getenv("HOME");
+    if (home == nullptr) {
+      const struct passwd* entry = getpwuid(getuid());
+      home = (entry != nullptr) ? entry->pw_dir : nullptr;
+    }
+  } else {
+    const struct passwd* entry = getpwnam(user_name.c_str());
+    home = (entry != nullptr) ? entry->pw_dir : nullptr;
+  }
+  if (home == nullptr) {
+    return pattern;
+  }
+  return home + pattern.substr(name_end);
+}
+
+}  // namespace
+
+std::string GlobBaseDirectory(const std::string& pattern) {
+  const std::string expanded = ExpandTilde(pattern);
+  const std::size_t wildcard_index = expanded.find_first_of("*?[");
+  const std::string literal = expanded.substr(0, wildcard_index);
+  const std::size_t separator_index = literal.find_last_of("/\\");
+  if (separator_index == std::string::npos) {
+    return "";
+  }
+  return literal.substr(0, separator_index + 1);
+}
+
+std::string OutputRelativePath(const std::string& input_filename,
+                               const std::string& base_directory,
+                               OutputLayout layout, int hash_levels) {
+  const std::size_t separator_index = input_filename.find_last_of("/\\");
+  const std::string base_name =
+      (separator_index == std::string::npos)
+          ? input_filename
+          : input_filename.substr(separator_index + 1);
+  if (layout == OutputLayout::kFlat) {
+    return base_name;
+  }
+  const std::string relative_path =
+      RelativePath(input_filename, base_directory);
+  if (layout == OutputLayout::kMirror) {
+    return relative_path;
+  }
+  static const char kHexDigits[] = "0123456789abcdef";
+  const uint64_t hash = HashPath(relative_path);
+  std::string result;
+  for (int level = 0; level < hash_levels; ++level) {
+    const int byte = (hash >> (8 * (level % 8))) & 0xff;
+    result += kHexDigits[byte >> 4];
+    result += kHexDigits[byte & 0xf];
+    result += '/';
+  }
+  return result + base_name;
+}
+
+Status DirectoryCreator::Create(const std::string& path) {
+  std::string trimmed = path;
+  while ((trimmed.size() > 1) && IsSeparator(trimmed.back())) {
+    trimmed.pop_back();
+  }
+  if (trimmed.empty() || (known_.count(trimmed) != 0)) {
+    return Status::OK();
+  }
+  // Parents first, so that each mkdir() has somewhere to go.
+  const std::size_t separator_index = trimmed.find_last_of("/\\");
+  if ((separator_index != std::string::npos) && (separator_index > 0)) {
+    TF_RETURN_IF_ERROR(Create(trimmed.substr(0, separator_index)));
+  }
+  ++mkdir_calls_;
+  if ((mkdir(trimmed.c_str(), ACCESSPERMS) != 0) && (errno != EEXIST)) {
+    return errors::Unavailable("Couldn't create directory '", trimmed,
+                               "': ", strerror(errno));
+  }
+  known_.insert(trimmed);
+  return Status::OK();
+}
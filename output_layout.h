@@ -0,0 +1,68 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Decides where each output file goes under the output root, and creates the
+// directories that needs.
+
+#ifndef OUTPUT_LAYOUT_H_
+#define OUTPUT_LAYOUT_H_
+
+#include <stdint.h>
+
+#include <set>
+#include <string>
+
+#include "status.h"
+
+enum class OutputLayout {
+  // Every output goes straight into the root, under its input's file name.
+  kFlat,
+  // The input's path below the glob's base directory is recreated.
+  kMirror,
+  // Outputs are spread over levels of subdirectories named by a hash of the
+  // input's relative path, so no directory gets too big.
+  kHash,
+};
+
+// Returns the directory part of a glob pattern before its first wildcard,
+// including the trailing separator, e.g. "data/" for "data/*/*.wav". Patterns
+// with a wildcard in their first component give an empty string. A leading "~"
+// is expanded to the home directory first, as glob() does with GLOB_TILDE.
+std::string GlobBaseDirectory(const std::string& pattern);
+
+// Returns the output path for an input, relative to the output root. With
+// kHash, each of hash_levels directories has a two hex digit name, so there
+// are 256 at each level.
+std::string OutputRelativePath(const std::string& input_filename,
+                               const std::string& base_directory,
+                               OutputLayout layout, int hash_levels);
+
+// Creates directories along with any missing parents, remembering every one
+// it has seen so that each is only created once, however many files go in it.
+// Nothing is checked with stat(); a directory that already exists is found by
+// mkdir() failing with EEXIST.
+class DirectoryCreator {
+ public:
+  Status Create(const std::string& path);
+
+  // How many mkdir() calls have been made.
+  int64_t mkdir_calls() const { return mkdir_calls_; }
+
+ private:
+  std::set<std::string> known_;
+  int64_t mkdir_calls_ = 0;
+};
+
+#endif  // OUTPUT_LAYOUT_H_
@@ -0,0 +1,57 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "reorder_buffer.h"
+
+#include <assert.h>
+
+ReorderBuffer::ReorderBuffer(int64_t window, std::ostream* output)
+    : window_(window), output_(output), slots_(window), next_(0) {
+  // The slots swap strings with the LogBuffers that are committed, so they
+  // start with the same capacity.
+  for (Slot& slot : slots_) {
+    slot.text.reserve(LogBuffer::kInitialCapacity);
+  }
+}
+
+void ReorderBuffer::WaitForRoom(int64_t index) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  room_available_.wait(lock, [this, index]() {
+    return index < (next_ + window_);
+  });
+}
+
+void ReorderBuffer::Commit(int64_t index, std::string* text) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  assert((index >= next_) && (index < (next_ + window_)));
+  Slot& slot = slots_[index % window_];
+  slot.text.swap(*text);
+  text->clear();
+  slot.ready = true;
+  if (index != next_) {
+    return;
+  }
+  while (true) {
+    Slot& next_slot = slots_[next_ % window_];
+    if (!next_slot.ready) {
+      break;
+    }
+    output_->write(next_slot.text.data(), next_slot.text.size());
+    next_slot.ready = false;
+    ++next_;
+  }
+  output_->flush();
+  room_available_.notify_all();
+}
@@ -0,0 +1,113 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Puts the per-file log back into input order when files are processed in
+// parallel, so that the logs of two runs over the same inputs can be diffed.
+
+#ifndef REORDER_BUFFER_H_
+#define REORDER_BUFFER_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// An ostream that collects one file's log lines in a string. Clearing it keeps
+// the string's capacity, unlike std::ostringstream, so once it has held the
+// longest log it stops touching the heap.
+class LogBuffer : public std::ostream {
+ public:
+  // Enough for a few lines with long paths, so most logs never need more.
+  static constexpr size_t kInitialCapacity = 4096;
+
+  LogBuffer() : std::ostream(&buffer_) {
+    buffer_.text.reserve(kInitialCapacity);
+  }
+
+  const std::string& text() const { return buffer_.text; }
+  std::string* mutable_text() { return &buffer_.text; }
+
+ private:
+  struct StringBuffer : public std::streambuf {
+    int_type overflow(int_type c) override {
+      if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        text.push_back(traits_type::to_char_type(c));
+      }
+      return traits_type::not_eof(c);
+    }
+    std::streamsize xsputn(const char* data, std::streamsize size) override {
+      text.append(data, size);
+      return size;
+    }
+    std::string text;
+  };
+
+  StringBuffer buffer_;
+};
+
+// Holds each file's finished log until every file before it has finished
+// too, then writes them all out in input order. Only window files past the
+// oldest unfinished one can be in progress at once, which bounds how much is
+// held: a thread that wants to start a file further ahead waits in
+// WaitForRoom() until the files before it catch up. A bigger window lets
+// threads work further past a slow file, at the cost of memory.
+//
+// Every index from zero up has to be committed exactly once, even if its log
+// is empty, or the ones after it will never be written.
+//
+// Example usage:
+//
+// ReorderBuffer reorder(64, &std::cerr);
+// reorder.WaitForRoom(index);
+// LogBuffer log;
+// log << "Saved to '" << name << "'" << std::endl;
+// reorder.Commit(index, log.mutable_text());
+class ReorderBuffer {
+ public:
+  ReorderBuffer(int64_t window, std::ostream* output);
+
+  // Waits until index is less than window past the oldest unfinished file.
+  // As long as the thread holding that file never waits here for a later one,
+  // this can't deadlock.
+  void WaitForRoom(int64_t index);
+
+  // Takes over a finished file's log, leaving text empty, and writes out the
+  // run of finished logs that's ready, if there is one. The strings are
+  // swapped rather than copied, so their buffers are recycled.
+  void Commit(int64_t index, std::string* text);
+
+  int64_t window() const { return window_; }
+
+ private:
+  struct Slot {
+    bool ready = false;
+    std::string text;
+  };
+
+  const int64_t window_;
+  std::ostream* output_;
+  std::mutex mutex_;
+  std::condition_variable room_available_;
+  // Logs waiting for an earlier file, with index i in slot i % window.
+  std::vector<Slot> slots_;
+  // The oldest file that hasn't been committed.
+  int64_t next_;
+};
+
+#endif  // REORDER_BUFFER_H_
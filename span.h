@@ -0,0 +1,56 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// A non-owning view of a contiguous array, like std::span from C++20.
+
+#ifndef SPAN_H_
+#define SPAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Points at memory owned by someone else, such as a memory-mapped file, a
+// network buffer, or a vector. It's cheap to copy, and the caller must keep the
+// underlying memory alive for as long as the span is in use.
+template <class T>
+class Span {
+ public:
+  Span() : data_(nullptr), size_(0) {}
+  Span(T* data, int64_t size) : data_(data), size_(size) {}
+  template <class U>
+  Span(const std::vector<U>& vector)
+      : data_(vector.data()), size_(vector.size()) {}
+  template <class U>
+  Span(std::vector<U>& vector) : data_(vector.data()), size_(vector.size()) {}
+
+  T* data() const { return data_; }
+  int64_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  T& operator[](int64_t index) const { return data_[index]; }
+  T* begin() const { return data_; }
+  T* end() const { return data_ + size_; }
+
+  Span subspan(int64_t offset, int64_t count) const {
+    return Span(data_ + offset, count);
+  }
+
+ private:
+  T* data_;
+  int64_t size_;
+};
+
+#endif  // SPAN_H_
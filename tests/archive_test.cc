@@ -0,0 +1,211 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Checks the tar and zip member listings against archives written by the
+// system's own tar and zip, which tests/testdata/make_fixtures.sh made, and
+// that damaged archives give errors rather than members that point outside
+// the data.
+//
+// Usage: archive_test
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "archive.h"
+#include "tests/test_util.h"
+
+TEST_MAIN_GLOBALS;
+
+namespace {
+
+const char kTestDataDir[] = "tests/testdata/";
+const char kLongPath[] =
+    "a_directory_with_a_name_long_enough_that_the_path/"
+    "of_anything_inside_it_overflows_the_tar_name_field/short.wav";
+
+typedef Status (*ListFunction)(const uint8_t* data, size_t size,
+                               std::vector<ArchiveMember>* members);
+
+uint64_t ReadLittleEndian(const uint8_t* data, int size) {
+  uint64_t value = 0;
+  for (int i = 0; i < size; ++i) {
+    value |= static_cast<uint64_t>(data[i]) << (8 * i);
+  }
+  return value;
+}
+
+void WriteLittleEndian(uint64_t value, int size, uint8_t* data) {
+  for (int i = 0; i < size; ++i) {
+    data[i] = (value >> (8 * i)) & 0xff;
+  }
+}
+
+// Finds the last copy of a four byte zip signature.
+size_t FindSignature(const std::vector<uint8_t>& data, uint32_t signature) {
+  for (size_t i = data.size() - 4; i > 0; --i) {
+    if (ReadLittleEndian(data.data() + i, 4) == signature) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+// Every member has to lie within the archive, whatever state it's in.
+void CheckInBounds(const char* name, size_t size,
+                   const std::vector<ArchiveMember>& members) {
+  for (const ArchiveMember& member : members) {
+    if ((member.offset > size) || (member.size > (size - member.offset))) {
+      std::cerr << name << ": '" << member.path << "' at " << member.offset
+                << " with " << member.size << " bytes is outside the "
+                << size << " byte archive" << std::endl;
+      ++g_test_failures;
+    }
+  }
+}
+
+// Lists a fixture and checks the stored clips are where they're said to be.
+// Compressed members are only checked for their method.
+void CheckListing(const char* filename, ListFunction list,
+                  const std::vector<std::string>& expected_paths,
+                  const std::vector<uint16_t>& expected_methods,
+                  const std::vector<uint8_t>& clip) {
+  const std::vector<uint8_t> archive =
+      ReadTestFile(std::string(kTestDataDir) + filename);
+  if (archive.empty()) {
+    return;
+  }
+  std::vector<ArchiveMember> members;
+  EXPECT_OK(list(archive.data(), archive.size(), &members));
+  EXPECT_EQ(expected_paths.size(), members.size());
+  CheckInBounds(filename, archive.size(), members);
+  for (size_t i = 0; (i < members.size()) && (i < expected_paths.size());
+       ++i) {
+    const ArchiveMember& member = members[i];
+    EXPECT_EQ(expected_paths[i], member.path);
+    EXPECT_EQ(expected_methods[i], member.compression_method);
+    if ((member.compression_method == 0) &&
+        ((member.size != clip.size()) ||
+         (memcmp(archive.data() + member.offset, clip.data(), clip.size()) !=
+          0))) {
+      std::cerr << filename << ": '" << member.path
+                << "' doesn't point at the clip" << std::endl;
+      ++g_test_failures;
+    }
+  }
+
+  // Cut short anywhere, an archive can only give fewer of its members. Each
+  // is a copy, so reading past the end shows up under -fsanitize=address.
+  for (size_t size = 0; size < archive.size(); ++size) {
+    const std::vector<uint8_t> truncated(archive.begin(),
+                                         archive.begin() + size);
+    members.clear();
+    list(truncated.data(), truncated.size(), &members);
+    CheckInBounds(filename, truncated.size(), members);
+    EXPECT_TRUE(members.size() <= expected_paths.size());
+  }
+
+  // Damage to any byte mustn't lead outside the archive either.
+  std::vector<uint8_t> damaged = archive;
+  for (size_t i = 0; i < damaged.size(); ++i) {
+    for (const uint8_t flip : {0x01, 0xff}) {
+      damaged[i] ^= flip;
+      members.clear();
+      list(damaged.data(), damaged.size(), &members);
+      CheckInBounds(filename, damaged.size(), members);
+      damaged[i] ^= flip;
+    }
+  }
+}
+
+// Tar headers are checksummed, so damage to one is reported.
+void CheckTarHeaderDamage() {
+  std::vector<uint8_t> archive =
+      ReadTestFile(std::string(kTestDataDir) + "gnu.tar");
+  if (archive.size() < 512) {
+    return;
+  }
+  archive[0] ^= 0x01;
+  std::vector<ArchiveMember> members;
+  const Status status = ListTarMembers(archive.data(), archive.size(),
+                                       &members);
+  EXPECT_TRUE(errors::IsDataLoss(status));
+  EXPECT_EQ(static_cast<size_t>(0), members.size());
+}
+
+// Offsets read from a Zip64 archive are 64 bits, so adding a record's size to
+// one can wrap around and look like it's in range.
+void CheckZip64Offsets() {
+  const std::vector<uint8_t> archive =
+      ReadTestFile(std::string(kTestDataDir) + "zip64.zip");
+  if (archive.empty()) {
+    return;
+  }
+  const size_t locator = FindSignature(archive, 0x07064b50);
+  const size_t central = FindSignature(archive, 0x02014b50);
+  EXPECT_TRUE((locator > 0) && (central > 0));
+  if ((locator == 0) || (central == 0)) {
+    return;
+  }
+  for (const uint64_t record_offset :
+       {~uint64_t(0) - 15, ~uint64_t(0), uint64_t(archive.size() - 20)}) {
+    std::vector<uint8_t> damaged = archive;
+    WriteLittleEndian(record_offset, 8, damaged.data() + locator + 8);
+    std::vector<ArchiveMember> members;
+    EXPECT_TRUE(errors::IsDataLoss(
+        ListZipMembers(damaged.data(), damaged.size(), &members)));
+  }
+
+  // The last central directory entry's local header offset, moved into its
+  // Zip64 extra field in place of the uncompressed size that's there now.
+  const uint64_t name_length = ReadLittleEndian(&archive[central + 28], 2);
+  const uint64_t extra_length = ReadLittleEndian(&archive[central + 30], 2);
+  const size_t extra = central + 46 + name_length;
+  EXPECT_EQ(static_cast<uint64_t>(12), extra_length);
+  EXPECT_EQ(static_cast<uint64_t>(1), ReadLittleEndian(&archive[extra], 2));
+  if ((extra_length != 12) || (ReadLittleEndian(&archive[extra], 2) != 1)) {
+    return;
+  }
+  for (const uint64_t local_offset : {~uint64_t(0) - 15, ~uint64_t(0)}) {
+    std::vector<uint8_t> damaged = archive;
+    WriteLittleEndian(1044, 4, &damaged[central + 24]);
+    WriteLittleEndian(0xffffffff, 4, &damaged[central + 42]);
+    WriteLittleEndian(local_offset, 8, &damaged[extra + 4]);
+    std::vector<ArchiveMember> members;
+    EXPECT_TRUE(errors::IsDataLoss(
+        ListZipMembers(damaged.data(), damaged.size(), &members)));
+    CheckInBounds("zip64.zip", damaged.size(), members);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const std::vector<uint8_t> clip =
+      ReadTestFile(std::string(kTestDataDir) + "short.wav");
+  const std::vector<std::string> paths = {"short.wav", kLongPath};
+  // GNU tars keep long names in 'L' records, pax ones in extended headers,
+  // and ustar ones split them into a prefix and a name.
+  for (const char* filename : {"gnu.tar", "pax.tar", "ustar.tar"}) {
+    CheckListing(filename, ListTarMembers, paths, {0, 0}, clip);
+  }
+  CheckListing("mixed.zip", ListZipMembers, paths, {0, 8}, clip);
+  CheckListing("zip64.zip", ListZipMembers, paths, {0, 0}, clip);
+  CheckTarHeaderDamage();
+  CheckZip64Offsets();
+  return FinishTests("archive_test");
+}
@@ -0,0 +1,161 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Checks the gzip and zstd readers against files written by the system's own
+// gzip and zstd, which tests/testdata/make_fixtures.sh made, and that streams
+// which are cut short or damaged are reported as errors instead of crashing
+// or coming out wrong.
+//
+// Usage: compressed_input_test
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "byte_reader.h"
+#include "gzip_reader.h"
+#include "tests/test_util.h"
+#include "zstd_reader.h"
+
+TEST_MAIN_GLOBALS;
+
+namespace {
+
+const char kTestDataDir[] = "tests/testdata/";
+
+enum class Format { kGzip, kZstd };
+
+struct Fixture {
+  const char* filename;
+  Format format;
+  // Concatenated members or frames can be cut cleanly between them.
+  bool single_member;
+  // Whether the stream has a checksum of its contents, so any damage to it
+  // has to be noticed.
+  bool has_checksum;
+};
+
+const Fixture kFixtures[] = {
+    {"tone.wav.gz", Format::kGzip, true, true},
+    {"tone_fast.wav.gz", Format::kGzip, true, true},
+    {"tone_members.wav.gz", Format::kGzip, false, true},
+    {"tone.wav.zst", Format::kZstd, true, true},
+    {"tone_fast.wav.zst", Format::kZstd, true, false},
+    {"tone_frames.wav.zst", Format::kZstd, false, true},
+};
+
+// Reads the whole stream in pieces of piece_size bytes.
+Status Decompress(Format format, const uint8_t* data, size_t size,
+                  int64_t piece_size, Arena* arena,
+                  std::vector<uint8_t>* output) {
+  output->clear();
+  std::unique_ptr<ByteReader> reader;
+  if (format == Format::kGzip) {
+    reader.reset(new GzipReader(data, size, arena));
+  } else {
+    reader.reset(new ZstdReader(data, size, arena));
+  }
+  std::vector<uint8_t> piece(piece_size);
+  while (true) {
+    int64_t bytes_read = 0;
+    TF_RETURN_IF_ERROR(reader->Read(piece.data(), piece_size, &bytes_read));
+    if (bytes_read == 0) {
+      return Status::OK();
+    }
+    output->insert(output->end(), piece.begin(), piece.begin() + bytes_read);
+  }
+}
+
+void CheckFixture(const Fixture& fixture, const std::vector<uint8_t>& expected,
+                  Arena* arena) {
+  const std::vector<uint8_t> compressed =
+      ReadTestFile(std::string(kTestDataDir) + fixture.filename);
+  if (compressed.empty()) {
+    return;
+  }
+  std::vector<uint8_t> output;
+  // Reads that are tiny, odd-sized, and bigger than the whole output.
+  for (const int64_t piece_size : {1, 7, 4096, 1 << 20}) {
+    const Status status = Decompress(fixture.format, compressed.data(),
+                                     compressed.size(), piece_size, arena,
+                                     &output);
+    arena->Reset();
+    if (!status.ok() || (output != expected)) {
+      std::cerr << fixture.filename << " read " << piece_size
+                << " bytes at a time gave " << output.size()
+                << " bytes that don't match, with " << status << std::endl;
+      ++g_test_failures;
+    }
+  }
+
+  // Every way of cutting the stream short. Each is a copy, so reading past
+  // the end shows up under -fsanitize=address.
+  for (size_t size = 0; size < compressed.size(); ++size) {
+    const std::vector<uint8_t> truncated(compressed.begin(),
+                                         compressed.begin() + size);
+    const Status status =
+        Decompress(fixture.format, truncated.data(), truncated.size(), 4096,
+                   arena, &output);
+    arena->Reset();
+    if (fixture.single_member) {
+      if (status.ok()) {
+        std::cerr << fixture.filename << " cut to " << size
+                  << " bytes wasn't reported as an error" << std::endl;
+        ++g_test_failures;
+      }
+    } else if (status.ok() &&
+               ((output.size() >= expected.size()) ||
+                !std::equal(output.begin(), output.end(), expected.begin()))) {
+      std::cerr << fixture.filename << " cut to " << size
+                << " bytes gave the wrong data" << std::endl;
+      ++g_test_failures;
+    }
+  }
+
+  // A single flipped bit in each byte in turn. With a checksum the output has
+  // to be either an error or still right, and without one it just mustn't
+  // crash.
+  std::vector<uint8_t> damaged = compressed;
+  for (size_t i = 0; i < damaged.size(); ++i) {
+    const uint8_t flip = 1 << (i % 8);
+    damaged[i] ^= flip;
+    const Status status = Decompress(fixture.format, damaged.data(),
+                                     damaged.size(), 4096, arena, &output);
+    arena->Reset();
+    damaged[i] ^= flip;
+    if (fixture.has_checksum && status.ok() && (output != expected)) {
+      std::cerr << fixture.filename << " with byte " << i
+                << " damaged gave the wrong data without an error"
+                << std::endl;
+      ++g_test_failures;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const std::vector<uint8_t> expected =
+      ReadTestFile(std::string(kTestDataDir) + "tone.wav");
+  Arena arena(1 << 20, false);
+  for (const Fixture& fixture : kFixtures) {
+    CheckFixture(fixture, expected, &arena);
+  }
+  return FinishTests("compressed_input_test");
+}
@@ -0,0 +1,298 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Checks that clips written by the FLAC encoder decode back to exactly the
+// samples that went in, for signals that exercise each kind of subframe, and
+// that the decoder can seek between frames and reports damaged streams as
+// errors.
+//
+// Usage: flac_test
+
+#include <math.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "flac_decoder.h"
+#include "flac_encoder.h"
+#include "tests/test_util.h"
+
+TEST_MAIN_GLOBALS;
+
+namespace {
+
+// Fills interleaved samples for every channel, with each channel a slightly
+// different version of the signal so that mixing them up would be noticed.
+typedef int16_t (*SignalFunction)(int64_t frame, int channel,
+                                  uint32_t* random_state);
+
+int16_t Silence(int64_t, int, uint32_t*) { return 0; }
+
+int16_t Constant(int64_t, int channel, uint32_t*) {
+  return -1234 + channel;
+}
+
+// Polynomials are predicted exactly by the fixed predictors.
+int16_t Ramp(int64_t frame, int channel, uint32_t*) {
+  return static_cast<int16_t>(((frame * 7) % 60000) - 30000 + channel);
+}
+
+// A mix of tones, which the LPC predictors do best on.
+int16_t Tones(int64_t frame, int channel, uint32_t*) {
+  const double t = frame / 16000.0;
+  return static_cast<int16_t>(lrint(12000.0 * sin(2 * M_PI * 440.0 * t) +
+                                    6000.0 * sin(2 * M_PI * 1234.5 * t) +
+                                    (channel * 100.0)));
+}
+
+// White noise can't be predicted, so it's stored verbatim.
+int16_t Noise(int64_t, int, uint32_t* random_state) {
+  *random_state = (*random_state * 1664525) + 1013904223;
+  return static_cast<int16_t>(*random_state >> 16);
+}
+
+// Jumps between the extremes give the largest residuals there can be.
+int16_t FullScale(int64_t frame, int channel, uint32_t*) {
+  return (((frame / (channel + 1)) % 2) == 0) ? 32767 : -32768;
+}
+
+void CheckRoundTrip(const char* name, SignalFunction signal,
+                    uint32_t sample_rate, int channel_count,
+                    int64_t frame_count, Arena* arena) {
+  uint32_t random_state = 1;
+  std::vector<int16_t> samples(frame_count * channel_count);
+  for (int64_t i = 0; i < frame_count; ++i) {
+    for (int c = 0; c < channel_count; ++c) {
+      samples[(i * channel_count) + c] = signal(i, c, &random_state);
+    }
+  }
+  std::vector<char> encoded(FlacMaxSize(channel_count, frame_count));
+  size_t encoded_size = 0;
+  const Status encode_status = EncodeLin16AsFlac(
+      samples.data(), sample_rate, channel_count, frame_count, arena,
+      encoded.data(), encoded.size(), &encoded_size);
+  if (!encode_status.ok()) {
+    std::cerr << name << ": encoding failed with " << encode_status
+              << std::endl;
+    ++g_test_failures;
+    return;
+  }
+  EXPECT_TRUE(encoded_size <= encoded.size());
+
+  FlacDecoder decoder(reinterpret_cast<const uint8_t*>(encoded.data()),
+                      encoded_size);
+  EXPECT_OK(decoder.ReadHeader());
+  EXPECT_EQ(sample_rate, decoder.sample_rate());
+  EXPECT_EQ(channel_count, decoder.channel_count());
+  EXPECT_EQ(16, decoder.bits_per_sample());
+  EXPECT_EQ(frame_count, decoder.total_frames());
+  if ((decoder.channel_count() != channel_count) ||
+      (decoder.max_block_size() < 1)) {
+    return;
+  }
+  const int max_block_size = decoder.max_block_size();
+  std::vector<int32_t> block(channel_count * max_block_size);
+  int64_t decoded_frames = 0;
+  int64_t mismatches = 0;
+  while (true) {
+    int block_size = 0;
+    const Status frame_status = decoder.ReadFrame(block.data(), &block_size);
+    if (!frame_status.ok()) {
+      std::cerr << name << ": decoding failed at frame " << decoded_frames
+                << " with " << frame_status << std::endl;
+      ++g_test_failures;
+      return;
+    }
+    if (block_size == 0) {
+      break;
+    }
+    for (int i = 0; i < block_size; ++i) {
+      const int64_t frame = decoded_frames + i;
+      for (int c = 0; c < channel_count; ++c) {
+        if ((frame >= frame_count) ||
+            (block[(c * max_block_size) + i] !=
+             samples[(frame * channel_count) + c])) {
+          ++mismatches;
+        }
+      }
+    }
+    decoded_frames += block_size;
+  }
+  if ((decoded_frames != frame_count) || (mismatches != 0)) {
+    std::cerr << name << " with " << channel_count << " channels and "
+              << frame_count << " frames: decoded " << decoded_frames
+              << " frames with " << mismatches << " mismatched samples"
+              << std::endl;
+    ++g_test_failures;
+  }
+  arena->Reset();
+}
+
+// Encodes a few blocks of tones for the decoder checks below.
+std::vector<uint8_t> EncodeTones(int channel_count, int64_t frame_count,
+                                 Arena* arena) {
+  uint32_t random_state = 1;
+  std::vector<int16_t> samples(frame_count * channel_count);
+  for (int64_t i = 0; i < frame_count; ++i) {
+    for (int c = 0; c < channel_count; ++c) {
+      samples[(i * channel_count) + c] = Tones(i, c, &random_state);
+    }
+  }
+  std::vector<uint8_t> encoded(FlacMaxSize(channel_count, frame_count));
+  size_t encoded_size = 0;
+  EXPECT_OK(EncodeLin16AsFlac(samples.data(), 16000, channel_count,
+                              frame_count, arena,
+                              reinterpret_cast<char*>(encoded.data()),
+                              encoded.size(), &encoded_size));
+  encoded.resize(encoded_size);
+  arena->Reset();
+  return encoded;
+}
+
+// Decodes every frame, returning the first error, and how many audio frames
+// came out before it.
+Status DecodeAll(const uint8_t* data, size_t size, int64_t* decoded_frames) {
+  *decoded_frames = 0;
+  FlacDecoder decoder(data, size);
+  TF_RETURN_IF_ERROR(decoder.ReadHeader());
+  if ((decoder.channel_count() < 1) || (decoder.max_block_size() < 1)) {
+    return errors::DataLoss("Empty FLAC stream");
+  }
+  std::vector<int32_t> block(decoder.channel_count() *
+                             decoder.max_block_size());
+  while (true) {
+    int block_size = 0;
+    TF_RETURN_IF_ERROR(decoder.ReadFrame(block.data(), &block_size));
+    if (block_size == 0) {
+      return Status::OK();
+    }
+    *decoded_frames += block_size;
+  }
+}
+
+// Going back to a frame that was passed earlier gives the same samples again,
+// which is what the partial decode of the winning window relies on.
+void CheckSeeking(Arena* arena) {
+  const std::vector<uint8_t> encoded = EncodeTones(2, (5 * 4096) + 100, arena);
+  FlacDecoder decoder(encoded.data(), encoded.size());
+  EXPECT_OK(decoder.ReadHeader());
+  const int max_block_size = decoder.max_block_size();
+  std::vector<FlacSeekPoint> points;
+  std::vector<std::vector<int32_t>> blocks;
+  while (true) {
+    const FlacSeekPoint point = decoder.position();
+    std::vector<int32_t> block(2 * max_block_size);
+    int block_size = 0;
+    EXPECT_OK(decoder.ReadFrame(block.data(), &block_size));
+    if (block_size == 0) {
+      break;
+    }
+    EXPECT_EQ(static_cast<int64_t>(points.size()) * 4096, point.first_frame);
+    points.push_back(point);
+    blocks.push_back(block);
+  }
+  EXPECT_EQ(static_cast<size_t>(6), points.size());
+  for (int i = static_cast<int>(points.size()) - 1; i >= 0; --i) {
+    decoder.Seek(points[i]);
+    EXPECT_EQ(points[i].first_frame, decoder.position().first_frame);
+    std::vector<int32_t> block(2 * max_block_size);
+    int block_size = 0;
+    EXPECT_OK(decoder.ReadFrame(block.data(), &block_size));
+    EXPECT_TRUE(block == blocks[i]);
+  }
+}
+
+// Streams cut short or with a damaged byte have to come back as errors
+// rather than reading out of bounds, which is worth running under
+// -fsanitize=address too.
+void CheckDamagedStreams(Arena* arena) {
+  // Two frames, so there's a short last one, while keeping the number of
+  // damaged copies down.
+  const int64_t frame_count = 4096 + 100;
+  const std::vector<uint8_t> encoded = EncodeTones(2, frame_count, arena);
+  FlacDecoder decoder(encoded.data(), encoded.size());
+  EXPECT_OK(decoder.ReadHeader());
+  const size_t first_frame_offset = decoder.position().offset;
+
+  // Cutting the stream anywhere but between frames leaves a frame that's
+  // incomplete.
+  for (size_t size = 0; size < encoded.size(); ++size) {
+    // A copy, so reading past the end is caught by the address sanitizer.
+    const std::vector<uint8_t> truncated(encoded.begin(),
+                                         encoded.begin() + size);
+    int64_t decoded_frames = 0;
+    const Status status =
+        DecodeAll(truncated.data(), truncated.size(), &decoded_frames);
+    if (status.ok()) {
+      EXPECT_TRUE(size >= first_frame_offset);
+      EXPECT_TRUE(decoded_frames < frame_count);
+    }
+  }
+
+  // Each frame ends with a CRC-16 of everything before it, which catches any
+  // change to a single byte.
+  std::vector<uint8_t> damaged = encoded;
+  for (size_t i = first_frame_offset; i < damaged.size(); ++i) {
+    for (const uint8_t flip : {0x01, 0xff}) {
+      damaged[i] ^= flip;
+      int64_t decoded_frames = 0;
+      EXPECT_NOT_OK(DecodeAll(damaged.data(), damaged.size(),
+                              &decoded_frames));
+      damaged[i] ^= flip;
+    }
+  }
+  // Damage to the metadata may only change what the header says, but it
+  // mustn't crash.
+  for (size_t i = 0; i < first_frame_offset; ++i) {
+    damaged[i] ^= 0xff;
+    int64_t decoded_frames = 0;
+    DecodeAll(damaged.data(), damaged.size(), &decoded_frames);
+    damaged[i] ^= 0xff;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Arena arena(1 << 20, false);
+  struct NamedSignal {
+    const char* name;
+    SignalFunction signal;
+  };
+  const NamedSignal signals[] = {
+      {"Silence", Silence}, {"Constant", Constant},   {"Ramp", Ramp},
+      {"Tones", Tones},     {"Noise", Noise},         {"FullScale", FullScale},
+  };
+  // Lengths either side of the encoder's 4096 frame blocks, so the short
+  // last block is covered.
+  const int64_t frame_counts[] = {1, 31, 4095, 4096, 4097, (3 * 4096) + 17};
+  for (const NamedSignal& named : signals) {
+    for (const int64_t frame_count : frame_counts) {
+      for (const int channel_count : {1, 2, 8}) {
+        CheckRoundTrip(named.name, named.signal, 16000, channel_count,
+                       frame_count, &arena);
+      }
+    }
+  }
+  // Frame headers leave the rate to STREAMINFO, so any rate it can hold
+  // should survive.
+  CheckRoundTrip("Tones", Tones, 44100, 2, 5000, &arena);
+  CheckRoundTrip("Tones", Tones, (1 << 20) - 1, 1, 5000, &arena);
+  CheckSeeking(&arena);
+  CheckDamagedStreams(&arena);
+  return FinishTests("flac_test");
+}
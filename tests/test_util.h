@@ -0,0 +1,101 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Just enough of a harness for the reference checks in this directory. Each
+// check is a plain program built like the tools, which prints what failed
+// and exits with a non-zero status if anything did.
+
+#ifndef TESTS_TEST_UTIL_H_
+#define TESTS_TEST_UTIL_H_
+
+#include <stdint.h>
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "status.h"
+
+// How many expectations have failed so far in this program.
+extern int g_test_failures;
+
+// Defines the failure counter. Used once, in the file with main().
+#define TEST_MAIN_GLOBALS int g_test_failures = 0
+
+#define EXPECT_TRUE(condition)                                          \
+  do {                                                                  \
+    if (!(condition)) {                                                 \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": Expected "         \
+                << #condition << std::endl;                             \
+      ++g_test_failures;                                                \
+    }                                                                   \
+  } while (0)
+
+#define EXPECT_EQ(expected, actual)                                     \
+  do {                                                                  \
+    const auto& _expected = (expected);                                 \
+    const auto& _actual = (actual);                                     \
+    if (!(_expected == _actual)) {                                      \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": Expected "         \
+                << #actual << " to be " << _expected << ", got "        \
+                << _actual << std::endl;                                \
+      ++g_test_failures;                                                \
+    }                                                                   \
+  } while (0)
+
+#define EXPECT_OK(expr)                                                 \
+  do {                                                                  \
+    const ::Status _status = (expr);                                    \
+    if (!_status.ok()) {                                                \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " << #expr         \
+                << " failed with " << _status << std::endl;             \
+      ++g_test_failures;                                                \
+    }                                                                   \
+  } while (0)
+
+#define EXPECT_NOT_OK(expr)                                             \
+  do {                                                                  \
+    if ((expr).ok()) {                                                  \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": Expected " << #expr \
+                << " to fail" << std::endl;                             \
+      ++g_test_failures;                                                \
+    }                                                                   \
+  } while (0)
+
+// Loads a fixture, counting a failure if it can't be read.
+inline std::vector<uint8_t> ReadTestFile(const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) {
+    std::cerr << "Couldn't read '" << filename << "'" << std::endl;
+    ++g_test_failures;
+    return std::vector<uint8_t>();
+  }
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(file),
+                              std::istreambuf_iterator<char>());
+}
+
+// Prints the result and returns the program's exit code.
+inline int FinishTests(const char* name) {
+  if (g_test_failures > 0) {
+    std::cerr << name << ": " << g_test_failures << " failures" << std::endl;
+    return 1;
+  }
+  std::cerr << name << ": passed" << std::endl;
+  return 0;
+}
+
+#endif  // TESTS_TEST_UTIL_H_
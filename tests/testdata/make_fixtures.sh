@@ -0,0 +1,78 @@
+#!/bin/bash
+# Regenerates the fixtures in this directory with the system's own gzip, zstd,
+# tar and zip, so the readers are checked against independent writers. The
+# outputs are checked in, so this only needs running to change them.
+#
+# Usage: tests/testdata/make_fixtures.sh
+
+set -e
+cd "$(dirname "$0")"
+
+# Half a second of 16kHz mono audio: a tone, then noise that won't compress,
+# then silence, so the compressors use several kinds of block. The archives
+# hold a short clip of the start, since only their layout matters.
+python3 - <<'PYTHON'
+import math, struct, wave
+samples = []
+state = 1
+for i in range(8000):
+  if i < 3000:
+    value = int(round(10000 * math.sin(2 * math.pi * 440 * i / 16000)))
+  elif i < 6000:
+    state = (state * 1664525 + 1013904223) % (1 << 32)
+    value = (state >> 16) - 32768
+  else:
+    value = 0
+  samples.append(value)
+for filename, count in (("tone.wav", 8000), ("short.wav", 500)):
+  with wave.open(filename, "wb") as output:
+    output.setnchannels(1)
+    output.setsampwidth(2)
+    output.setframerate(16000)
+    output.writeframes(struct.pack("<%dh" % count, *samples[:count]))
+PYTHON
+
+# -n leaves out the name and timestamp, so the output doesn't change.
+gzip -9 -n -c tone.wav > tone.wav.gz
+gzip -1 -n -c tone.wav > tone_fast.wav.gz
+# Concatenated members come out as one stream.
+head -c 10000 tone.wav | gzip -n -c > tone_members.wav.gz
+tail -c +10001 tone.wav | gzip -n -c >> tone_members.wav.gz
+
+zstd -q -19 --check -c tone.wav > tone.wav.zst
+zstd -q -1 --no-check -c tone.wav > tone_fast.wav.zst
+head -c 10000 tone.wav | zstd -q --check -c > tone_frames.wav.zst
+tail -c +10001 tone.wav | zstd -q --check -c >> tone_frames.wav.zst
+
+# Each archive holds directories, a clip at the top level, and the same clip
+# under a path too long for the 100 byte tar name field, which GNU, pax and
+# ustar tars each store differently. Fixed times and owners keep the output
+# the same from run to run.
+long_dir="a_directory_with_a_name_long_enough_that_the_path/of_anything_inside"
+long_dir="${long_dir}_it_overflows_the_tar_name_field"
+staging=$(mktemp -d)
+trap 'rm -rf "${staging}"' EXIT
+mkdir -p "${staging}/${long_dir}"
+cp short.wav "${staging}/short.wav"
+cp short.wav "${staging}/${long_dir}/short.wav"
+touch -d "2020-01-01 00:00:00 UTC" "${staging}/${long_dir%/*}" \
+  "${staging}/${long_dir}" "${staging}/short.wav" \
+  "${staging}/${long_dir}/short.wav"
+tar_options=(--sort=name --mtime="2020-01-01 00:00:00 UTC" --owner=0
+  --group=0 --numeric-owner --blocking-factor=1 -C "${staging}")
+tar "${tar_options[@]}" --format=gnu -cf gnu.tar short.wav "${long_dir%/*}"
+tar "${tar_options[@]}" --format=ustar -cf ustar.tar short.wav \
+  "${long_dir%/*}"
+tar "${tar_options[@]}" --format=pax \
+  --pax-option=exthdr.name=%d/PaxHeaders/%f,delete=atime,delete=ctime \
+  -cf pax.tar short.wav "${long_dir%/*}"
+
+# Zip members can be stored or compressed, and -fz forces the Zip64 records
+# that archives over 4GB need.
+rm -f mixed.zip zip64.zip
+(
+  cd "${staging}"
+  zip -q -X -0 "${OLDPWD}/mixed.zip" short.wav "${long_dir}/"
+  zip -q -X -9 "${OLDPWD}/mixed.zip" "${long_dir}/short.wav"
+  zip -q -X -0 -fz "${OLDPWD}/zip64.zip" short.wav "${long_dir}/short.wav"
+)
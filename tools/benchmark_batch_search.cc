@@ -0,0 +1,163 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Times the loudest window search over a set of WAV files held in memory, once
+// a clip at a time and once in batches of clips with the same sample rate,
+// and checks that both give the same windows.
+//
+// Usage: benchmark_batch_search [--kernel=NAME] <wav file>...
+
+#include <stdint.h>
+#include <string.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "kernels.h"
+#include "loudest_section.h"
+#include "wav_io.h"
+
+namespace {
+
+constexpr int64_t kDesiredLengthMs = 1000;
+// Enough passes over a corpus of short clips to get a stable time.
+constexpr int kRepetitions = 20;
+
+// The clips that share a sample rate, and so a window size.
+struct RateGroup {
+  std::vector<Span<const int16_t>> inputs;
+  std::vector<int> channel_counts;
+  std::vector<SegmentRange> ranges;
+};
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  int first_file = 1;
+  if ((argc > 1) && (strncmp(argv[1], "--kernel=", 9) == 0)) {
+    Status status = SelectAudioKernels(argv[1] + 9);
+    if (!status.ok()) {
+      std::cerr << status << std::endl;
+      return -1;
+    }
+    first_file = 2;
+  }
+  if (argc <= first_file) {
+    std::cerr << "Usage: benchmark_batch_search [--kernel=NAME] <wav file>..."
+              << std::endl;
+    return -1;
+  }
+
+  // The samples are copied into aligned arrays, since WAV data can start at
+  // any offset.
+  std::vector<std::vector<int16_t>> clips;
+  std::map<uint32_t, RateGroup> groups;
+  int64_t total_frames = 0;
+  for (int i = first_file; i < argc; ++i) {
+    std::ifstream file(argv[i], std::ios::binary);
+    const std::string wav_data((std::istreambuf_iterator<char>(file)),
+                               std::istreambuf_iterator<char>());
+    int64_t sample_count;
+    uint16_t channel_count;
+    uint32_t sample_rate;
+    const uint8_t* sample_data;
+    Status status = FindLin16WaveSamples(
+        reinterpret_cast<const uint8_t*>(wav_data.data()), wav_data.size(),
+        &sample_count, &channel_count, &sample_rate, &sample_data);
+    if (!status.ok()) {
+      std::cerr << "Skipping '" << argv[i] << "': " << status << std::endl;
+      continue;
+    }
+    // sample_count is in frames, which hold one value per channel.
+    const int64_t value_count = sample_count * channel_count;
+    clips.emplace_back(value_count);
+    memcpy(clips.back().data(), sample_data, value_count * sizeof(int16_t));
+    RateGroup& group = groups[sample_rate];
+    group.inputs.push_back(
+        Span<const int16_t>(clips.back().data(), value_count));
+    group.channel_counts.push_back(channel_count);
+    total_frames += sample_count;
+  }
+
+  // The two searches take turns, so that anything else slowing the machine
+  // down affects both equally.
+  std::vector<SegmentRange> batch_ranges;
+  double single_seconds = 0.0;
+  double batch_seconds = 0.0;
+  for (int repetition = 0; repetition < kRepetitions; ++repetition) {
+    for (auto& rate_and_group : groups) {
+      RateGroup& group = rate_and_group.second;
+      const int64_t desired_frames =
+          (kDesiredLengthMs * rate_and_group.first) / 1000;
+      group.ranges.resize(group.inputs.size());
+      batch_ranges.resize(group.inputs.size());
+      const auto single_start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < group.inputs.size(); ++i) {
+        group.ranges[i] =
+            FindLoudestSegmentLin16(group.inputs[i], group.channel_counts[i],
+                                    desired_frames, 1);
+      }
+      single_seconds += SecondsSince(single_start);
+      const auto batch_start = std::chrono::steady_clock::now();
+      FindLoudestSegmentsLin16Batch(
+          group.inputs.data(), group.channel_counts.data(),
+          group.inputs.size(), desired_frames, batch_ranges.data());
+      batch_seconds += SecondsSince(batch_start);
+    }
+  }
+
+  // Checks a batched pass over each group against the single ones.
+  int mismatches = 0;
+  for (auto& rate_and_group : groups) {
+    RateGroup& group = rate_and_group.second;
+    const int64_t desired_frames =
+        (kDesiredLengthMs * rate_and_group.first) / 1000;
+    FindLoudestSegmentsLin16Batch(
+        group.inputs.data(), group.channel_counts.data(), group.inputs.size(),
+        desired_frames, batch_ranges.data());
+    for (size_t i = 0; i < group.inputs.size(); ++i) {
+      if ((batch_ranges[i].start != group.ranges[i].start) ||
+          (batch_ranges[i].end != group.ranges[i].end)) {
+        ++mismatches;
+      }
+    }
+  }
+
+  const double frames = static_cast<double>(total_frames) * kRepetitions;
+  std::cout << clips.size() << " clips, " << GetAudioKernels().name
+            << " kernels" << std::endl;
+  std::cout << "Single: " << single_seconds << " s, "
+            << (frames / single_seconds) / 1e6 << "M frames/s" << std::endl;
+  std::cout << "Batched: " << batch_seconds << " s, "
+            << (frames / batch_seconds) / 1e6 << "M frames/s" << std::endl;
+  std::cout << "Speedup: " << (single_seconds / batch_seconds) << "x"
+            << std::endl;
+  if (mismatches > 0) {
+    std::cerr << mismatches << " clips had different windows" << std::endl;
+    return -1;
+  }
+  return 0;
+}
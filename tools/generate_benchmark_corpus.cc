@@ -0,0 +1,113 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Writes a reproducible set of synthetic speech-like WAV files, for measuring
+// throughput and for training profile-guided builds.
+//
+// Usage: generate_benchmark_corpus <output dir> [file count]
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "wav_io.h"
+
+namespace {
+
+// A tiny linear congruential generator, so the corpus is identical everywhere
+// regardless of the standard library.
+class Random {
+ public:
+  explicit Random(uint32_t seed) : state_(seed) {}
+  uint32_t Next() {
+    state_ = (state_ * 1664525u) + 1013904223u;
+    return state_;
+  }
+  // Uniform in [-1, 1).
+  float NextSigned() { return ((Next() >> 8) / float(1 << 23)) - 1.0f; }
+  int Below(int limit) { return (Next() >> 8) % limit; }
+
+ private:
+  uint32_t state_;
+};
+
+// Fills a clip with quiet background noise, plus a louder burst standing in
+// for a spoken word somewhere in the middle.
+void MakeClip(Random* random, int sample_rate, int channel_count,
+              int frame_count, std::vector<float>* samples) {
+  samples->resize(frame_count * channel_count);
+  const int word_frames = sample_rate / 2;
+  const int word_start = random->Below(std::max(1, frame_count - word_frames));
+  const float word_volume = 0.2f + (random->Below(60) / 100.0f);
+  for (int i = 0; i < frame_count; ++i) {
+    const bool in_word = (i >= word_start) && (i < (word_start + word_frames));
+    const float volume = in_word ? word_volume : 0.01f;
+    for (int c = 0; c < channel_count; ++c) {
+      (*samples)[(i * channel_count) + c] = random->NextSigned() * volume;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "Usage: generate_benchmark_corpus <output dir> [file count]"
+              << std::endl;
+    return -1;
+  }
+  const std::string output_dir = argv[1];
+  const int file_count = (argc > 2) ? atoi(argv[2]) : 2000;
+  if ((mkdir(output_dir.c_str(), ACCESSPERMS) != 0) && (errno != EEXIST)) {
+    std::cerr << "Couldn't create '" << output_dir << "': " << strerror(errno)
+              << std::endl;
+    return -1;
+  }
+
+  Random random(42);
+  std::vector<float> samples;
+  std::string wav_data;
+  for (int i = 0; i < file_count; ++i) {
+    // Mostly short keyword-style clips, with the odd long recording.
+    const int sample_rate = (random.Below(4) == 0) ? 44100 : 16000;
+    const int channel_count = (random.Below(4) == 0) ? 2 : 1;
+    const int duration_ms = (random.Below(50) == 0)
+                                ? (30000 + random.Below(30000))
+                                : (1000 + random.Below(2000));
+    const int frame_count = (sample_rate * duration_ms) / 1000;
+    MakeClip(&random, sample_rate, channel_count, frame_count, &samples);
+    Status status = EncodeAudioAsS16LEWav(samples.data(), sample_rate,
+                                          channel_count, frame_count,
+                                          &wav_data);
+    if (!status.ok()) {
+      std::cerr << "Failed to encode clip " << i << ": " << status
+                << std::endl;
+      return -1;
+    }
+    char filename[32];
+    snprintf(filename, sizeof(filename), "/clip_%05d.wav", i);
+    std::ofstream output_file(output_dir + filename);
+    output_file.write(wav_data.c_str(), wav_data.length());
+  }
+  std::cerr << "Wrote " << file_count << " files to '" << output_dir << "'"
+            << std::endl;
+  return 0;
+}
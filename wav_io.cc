@@ -20,6 +20,7 @@ limitations under the License.
 #include <algorithm>
 
 #include "wav_io.h"
+#include "kernels.h"
 #include "status.h"
 
 using std::string;
@@ -78,24 +79,15 @@ constexpr char kRiffType[] = "WAVE";
 constexpr char kFormatChunkId[] = "fmt ";
 constexpr char kDataChunkId[] = "data";
 
-inline int16_t FloatToInt16Sample(float data) {
-  constexpr float kMultiplier = 1.0f * (1 << 15);
-  return std::min<float>(std::max<float>(roundf(data * kMultiplier), kint16min),
-                         kint16max);
-}
-
-inline float Int16SampleToFloat(int16_t data) {
-  constexpr float kMultiplier = 1.0f / (1 << 15);
-  return data * kMultiplier;
-}
-
+// The offsets are size_t, so that data chunks over 2GB can be read. Each check
+// compares against the space that's left, which can't wrap around.
 Status ExpectText(const uint8_t* data, size_t data_length, const string& expected_text,
-                  int* offset) {
-  const int new_offset = *offset + expected_text.size();
-  if (new_offset > data_length) {
+                  size_t* offset) {
+  if (expected_text.size() > (data_length - *offset)) {
     return errors::InvalidArgument("Data too short when trying to read ",
                                    expected_text);
   }
+  const size_t new_offset = *offset + expected_text.size();
   const string found_text(data + *offset, data + new_offset);
   if (found_text != expected_text) {
     return errors::InvalidArgument("Header mismatch: Expected ", expected_text,
@@ -106,24 +98,22 @@ Status ExpectText(const uint8_t* data, size_t data_length, const string& expecte
 }
 
 template <class T>
-Status ReadValue(const uint8_t* data, size_t data_length, T* value, int* offset) {
-  const int new_offset = *offset + sizeof(T);
-  if (new_offset > data_length) {
+Status ReadValue(const uint8_t* data, size_t data_length, T* value, size_t* offset) {
+  if (sizeof(T) > (data_length - *offset)) {
     return errors::InvalidArgument("Data too short when trying to read value");
   }
   memcpy(value, data + *offset, sizeof(T));
-  *offset = new_offset;
+  *offset += sizeof(T);
   return Status::OK();
 }
 
-Status ReadString(const uint8_t* data, size_t data_length, int expected_length, string* value,
-                  int* offset) {
-  const int new_offset = *offset + expected_length;
-  if (new_offset > data_length) {
+Status ReadString(const uint8_t* data, size_t data_length, size_t expected_length, string* value,
+                  size_t* offset) {
+  if (expected_length > (data_length - *offset)) {
     return errors::InvalidArgument("Data too short when trying to read string");
   }
-  *value = string(data + *offset, data + new_offset);
-  *offset = new_offset;
+  *value = string(data + *offset, data + *offset + expected_length);
+  *offset += expected_length;
   return Status::OK();
 }
 
@@ -147,9 +137,24 @@ Status ReadString(const uint8_t* data, size_t data_length, int expected_length,
 
 }  // namespace
 
+size_t S16LEWavSize(size_t num_channels, size_t num_frames) {
+  return sizeof(WavHeader) + (num_channels * num_frames * sizeof(int16_t));
+}
+
 Status EncodeAudioAsS16LEWav(const float* audio, size_t sample_rate,
                              size_t num_channels, size_t num_frames,
                              string* wav_string) {
+  if (wav_string == nullptr) {
+    return errors::InvalidArgument("wav_string is null");
+  }
+  wav_string->resize(S16LEWavSize(num_channels, num_frames));
+  return EncodeAudioAsS16LEWav(audio, sample_rate, num_channels, num_frames,
+                               &wav_string->at(0), wav_string->size());
+}
+
+Status EncodeAudioAsS16LEWav(const float* audio, size_t sample_rate,
+                             size_t num_channels, size_t num_frames,
+                             char* wav_data, size_t wav_data_size) {
   constexpr size_t kFormatChunkSize = 16;
   constexpr size_t kCompressionCodePcm = 1;
   constexpr size_t kBitsPerSample = 16;
@@ -159,8 +164,8 @@ Status EncodeAudioAsS16LEWav(const float* audio, size_t sample_rate,
   if (audio == nullptr) {
     return errors::InvalidArgument("audio is null");
   }
-  if (wav_string == nullptr) {
-    return errors::InvalidArgument("wav_string is null");
+  if (wav_data == nullptr) {
+    return errors::InvalidArgument("wav_data is null");
   }
   if (sample_rate == 0 || sample_rate > kuint32max) {
     return errors::InvalidArgument("sample_rate must be in (0, 2^32), got: ",
@@ -174,11 +179,11 @@ Status EncodeAudioAsS16LEWav(const float* audio, size_t sample_rate,
     return errors::InvalidArgument("num_frames must be positive.");
   }
 
-  const size_t bytes_per_second = sample_rate * kBytesPerSample;
   const size_t num_samples = num_frames * num_channels;
   const size_t data_size = num_samples * kBytesPerSample;
   const size_t file_size = kHeaderSize + num_samples * kBytesPerSample;
   const size_t bytes_per_frame = kBytesPerSample * num_channels;
+  const size_t bytes_per_second = sample_rate * bytes_per_frame;
 
   // WAV represents the length of the file as a uint32 so file_size cannot
   // exceed kuint32max.
@@ -187,8 +192,12 @@ Status EncodeAudioAsS16LEWav(const float* audio, size_t sample_rate,
         "Provided channels and frames cannot be encoded as a WAV.");
   }
 
-  wav_string->resize(file_size);
-  char* data = &wav_string->at(0);
+  if (wav_data_size != file_size) {
+    return errors::InvalidArgument("wav_data_size must be ", file_size,
+                                   ", got: ", wav_data_size);
+  }
+
+  char* data = wav_data;
   WavHeader* header = bit_cast<WavHeader*>(data);
 
   // Fill RIFF chunk.
@@ -213,22 +222,17 @@ Status EncodeAudioAsS16LEWav(const float* audio, size_t sample_rate,
   memcpy(data_chunk->chunk_id, kDataChunkId, 4);
   EncodeFixed32(data_chunk->chunk_data_size, data_size);
 
-  // Write the audio.
+  // Write the audio. The encode_lin16 kernel rounds each sample and saturates
+  // it to the int16 range.
   data += kHeaderSize;
-  for (size_t i = 0; i < num_samples; ++i) {
-    int16_t sample = FloatToInt16Sample(audio[i]);
-    EncodeFixed16(&data[i * kBytesPerSample],
-                        static_cast<uint16_t>(sample));
-  }
+  GetAudioKernels().encode_lin16(audio, num_samples, data);
   return Status::OK();
 }
 
-Status DecodeLin16WaveAsFloatVector(const uint8_t* wav_data,
-                                    size_t wav_length,
-                                    std::vector<float>* float_values,
-                                    uint32_t* sample_count, uint16_t* channel_count,
-                                    uint32_t* sample_rate) {
-  int offset = 0;
+Status DecodeLin16WaveHeader(const uint8_t* wav_data, size_t wav_length,
+                             uint16_t* channel_count, uint32_t* sample_rate,
+                             uint16_t* bytes_per_sample, int* offset_out) {
+  size_t offset = 0;
   TF_RETURN_IF_ERROR(ExpectText(wav_data, wav_length, kRiffChunkId, &offset));
   uint32_t total_file_size;
   TF_RETURN_IF_ERROR(ReadValue<uint32_t>(wav_data, wav_length, &total_file_size, &offset));
@@ -248,11 +252,13 @@ Status DecodeLin16WaveAsFloatVector(const uint8_t* wav_data,
         "Bad audio format for WAV: Expected 1 (PCM), but got", audio_format);
   }
   TF_RETURN_IF_ERROR(ReadValue<uint16_t>(wav_data, wav_length, channel_count, &offset));
+  if (*channel_count == 0) {
+    return errors::InvalidArgument("WAV header has no channels");
+  }
   TF_RETURN_IF_ERROR(ReadValue<uint32_t>(wav_data, wav_length, sample_rate, &offset));
   uint32_t bytes_per_second;
   TF_RETURN_IF_ERROR(ReadValue<uint32_t>(wav_data, wav_length, &bytes_per_second, &offset));
-  uint16_t bytes_per_sample;
-  TF_RETURN_IF_ERROR(ReadValue<uint16_t>(wav_data, wav_length, &bytes_per_sample, &offset));
+  TF_RETURN_IF_ERROR(ReadValue<uint16_t>(wav_data, wav_length, bytes_per_sample, &offset));
   // Confusingly, bits per sample is defined as holding the number of bits for
   // one channel, unlike the definition of sample used elsewhere in the WAV
   // spec. For example, bytes per sample is the memory needed for all channels
@@ -265,24 +271,38 @@ Status DecodeLin16WaveAsFloatVector(const uint8_t* wav_data,
   }
   const uint32_t expected_bytes_per_sample =
       ((bits_per_sample * *channel_count) + 7) / 8;
-  if (bytes_per_sample != expected_bytes_per_sample) {
+  if (*bytes_per_sample != expected_bytes_per_sample) {
     return errors::InvalidArgument(
         "Bad bytes per sample in WAV header: Expected ",
-        expected_bytes_per_sample, " but got ", bytes_per_sample);
+        expected_bytes_per_sample, " but got ", *bytes_per_sample);
   }
   const uint32_t expected_bytes_per_second =
-      (bytes_per_sample * (*sample_rate));
+      (*bytes_per_sample * (*sample_rate));
   if (bytes_per_second != expected_bytes_per_second) {
     return errors::InvalidArgument(
         "Bad bytes per second in WAV header: Expected ",
         expected_bytes_per_second, " but got ", bytes_per_second,
-        " (sample_rate=", *sample_rate, ", bytes_per_sample=", bytes_per_sample,
+        " (sample_rate=", *sample_rate, ", bytes_per_sample=", *bytes_per_sample,
         ")");
   }
   if (format_chunk_size == 18) {
     // Skip over this unused section.
     offset += 2;
   }
+  *offset_out = offset;
+  return Status::OK();
+}
+
+Status FindLin16WaveSamples(const uint8_t* wav_data, size_t wav_length,
+                            int64_t* sample_count, uint16_t* channel_count,
+                            uint32_t* sample_rate,
+                            const uint8_t** sample_data) {
+  int header_size;
+  uint16_t bytes_per_sample;
+  TF_RETURN_IF_ERROR(DecodeLin16WaveHeader(wav_data, wav_length, channel_count,
+                                           sample_rate, &bytes_per_sample,
+                                           &header_size));
+  size_t offset = header_size;
 
   bool was_data_found = false;
   while (offset < wav_length) {
@@ -290,20 +310,27 @@ Status DecodeLin16WaveAsFloatVector(const uint8_t* wav_data,
     TF_RETURN_IF_ERROR(ReadString(wav_data, wav_length, 4, &chunk_id, &offset));
     uint32_t chunk_size;
     TF_RETURN_IF_ERROR(ReadValue<uint32_t>(wav_data, wav_length, &chunk_size, &offset));
+    // A corrupt size could otherwise wrap the offset around and send the loop
+    // back into data it's already seen.
+    if (chunk_size > (wav_length - offset)) {
+      return errors::DataLoss("WAV chunk '", chunk_id, "' claims ", chunk_size,
+                              " bytes, but only ", (wav_length - offset),
+                              " are left in the file");
+    }
     if (chunk_id == kDataChunkId) {
       if (was_data_found) {
         return errors::InvalidArgument("More than one data chunk found in WAV");
       }
       was_data_found = true;
       *sample_count = chunk_size / bytes_per_sample;
-      const uint32_t data_count = *sample_count * *channel_count;
-      float_values->resize(data_count);
-      for (int i = 0; i < data_count; ++i) {
-        int16_t single_channel_value = 0;
-        TF_RETURN_IF_ERROR(
-            ReadValue<int16_t>(wav_data, wav_length, &single_channel_value, &offset));
-        (*float_values)[i] = Int16SampleToFloat(single_channel_value);
+      const uint64_t data_count = *sample_count * *channel_count;
+      const uint64_t data_size = data_count * sizeof(int16_t);
+      if (data_size > (wav_length - offset)) {
+        return errors::InvalidArgument(
+            "Data too short when trying to read value");
       }
+      *sample_data = wav_data + offset;
+      offset += data_size;
     } else {
       offset += chunk_size;
     }
@@ -313,3 +340,23 @@ Status DecodeLin16WaveAsFloatVector(const uint8_t* wav_data,
   }
   return Status::OK();
 }
+
+void DecodeLin16Samples(const uint8_t* sample_data, size_t value_count,
+                        float* float_values) {
+  GetAudioKernels().decode_lin16(sample_data, value_count, float_values);
+}
+
+Status DecodeLin16WaveAsFloatVector(const uint8_t* wav_data,
+                                    size_t wav_length,
+                                    std::vector<float>* float_values,
+                                    int64_t* sample_count, uint16_t* channel_count,
+                                    uint32_t* sample_rate) {
+  const uint8_t* sample_data;
+  TF_RETURN_IF_ERROR(FindLin16WaveSamples(wav_data, wav_length, sample_count,
+                                          channel_count, sample_rate,
+                                          &sample_data));
+  const uint64_t data_count = *sample_count * *channel_count;
+  float_values->resize(data_count);
+  DecodeLin16Samples(sample_data, data_count, float_values->data());
+  return Status::OK();
+}
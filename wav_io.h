@@ -39,6 +39,15 @@ Status EncodeAudioAsS16LEWav(const float* audio, size_t sample_rate,
                              size_t num_channels, size_t num_frames,
                              std::string* wav_string);
 
+// Returns how many bytes EncodeAudioAsS16LEWav() will need for the audio.
+size_t S16LEWavSize(size_t num_channels, size_t num_frames);
+
+// Same as above, but writes into a caller-owned buffer, which must be exactly
+// S16LEWavSize() bytes long.
+Status EncodeAudioAsS16LEWav(const float* audio, size_t sample_rate,
+                             size_t num_channels, size_t num_frames,
+                             char* wav_data, size_t wav_data_size);
+
 // Decodes the little-endian signed 16-bit PCM WAV file data (aka LIN16
 // encoding) into a float Tensor. The channels are encoded as the lowest
 // dimension of the tensor, with the number of frames as the second. This means
@@ -49,7 +58,27 @@ Status EncodeAudioAsS16LEWav(const float* audio, size_t sample_rate,
 Status DecodeLin16WaveAsFloatVector(const uint8_t* wav_data,
                                     size_t wav_length,
                                     std::vector<float>* float_values,
-                                    uint32_t* sample_count, uint16_t* channel_count,
+                                    int64_t* sample_count, uint16_t* channel_count,
                                     uint32_t* sample_rate);
 
+// Checks the header of a LIN16 WAV file and finds where the samples start,
+// without decoding them. This lets callers decode into memory they manage
+// themselves, using DecodeLin16Samples().
+Status FindLin16WaveSamples(const uint8_t* wav_data, size_t wav_length,
+                            int64_t* sample_count, uint16_t* channel_count,
+                            uint32_t* sample_rate, const uint8_t** sample_data);
+
+// Converts value_count little-endian signed 16-bit values to floats within the
+// range -1 to 1.
+void DecodeLin16Samples(const uint8_t* sample_data, size_t value_count,
+                        float* float_values);
+
+// Reads the RIFF and format chunks at the start of a LIN16 WAV file, and checks
+// that the format is one we support. Only the header needs to be present in
+// wav_data, so this can be used on the first few bytes of a stream. On success
+// offset is set to the position of the first chunk after the format chunk.
+Status DecodeLin16WaveHeader(const uint8_t* wav_data, size_t wav_length,
+                             uint16_t* channel_count, uint32_t* sample_rate,
+                             uint16_t* bytes_per_sample, int* offset);
+
 #endif  // WAV_IO_H_
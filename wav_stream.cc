@@ -0,0 +1,118 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "wav_stream.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "wav_io.h"
+
+namespace {
+
+constexpr uint32_t kUnknownChunkSize = 0xFFFFFFFF;
+constexpr int64_t kRiffHeaderSize = 12;
+constexpr int64_t kChunkHeaderSize = 8;
+// Guards against corrupt headers asking us to buffer huge format chunks.
+constexpr uint32_t kMaxFormatChunkSize = 1024;
+
+uint32_t DecodeFixed32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+}  // namespace
+
+WavStreamReader::WavStreamReader(ByteReader* input)
+    : input_(input),
+      channel_count_(0),
+      sample_rate_(0),
+      bytes_per_frame_(0),
+      is_unbounded_(false),
+      data_bytes_left_(0) {}
+
+Status WavStreamReader::ReadExactly(uint8_t* data, int64_t length) {
+  int64_t bytes_read;
+  TF_RETURN_IF_ERROR(input_->Read(data, length, &bytes_read));
+  if (bytes_read != length) {
+    return errors::InvalidArgument("WAV stream ended inside the header");
+  }
+  return Status::OK();
+}
+
+Status WavStreamReader::ReadHeader() {
+  // The format chunk has to come first, so buffer up to the end of it and
+  // let the regular header decoder check it. It lives on the stack, so
+  // there's nothing to allocate per stream.
+  uint8_t header[kRiffHeaderSize + kChunkHeaderSize + kMaxFormatChunkSize];
+  const int64_t format_start = kRiffHeaderSize + kChunkHeaderSize;
+  TF_RETURN_IF_ERROR(ReadExactly(header, format_start));
+  const uint32_t format_chunk_size = DecodeFixed32(&header[kRiffHeaderSize + 4]);
+  if (format_chunk_size > kMaxFormatChunkSize) {
+    return errors::InvalidArgument("Bad format chunk size for WAV: ",
+                                   format_chunk_size);
+  }
+  TF_RETURN_IF_ERROR(ReadExactly(&header[format_start], format_chunk_size));
+  int offset;
+  TF_RETURN_IF_ERROR(DecodeLin16WaveHeader(
+      header, format_start + format_chunk_size, &channel_count_,
+      &sample_rate_, &bytes_per_frame_, &offset));
+
+  // Skip any other chunks until we reach the samples.
+  uint8_t chunk_header[kChunkHeaderSize];
+  while (true) {
+    TF_RETURN_IF_ERROR(ReadExactly(chunk_header, kChunkHeaderSize));
+    const uint32_t chunk_size = DecodeFixed32(chunk_header + 4);
+    if (memcmp(chunk_header, "data", 4) == 0) {
+      is_unbounded_ = (chunk_size == kUnknownChunkSize);
+      data_bytes_left_ = chunk_size;
+      return Status::OK();
+    }
+    uint8_t skipped[256];
+    uint32_t skip_left = chunk_size;
+    while (skip_left > 0) {
+      const int64_t skip_now = std::min<uint32_t>(skip_left, sizeof(skipped));
+      TF_RETURN_IF_ERROR(ReadExactly(skipped, skip_now));
+      skip_left -= skip_now;
+    }
+  }
+}
+
+Status WavStreamReader::ReadFrames(int16_t* frames, int64_t max_frames,
+                                   int64_t* frames_read) {
+  *frames_read = 0;
+  int64_t bytes_wanted = max_frames * bytes_per_frame_;
+  if (!is_unbounded_) {
+    bytes_wanted = std::min<uint64_t>(bytes_wanted, data_bytes_left_);
+  }
+  if (bytes_wanted == 0) {
+    return Status::OK();
+  }
+  // The samples are little-endian like the host, so they can be read straight
+  // into place.
+  uint8_t* data = reinterpret_cast<uint8_t*>(frames);
+  int64_t bytes_read;
+  TF_RETURN_IF_ERROR(input_->Read(data, bytes_wanted, &bytes_read));
+  // A trailing partial frame can only come from a truncated stream, so it's
+  // dropped.
+  *frames_read = bytes_read / bytes_per_frame_;
+  if (!is_unbounded_) {
+    data_bytes_left_ = (bytes_read < bytes_wanted) ? 0 :
+        (data_bytes_left_ - bytes_read);
+  }
+  return Status::OK();
+}
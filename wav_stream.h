@@ -0,0 +1,70 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Reads LIN16 WAV data incrementally from a pipe or a decompressor.
+
+#ifndef WAV_STREAM_H_
+#define WAV_STREAM_H_
+
+#include <stdint.h>
+
+#include "byte_reader.h"
+#include "status.h"
+
+// Pulls frames out of a WAV stream without needing the whole file in memory,
+// or even knowing how long it is. Tools like ffmpeg that write WAVs to a pipe
+// can't go back to fill in the sizes, so they set the RIFF and data chunk
+// lengths to 0xFFFFFFFF, and in that case samples are read until end of file.
+//
+// Example usage:
+//
+// FdByteReader input(STDIN_FILENO);
+// WavStreamReader reader(&input);
+// TF_RETURN_IF_ERROR(reader.ReadHeader());
+// std::vector<int16_t> block(4096 * reader.channel_count());
+// int64_t frames_read;
+// do {
+//   TF_RETURN_IF_ERROR(reader.ReadFrames(block.data(), 4096, &frames_read));
+//   ...
+// } while (frames_read > 0);
+class WavStreamReader {
+ public:
+  // The input must outlive the reader.
+  WavStreamReader(ByteReader* input);
+
+  // Parses everything up to the start of the sample data.
+  Status ReadHeader();
+
+  // Reads up to max_frames interleaved frames of signed 16-bit values.
+  // frames_read is set to zero at the end of the data.
+  Status ReadFrames(int16_t* frames, int64_t max_frames, int64_t* frames_read);
+
+  uint16_t channel_count() const { return channel_count_; }
+  uint32_t sample_rate() const { return sample_rate_; }
+  // True if the header didn't say how much data there is.
+  bool is_unbounded() const { return is_unbounded_; }
+
+ private:
+  Status ReadExactly(uint8_t* data, int64_t length);
+
+  ByteReader* input_;
+  uint16_t channel_count_;
+  uint32_t sample_rate_;
+  uint16_t bytes_per_frame_;
+  bool is_unbounded_;
+  uint64_t data_bytes_left_;
+};
+
+#endif  // WAV_STREAM_H_
@@ -0,0 +1,277 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "weighted_window.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+void ComputeWindowWeights(const WindowShape& shape, int64_t count,
+                          double* weights) {
+  // A Hann window is a Tukey window that's tapered all the way across.
+  double alpha = 0.0;
+  if (shape.weighting == WindowWeighting::kHann) {
+    alpha = 1.0;
+  } else if (shape.weighting == WindowWeighting::kTukey) {
+    alpha = std::min(1.0, std::max(0.0, static_cast<double>(shape.tukey_alpha)));
+  }
+  const double taper = (alpha * (count - 1)) / 2.0;
+  for (int64_t i = 0; i < count; ++i) {
+    // Distance from the nearer end, so both tapers are exactly symmetric.
+    const double edge = std::min<int64_t>(i, (count - 1) - i);
+    if ((taper <= 0.0) || (edge >= taper)) {
+      weights[i] = 1.0;
+    } else {
+      weights[i] = 0.5 * (1.0 - cos(M_PI * edge / taper));
+    }
+  }
+}
+
+WeightedWindowPlan::WeightedWindowPlan(const WindowShape& shape,
+                                       int64_t desired_frames)
+    : shape_(shape), desired_frames_(desired_frames) {
+  // At least twice the window, so each block scores as many windows as it
+  // needs frames from the one before.
+  fft_size_ = 4;
+  while (fft_size_ < (2 * desired_frames_)) {
+    fft_size_ *= 2;
+  }
+  const int64_t half_size = fft_size_ / 2;
+  cos_table_.resize(half_size + 1);
+  sin_table_.resize(half_size + 1);
+  for (int64_t k = 0; k <= half_size; ++k) {
+    const double angle = (2.0 * M_PI * k) / fft_size_;
+    cos_table_[k] = cos(angle);
+    sin_table_[k] = sin(angle);
+  }
+
+  std::vector<double> weights(fft_size_, 0.0);
+  ComputeWindowWeights(shape, desired_frames_, weights.data());
+  std::vector<double> half_real(half_size);
+  std::vector<double> half_imag(half_size);
+  weight_real_.resize(half_size + 1);
+  weight_imag_.resize(half_size + 1);
+  ForwardReal(weights.data(), weight_real_.data(), weight_imag_.data(),
+              half_real.data(), half_imag.data());
+  // The inverse transform is unscaled, so that's folded in here.
+  const double scale = 1.0 / half_size;
+  for (int64_t k = 0; k <= half_size; ++k) {
+    weight_real_[k] *= scale;
+    weight_imag_[k] *= -scale;
+  }
+}
+
+const WeightedWindowPlan& WeightedWindowPlan::Get(const WindowShape& shape,
+                                                  int64_t desired_frames) {
+  static std::mutex mutex;
+  static std::vector<std::unique_ptr<WeightedWindowPlan>>* plans =
+      new std::vector<std::unique_ptr<WeightedWindowPlan>>();
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const std::unique_ptr<WeightedWindowPlan>& plan : *plans) {
+    if ((plan->desired_frames_ == desired_frames) &&
+        (plan->shape_.weighting == shape.weighting) &&
+        (plan->shape_.tukey_alpha == shape.tukey_alpha)) {
+      return *plan;
+    }
+  }
+  plans->emplace_back(new WeightedWindowPlan(shape, desired_frames));
+  return *plans->back();
+}
+
+void WeightedWindowPlan::HalfSizeFft(double* real, double* imag,
+                                     bool inverse) const {
+  const int64_t size = fft_size_ / 2;
+  for (int64_t i = 1, j = 0; i < size; ++i) {
+    int64_t bit = size >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      std::swap(real[i], real[j]);
+      std::swap(imag[i], imag[j]);
+    }
+  }
+  const double sign = inverse ? 1.0 : -1.0;
+  for (int64_t length = 2; length <= size; length *= 2) {
+    const int64_t half = length / 2;
+    // Twiddle j of this stage is entry j * step of the full-size tables.
+    const int64_t step = fft_size_ / length;
+    for (int64_t start = 0; start < size; start += length) {
+      for (int64_t j = 0; j < half; ++j) {
+        const double twiddle_real = cos_table_[j * step];
+        const double twiddle_imag = sign * sin_table_[j * step];
+        const int64_t a = start + j;
+        const int64_t b = a + half;
+        const double b_real =
+            (real[b] * twiddle_real) - (imag[b] * twiddle_imag);
+        const double b_imag =
+            (real[b] * twiddle_imag) + (imag[b] * twiddle_real);
+        real[b] = real[a] - b_real;
+        imag[b] = imag[a] - b_imag;
+        real[a] += b_real;
+        imag[a] += b_imag;
+      }
+    }
+  }
+}
+
+void WeightedWindowPlan::ForwardReal(const double* input, double* output_real,
+                                     double* output_imag, double* half_real,
+                                     double* half_imag) const {
+  // The even inputs go in the real parts and the odd ones in the imaginary
+  // parts, and the two spectra are pulled apart afterwards.
+  const int64_t half_size = fft_size_ / 2;
+  for (int64_t m = 0; m < half_size; ++m) {
+    half_real[m] = input[2 * m];
+    half_imag[m] = input[(2 * m) + 1];
+  }
+  HalfSizeFft(half_real, half_imag, false);
+  for (int64_t k = 0; k <= half_size; ++k) {
+    const int64_t index = k % half_size;
+    const int64_t mirror = (half_size - k) % half_size;
+    const double even_real = (half_real[index] + half_real[mirror]) / 2.0;
+    const double even_imag = (half_imag[index] - half_imag[mirror]) / 2.0;
+    const double odd_real = (half_imag[index] + half_imag[mirror]) / 2.0;
+    const double odd_imag = -(half_real[index] - half_real[mirror]) / 2.0;
+    const double twiddle_real = cos_table_[k];
+    const double twiddle_imag = -sin_table_[k];
+    output_real[k] =
+        even_real + (twiddle_real * odd_real) - (twiddle_imag * odd_imag);
+    output_imag[k] =
+        even_imag + (twiddle_real * odd_imag) + (twiddle_imag * odd_real);
+  }
+}
+
+void WeightedWindowPlan::Correlate(double* spectrum_real,
+                                   double* spectrum_imag, double* half_real,
+                                   double* half_imag, double* output) const {
+  const int64_t half_size = fft_size_ / 2;
+  for (int64_t k = 0; k <= half_size; ++k) {
+    const double real = spectrum_real[k];
+    const double imag = spectrum_imag[k];
+    spectrum_real[k] = (real * weight_real_[k]) - (imag * weight_imag_[k]);
+    spectrum_imag[k] = (real * weight_imag_[k]) + (imag * weight_real_[k]);
+  }
+  // Splits the spectrum back into the even and odd samples' spectra, and
+  // packs them into one complex transform of half the size.
+  for (int64_t k = 0; k < half_size; ++k) {
+    const int64_t mirror = half_size - k;
+    const double even_real = (spectrum_real[k] + spectrum_real[mirror]) / 2.0;
+    const double even_imag = (spectrum_imag[k] - spectrum_imag[mirror]) / 2.0;
+    const double difference_real =
+        (spectrum_real[k] - spectrum_real[mirror]) / 2.0;
+    const double difference_imag =
+        (spectrum_imag[k] + spectrum_imag[mirror]) / 2.0;
+    const double odd_real = (difference_real * cos_table_[k]) -
+                            (difference_imag * sin_table_[k]);
+    const double odd_imag = (difference_real * sin_table_[k]) +
+                            (difference_imag * cos_table_[k]);
+    half_real[k] = even_real - odd_imag;
+    half_imag[k] = even_imag + odd_real;
+  }
+  HalfSizeFft(half_real, half_imag, true);
+  for (int64_t m = 0; m < half_size; ++m) {
+    output[2 * m] = half_real[m];
+    output[(2 * m) + 1] = half_imag[m];
+  }
+}
+
+WeightedLoudestWindow::WeightedLoudestWindow(const WeightedWindowPlan& plan,
+                                             Arena* arena)
+    : plan_(plan),
+      desired_frames_(plan.desired_frames()),
+      buffer_start_(0),
+      buffer_fill_(0),
+      frames_seen_(0),
+      has_loudest_(false),
+      loudest_score_(0.0),
+      loudest_start_(0) {
+  const int64_t fft_size = plan.fft_size();
+  buffer_ = arena->AllocateArray<double>(fft_size);
+  spectrum_real_ = arena->AllocateArray<double>((fft_size / 2) + 1);
+  spectrum_imag_ = arena->AllocateArray<double>((fft_size / 2) + 1);
+  half_real_ = arena->AllocateArray<double>(fft_size / 2);
+  half_imag_ = arena->AllocateArray<double>(fft_size / 2);
+  scores_ = arena->AllocateArray<double>(fft_size);
+}
+
+bool WeightedLoudestWindow::AddVolumes(const int64_t* volumes,
+                                       int64_t count) {
+  const int64_t fft_size = plan_.fft_size();
+  bool changed = false;
+  while (count > 0) {
+    const int64_t run = std::min(count, fft_size - buffer_fill_);
+    for (int64_t i = 0; i < run; ++i) {
+      buffer_[buffer_fill_ + i] = volumes[i];
+    }
+    buffer_fill_ += run;
+    frames_seen_ += run;
+    volumes += run;
+    count -= run;
+    if (buffer_fill_ == fft_size) {
+      changed |= ScoreBlock(plan_.hop());
+    }
+  }
+  return changed;
+}
+
+bool WeightedLoudestWindow::Finish() {
+  if (buffer_fill_ < desired_frames_) {
+    return false;
+  }
+  return ScoreBlock((buffer_fill_ - desired_frames_) + 1);
+}
+
+bool WeightedLoudestWindow::ScoreBlock(int64_t window_count) {
+  const int64_t fft_size = plan_.fft_size();
+  for (int64_t i = buffer_fill_; i < fft_size; ++i) {
+    buffer_[i] = 0.0;
+  }
+  plan_.ForwardReal(buffer_, spectrum_real_, spectrum_imag_, half_real_,
+                    half_imag_);
+  plan_.Correlate(spectrum_real_, spectrum_imag_, half_real_, half_imag_,
+                  scores_);
+  bool changed = false;
+  for (int64_t s = 0; s < window_count; ++s) {
+    if (!has_loudest_ || (scores_[s] > loudest_score_)) {
+      has_loudest_ = true;
+      loudest_score_ = scores_[s];
+      loudest_start_ = buffer_start_ + s;
+      changed = true;
+    }
+  }
+  // Every window starting before window_count has now been scored, and the
+  // ones after need the frames from there on.
+  const int64_t kept = buffer_fill_ - window_count;
+  memmove(buffer_, buffer_ + window_count, kept * sizeof(double));
+  buffer_start_ += window_count;
+  buffer_fill_ = kept;
+  return changed;
+}
+
+SegmentRange WeightedLoudestWindow::loudest() const {
+  if (desired_frames_ >= frames_seen_) {
+    return SegmentRange{0, frames_seen_};
+  }
+  if (!has_loudest_) {
+    return SegmentRange{0, desired_frames_};
+  }
+  return SegmentRange{loudest_start_, loudest_start_ + desired_frames_};
+}
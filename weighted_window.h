@@ -0,0 +1,146 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// A loudest window search that weights the middle of the window more heavily
+// than its edges, so a word isn't chosen with its start or end right at the
+// cut.
+
+#ifndef WEIGHTED_WINDOW_H_
+#define WEIGHTED_WINDOW_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "arena.h"
+#include "loudest_section.h"
+
+enum class WindowWeighting { kFlat, kHann, kTukey };
+
+// How much each position in the window counts towards its score.
+struct WindowShape {
+  WindowWeighting weighting = WindowWeighting::kFlat;
+  // The fraction of a Tukey window that's tapered, split evenly between its
+  // two ends. Zero is the same as a flat window and one is a Hann window.
+  float tukey_alpha = 0.5f;
+};
+
+// Fills weights with the shape's weight for each of the count positions.
+void ComputeWindowWeights(const WindowShape& shape, int64_t count,
+                          double* weights);
+
+// Everything about a weighted search that only depends on the shape and the
+// window size, which is the FFT size, its twiddles, and the weights' spectrum.
+// Working these out takes longer than searching a short clip, so they're
+// shared between all the files with the same sample rate.
+class WeightedWindowPlan {
+ public:
+  WeightedWindowPlan(const WindowShape& shape, int64_t desired_frames);
+
+  // Returns a plan for these settings, creating it the first time they're
+  // seen. Safe to call from several threads at once.
+  static const WeightedWindowPlan& Get(const WindowShape& shape,
+                                       int64_t desired_frames);
+
+  int64_t desired_frames() const { return desired_frames_; }
+  int64_t fft_size() const { return fft_size_; }
+  // How many new frames each block of the overlap-save adds.
+  int64_t hop() const { return fft_size_ - desired_frames_ + 1; }
+
+  // Transforms fft_size() reals into fft_size() / 2 + 1 complex values, using
+  // half_real and half_imag, of fft_size() / 2 each, as scratch space.
+  void ForwardReal(const double* input, double* output_real,
+                   double* output_imag, double* half_real,
+                   double* half_imag) const;
+  // Multiplies a spectrum by the conjugate of the weights' spectrum and
+  // transforms it back, which gives the correlation of the input with the
+  // weights: output[s] is the weighted sum of the window starting at s, for
+  // every window that doesn't wrap around the end.
+  void Correlate(double* spectrum_real, double* spectrum_imag,
+                 double* half_real, double* half_imag, double* output) const;
+
+ private:
+  // A complex FFT of fft_size() / 2 values, in place.
+  void HalfSizeFft(double* real, double* imag, bool inverse) const;
+
+  const WindowShape shape_;
+  const int64_t desired_frames_;
+  int64_t fft_size_;
+  // cos and sin of 2 * pi * k / fft_size_, for k up to fft_size_ / 2.
+  std::vector<double> cos_table_;
+  std::vector<double> sin_table_;
+  // The weights' spectrum, conjugated and scaled for the inverse transform.
+  std::vector<double> weight_real_;
+  std::vector<double> weight_imag_;
+};
+
+// Scores every window as the weighted sum of its frame volumes, and keeps the
+// earliest of the highest-scoring ones. Rather than summing a window's worth
+// of products for every position, which would cost O(n * window), the scores
+// come from an overlap-save correlation of the volumes with the weights, a
+// block at a time, using real FFTs of at least twice the window size. That
+// keeps the cost per frame logarithmic in the window size.
+//
+// Each block is only scored once it's full, so a window is found up to
+// latency() frames after its last frame has been added, and callers that keep
+// a ring of recent frames need to make room for that. The per-file buffers
+// come from the arena. The scores are computed in double precision, so
+// windows whose scores differ by less than rounding error may be picked
+// differently from an exact sum, but the same input always gives the same
+// result.
+//
+// Example usage:
+//
+// WeightedLoudestWindow search(WeightedWindowPlan::Get(shape, 16000), &arena);
+// while (...) {
+//   search.AddVolumes(volumes, count);
+// }
+// search.Finish();
+// const SegmentRange range = search.loudest();
+class WeightedLoudestWindow : public WindowSearch {
+ public:
+  WeightedLoudestWindow(const WeightedWindowPlan& plan, Arena* arena);
+
+  bool AddVolumes(const int64_t* volumes, int64_t count) override;
+  bool Finish() override;
+  SegmentRange loudest() const override;
+  int64_t frames_seen() const override { return frames_seen_; }
+  int64_t latency() const override { return plan_.hop(); }
+
+ private:
+  // Scores the windows starting at the first window_count positions of the
+  // buffer, and then moves the frames that later windows still need to the
+  // front. Returns true if one of them is the new loudest.
+  bool ScoreBlock(int64_t window_count);
+
+  const WeightedWindowPlan& plan_;
+  const int64_t desired_frames_;
+  // The volumes of the frames from buffer_start_ onwards.
+  double* buffer_;
+  int64_t buffer_start_;
+  int64_t buffer_fill_;
+  // Scratch space for the transforms.
+  double* spectrum_real_;
+  double* spectrum_imag_;
+  double* half_real_;
+  double* half_imag_;
+  double* scores_;
+  int64_t frames_seen_;
+  bool has_loudest_;
+  double loudest_score_;
+  int64_t loudest_start_;
+};
+
+#endif  // WEIGHTED_WINDOW_H_
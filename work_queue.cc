@@ -0,0 +1,494 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "work_queue.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace {
+
+// Batches are named by their number, padded so that listing a directory in
+// name order gives them in input order.
+std::string BatchName(int64_t batch) {
+  char name[32];
+  snprintf(name, sizeof(name), "%010lld", static_cast<long long>(batch));
+  return name;
+}
+
+// Splits a pending or leased name into its batch number and owner, which is
+// empty for pending batches. Returns false for anything else.
+bool ParseBatchName(const std::string& name, int64_t* batch,
+                    std::string* owner) {
+  const std::size_t dot = name.find('.');
+  const std::string digits = name.substr(0, dot);
+  if (digits.empty() ||
+      (digits.find_first_not_of("0123456789") != std::string::npos)) {
+    return false;
+  }
+  *batch = strtoll(digits.c_str(), nullptr, 10);
+  *owner = (dot == std::string::npos) ? "" : name.substr(dot + 1);
+  return true;
+}
+
+// Lists a directory's entries in name order, leaving out hidden ones, which
+// include the temporary names NFS gives to files that are deleted while open.
+Status ListDirectory(const std::string& path, std::vector<std::string>* names) {
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    return errors::Unavailable("Couldn't list '", path, "': ",
+                               strerror(errno));
+  }
+  names->clear();
+  while (const struct dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] != '.') {
+      names->push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(names->begin(), names->end());
+  return Status::OK();
+}
+
+Status MakeDirectory(const std::string& path) {
+  if ((mkdir(path.c_str(), ACCESSPERMS) != 0) && (errno != EEXIST)) {
+    return errors::Unavailable("Couldn't create '", path, "': ",
+                               strerror(errno));
+  }
+  return Status::OK();
+}
+
+Status WriteTextFile(const std::string& path, const std::string& text) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    return errors::Unavailable("Couldn't create '", path, "': ",
+                               strerror(errno));
+  }
+  const size_t written = fwrite(text.data(), 1, text.size(), file);
+  if ((fclose(file) != 0) || (written != text.size())) {
+    return errors::Unavailable("Writing to '", path, "' failed");
+  }
+  return Status::OK();
+}
+
+// Sets a file's modification time to the filesystem's current time, which
+// over NFS is the server's. Returns NotFound if the file has gone.
+Status Touch(const std::string& path) {
+  if (utimes(path.c_str(), nullptr) != 0) {
+    if (errno == ENOENT) {
+      return errors::NotFound("'", path, "' has gone");
+    }
+    return errors::Unavailable("Couldn't touch '", path, "': ",
+                               strerror(errno));
+  }
+  return Status::OK();
+}
+
+// Reads a file's modification time. NFS clients can cache the results of
+// stat() for a minute, but opening a file always fetches them again.
+Status ModificationTime(const std::string& path, time_t* modified) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    if (errno == ENOENT) {
+      return errors::NotFound("'", path, "' has gone");
+    }
+    return errors::Unavailable("Couldn't open '", path, "': ",
+                               strerror(errno));
+  }
+  struct stat stat_buffer;
+  const int result = fstat(fd, &stat_buffer);
+  close(fd);
+  if (result != 0) {
+    return errors::Unavailable("Couldn't stat '", path, "': ",
+                               strerror(errno));
+  }
+  *modified = stat_buffer.st_mtime;
+  return Status::OK();
+}
+
+// FNV-1a over the names, each followed by a zero byte.
+uint64_t HashNames(const std::vector<std::string>& names) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (const std::string& name : names) {
+    for (const char c : name) {
+      hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3ull;
+    }
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+}  // namespace
+
+SharedWorkQueue::SharedWorkQueue(
+    const std::string& directory,
+    const std::vector<std::string>& input_filenames, int64_t batch_size,
+    int lease_seconds)
+    : root_(directory + "/queue"),
+      file_count_(input_filenames.size()),
+      batch_size_(batch_size),
+      lease_seconds_(lease_seconds) {
+  status_ = Open(directory, input_filenames);
+  if (status_.ok()) {
+    heartbeat_ = std::thread(&SharedWorkQueue::RenewLeases, this);
+  }
+}
+
+SharedWorkQueue::~SharedWorkQueue() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  heartbeat_wakeup_.notify_all();
+  if (heartbeat_.joinable()) {
+    heartbeat_.join();
+  }
+  if (status_.ok()) {
+    unlink(ClockPath().c_str());
+  }
+}
+
+Status SharedWorkQueue::Open(const std::string& directory,
+                             const std::vector<std::string>& input_filenames) {
+  char host[256];
+  if (gethostname(host, sizeof(host)) != 0) {
+    snprintf(host, sizeof(host), "unknown");
+  }
+  host[sizeof(host) - 1] = '\0';
+  owner_ = std::string(host) + "." + std::to_string(getpid());
+
+  char manifest[128];
+  snprintf(manifest, sizeof(manifest), "ELSQUEUE1 %lld %lld %016llx\n",
+           static_cast<long long>(file_count_),
+           static_cast<long long>(batch_size_),
+           static_cast<unsigned long long>(HashNames(input_filenames)));
+  TF_RETURN_IF_ERROR(MakeDirectory(directory));
+  const std::string manifest_path = root_ + "/manifest";
+  if (access(manifest_path.c_str(), F_OK) != 0) {
+    if (errno != ENOENT) {
+      return errors::Unavailable("Couldn't check for '", manifest_path,
+                                 "': ", strerror(errno));
+    }
+    TF_RETURN_IF_ERROR(Create(directory, manifest));
+  }
+
+  std::ifstream manifest_file(manifest_path);
+  const std::string existing((std::istreambuf_iterator<char>(manifest_file)),
+                             std::istreambuf_iterator<char>());
+  if (existing != manifest) {
+    return errors::FailedPrecondition(
+        "The work queue in '", root_,
+        "' was made for different inputs or a different batch size");
+  }
+  const std::string clock_path = ClockPath();
+  const int fd = open(clock_path.c_str(), O_WRONLY | O_CREAT, 0666);
+  if (fd == -1) {
+    return errors::Unavailable("Couldn't create '", clock_path, "': ",
+                               strerror(errno));
+  }
+  close(fd);
+  return Status::OK();
+}
+
+Status SharedWorkQueue::Create(const std::string& directory,
+                               const std::string& manifest) {
+  const std::string setup = directory + "/.setup-" + owner_;
+  const char* const subdirectories[] = {"pending", "leased", "done", "clocks"};
+  TF_RETURN_IF_ERROR(MakeDirectory(setup));
+  for (const char* subdirectory : subdirectories) {
+    TF_RETURN_IF_ERROR(MakeDirectory(setup + "/" + subdirectory));
+  }
+  TF_RETURN_IF_ERROR(WriteTextFile(setup + "/manifest", manifest));
+  const int64_t batch_count = (file_count_ + batch_size_ - 1) / batch_size_;
+  for (int64_t batch = 0; batch < batch_count; ++batch) {
+    TF_RETURN_IF_ERROR(
+        WriteTextFile(setup + "/pending/" + BatchName(batch), ""));
+  }
+  if (rename(setup.c_str(), root_.c_str()) == 0) {
+    std::cerr << "Created a work queue of " << batch_count << " batches in '"
+              << root_ << "'" << std::endl;
+    return Status::OK();
+  }
+  if ((errno != EEXIST) && (errno != ENOTEMPTY)) {
+    return errors::Unavailable("Couldn't move '", setup, "' to '", root_,
+                               "': ", strerror(errno));
+  }
+  // Another process got there first, so this copy isn't needed.
+  for (int64_t batch = 0; batch < batch_count; ++batch) {
+    unlink((setup + "/pending/" + BatchName(batch)).c_str());
+  }
+  unlink((setup + "/manifest").c_str());
+  for (const char* subdirectory : subdirectories) {
+    rmdir((setup + "/" + subdirectory).c_str());
+  }
+  rmdir(setup.c_str());
+  return Status::OK();
+}
+
+bool SharedWorkQueue::Next(int64_t* index) {
+  const auto poll_interval =
+      std::chrono::milliseconds(std::min(1000, lease_seconds_ * 250));
+  std::unique_lock<std::mutex> claim_lock(claim_mutex_, std::defer_lock);
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (Lease& lease : leases_) {
+        if (lease.next < lease.end) {
+          *index = lease.next++;
+          return true;
+        }
+      }
+      if (exhausted_) {
+        return false;
+      }
+    }
+    if (!claim_lock.owns_lock()) {
+      // Only one thread looks for more work at a time, and another may have
+      // found some while this one waited, so look at the leases again first.
+      claim_lock.lock();
+      continue;
+    }
+    bool claimed;
+    bool others_active;
+    Status claim_status = Claim(&claimed, &others_active);
+    if (!claim_status.ok()) {
+      std::cerr << "Couldn't take work from the queue: " << claim_status
+                << std::endl;
+      std::lock_guard<std::mutex> lock(mutex_);
+      exhausted_ = true;
+      return false;
+    }
+    if (claimed) {
+      continue;
+    }
+    if (!others_active) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      exhausted_ = true;
+      return false;
+    }
+    // Other processes still hold batches, which will need taking over if
+    // they've died, so check again once their leases might have run out.
+    claim_lock.unlock();
+    std::this_thread::sleep_for(poll_interval);
+  }
+}
+
+void SharedWorkQueue::Finish(int64_t index) {
+  const int64_t batch = index / batch_size_;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto lease = leases_.begin();
+    while ((lease != leases_.end()) && (lease->batch != batch)) {
+      ++lease;
+    }
+    if ((lease == leases_.end()) || (--lease->unfinished > 0)) {
+      return;
+    }
+    const bool lost = lease->lost;
+    leases_.erase(lease);
+    if (lost) {
+      return;
+    }
+  }
+  // Once the lease is gone from leases_ nothing else touches its file, so the
+  // rename can happen without holding the lock.
+  const std::string done_path = root_ + "/done/" + BatchName(batch);
+  if (rename(LeasePath(batch).c_str(), done_path.c_str()) != 0) {
+    if (errno == ENOENT) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++leases_lost_;
+    } else {
+      std::cerr << "Couldn't mark batch " << batch << " as done: "
+                << strerror(errno) << std::endl;
+    }
+  }
+}
+
+Status SharedWorkQueue::Claim(bool* claimed, bool* others_active) {
+  *claimed = false;
+  *others_active = false;
+  int64_t batch;
+  std::string owner;
+  // Pending batches are only ever taken away, so the listing is kept until
+  // it's been worked through, and batches that other processes have taken
+  // since are skipped.
+  bool relisted = false;
+  while (true) {
+    if (pending_next_ == pending_.size()) {
+      if (relisted) {
+        break;
+      }
+      TF_RETURN_IF_ERROR(ListDirectory(root_ + "/pending", &pending_));
+      pending_next_ = 0;
+      relisted = true;
+      continue;
+    }
+    const std::string& name = pending_[pending_next_++];
+    if (!ParseBatchName(name, &batch, &owner)) {
+      continue;
+    }
+    // Touching it first means the lease starts out fresh, rather than with
+    // the time the queue was made. Whoever renames it first gets it.
+    const std::string pending_path = root_ + "/pending/" + name;
+    Status touch_status = Touch(pending_path);
+    if (errors::IsNotFound(touch_status)) {
+      continue;
+    }
+    TF_RETURN_IF_ERROR(touch_status);
+    if (rename(pending_path.c_str(), LeasePath(batch).c_str()) != 0) {
+      if (errno == ENOENT) {
+        continue;
+      }
+      return errors::Unavailable("Couldn't lease '", pending_path, "': ",
+                                 strerror(errno));
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    AddLease(batch);
+    ++batches_claimed_;
+    *claimed = true;
+    return Status::OK();
+  }
+
+  std::vector<std::string> names;
+  TF_RETURN_IF_ERROR(ListDirectory(root_ + "/leased", &names));
+  time_t now = 0;
+  for (const std::string& name : names) {
+    if (!ParseBatchName(name, &batch, &owner) || (owner == owner_)) {
+      continue;
+    }
+    if (now == 0) {
+      TF_RETURN_IF_ERROR(FilesystemTime(&now));
+    }
+    const std::string lease_path = root_ + "/leased/" + name;
+    time_t modified;
+    Status time_status = ModificationTime(lease_path, &modified);
+    if (errors::IsNotFound(time_status)) {
+      continue;
+    }
+    TF_RETURN_IF_ERROR(time_status);
+    if (now <= (modified + lease_seconds_)) {
+      *others_active = true;
+      continue;
+    }
+    // Its owner has stopped renewing it, so take it over, touching it first
+    // for the same reason as above.
+    Status touch_status = Touch(lease_path);
+    if (errors::IsNotFound(touch_status)) {
+      continue;
+    }
+    TF_RETURN_IF_ERROR(touch_status);
+    if (rename(lease_path.c_str(), LeasePath(batch).c_str()) != 0) {
+      if (errno == ENOENT) {
+        continue;
+      }
+      return errors::Unavailable("Couldn't take over '", lease_path, "': ",
+                                 strerror(errno));
+    }
+    std::cerr << "Took over batch " << batch << " from " << owner
+              << ", whose lease had run out" << std::endl;
+    std::lock_guard<std::mutex> lock(mutex_);
+    AddLease(batch);
+    ++batches_reclaimed_;
+    *claimed = true;
+    return Status::OK();
+  }
+  return Status::OK();
+}
+
+Status SharedWorkQueue::FilesystemTime(time_t* now) {
+  const std::string clock_path = ClockPath();
+  TF_RETURN_IF_ERROR(Touch(clock_path));
+  return ModificationTime(clock_path, now);
+}
+
+void SharedWorkQueue::AddLease(int64_t batch) {
+  const int64_t start = batch * batch_size_;
+  const int64_t end = std::min(start + batch_size_, file_count_);
+  leases_.push_back(Lease{batch, start, end, end - start, false});
+}
+
+std::string SharedWorkQueue::LeasePath(int64_t batch) const {
+  return root_ + "/leased/" + BatchName(batch) + "." + owner_;
+}
+
+std::string SharedWorkQueue::ClockPath() const {
+  return root_ + "/clocks/" + owner_;
+}
+
+void SharedWorkQueue::RenewLeases() {
+  const auto interval = std::chrono::milliseconds(lease_seconds_ * 250);
+  std::vector<int64_t> batches;
+  std::vector<int64_t> lost_batches;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!heartbeat_wakeup_.wait_for(lock, interval,
+                                     [this]() { return stopping_; })) {
+    // Touching the files can be slow over NFS, so it's done from a copy of
+    // the batch numbers, without holding the lock.
+    batches.clear();
+    for (const Lease& lease : leases_) {
+      if (!lease.lost) {
+        batches.push_back(lease.batch);
+      }
+    }
+    lock.unlock();
+    lost_batches.clear();
+    for (const int64_t batch : batches) {
+      Status touch_status = Touch(LeasePath(batch));
+      if (errors::IsNotFound(touch_status)) {
+        lost_batches.push_back(batch);
+      } else if (!touch_status.ok()) {
+        std::cerr << "Couldn't renew the lease on batch " << batch << ": "
+                  << touch_status << std::endl;
+      }
+    }
+    lock.lock();
+    for (const int64_t batch : lost_batches) {
+      // A batch that was finished while its file was being touched has gone
+      // from leases_ too, and wasn't lost.
+      auto lease = leases_.begin();
+      while ((lease != leases_.end()) && (lease->batch != batch)) {
+        ++lease;
+      }
+      if ((lease == leases_.end()) || lease->lost) {
+        continue;
+      }
+      // Another process has taken the batch over, so leave the rest of its
+      // files to that one.
+      std::cerr << "Lost the lease on batch " << batch
+                << " to another process" << std::endl;
+      ++leases_lost_;
+      lease->unfinished -= lease->end - lease->next;
+      lease->next = lease->end;
+      lease->lost = true;
+      if (lease->unfinished == 0) {
+        leases_.erase(lease);
+      }
+    }
+  }
+}
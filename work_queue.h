@@ -0,0 +1,160 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// Shares the inputs out between several processes, usually on different
+// machines, through a directory on a filesystem they can all reach, like NFS,
+// without any service to coordinate them.
+
+#ifndef WORK_QUEUE_H_
+#define WORK_QUEUE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "status.h"
+
+// Splits the inputs into batches of consecutive files, and lets processes
+// that were all given the same inputs take batches from a queue directory as
+// they need them, so a slow machine just ends up doing fewer batches.
+//
+// The queue is a "queue" directory below the one given. Its layout is:
+//
+//   manifest      the file count, batch size and a hash of the input names
+//   pending/B     an empty file for each batch B that nobody has taken yet
+//   leased/B.O    batch B, leased by owner O, a host name and process ID
+//   done/B        batches that have been processed
+//   clocks/O      touched to read the filesystem's clock, and removed when
+//                 the queue is destroyed
+//
+// Every step is a single rename(), which is atomic even over NFS, so when two
+// processes go for the same batch, only one of them gets it. The first process
+// to arrive builds the whole queue in a directory of its own, then renames
+// that into place, so nobody ever sees a half-made queue.
+//
+// A lease lasts lease_seconds from its file's modification time, and a
+// background thread keeps touching the files of the batches this process
+// holds. Once nothing is pending, a process takes over any lease that has run
+// out, since its owner has probably died, and it keeps checking until every
+// batch is done, so all of the processes finish within about a batch of each
+// other. The times come from the filesystem rather than each machine's own
+// clock, so they can't disagree. If a lease is taken over from a process
+// that's still running, but too slow to renew it, that process skips the rest
+// of the batch and the files in it are processed twice, which gives the same
+// outputs.
+//
+// Example usage:
+//
+// SharedWorkQueue queue("/mnt/shared/queue", input_filenames, 64, 60);
+// TF_RETURN_IF_ERROR(queue.status());
+// int64_t index;
+// while (queue.Next(&index)) {
+//   Process(input_filenames[index]);
+//   queue.Finish(index);
+// }
+class SharedWorkQueue {
+ public:
+  SharedWorkQueue(const std::string& directory,
+                  const std::vector<std::string>& input_filenames,
+                  int64_t batch_size, int lease_seconds);
+  ~SharedWorkQueue();
+
+  const Status& status() const { return status_; }
+
+  // Sets index to the next file to process, taking another batch when this
+  // process's have all been handed out, and waiting while other processes
+  // hold batches whose leases could still run out. Returns false once there's
+  // nothing left to take. Safe to call from several threads at once.
+  bool Next(int64_t* index);
+
+  // Called once each file from Next() has been processed. When every file in
+  // its batch has been, the batch is marked as done.
+  void Finish(int64_t index);
+
+  // How many batches this process took from pending, and from other
+  // processes whose leases had run out, and how many were taken from it.
+  int64_t batches_claimed() const { return batches_claimed_; }
+  int64_t batches_reclaimed() const { return batches_reclaimed_; }
+  int64_t leases_lost() const { return leases_lost_; }
+
+ private:
+  // A batch this process holds.
+  struct Lease {
+    int64_t batch;
+    // The next file to hand out, and the end of the batch.
+    int64_t next;
+    int64_t end;
+    // Files that have been handed out or are waiting, but aren't finished.
+    int64_t unfinished;
+    // Set if another process has taken the batch over.
+    bool lost;
+  };
+
+  Status Open(const std::string& directory,
+              const std::vector<std::string>& input_filenames);
+  // Builds the queue in a directory of its own, then moves it into place.
+  Status Create(const std::string& directory, const std::string& manifest);
+  // Takes a pending batch, or one whose lease has run out. others_active is
+  // set if other processes hold leases that haven't. Must be called with
+  // claim_mutex_ held, and not mutex_, which it only takes to add the lease.
+  Status Claim(bool* claimed, bool* others_active);
+  // Reads the current time from the filesystem, by touching this process's
+  // clock file.
+  Status FilesystemTime(time_t* now);
+  void AddLease(int64_t batch);
+  std::string LeasePath(int64_t batch) const;
+  std::string ClockPath() const;
+  // The heartbeat thread, which touches every lease this process holds a few
+  // times per lease period, without holding mutex_ while it does.
+  void RenewLeases();
+
+  const std::string root_;
+  const int64_t file_count_;
+  const int64_t batch_size_;
+  const int lease_seconds_;
+  std::string owner_;
+  Status status_;
+
+  // Guards the leases, exhausted_, the counters and stopping_. Nothing holds
+  // it while going to the filesystem, so a slow server can't hold up threads
+  // that are only taking files from leases they already have.
+  std::mutex mutex_;
+  std::vector<Lease> leases_;
+  // Set once there's nothing left to take.
+  bool exhausted_ = false;
+  int64_t batches_claimed_ = 0;
+  int64_t batches_reclaimed_ = 0;
+  int64_t leases_lost_ = 0;
+
+  // Lets only one thread at a time look for more work, and guards the
+  // listing of pending batches. When both are needed, it's taken before
+  // mutex_.
+  std::mutex claim_mutex_;
+  // The last listing of pending batches, and how far through it Claim() is.
+  std::vector<std::string> pending_;
+  size_t pending_next_ = 0;
+
+  // Renews the leases until stopping_ is set.
+  std::thread heartbeat_;
+  std::condition_variable heartbeat_wakeup_;
+  bool stopping_ = false;
+};
+
+#endif  // WORK_QUEUE_H_
@@ -0,0 +1,1174 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+#include "zstd_reader.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace {
+
+constexpr uint32_t kZstdMagic = 0xfd2fb528;
+constexpr uint32_t kSkippableMagicMask = 0xfffffff0;
+constexpr uint32_t kSkippableMagic = 0x184d2a50;
+constexpr int64_t kMaxBlockSize = 128 * 1024;
+constexpr int64_t kMaxWindowSize = 1ll << 27;
+constexpr int kMaxHuffmanBits = 11;
+constexpr int kMaxFseLog = 9;
+
+enum SequenceTableIndex { kLiteralLengths = 0, kOffsets = 1, kMatchLengths = 2 };
+const int kMaxSequenceSymbol[3] = {35, 31, 52};
+const int kMaxSequenceLog[3] = {9, 8, 9};
+
+// The predefined distributions, used when a block doesn't describe its own.
+const int16_t kDefaultLiteralLengths[36] = {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1, -1, -1, -1, -1};
+const int16_t kDefaultOffsets[29] = {1, 1, 1, 1, 1, 1, 2, 2, 2, 1,
+                                     1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                                     1, 1, 1, 1, -1, -1, -1, -1, -1};
+const int16_t kDefaultMatchLengths[53] = {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1, -1, -1};
+const int16_t* const kDefaultDistributions[3] = {
+    kDefaultLiteralLengths, kDefaultOffsets, kDefaultMatchLengths};
+const int kDefaultSymbolCounts[3] = {36, 29, 53};
+const int kDefaultLogs[3] = {6, 5, 6};
+
+const uint32_t kLiteralLengthBase[36] = {
+    0,  1,  2,   3,   4,   5,    6,    7,    8,    9,     10,    11,
+    12, 13, 14,  15,  16,  18,   20,   22,   24,   28,    32,    40,
+    48, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536};
+const uint8_t kLiteralLengthBits[36] = {0, 0, 0, 0, 0, 0, 0, 0, 0,  0,  0,  0,
+                                        0, 0, 0, 0, 1, 1, 1, 1, 2,  2,  3,  3,
+                                        4, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+const uint32_t kMatchLengthBase[53] = {
+    3,  4,  5,  6,  7,  8,  9,  10,  11,  12,   13,   14,   15,    16,
+    17, 18, 19, 20, 21, 22, 23, 24,  25,  26,   27,   28,   29,    30,
+    31, 32, 33, 34, 35, 37, 39, 41,  43,  47,   51,   59,   67,    83,
+    99, 131, 259, 515, 1027, 2051, 4099, 8195, 16387, 32771, 65539};
+const uint8_t kMatchLengthBits[53] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1,
+    2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+
+uint32_t DecodeFixed32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+uint64_t DecodeFixed64(const uint8_t* data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+// Reads a little-endian value of up to eight bytes.
+uint64_t DecodeVariable(const uint8_t* data, int size) {
+  uint64_t value = 0;
+  for (int i = 0; i < size; ++i) {
+    value |= static_cast<uint64_t>(data[i]) << (8 * i);
+  }
+  return value;
+}
+
+int HighBit(uint32_t value) { return 31 - __builtin_clz(value); }
+
+Status Corrupt(const char* what) {
+  return errors::DataLoss(what, " in zstd data");
+}
+
+Status Truncated() { return errors::DataLoss("zstd data is truncated"); }
+
+// Zstandard's entropy coded streams are written forwards and read backwards,
+// starting just below a marker bit in the last byte. This follows the
+// reference decoder's bit container, so that running off the start of the
+// stream, which the Huffman weight decoder relies on, is detected the same way.
+class BackwardBitReader {
+ public:
+  BackwardBitReader()
+      : start_(nullptr), position_(nullptr), container_(0), consumed_(0) {}
+
+  Status Init(const uint8_t* data, size_t size) {
+    if (size == 0) {
+      return Corrupt("Empty bitstream");
+    }
+    const uint8_t last = data[size - 1];
+    if (last == 0) {
+      return Corrupt("Missing bitstream end marker");
+    }
+    start_ = data;
+    if (size >= sizeof(uint64_t)) {
+      position_ = data + size - sizeof(uint64_t);
+      container_ = DecodeFixed64(position_);
+      consumed_ = 0;
+    } else {
+      position_ = data;
+      container_ = DecodeVariable(data, size);
+      consumed_ = (sizeof(uint64_t) - size) * 8;
+    }
+    consumed_ += 8 - HighBit(last);
+    return Status::OK();
+  }
+
+  uint64_t Look(int count) const {
+    return ((container_ << (consumed_ & 63)) >> 1) >> ((63 - count) & 63);
+  }
+
+  void Skip(int count) { consumed_ += count; }
+
+  uint64_t Read(int count) {
+    const uint64_t value = Look(count);
+    Skip(count);
+    return value;
+  }
+
+  // Refills the container so at least 57 bits can be read, unless the start
+  // of the stream is close.
+  void Reload() {
+    if (consumed_ > 64) {
+      return;
+    }
+    if (position_ >= (start_ + sizeof(uint64_t))) {
+      position_ -= consumed_ >> 3;
+      consumed_ &= 7;
+      container_ = DecodeFixed64(position_);
+      return;
+    }
+    if (position_ == start_) {
+      return;
+    }
+    size_t bytes = consumed_ >> 3;
+    if (bytes > static_cast<size_t>(position_ - start_)) {
+      bytes = position_ - start_;
+    }
+    position_ -= bytes;
+    consumed_ -= bytes * 8;
+    container_ = DecodeFixed64(position_);
+  }
+
+  // True once more bits have been read than the stream holds.
+  bool overflowed() const { return consumed_ > 64; }
+  // True if every bit has been read, and no more.
+  bool finished() const { return (position_ == start_) && (consumed_ == 64); }
+
+ private:
+  const uint8_t* start_;
+  const uint8_t* position_;
+  uint64_t container_;
+  uint32_t consumed_;
+};
+
+// Reads an FSE table description, which gives each symbol's normalized
+// probability, from a forward little-endian bitstream.
+Status ReadFseDistribution(const uint8_t* data, size_t size, int max_symbol,
+                           int max_log, int16_t* counts, int* symbol_count,
+                           int* log, size_t* consumed) {
+  int64_t bit_position = 0;
+  auto peek = [data, size, &bit_position]() {
+    const size_t byte = bit_position >> 3;
+    uint32_t value = 0;
+    if ((byte + sizeof(value)) <= size) {
+      value = DecodeFixed32(data + byte);
+    } else if (byte < size) {
+      value = DecodeVariable(data + byte, size - byte);
+    }
+    return value >> (bit_position & 7);
+  };
+  *log = (peek() & 15) + 5;
+  bit_position += 4;
+  if (*log > max_log) {
+    return Corrupt("FSE table log too large");
+  }
+  int remaining = (1 << *log) + 1;
+  int threshold = 1 << *log;
+  int bit_count = *log + 1;
+  int symbol = 0;
+  bool previous_zero = false;
+  while ((remaining > 1) && (symbol <= max_symbol)) {
+    if (previous_zero) {
+      // Runs of zero probabilities are stored as a count, two bits at a time.
+      int zero_end = symbol;
+      uint32_t repeat;
+      while ((repeat = (peek() & 3)) == 3) {
+        zero_end += 3;
+        bit_position += 2;
+        if ((bit_position >> 3) > static_cast<int64_t>(size)) {
+          return Truncated();
+        }
+      }
+      zero_end += repeat;
+      bit_position += 2;
+      if (zero_end > max_symbol) {
+        return Corrupt("Too many FSE symbols");
+      }
+      while (symbol < zero_end) {
+        counts[symbol++] = 0;
+      }
+      previous_zero = false;
+      continue;
+    }
+    const uint32_t bits = peek();
+    const int max = (2 * threshold - 1) - remaining;
+    int count;
+    if (static_cast<int>(bits & (threshold - 1)) < max) {
+      count = bits & (threshold - 1);
+      bit_position += bit_count - 1;
+    } else {
+      count = bits & (2 * threshold - 1);
+      if (count >= threshold) {
+        count -= max;
+      }
+      bit_position += bit_count;
+    }
+    // Zero is stored as one, and the special "less than one" as zero.
+    --count;
+    remaining -= (count < 0) ? -count : count;
+    counts[symbol++] = count;
+    previous_zero = (count == 0);
+    while (remaining < threshold) {
+      --bit_count;
+      threshold >>= 1;
+    }
+  }
+  *consumed = (bit_position + 7) >> 3;
+  if ((remaining != 1) || (*consumed > size)) {
+    return Corrupt("Bad FSE table description");
+  }
+  *symbol_count = symbol;
+  return Status::OK();
+}
+
+}  // namespace
+
+// A finite state entropy decoding table. Each state gives a symbol, and the
+// next state is base plus that many bits from the stream.
+struct ZstdReader::FseTable {
+  struct Entry {
+    uint8_t symbol;
+    uint8_t bits;
+    uint16_t base;
+  };
+  int log;
+  Entry entries[1 << kMaxFseLog];
+};
+
+// Indexed by the next max_bits bits of a stream.
+struct ZstdReader::HuffmanTable {
+  struct Entry {
+    uint8_t symbol;
+    uint8_t bits;
+  };
+  int max_bits;
+  Entry entries[1 << kMaxHuffmanBits];
+};
+
+// XXH64 with a zero seed, of which frames store the low 32 bits.
+struct ZstdReader::Checksum {
+  static constexpr uint64_t kPrime1 = 11400714785074694791ull;
+  static constexpr uint64_t kPrime2 = 14029467366897019727ull;
+  static constexpr uint64_t kPrime3 = 1609587929392839161ull;
+  static constexpr uint64_t kPrime4 = 9650029242287828579ull;
+  static constexpr uint64_t kPrime5 = 2870177450012600261ull;
+
+  uint64_t lanes[4];
+  uint8_t pending[32];
+  int pending_size;
+  uint64_t total_size;
+
+  static uint64_t Rotate(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+  }
+
+  static uint64_t Round(uint64_t lane, uint64_t input) {
+    lane += input * kPrime2;
+    return Rotate(lane, 31) * kPrime1;
+  }
+
+  static uint64_t MergeRound(uint64_t hash, uint64_t lane) {
+    hash ^= Round(0, lane);
+    return (hash * kPrime1) + kPrime4;
+  }
+
+  void Reset() {
+    lanes[0] = kPrime1 + kPrime2;
+    lanes[1] = kPrime2;
+    lanes[2] = 0;
+    lanes[3] = -kPrime1;
+    pending_size = 0;
+    total_size = 0;
+  }
+
+  void Stripe(const uint8_t* data) {
+    for (int i = 0; i < 4; ++i) {
+      lanes[i] = Round(lanes[i], DecodeFixed64(data + (i * 8)));
+    }
+  }
+
+  void Update(const uint8_t* data, size_t size) {
+    total_size += size;
+    if (pending_size > 0) {
+      const size_t fill = std::min<size_t>(size, 32 - pending_size);
+      memcpy(pending + pending_size, data, fill);
+      pending_size += fill;
+      data += fill;
+      size -= fill;
+      if (pending_size < 32) {
+        return;
+      }
+      Stripe(pending);
+      pending_size = 0;
+    }
+    for (; size >= 32; data += 32, size -= 32) {
+      Stripe(data);
+    }
+    memcpy(pending, data, size);
+    pending_size = size;
+  }
+
+  uint32_t Digest() const {
+    uint64_t hash;
+    if (total_size >= 32) {
+      hash = Rotate(lanes[0], 1) + Rotate(lanes[1], 7) +
+             Rotate(lanes[2], 12) + Rotate(lanes[3], 18);
+      for (int i = 0; i < 4; ++i) {
+        hash = MergeRound(hash, lanes[i]);
+      }
+    } else {
+      hash = kPrime5;
+    }
+    hash += total_size;
+    int i = 0;
+    for (; (i + 8) <= pending_size; i += 8) {
+      hash ^= Round(0, DecodeFixed64(pending + i));
+      hash = (Rotate(hash, 27) * kPrime1) + kPrime4;
+    }
+    if ((i + 4) <= pending_size) {
+      hash ^= DecodeFixed32(pending + i) * kPrime1;
+      hash = (Rotate(hash, 23) * kPrime2) + kPrime3;
+      i += 4;
+    }
+    for (; i < pending_size; ++i) {
+      hash ^= pending[i] * kPrime5;
+      hash = Rotate(hash, 11) * kPrime1;
+    }
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return static_cast<uint32_t>(hash);
+  }
+};
+
+namespace {
+
+// Spreads the symbols over the table's states as the format specifies.
+template <class Table>
+Status BuildFseTable(const int16_t* counts, int symbol_count, int log,
+                     Table* table) {
+  const int size = 1 << log;
+  int high = size - 1;
+  uint16_t next[256];
+  table->log = log;
+  for (int s = 0; s < symbol_count; ++s) {
+    if (counts[s] == -1) {
+      table->entries[high--].symbol = s;
+      next[s] = 1;
+    } else {
+      next[s] = std::max<int16_t>(0, counts[s]);
+    }
+  }
+  const int step = (size >> 1) + (size >> 3) + 3;
+  const int mask = size - 1;
+  int position = 0;
+  for (int s = 0; s < symbol_count; ++s) {
+    for (int i = 0; i < counts[s]; ++i) {
+      table->entries[position].symbol = s;
+      do {
+        position = (position + step) & mask;
+      } while (position > high);
+    }
+  }
+  if (position != 0) {
+    return Corrupt("Bad FSE distribution");
+  }
+  for (int u = 0; u < size; ++u) {
+    const uint16_t state = next[table->entries[u].symbol]++;
+    const int bits = log - HighBit(state);
+    table->entries[u].bits = bits;
+    table->entries[u].base = (state << bits) - size;
+  }
+  return Status::OK();
+}
+
+template <class Table>
+void BuildRleTable(uint8_t symbol, Table* table) {
+  table->log = 0;
+  table->entries[0].symbol = symbol;
+  table->entries[0].bits = 0;
+  table->entries[0].base = 0;
+}
+
+// Copies a match, which may overlap its own output.
+inline void CopyMatch(uint8_t* to, int64_t offset, int64_t length) {
+  const uint8_t* from = to - offset;
+  if (offset >= length) {
+    memcpy(to, from, length);
+  } else {
+    for (int64_t i = 0; i < length; ++i) {
+      to[i] = from[i];
+    }
+  }
+}
+
+}  // namespace
+
+ZstdReader::ZstdReader(const uint8_t* data, size_t size, Arena* arena)
+    : data_(data),
+      size_(size),
+      arena_(arena),
+      position_(0),
+      in_frame_(false),
+      done_(false),
+      window_size_(0),
+      block_max_size_(0),
+      has_content_size_(false),
+      content_size_(0),
+      frame_output_(0),
+      has_checksum_(false),
+      last_block_(false),
+      history_(nullptr),
+      history_capacity_(0),
+      history_end_(0),
+      read_position_(0),
+      literals_(nullptr),
+      huffman_(nullptr),
+      has_huffman_(false),
+      sequence_tables_{nullptr, nullptr, nullptr},
+      has_sequence_table_{false, false, false},
+      weight_table_(nullptr),
+      repeat_offsets_{1, 4, 8},
+      checksum_(nullptr) {}
+
+Status ZstdReader::Read(uint8_t* data, int64_t length, int64_t* bytes_read) {
+  *bytes_read = 0;
+  while (*bytes_read < length) {
+    if (read_position_ == history_end_) {
+      if (done_) {
+        break;
+      }
+      if (!in_frame_) {
+        TF_RETURN_IF_ERROR(ReadFrameHeader());
+      } else {
+        TF_RETURN_IF_ERROR(DecodeBlock());
+      }
+      continue;
+    }
+    const int64_t count =
+        std::min(length - *bytes_read, history_end_ - read_position_);
+    memcpy(data + *bytes_read, history_ + read_position_, count);
+    read_position_ += count;
+    *bytes_read += count;
+  }
+  return Status::OK();
+}
+
+Status ZstdReader::ReadFrameHeader() {
+  while (true) {
+    if ((position_ + 4) > size_) {
+      return Truncated();
+    }
+    const uint32_t magic = DecodeFixed32(data_ + position_);
+    if (magic == kZstdMagic) {
+      position_ += 4;
+      break;
+    }
+    if ((magic & kSkippableMagicMask) != kSkippableMagic) {
+      return errors::InvalidArgument("Missing zstd frame marker at byte ",
+                                     position_);
+    }
+    if ((position_ + 8) > size_) {
+      return Truncated();
+    }
+    const uint64_t skip_size = DecodeFixed32(data_ + position_ + 4);
+    if ((position_ + 8 + skip_size) > size_) {
+      return Truncated();
+    }
+    position_ += 8 + skip_size;
+    if (position_ == size_) {
+      done_ = true;
+      return Status::OK();
+    }
+  }
+
+  if (position_ >= size_) {
+    return Truncated();
+  }
+  const uint8_t descriptor = data_[position_++];
+  const int content_size_flag = descriptor >> 6;
+  const bool single_segment = (descriptor >> 5) & 1;
+  const int dictionary_flag = descriptor & 3;
+  if (descriptor & 0x08) {
+    return Corrupt("Reserved frame header bit set");
+  }
+  has_checksum_ = (descriptor >> 2) & 1;
+  const int dictionary_id_sizes[4] = {0, 1, 2, 4};
+  const int content_size_sizes[4] = {single_segment ? 1 : 0, 2, 4, 8};
+  const int dictionary_id_size = dictionary_id_sizes[dictionary_flag];
+  const int content_size_size = content_size_sizes[content_size_flag];
+  const size_t header_size =
+      (single_segment ? 0 : 1) + dictionary_id_size + content_size_size;
+  if ((position_ + header_size) > size_) {
+    return Truncated();
+  }
+  uint64_t window_size = 0;
+  if (!single_segment) {
+    const uint8_t window_descriptor = data_[position_++];
+    const uint64_t window_base = 1ull << (10 + (window_descriptor >> 3));
+    window_size = window_base + ((window_base / 8) * (window_descriptor & 7));
+  }
+  if (DecodeVariable(data_ + position_, dictionary_id_size) != 0) {
+    return errors::Unimplemented("zstd frames with dictionaries aren't "
+                                 "supported");
+  }
+  position_ += dictionary_id_size;
+  has_content_size_ = (content_size_size > 0);
+  content_size_ = DecodeVariable(data_ + position_, content_size_size);
+  if (content_size_size == 2) {
+    content_size_ += 256;
+  }
+  position_ += content_size_size;
+  if (single_segment) {
+    window_size = content_size_;
+  }
+  if (window_size > kMaxWindowSize) {
+    return errors::Unimplemented("zstd window of ", window_size,
+                                 " bytes is over the ", kMaxWindowSize,
+                                 " byte limit");
+  }
+  window_size_ = window_size;
+  block_max_size_ = std::min(window_size_, kMaxBlockSize);
+
+  // Keeping a window of history plus as much again to decode into means only
+  // one byte is moved for every one decoded, at most.
+  const int64_t capacity = std::max<int64_t>(
+      1, (2 * window_size_) + block_max_size_);
+  if (capacity > history_capacity_) {
+    history_ = arena_->AllocateArray<uint8_t>(capacity);
+    TF_RETURN_IF_ERROR(arena_->status());
+    history_capacity_ = capacity;
+  }
+  if (literals_ == nullptr) {
+    uint8_t* literals = arena_->AllocateArray<uint8_t>(kMaxBlockSize);
+    huffman_ = arena_->AllocateArray<HuffmanTable>(1);
+    for (int i = 0; i < 3; ++i) {
+      sequence_tables_[i] = arena_->AllocateArray<FseTable>(1);
+    }
+    weight_table_ = arena_->AllocateArray<FseTable>(1);
+    checksum_ = arena_->AllocateArray<Checksum>(1);
+    TF_RETURN_IF_ERROR(arena_->status());
+    // Only set once everything else is, since it marks the tables as ready.
+    literals_ = literals;
+  }
+  history_end_ = 0;
+  read_position_ = 0;
+  frame_output_ = 0;
+  last_block_ = false;
+  has_huffman_ = false;
+  for (int i = 0; i < 3; ++i) {
+    has_sequence_table_[i] = false;
+  }
+  repeat_offsets_[0] = 1;
+  repeat_offsets_[1] = 4;
+  repeat_offsets_[2] = 8;
+  checksum_->Reset();
+  in_frame_ = true;
+  return Status::OK();
+}
+
+Status ZstdReader::DecodeBlock() {
+  if (last_block_) {
+    return FinishFrame();
+  }
+  // Everything has been read, so only the window has to be kept.
+  if ((history_end_ + block_max_size_) > history_capacity_) {
+    const int64_t shift = history_end_ - window_size_;
+    memmove(history_, history_ + shift, window_size_);
+    history_end_ = window_size_;
+    read_position_ = window_size_;
+  }
+  if ((position_ + 3) > size_) {
+    return Truncated();
+  }
+  const uint32_t header = DecodeVariable(data_ + position_, 3);
+  position_ += 3;
+  last_block_ = header & 1;
+  const int type = (header >> 1) & 3;
+  const int64_t block_size = header >> 3;
+  if (block_size > block_max_size_) {
+    return Corrupt("Block larger than the maximum");
+  }
+  const int64_t block_start = history_end_;
+  switch (type) {
+    case 0:
+      if ((position_ + block_size) > size_) {
+        return Truncated();
+      }
+      memcpy(history_ + history_end_, data_ + position_, block_size);
+      position_ += block_size;
+      history_end_ += block_size;
+      break;
+    case 1:
+      if (position_ >= size_) {
+        return Truncated();
+      }
+      memset(history_ + history_end_, data_[position_], block_size);
+      position_ += 1;
+      history_end_ += block_size;
+      break;
+    case 2:
+      if ((position_ + block_size) > size_) {
+        return Truncated();
+      }
+      TF_RETURN_IF_ERROR(
+          DecodeCompressedBlock(data_ + position_, block_size));
+      position_ += block_size;
+      break;
+    default:
+      return Corrupt("Reserved block type");
+  }
+  const int64_t produced = history_end_ - block_start;
+  frame_output_ += produced;
+  if (has_checksum_) {
+    checksum_->Update(history_ + block_start, produced);
+  }
+  return Status::OK();
+}
+
+Status ZstdReader::FinishFrame() {
+  if (has_content_size_ && (frame_output_ != content_size_)) {
+    return Corrupt("Frame content size mismatch");
+  }
+  if (has_checksum_) {
+    if ((position_ + 4) > size_) {
+      return Truncated();
+    }
+    if (DecodeFixed32(data_ + position_) != checksum_->Digest()) {
+      return errors::DataLoss("zstd checksum mismatch");
+    }
+    position_ += 4;
+  }
+  in_frame_ = false;
+  done_ = (position_ == size_);
+  return Status::OK();
+}
+
+Status ZstdReader::DecodeCompressedBlock(const uint8_t* block, size_t size) {
+  size_t literals_size;
+  const uint8_t* literals;
+  int64_t literal_count;
+  TF_RETURN_IF_ERROR(
+      DecodeLiterals(block, size, &literals_size, &literals, &literal_count));
+  const uint8_t* data = block + literals_size;
+  const uint8_t* end = block + size;
+  if (data >= end) {
+    return Corrupt("Missing sequences section");
+  }
+  int64_t sequence_count = data[0];
+  if (sequence_count < 128) {
+    data += 1;
+  } else if (sequence_count < 255) {
+    if ((data + 2) > end) {
+      return Truncated();
+    }
+    sequence_count = ((sequence_count - 128) << 8) + data[1];
+    data += 2;
+  } else {
+    if ((data + 3) > end) {
+      return Truncated();
+    }
+    sequence_count = data[1] + (data[2] << 8) + 0x7f00;
+    data += 3;
+  }
+  if (sequence_count == 0) {
+    if (literal_count > block_max_size_) {
+      return Corrupt("Block larger than the maximum");
+    }
+    memcpy(history_ + history_end_, literals, literal_count);
+    history_end_ += literal_count;
+    return Status::OK();
+  }
+  if (data >= end) {
+    return Truncated();
+  }
+  const uint8_t modes = *data++;
+  if (modes & 3) {
+    return Corrupt("Reserved sequence modes set");
+  }
+  TF_RETURN_IF_ERROR(ReadSequenceTable(modes >> 6, kLiteralLengths, &data, end));
+  TF_RETURN_IF_ERROR(ReadSequenceTable((modes >> 4) & 3, kOffsets, &data, end));
+  TF_RETURN_IF_ERROR(
+      ReadSequenceTable((modes >> 2) & 3, kMatchLengths, &data, end));
+  return ExecuteSequences(data, end, sequence_count, literals, literal_count);
+}
+
+Status ZstdReader::DecodeLiterals(const uint8_t* block, size_t size,
+                                  size_t* consumed, const uint8_t** literals,
+                                  int64_t* literal_count) {
+  if (size < 1) {
+    return Truncated();
+  }
+  const int type = block[0] & 3;
+  const int size_format = (block[0] >> 2) & 3;
+  if (type < 2) {
+    // Raw or run-length literals.
+    int header_size;
+    int64_t regenerated;
+    if ((size_format & 1) == 0) {
+      header_size = 1;
+      regenerated = block[0] >> 3;
+    } else if (size_format == 1) {
+      header_size = 2;
+      regenerated = DecodeVariable(block, 2) >> 4;
+    } else {
+      header_size = 3;
+      regenerated = DecodeVariable(block, 3) >> 4;
+    }
+    if (regenerated > kMaxBlockSize) {
+      return Corrupt("Too many literals");
+    }
+    if (type == 0) {
+      if ((header_size + regenerated) > static_cast<int64_t>(size)) {
+        return Truncated();
+      }
+      *literals = block + header_size;
+      *consumed = header_size + regenerated;
+    } else {
+      if ((header_size + 1) > static_cast<int64_t>(size)) {
+        return Truncated();
+      }
+      memset(literals_, block[header_size], regenerated);
+      *literals = literals_;
+      *consumed = header_size + 1;
+    }
+    *literal_count = regenerated;
+    return Status::OK();
+  }
+
+  // Huffman coded literals, either with a new table or the previous one.
+  const int header_sizes[4] = {3, 3, 4, 5};
+  const int size_bits[4] = {10, 10, 14, 18};
+  const int header_size = header_sizes[size_format];
+  if (header_size > static_cast<int>(size)) {
+    return Truncated();
+  }
+  const uint64_t header = DecodeVariable(block, header_size);
+  const uint64_t mask = (1ull << size_bits[size_format]) - 1;
+  const int64_t regenerated = (header >> 4) & mask;
+  int64_t compressed = (header >> (4 + size_bits[size_format])) & mask;
+  if (regenerated > kMaxBlockSize) {
+    return Corrupt("Too many literals");
+  }
+  if ((header_size + compressed) > static_cast<int64_t>(size)) {
+    return Truncated();
+  }
+  const uint8_t* data = block + header_size;
+  if (type == 2) {
+    size_t table_size;
+    TF_RETURN_IF_ERROR(ReadHuffmanTable(data, compressed, &table_size));
+    data += table_size;
+    compressed -= table_size;
+    has_huffman_ = true;
+  } else if (!has_huffman_) {
+    return Corrupt("Repeated Huffman table with none before it");
+  }
+  if (size_format == 0) {
+    TF_RETURN_IF_ERROR(
+        DecodeHuffmanStream(data, compressed, literals_, regenerated));
+  } else {
+    // Four streams, each a quarter of the output, after a table of the
+    // first three's sizes.
+    if (compressed < 6) {
+      return Truncated();
+    }
+    size_t stream_sizes[4];
+    size_t total = 6;
+    for (int i = 0; i < 3; ++i) {
+      stream_sizes[i] = DecodeVariable(data + (i * 2), 2);
+      total += stream_sizes[i];
+    }
+    if (total > static_cast<size_t>(compressed)) {
+      return Corrupt("Bad Huffman stream sizes");
+    }
+    stream_sizes[3] = compressed - total;
+    const int64_t segment = (regenerated + 3) / 4;
+    if ((segment * 3) > regenerated) {
+      return Corrupt("Too few literals for four streams");
+    }
+    const uint8_t* streams[4];
+    int64_t counts[4];
+    streams[0] = data + 6;
+    for (int i = 0; i < 4; ++i) {
+      if (i > 0) {
+        streams[i] = streams[i - 1] + stream_sizes[i - 1];
+      }
+      counts[i] = (i < 3) ? segment : (regenerated - (3 * segment));
+    }
+    TF_RETURN_IF_ERROR(
+        DecodeHuffmanStreams(streams, stream_sizes, counts, segment));
+  }
+  *literals = literals_;
+  *literal_count = regenerated;
+  *consumed = header_size + ((header >> (4 + size_bits[size_format])) & mask);
+  return Status::OK();
+}
+
+Status ZstdReader::ReadHuffmanTable(const uint8_t* data, size_t size,
+                                    size_t* consumed) {
+  if (size < 1) {
+    return Truncated();
+  }
+  const uint8_t header = data[0];
+  uint8_t weights[256];
+  int weight_count = 0;
+  if (header < 128) {
+    // The weights are FSE coded, with two interleaved states.
+    if ((1u + header) > size) {
+      return Truncated();
+    }
+    int16_t counts[256];
+    int symbol_count;
+    int log;
+    size_t description_size;
+    TF_RETURN_IF_ERROR(ReadFseDistribution(data + 1, header, 255, 6, counts,
+                                           &symbol_count, &log,
+                                           &description_size));
+    FseTable* table = weight_table_;
+    TF_RETURN_IF_ERROR(BuildFseTable(counts, symbol_count, log, table));
+    BackwardBitReader bits;
+    TF_RETURN_IF_ERROR(bits.Init(data + 1 + description_size,
+                                 header - description_size));
+    uint32_t states[2];
+    states[0] = bits.Read(log);
+    states[1] = bits.Read(log);
+    bits.Reload();
+    // Decoding stops when a state update runs off the start of the stream,
+    // and the other state still holds one last weight.
+    for (int which = 0;; which ^= 1) {
+      if (weight_count >= 254) {
+        return Corrupt("Too many Huffman weights");
+      }
+      const FseTable::Entry& entry = table->entries[states[which]];
+      weights[weight_count++] = entry.symbol;
+      states[which] = entry.base + bits.Read(entry.bits);
+      bits.Reload();
+      if (bits.overflowed()) {
+        weights[weight_count++] = table->entries[states[which ^ 1]].symbol;
+        break;
+      }
+    }
+    *consumed = 1 + header;
+  } else {
+    weight_count = header - 127;
+    const size_t byte_count = (weight_count + 1) / 2;
+    if ((1 + byte_count) > size) {
+      return Truncated();
+    }
+    for (int i = 0; i < weight_count; ++i) {
+      const uint8_t byte = data[1 + (i / 2)];
+      weights[i] = (i & 1) ? (byte & 15) : (byte >> 4);
+    }
+    *consumed = 1 + byte_count;
+  }
+
+  // The last symbol's weight is whatever brings the total up to a power of
+  // two.
+  uint32_t total = 0;
+  for (int i = 0; i < weight_count; ++i) {
+    if (weights[i] > kMaxHuffmanBits) {
+      return Corrupt("Huffman weight too large");
+    }
+    if (weights[i] > 0) {
+      total += 1u << (weights[i] - 1);
+    }
+  }
+  if (total == 0) {
+    return Corrupt("Empty Huffman table");
+  }
+  const int max_bits = HighBit(total) + 1;
+  const uint32_t left = (1u << max_bits) - total;
+  if ((max_bits > kMaxHuffmanBits) || ((left & (left - 1)) != 0)) {
+    return Corrupt("Incomplete Huffman table");
+  }
+  weights[weight_count++] = HighBit(left) + 1;
+
+  // Codes are handed out from the lowest weight up, in symbol order, with
+  // each symbol covering 2^(weight - 1) entries.
+  uint32_t starts[kMaxHuffmanBits + 2] = {};
+  for (int i = 0; i < weight_count; ++i) {
+    if (weights[i] > 0) {
+      starts[weights[i]] += 1u << (weights[i] - 1);
+    }
+  }
+  uint32_t next = 0;
+  for (int w = 1; w <= max_bits; ++w) {
+    const uint32_t span = starts[w];
+    starts[w] = next;
+    next += span;
+  }
+  huffman_->max_bits = max_bits;
+  for (int i = 0; i < weight_count; ++i) {
+    const int w = weights[i];
+    if (w == 0) {
+      continue;
+    }
+    const uint32_t length = 1u << (w - 1);
+    const HuffmanTable::Entry entry = {static_cast<uint8_t>(i),
+                                       static_cast<uint8_t>(max_bits + 1 - w)};
+    for (uint32_t k = 0; k < length; ++k) {
+      huffman_->entries[starts[w] + k] = entry;
+    }
+    starts[w] += length;
+  }
+  return Status::OK();
+}
+
+Status ZstdReader::DecodeHuffmanStream(const uint8_t* data, size_t size,
+                                       uint8_t* output, int64_t count) {
+  BackwardBitReader bits;
+  TF_RETURN_IF_ERROR(bits.Init(data, size));
+  const HuffmanTable::Entry* entries = huffman_->entries;
+  const int max_bits = huffman_->max_bits;
+  int64_t i = 0;
+  // Four codes of up to 11 bits fit between reloads.
+  for (; (i + 4) <= count; i += 4) {
+    bits.Reload();
+    for (int k = 0; k < 4; ++k) {
+      const HuffmanTable::Entry entry = entries[bits.Look(max_bits)];
+      bits.Skip(entry.bits);
+      output[i + k] = entry.symbol;
+    }
+  }
+  bits.Reload();
+  for (; i < count; ++i) {
+    const HuffmanTable::Entry entry = entries[bits.Look(max_bits)];
+    bits.Skip(entry.bits);
+    output[i] = entry.symbol;
+  }
+  bits.Reload();
+  if (!bits.finished()) {
+    return Corrupt("Huffman stream length mismatch");
+  }
+  return Status::OK();
+}
+
+Status ZstdReader::DecodeHuffmanStreams(const uint8_t* const* streams,
+                                        const size_t* sizes,
+                                        const int64_t* counts,
+                                        int64_t segment) {
+  // The four streams are independent, so decoding them in lockstep lets the
+  // CPU overlap their table lookups.
+  BackwardBitReader bits[4];
+  for (int i = 0; i < 4; ++i) {
+    TF_RETURN_IF_ERROR(bits[i].Init(streams[i], sizes[i]));
+  }
+  const HuffmanTable::Entry* entries = huffman_->entries;
+  const int max_bits = huffman_->max_bits;
+  uint8_t* const output = literals_;
+  const int64_t common = std::min(counts[0], counts[3]);
+  int64_t i = 0;
+  for (; (i + 4) <= common; i += 4) {
+    for (int s = 0; s < 4; ++s) {
+      bits[s].Reload();
+    }
+    for (int k = 0; k < 4; ++k) {
+      for (int s = 0; s < 4; ++s) {
+        const HuffmanTable::Entry entry = entries[bits[s].Look(max_bits)];
+        bits[s].Skip(entry.bits);
+        output[(s * segment) + i + k] = entry.symbol;
+      }
+    }
+  }
+  for (int s = 0; s < 4; ++s) {
+    bits[s].Reload();
+    for (int64_t j = i; j < counts[s]; ++j) {
+      if (((j - i) & 3) == 3) {
+        bits[s].Reload();
+      }
+      const HuffmanTable::Entry entry = entries[bits[s].Look(max_bits)];
+      bits[s].Skip(entry.bits);
+      output[(s * segment) + j] = entry.symbol;
+    }
+    bits[s].Reload();
+    if (!bits[s].finished()) {
+      return Corrupt("Huffman stream length mismatch");
+    }
+  }
+  return Status::OK();
+}
+
+Status ZstdReader::ReadSequenceTable(int mode, int index, const uint8_t** data,
+                                     const uint8_t* end) {
+  FseTable* table = sequence_tables_[index];
+  switch (mode) {
+    case 0:
+      TF_RETURN_IF_ERROR(BuildFseTable(kDefaultDistributions[index],
+                                       kDefaultSymbolCounts[index],
+                                       kDefaultLogs[index], table));
+      break;
+    case 1:
+      if (*data >= end) {
+        return Truncated();
+      }
+      if (**data > kMaxSequenceSymbol[index]) {
+        return Corrupt("Bad run-length sequence symbol");
+      }
+      BuildRleTable(**data, table);
+      *data += 1;
+      break;
+    case 2: {
+      int16_t counts[64];
+      int symbol_count;
+      int log;
+      size_t consumed;
+      TF_RETURN_IF_ERROR(ReadFseDistribution(
+          *data, end - *data, kMaxSequenceSymbol[index],
+          kMaxSequenceLog[index], counts, &symbol_count, &log, &consumed));
+      TF_RETURN_IF_ERROR(BuildFseTable(counts, symbol_count, log, table));
+      *data += consumed;
+      break;
+    }
+    default:
+      if (!has_sequence_table_[index]) {
+        return Corrupt("Repeated sequence table with none before it");
+      }
+      break;
+  }
+  has_sequence_table_[index] = true;
+  return Status::OK();
+}
+
+Status ZstdReader::ExecuteSequences(const uint8_t* data, const uint8_t* end,
+                                    int64_t sequence_count,
+                                    const uint8_t* literals,
+                                    int64_t literal_count) {
+  const FseTable& literal_lengths = *sequence_tables_[kLiteralLengths];
+  const FseTable& offsets = *sequence_tables_[kOffsets];
+  const FseTable& match_lengths = *sequence_tables_[kMatchLengths];
+  BackwardBitReader bits;
+  TF_RETURN_IF_ERROR(bits.Init(data, end - data));
+  uint32_t literal_length_state = bits.Read(literal_lengths.log);
+  uint32_t offset_state = bits.Read(offsets.log);
+  uint32_t match_length_state = bits.Read(match_lengths.log);
+  bits.Reload();
+
+  uint8_t* const history = history_;
+  int64_t output = history_end_;
+  const int64_t output_limit = history_end_ + block_max_size_;
+  const uint8_t* const literals_end = literals + literal_count;
+  uint32_t* const repeats = repeat_offsets_;
+  for (int64_t i = 0; i < sequence_count; ++i) {
+    const FseTable::Entry& literal_length_entry =
+        literal_lengths.entries[literal_length_state];
+    const FseTable::Entry& offset_entry = offsets.entries[offset_state];
+    const FseTable::Entry& match_length_entry =
+        match_lengths.entries[match_length_state];
+    const int offset_code = offset_entry.symbol;
+    const int match_length_code = match_length_entry.symbol;
+    const int literal_length_code = literal_length_entry.symbol;
+    if ((offset_code > 31) || (match_length_code > 52) ||
+        (literal_length_code > 35)) {
+      return Corrupt("Bad sequence code");
+    }
+    uint64_t offset_value = (1ull << offset_code) + bits.Read(offset_code);
+    bits.Reload();
+    const int64_t match_length = kMatchLengthBase[match_length_code] +
+                                 bits.Read(kMatchLengthBits[match_length_code]);
+    const int64_t literal_length =
+        kLiteralLengthBase[literal_length_code] +
+        bits.Read(kLiteralLengthBits[literal_length_code]);
+    bits.Reload();
+
+    // Values of three or less pick one of the recent offsets, shifted by one
+    // when there are no literals.
+    uint64_t offset;
+    if (offset_value > 3) {
+      offset = offset_value - 3;
+      repeats[2] = repeats[1];
+      repeats[1] = repeats[0];
+      repeats[0] = offset;
+    } else {
+      if (literal_length == 0) {
+        ++offset_value;
+      }
+      if (offset_value == 1) {
+        offset = repeats[0];
+      } else if (offset_value == 2) {
+        offset = repeats[1];
+        repeats[1] = repeats[0];
+        repeats[0] = offset;
+      } else if (offset_value == 3) {
+        offset = repeats[2];
+        repeats[2] = repeats[1];
+        repeats[1] = repeats[0];
+        repeats[0] = offset;
+      } else {
+        offset = repeats[0] - 1;
+        if (offset == 0) {
+          return Corrupt("Zero repeated offset");
+        }
+        repeats[2] = repeats[1];
+        repeats[1] = repeats[0];
+        repeats[0] = offset;
+      }
+    }
+
+    if ((literal_length > (literals_end - literals)) ||
+        ((output + literal_length + match_length) > output_limit)) {
+      return Corrupt("Sequence runs past the end of the block");
+    }
+    memcpy(history + output, literals, literal_length);
+    literals += literal_length;
+    output += literal_length;
+    if (offset > static_cast<uint64_t>(output)) {
+      return Corrupt("Offset too far back");
+    }
+    CopyMatch(history + output, offset, match_length);
+    output += match_length;
+
+    if ((i + 1) < sequence_count) {
+      literal_length_state =
+          literal_length_entry.base + bits.Read(literal_length_entry.bits);
+      match_length_state =
+          match_length_entry.base + bits.Read(match_length_entry.bits);
+      offset_state = offset_entry.base + bits.Read(offset_entry.bits);
+      bits.Reload();
+    }
+  }
+  if (!bits.finished()) {
+    return Corrupt("Sequence stream length mismatch");
+  }
+  const int64_t remaining = literals_end - literals;
+  if ((output + remaining) > output_limit) {
+    return Corrupt("Block larger than the maximum");
+  }
+  memcpy(history + output, literals, remaining);
+  history_end_ = output + remaining;
+  return Status::OK();
+}
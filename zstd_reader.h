@@ -0,0 +1,110 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ==============================================================================*/
+
+// A streaming Zstandard decoder, with no outside dependencies.
+
+#ifndef ZSTD_READER_H_
+#define ZSTD_READER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "byte_reader.h"
+#include "status.h"
+
+constexpr char kZstdMarker[] = "\x28\xb5\x2f\xfd";
+constexpr int kZstdMarkerSize = 4;
+
+// Decompresses a Zstandard file held in memory one block at a time, keeping
+// only the window that the frame header says matches can reach back over, and
+// the block that's waiting to be read. Concatenated and skippable frames are
+// handled, along with the content size and checksum if the frame has them.
+// Dictionaries aren't supported, and nor are windows over 128MB, which is
+// also the reference decoder's default limit.
+//
+// Example usage:
+//
+// ZstdReader zstd(data, size, &arena);
+// WavStreamReader reader(&zstd);
+// TF_RETURN_IF_ERROR(reader.ReadHeader());
+class ZstdReader : public ByteReader {
+ public:
+  // The data must stay valid for as long as the reader is used. Buffers come
+  // from the arena as each frame starts.
+  ZstdReader(const uint8_t* data, size_t size, Arena* arena);
+
+  Status Read(uint8_t* data, int64_t length, int64_t* bytes_read) override;
+
+ private:
+  struct FseTable;
+  struct HuffmanTable;
+  struct Checksum;
+
+  Status ReadFrameHeader();
+  Status DecodeBlock();
+  Status FinishFrame();
+  Status DecodeCompressedBlock(const uint8_t* block, size_t size);
+  Status DecodeLiterals(const uint8_t* block, size_t size, size_t* consumed,
+                        const uint8_t** literals, int64_t* literal_count);
+  Status ReadHuffmanTable(const uint8_t* data, size_t size, size_t* consumed);
+  Status DecodeHuffmanStream(const uint8_t* data, size_t size,
+                             uint8_t* output, int64_t count);
+  Status DecodeHuffmanStreams(const uint8_t* const* streams,
+                              const size_t* sizes, const int64_t* counts,
+                              int64_t segment);
+  Status ReadSequenceTable(int mode, int index, const uint8_t** data,
+                           const uint8_t* end);
+  Status ExecuteSequences(const uint8_t* data, const uint8_t* end,
+                          int64_t sequence_count, const uint8_t* literals,
+                          int64_t literal_count);
+
+  const uint8_t* const data_;
+  const size_t size_;
+  Arena* const arena_;
+  size_t position_;
+  bool in_frame_;
+  bool done_;
+
+  // The current frame's settings.
+  int64_t window_size_;
+  int64_t block_max_size_;
+  bool has_content_size_;
+  uint64_t content_size_;
+  uint64_t frame_output_;
+  bool has_checksum_;
+  bool last_block_;
+
+  // Decoded bytes, with up to a window of history before read_position_ and
+  // the ones still to be read up to history_end_.
+  uint8_t* history_;
+  int64_t history_capacity_;
+  int64_t history_end_;
+  int64_t read_position_;
+
+  // State carried from block to block within a frame.
+  uint8_t* literals_;
+  HuffmanTable* huffman_;
+  bool has_huffman_;
+  // Literal length, offset and match length tables, in that order.
+  FseTable* sequence_tables_[3];
+  bool has_sequence_table_[3];
+  // For decoding the Huffman weights, which are FSE coded themselves.
+  FseTable* weight_table_;
+  uint32_t repeat_offsets_[3];
+  Checksum* checksum_;
+};
+
+#endif  // ZSTD_READER_H_